@@ -137,6 +137,7 @@ public:
   bool list(const string &target, int id);
   bool get(DNSResourceRecord &);
   void getAllDomains(vector<DomainInfo> *domains);
+  bool listsAllDomains() { return true; }
 
   static DNSBackend *maker();
   static pthread_mutex_t s_startup_lock;
@@ -25,7 +25,7 @@ using boost::trim_right;
 
 // Static members
 
-IPPrefTree * GeoBackend::ipt;
+boost::shared_ptr<IPPrefTree> GeoBackend::ipt;
 vector<string> GeoBackend::nsRecords;
 map<string, GeoRecord*> GeoBackend::georecords;
 string GeoBackend::soaMasterServer;
@@ -58,8 +58,6 @@ GeoBackend::GeoBackend(const string &suffix) : forceReload(false) {
         	return;
         first = false;
         
-        ipt = NULL;
-        
         loadZoneName();
         loadTTLValues();
         loadSOAValues();
@@ -74,10 +72,8 @@ GeoBackend::~GeoBackend() {
         	for (map<string, GeoRecord*>::iterator i = georecords.begin(); i != georecords.end(); ++i)
         		delete i->second;
         	
-        	if (ipt != NULL) {
-        		delete ipt;
-        		ipt = NULL;
-        	}
+        	Lock iptl(&ipt_lock);
+        	ipt.reset();
         }
 }
 
@@ -142,6 +138,7 @@ bool GeoBackend::get(DNSResourceRecord &r) {
         	r.ttl = ir->ttl;
         	r.domain_id = ir->domain_id;
         	r.last_modified = ir->last_modified;
+        	r.scopeMask = ir->scopeMask;
           r.auth = 1;
         			
         	delete ir;
@@ -185,37 +182,25 @@ void GeoBackend::answerGeoRecord(const QType &qtype, const string &qdomain, DNSP
         				
         // Try to find the isocode of the country corresponding to the source ip
         // If that fails, use the default
-        short isocode = 0;
-        if (p != NULL && ipt != NULL) {
-        	try {
-        		isocode = ipt->lookup(p->getRemote());
-        	}
-        	catch(ParsePrefixException &e) {	// Ignore
-        		L << Logger::Notice << logprefix << "Unable to parse IP '"
-        			<< p->getRemote()	<< " as IPv4 prefix" << endl;
-        	}
-        }
+        uint8_t scopeMask;
+        short isocode = lookupIsoCode(p, &scopeMask);
         
         DNSResourceRecord *rr = new DNSResourceRecord;
         string target = resolveTarget(*gr, isocode);
         fillGeoResourceRecord(qdomain, target, rr);
+        rr->scopeMask = scopeMask;
         
         L << Logger::Debug << logprefix << "Serving " << qdomain << " "
                 << rr->qtype.getName() << " " << target << " to "
-                << (p != NULL ? p->getRemote() : "(unknown)")
+                << (p != NULL ? p->getRealRemote().toString() : "(unknown)")
                 << " (" << isocode << ")" << endl;
         	
         answers.push_back(rr);		
 }
 
 void GeoBackend::answerLocalhostRecord(const string &qdomain, DNSPacket *p) {
-        short isocode = 0;
-        if (p != NULL) {
-        	try {
-        		isocode = ipt->lookup(p->getRemote());
-        	}
-        	catch(ParsePrefixException &e) {}	// Ignore
-        }
+        uint8_t scopeMask;
+        short isocode = lookupIsoCode(p, &scopeMask);
         
         ostringstream target;
         target << "127.0." << ((isocode >> 8) & 0xff) << "." << (isocode & 0xff);
@@ -228,10 +213,41 @@ void GeoBackend::answerLocalhostRecord(const string &qdomain, DNSPacket *p) {
         rr->ttl = geoTTL;
         rr->domain_id = 1;
         rr->last_modified = 0;
+        rr->scopeMask = scopeMask;
         
         answers.push_back(rr);	
 }
 
+// Looks up the client, or the subnet it sent with EDNS Client Subnet. scopeMask is set to the number of bits of that
+// address for which the answer is the same, so the packet cache can share it with the rest of that network.
+short GeoBackend::lookupIsoCode(DNSPacket *p, uint8_t *scopeMask) {
+        *scopeMask = 0;
+        if (p == NULL)
+        	return 0;
+
+        boost::shared_ptr<IPPrefTree> tree;
+        {
+        	// Hold on to the tree we look in, a reload may swap in a new one meanwhile
+        	Lock iptl(&ipt_lock);
+        	tree = ipt;
+        }
+        if (!tree)
+        	return 0;
+
+        string remote = p->getRealRemote().toStringNoMask();
+        try {
+        	unsigned int bits;
+        	short isocode = tree->lookup(remote, &bits);
+        	*scopeMask = bits;
+        	return isocode;
+        }
+        catch(ParsePrefixException &e) {	// Ignore
+        	L << Logger::Notice << logprefix << "Unable to parse IP '"
+        		<< remote << "': " << e.reason << endl;
+        }
+        return 0;
+}
+
 void GeoBackend::queueNSRecords(const string &qname) {
         // nsRecords may be empty, e.g. when used in overlay mode
         
@@ -342,7 +358,7 @@ void GeoBackend::loadIPLocationMap() {
         	
         L << Logger::Info << logprefix << "Parsing IP map zonefile" << endl;
         
-        IPPrefTree *new_ipt = new IPPrefTree;
+        boost::shared_ptr<IPPrefTree> new_ipt(new IPPrefTree);
         string line;
         int linenr = 0, entries = 0;
         
@@ -354,7 +370,14 @@ void GeoBackend::loadIPLocationMap() {
         		continue;	// Skip comments
 
         	vector<string> words;
-        	stringtok(words, line, " :");
+        	if (line.find(':') < line.find('.')) {
+        		// An IPv6 prefix, '2001:db8::/32 :127.0.0.56:'. The colons in it are no separators.
+        		string::size_type space = line.find_first_of(" \t");
+        		stringtok(words, line.substr(space == string::npos ? line.size() : space), " \t:");
+        		words.insert(words.begin(), line.substr(0, space));
+        	}
+        	else
+        		stringtok(words, line, " :");
         	
         	if (words.empty() || words[0] == "$SOA")
         		continue;
@@ -385,24 +408,16 @@ void GeoBackend::loadIPLocationMap() {
         	}
         }
         ifs.close();
+        new_ipt->compile();
         
         L << Logger::Info << logprefix << "Finished parsing IP map zonefile: added " 
         	<< entries << " prefixes, stored in " << new_ipt->getNodeCount()
         	<< " nodes using " << new_ipt->getMemoryUsage() << " bytes of memory"
         	<< endl;
         
-        // Swap the new tree with the old tree
-        IPPrefTree *oldipt = NULL;
-        {
-        	Lock iptl(&ipt_lock);
-        	
-        	oldipt = ipt;
-        	ipt = new_ipt;
-        }
-        
-        // Delete the old ip prefix tree
-        if (oldipt != NULL)
-        	delete oldipt;
+        // Swap the new tree with the old tree. The old one is deleted once the last lookup in it is done.
+        Lock iptl(&ipt_lock);
+        ipt.swap(new_ipt);
 }
 
 void GeoBackend::loadGeoRecords() {
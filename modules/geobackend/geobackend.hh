@@ -9,6 +9,7 @@
 #include <vector>
 #include <map>
 #include <pthread.h>
+#include <boost/shared_ptr.hpp>
 
 #include <pdns/dnsbackend.hh>
 #include <pdns/logger.hh>
@@ -43,7 +44,7 @@ public:
         
 private:
         // Static resources, shared by all instances
-        static IPPrefTree *ipt;
+        static boost::shared_ptr<IPPrefTree> ipt;	// replaced as a whole on reload, under ipt_lock
         static vector<string> nsRecords;
         static map<string, GeoRecord*> georecords;
         static string soaMasterServer;
@@ -67,6 +68,7 @@ private:
         
         void answerGeoRecord(const QType &qtype, const string &qdomain, DNSPacket *p);
         void answerLocalhostRecord(const string &qdomain, DNSPacket *p);
+        short lookupIsoCode(DNSPacket *p, uint8_t *scopeMask);
         void queueNSRecords(const string &qname);
         void queueGeoRecords();
         void fillGeoResourceRecord(const string &qname, const string &target, DNSResourceRecord *rr);
@@ -1,53 +1,112 @@
 /*        ippreftree.cc
  *         Copyright (C) 2004 Mark Bergsma <mark@nedworks.org>
  *        	This software is licensed under the terms of the GPL, version 2.
- * 
+ *
  *         $Id$
  */
 
-#include <sstream>
+#include <algorithm>
+#include <string.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
 
 #include "ippreftree.hh"
 
 IPPrefTree::IPPrefTree(): nodecount(0) {
-        root = allocateNode();
-        nodecount++;
+        building.resize(3);	// unused, IPv4 root, IPv6 root
+        memset(&building[0], 0, building.size() * sizeof(BuildNode));
 }
 
 IPPrefTree::~IPPrefTree() {
-        removeNode(root);
 }
 
 void IPPrefTree::add(const string &prefix, const short value) {
-        uint32_t ip;
+        unsigned char ip[16];
         int preflen;
-        parsePrefix(prefix, ip, preflen);
-        
-        add(ip, preflen, value);
+        if (parseAddress(prefix, ip, &preflen))
+        	add(ip, preflen, value);
+        else
+        	addNode(1, ip, preflen, value);
 }
 
 void IPPrefTree::add(const uint32_t ip, const int preflen, const short value) {
-        addNode(root, ip, preflenToNetmask(preflen), value);
+        if (preflen < 0 || preflen > 32)
+        	throw ParsePrefixException("Invalid prefix length");
+
+        unsigned char bytes[4];
+        for (int n = 0; n < 4; n++)
+        	bytes[n] = (ip >> (24 - 8 * n)) & 0xff;
+        addNode(1, bytes, preflen, value);
+}
+
+void IPPrefTree::add(const unsigned char *ip6, const int preflen, const short value) {
+        if (preflen < 0 || preflen > 128)
+        	throw ParsePrefixException("Invalid prefix length");
+
+        addNode(2, ip6, preflen, value);
 }
 
-short IPPrefTree::lookup(const string &prefix) const {
-        uint32_t ip;
+void IPPrefTree::compile() {
+        entries.assign(2 << rootbits, 0);
+        nodecount = 2;
+        fillNode(1, 0, rootbits, 0, 0, 0);
+        fillNode(2, 0, rootbits, 1 << rootbits, 0, 0);
+
+        vector<BuildNode>().swap(building);
+}
+
+short IPPrefTree::lookup(const string &address, unsigned int *bits) const {
+        unsigned char ip[16];
         int preflen;
-        parsePrefix(prefix, ip, preflen);
-        
-        return lookup(ip, preflen);
+        if (parseAddress(address, ip, &preflen))
+        	return lookup(ip, bits);
+        return lookup((uint32_t)ip[0] << 24 | ip[1] << 16 | ip[2] << 8 | ip[3], bits);
 }
 
-short IPPrefTree::lookup(const uint32_t ip, const int preflen) const {
-        const node_t *node = findDeepestFilledNode(root, ip, preflenToNetmask(preflen));
-        return (node == NULL ? 0 : node->value);
+short IPPrefTree::lookup(const uint32_t ip, unsigned int *bits) const {
+        if (entries.empty()) {
+        	if (bits)
+        		*bits = 0;
+        	return 0;
+        }
+
+        uint32_t entry = entries[ip >> (32 - rootbits)];
+        unsigned int shift = 32 - rootbits;
+        while (entry & childflag) {
+        	shift -= nodebits;
+        	entry = entries[(entry & ~childflag) + ((ip >> shift) & ((1 << nodebits) - 1))];
+        }
+        if (bits)
+        	*bits = 32 - shift;
+        return (short)entry;
 }
 
-void IPPrefTree::clear() {
-        // Remove all children of the root node, but not the root node itself (reallocate it)
-        removeNode(root);
-        root = allocateNode();
-        nodecount++;
+short IPPrefTree::lookup(const unsigned char *ip6, unsigned int *bits) const {
+        if (entries.empty()) {
+        	if (bits)
+        		*bits = 0;
+        	return 0;
+        }
+
+        static const unsigned char v4mapped[12] = { 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0xff, 0xff };
+        if (!memcmp(ip6, v4mapped, sizeof(v4mapped))) {
+        	short value = lookup((uint32_t)ip6[12] << 24 | ip6[13] << 16 | ip6[14] << 8 | ip6[15], bits);
+        	if (bits)
+        		*bits += 96;
+        	return value;
+        }
+
+        uint32_t entry = entries[(1 << rootbits) + (ip6[0] << 8 | ip6[1])];
+        unsigned int bit = rootbits;
+        while (entry & childflag) {
+        	unsigned char nibble = (bit & 4) ? ip6[bit / 8] & 0x0f : ip6[bit / 8] >> 4;
+        	entry = entries[(entry & ~childflag) + nibble];
+        	bit += nodebits;
+        }
+        if (bits)
+        	*bits = bit;
+        return (short)entry;
 }
 
 int IPPrefTree::getNodeCount() const {
@@ -55,92 +114,140 @@ int IPPrefTree::getNodeCount() const {
 }
 
 int IPPrefTree::getMemoryUsage() const {
-        return nodecount * sizeof(node_t);
+        return entries.size() * sizeof(uint32_t) + building.size() * sizeof(BuildNode);
 }
 
 // Private methods
 
-inline uint32_t IPPrefTree::preflenToNetmask (const int preflen) const {
-        return ~( (1 << (32 - preflen)) - 1);
-}
-
-inline void IPPrefTree::parsePrefix(const string &prefix, uint32_t &ip, int &preflen) const {
-        // Parse the prefix string (with format 131.155.230.139/25)
-        std::istringstream is(prefix);
-        ip = 0; preflen = 32;
-        char c;
-        
-        for (int i = 0; i < 4; i++) {
-        	int octet = 0;
-        	is >> octet;
-        	ip = (ip << 8) | octet;
-        	is.get(c);
-        	if (c != '.' && c != '/')
-        		throw ParsePrefixException("Invalid format: expected '.' or '/'");
+// Parses an IPv4 or IPv6 address, with an optional /preflen. Returns true for IPv6, ip then holds 16 bytes, else 4.
+bool IPPrefTree::parseAddress(const string &address, unsigned char *ip, int *preflen) {
+        string::size_type slash = address.find('/');
+        string addr = address.substr(0, slash);
+        bool v6 = addr.find(':') != string::npos;
+
+        if (inet_pton(v6 ? AF_INET6 : AF_INET, addr.c_str(), ip) <= 0)
+        	throw ParsePrefixException("Invalid address '" + addr + "'");
+
+        *preflen = v6 ? 128 : 32;
+        if (slash != string::npos) {
+        	char *end;
+        	long len = strtol(address.c_str() + slash + 1, &end, 10);
+        	if (*end != '\0' || end == address.c_str() + slash + 1 || len < 0 || len > *preflen)
+        		throw ParsePrefixException("Invalid prefix length in '" + address + "'");
+        	*preflen = len;
         }
-        
-        if (is.good() && c == '/') {
-        	// Read the prefix length
-        	is >> preflen;
-        }	
+        return v6;
 }
 
-void IPPrefTree::addNode(node_t *node, const uint32_t ip, const uint32_t mask, const short value) {
-        if (mask == 0) {
-        	// We are at the correct depth in the tree
-        	node->value = value;
+void IPPrefTree::addNode(uint32_t node, const unsigned char *ip, const int preflen, const short value) {
+        if (building.empty())
+        	throw ParsePrefixException("Prefix added after compiling the tree");
+
+        for (int depth = 0; depth < preflen; depth++) {
+        	int b = (ip[depth / 8] >> (7 - depth % 8)) & 1;
+
+        	if (building[node].child[b] == 0) {
+        		BuildNode child = { { 0, 0 }, 0 };
+        		building.push_back(child);
+        		building[node].child[b] = building.size() - 1;
+        	}
+        	node = building[node].child[b];
         }
-        else {	/* mask > 0 */
-        	// We need to walk deeper into the tree, and extend it if needed
-        	int b = (ip >> 31);
-        	
-        	if (node->child[b] == NULL) {
-        		node->child[b] = allocateNode();
+        building[node].value = value;
+}
+
+/* Fills the entries of the node at base that are reached through binary trie node 'node', which sits 'depth' bits
+ * deep, 'slot' holds the bits of this node's stride taken so far. 'best' is the value of the longest prefix so far,
+ * 0 if none. Where the binary trie goes on past 'end', the node for the next bits is appended. */
+void IPPrefTree::fillNode(uint32_t node, unsigned int depth, unsigned int end, uint32_t base, uint32_t slot, short best) {
+        if (node != 0 && building[node].value != 0)
+        	best = building[node].value;
+
+        bool deeper = node != 0 && (building[node].child[0] != 0 || building[node].child[1] != 0);
+        if (depth == end) {
+        	if (deeper) {
+        		uint32_t child = entries.size();
+        		entries.resize(child + (1 << nodebits));
         		nodecount++;
+        		entries[base + slot] = childflag | child;
+        		fillNode(node, depth, depth + nodebits, child, 0, best);
         	}
-        	
-        	// Recursively add
-        	addNode(node->child[b], ip << 1, mask << 1, value);
+        	else
+        		entries[base + slot] = (uint16_t)best;
+        	return;
+        }
+
+        if (!deeper) {
+        	// nothing more specific below here, the rest of the slots all get best
+        	unsigned int left = end - depth;
+        	std::fill(entries.begin() + base + (slot << left), entries.begin() + base + ((slot + 1) << left), (uint16_t)best);
+        	return;
         }
+
+        fillNode(building[node].child[0], depth + 1, end, base, slot << 1, best);
+        fillNode(building[node].child[1], depth + 1, end, base, (slot << 1) | 1, best);
 }
 
-node_t * IPPrefTree::allocateNode() {
-        node_t *node = new node_t;
-        
-        // Initialize
-        node->child[0] = node->child[1] = NULL;
-        node->value = 0;
-        
-        return node;	
+#ifdef BENCHMARK
+/* Loads an rbldnsd format map like zz.countries.nerd.dk and times lookups of random addresses:
+ *   ippreftree-bench zz.countries.nerd.dk.rbldnsd [lookups] */
+#include <fstream>
+#include <iostream>
+#include <sys/time.h>
+
+static double elapsed(const struct timeval &start) {
+        struct timeval now;
+        gettimeofday(&now, NULL);
+        return (now.tv_sec - start.tv_sec) + (now.tv_usec - start.tv_usec) / 1000000.0;
 }
 
-const node_t * IPPrefTree::findDeepestFilledNode(const node_t *node, const uint32_t ip, const uint32_t mask) const {
-        if (node == NULL) return NULL;
-        
-        if (mask == 0) {
-        	return (node->value == 0 ? NULL : node);
+int main(int argc, char **argv) {
+        if (argc < 2) {
+        	cerr << "Syntax: ippreftree-bench zonefile [lookups]" << endl;
+        	return 1;
         }
-        else {	/* mask > 0 */
-        	int b = (ip >> 31);
-        	const node_t *descendant = findDeepestFilledNode(node->child[b], ip << 1, mask << 1);
-        	if (descendant == NULL) {
-        		if (node->value != 0)	// Children have no (more) explicit information, do we?
-        			return node;
-        		else
-        			return NULL;
+        unsigned int lookups = argc > 2 ? atoi(argv[2]) : 10000000;
+
+        struct timeval start;
+        gettimeofday(&start, NULL);
+
+        IPPrefTree ipt;
+        std::ifstream ifs(argv[1]);
+        string line;
+        int entries = 0;
+        while (getline(ifs, line)) {
+        	// '1.2.3.0/24 :127.0.0.56:', the country code is in the last 15 bits of the address
+        	string::size_type colon = line.find(':', line.find_first_of(" \t"));
+        	if (line.empty() || line[0] == '#' || line[0] == '$' || colon == string::npos)
+        		continue;
+        	struct in_addr addr;
+        	if (inet_pton(AF_INET, line.substr(colon + 1, line.find(':', colon + 1) - colon - 1).c_str(), &addr) <= 0)
+        		continue;
+        	try {
+        		ipt.add(line.substr(0, line.find_first_of(" \t")), ntohl(addr.s_addr) & 0x7fff);
+        		entries++;
+        	}
+        	catch (ParsePrefixException &e) {
         	}
-        	else
-        		return descendant;
         }
-}
+        ipt.compile();
+        cout << "Loaded " << entries << " prefixes in " << elapsed(start) << "s, " << ipt.getNodeCount()
+        	<< " nodes using " << ipt.getMemoryUsage() << " bytes" << endl;
+
+        vector<uint32_t> ips(1 << 20);
+        uint32_t seed = 2463534242U;
+        for (unsigned int n = 0; n < ips.size(); n++) {
+        	seed ^= seed << 13; seed ^= seed >> 17; seed ^= seed << 5;	// xorshift, rand() is too slow to not matter
+        	ips[n] = seed;
+        }
 
-void IPPrefTree::removeNode(node_t *node) {
-        if (node == NULL) return;
-        
-        // Recursively remove and deallocate all descendants
-        removeNode(node->child[0]);
-        removeNode(node->child[1]);
-        nodecount--;
-        
-        delete node;
-}        
+        gettimeofday(&start, NULL);
+        unsigned long found = 0;
+        for (unsigned int n = 0; n < lookups; n++)
+        	found += ipt.lookup(ips[n & (ips.size() - 1)]) != 0;
+        double secs = elapsed(start);
+        cout << lookups << " IPv4 lookups in " << secs << "s, " << (secs * 1000000000.0 / lookups) << "ns each, "
+        	<< found << " found" << endl;
+        return 0;
+}
+#endif
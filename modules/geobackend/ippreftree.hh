@@ -1,51 +1,65 @@
 /*        ippreftree.hh
  *         Copyright (C) 2004 Mark Bergsma <mark@nedworks.org>
  *        	This software is licensed under the terms of the GPL, version 2.
- * 
+ *
  *         $Id$
  */
 
 #include <string>
+#include <vector>
 #include <sys/types.h>
 #include <cstdlib>
 #include <stdint.h>
 
 #include "pdns/namespaces.hh"
 
-// Use old style C structs for efficiency
-typedef struct node_t {
-        node_t *child[2];
-        short value;
-} node_t;        
-
+/* Longest prefix match for IPv4 and IPv6, as a multibit trie in one array. The first 16 bits of an address index
+ * a root node of 65536 entries, every following 4 bits a node of 16 entries, which is one cache line. An entry
+ * holds either a value or the offset of the node for the next 4 bits, values of shorter prefixes are pushed down
+ * into the nodes below them. So an IPv4 lookup reads at most 5 entries, and does no comparisons.
+ *
+ * Prefixes are first collected in a plain binary trie, compile() turns that into the array and throws it away.
+ * A tree is not changed after that, so a new one can be built next to the old one and swapped in when done.
+ * IPv4-mapped IPv6 addresses are looked up as IPv4.
+ */
 class IPPrefTree{
 
 public:
         IPPrefTree();
         ~IPPrefTree();
 
-        void add(const string &prefix, const short value);	
+        void add(const string &prefix, const short value);	// 131.155.230.139/25 or 2001:db8::/32
         void add(const uint32_t ip, const int preflen, const short value);
-        
-        short lookup(const string &prefix) const;
-        short lookup(const uint32_t ip, const int preflen) const;
-        
-        void clear();
-        
+        void add(const unsigned char *ip6, const int preflen, const short value);
+        void compile();	// after the last add(), before the first lookup()
+
+        // bits, if given, is set to the number of leading bits of the address that decided the answer, so every
+        // address that starts with those bits gets the same value
+        short lookup(const string &address, unsigned int *bits = NULL) const;
+        short lookup(const uint32_t ip, unsigned int *bits = NULL) const;
+        short lookup(const unsigned char *ip6, unsigned int *bits = NULL) const;
+
         int getNodeCount() const;
         int getMemoryUsage() const;
 
 private:
-        node_t *root;	// root of the tree
-        int nodecount;	// total number of nodes in the tree
-        
-        void addNode(node_t * node, const uint32_t ip, const uint32_t mask, const short value);
-        node_t * allocateNode();
-        const node_t * findDeepestFilledNode(const node_t *root, const uint32_t ip, const uint32_t mask) const;
-        void removeNode(node_t * node);
-        
-        inline uint32_t preflenToNetmask(const int preflen) const;
-        inline void parsePrefix(const string &prefix, uint32_t &ip, int &preflen) const;
+        static const unsigned int rootbits = 16;
+        static const unsigned int nodebits = 4;
+        static const uint32_t childflag = 0x80000000;	// entry is the offset of a node, not a value
+
+        struct BuildNode {
+        	uint32_t child[2];	// index in building, 0 for none
+        	short value;
+        };
+
+        vector<uint32_t> entries;	// root node for IPv4, root node for IPv6, then all other nodes
+        vector<BuildNode> building;	// binary trie until compile(), [1] is the IPv4 root, [2] the IPv6 root
+        int nodecount;
+
+        void addNode(uint32_t node, const unsigned char *ip, const int preflen, const short value);
+        void fillNode(uint32_t node, unsigned int depth, unsigned int end, uint32_t base, uint32_t slot, short best);
+
+        static bool parseAddress(const string &address, unsigned char *ip, int *preflen);
 };
 
 class ParsePrefixException
@@ -53,6 +67,6 @@ class ParsePrefixException
 public:
         ParsePrefixException() { reason = ""; };
         ParsePrefixException(string r) { reason = r; };
-        
+
         string reason;
 };
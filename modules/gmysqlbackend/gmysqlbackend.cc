@@ -11,13 +11,21 @@
 #include "gmysqlbackend.hh"
 #include "smysql.hh"
 #include <sstream>
+#include <boost/bind.hpp>
+
+static SSql* connect(const string &database, const string &host, uint16_t port, const string &msocket, const string &user,
+                     const string &password, const string &group, bool setIsolation)
+{
+  return new SMySQL(database, host, port, msocket, user, password, group, setIsolation);
+}
 
 gMySQLBackend::gMySQLBackend(const string &mode, const string &suffix)  : GSQLBackend(mode,suffix)
 {
   try {
-    setDB(new SMySQL(getArg("dbname"),
+    setConnector(boost::bind(&connect,
+                     getArg("dbname"),
                      getArg("host"),
-                     getArgAsNum("port"),
+                     (uint16_t)getArgAsNum("port"),
                      getArg("socket"),
                      getArg("user"),
                      getArg("password"),
@@ -47,6 +55,7 @@ public:
     declare(suffix,"password","Pdns backend password to connect with","");
     declare(suffix,"group", "Pdns backend MySQL 'group' to connect as", "client");
     declare(suffix,"innodb-read-committed","Use InnoDB READ-COMMITTED transaction isolation level","yes");
+    declare(suffix,"connections","Database connections shared by all threads, 0 for one per thread","0");
 
     declare(suffix,"dnssec","Assume DNSSEC Schema is in place","no");
 
@@ -96,6 +105,9 @@ public:
     declare(suffix,"insert-record-query","", "insert into records (content,ttl,prio,type,domain_id,name) values ('%s',%d,%d,'%s',%d,'%s')");
     declare(suffix,"insert-record-query-auth","", "insert into records (content,ttl,prio,type,domain_id,name,auth) values ('%s',%d,%d,'%s',%d,'%s','%d')");
     declare(suffix,"insert-record-order-query-auth","", "insert into records (content,ttl,prio,type,domain_id,name,ordername,auth) values ('%s',%d,%d,'%s',%d,'%s','%s','%d')");
+    declare(suffix,"bulk-insert-record-query","bulk insert records into zone, empty to insert them one by one with insert-record-query","");
+    declare(suffix,"bulk-insert-record-query-auth","bulk insert records into zone, empty to insert them one by one with insert-record-query","");
+    declare(suffix,"bulk-insert-record-order-query-auth","bulk insert records into zone, empty to insert them one by one with insert-record-query","");
     declare(suffix,"insert-ent-query", "insert empty non-terminal in zone", "insert into records (type,domain_id,name) values (null,'%d','%s')");
     declare(suffix,"insert-ent-query-auth", "insert empty non-terminal in zone", "insert into records (type,domain_id,name,auth) values (null,'%d','%s','1')");
     declare(suffix,"insert-ent-order-query-auth", "insert empty non-terminal in zone", "insert into records (type,domain_id,name,ordername,auth) values (null,'%d','%s','%s','1')");
@@ -104,6 +116,8 @@ public:
     declare(suffix,"get-order-before-query","DNSSEC Ordering Query, before", "select ordername, name from records where ordername <= '%s' and domain_id=%d and ordername is not null order by 1 desc limit 1");
     declare(suffix,"get-order-after-query","DNSSEC Ordering Query, after", "select min(ordername) from records where ordername > '%s' and domain_id=%d and ordername is not null");
     declare(suffix,"get-order-last-query","DNSSEC Ordering Query, last", "select ordername, name from records where ordername != '' and domain_id=%d and ordername is not null order by 1 desc limit 1");
+    declare(suffix,"get-order-list-query","DNSSEC Ordering Query, all", "select ordername, name from records where domain_id=%d and ordername is not null");
+    declare(suffix,"get-order-name-query","DNSSEC Ordering Query, one name", "select ordername, name from records where domain_id=%d and name='%s' and ordername is not null");
     declare(suffix,"set-order-and-auth-query", "DNSSEC set ordering query", "update records set ordername='%s',auth=%d where name='%s' and domain_id='%d'");
     declare(suffix,"set-auth-on-ds-record-query", "DNSSEC set auth on a DS record", "update records set auth=1 where domain_id='%d' and name='%s' and type='DS'");
 
@@ -93,6 +93,8 @@ int SMySQL::doQuery(const string &query)
   if(s_dolog)
     L<<Logger::Warning<<"Query: "<<query<<endl;
 
+  mysql_thread_init(); // pooled connections move between threads, this does nothing once a thread is set up
+
   int err;
   if((err=mysql_query(&d_db,query.c_str())))
     throw sPerrorException("Failed to execute mysql_query, perhaps connection died? Err="+itoa(err));
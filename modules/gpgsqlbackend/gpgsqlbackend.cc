@@ -11,11 +11,19 @@
 #include "gpgsqlbackend.hh"
 #include "spgsql.hh"
 #include <sstream>
+#include <boost/bind.hpp>
+
+static SSql* connect(const string &database, const string &host, const string& port, const string &msocket, const string &user,
+                     const string &password)
+{
+  return new SPgSQL(database, host, port, msocket, user, password);
+}
 
 gPgSQLBackend::gPgSQLBackend(const string &mode, const string &suffix)  : GSQLBackend(mode,suffix)
 {
   try {
-    setDB(new SPgSQL(getArg("dbname"),
+    setConnector(boost::bind(&connect,
+        	  getArg("dbname"),
         	  getArg("host"),
         	  getArg("port"),
         	  getArg("socket"),
@@ -44,6 +52,8 @@ public:
     declare(suffix,"socket","Pdns backend socket to connect to","");
     declare(suffix,"password","Pdns backend password to connect with","");
 
+    declare(suffix,"connections","Database connections shared by all threads, 0 for one per thread","0");
+
     declare(suffix,"dnssec","Assume DNSSEC Schema is in place","no");
 
     declare(suffix,"basic-query","Basic query","select content,ttl,prio,type,domain_id,name from records where type='%s' and name=E'%s'");
@@ -91,6 +101,9 @@ public:
     declare(suffix,"insert-record-query","", "insert into records (content,ttl,prio,type,domain_id,name) values (E'%s',%d,%d,'%s',%d,E'%s')");
     declare(suffix,"insert-record-query-auth","", "insert into records (content,ttl,prio,type,domain_id,name,auth) values (E'%s',%d,%d,'%s',%d,E'%s','%d')");
     declare(suffix,"insert-record-order-query-auth","", "insert into records (content,ttl,prio,type,domain_id,name,ordername,auth) values (E'%s',%d,%d,'%s',%d,E'%s',E'%s','%d')");
+    declare(suffix,"bulk-insert-record-query","bulk insert records into zone, empty to insert them one by one with insert-record-query","");
+    declare(suffix,"bulk-insert-record-query-auth","bulk insert records into zone, empty to insert them one by one with insert-record-query","");
+    declare(suffix,"bulk-insert-record-order-query-auth","bulk insert records into zone, empty to insert them one by one with insert-record-query","");
     declare(suffix,"insert-ent-query", "insert empty non-terminal in zone", "insert into records (type,domain_id,name) values (null,'%d',E'%s')");
     declare(suffix,"insert-ent-query-auth", "insert empty non-terminal in zone", "insert into records (type,domain_id,name,auth) values (null,'%d',E'%s',true)");
     declare(suffix,"insert-ent-order-query-auth", "insert empty non-terminal in zone", "insert into records (type,domain_id,name,ordername,auth) values (null,'%d',E'%s',E'%s',true)");
@@ -99,6 +112,8 @@ public:
     declare(suffix,"get-order-before-query","DNSSEC Ordering Query, before", "select ordername, name from records where ordername ~<=~ E'%s' and domain_id=%d and ordername is not null order by 1 using ~>~ limit 1");
     declare(suffix,"get-order-after-query","DNSSEC Ordering Query, after", "select ordername from records where ordername ~>~ E'%s' and domain_id=%d and ordername is not null order by 1 using ~<~ limit 1");
     declare(suffix,"get-order-last-query","DNSSEC Ordering Query, last", "select ordername, name from records where ordername != '' and domain_id=%d and ordername is not null order by 1 using ~>~ limit 1");
+    declare(suffix,"get-order-list-query","DNSSEC Ordering Query, all", "select ordername, name from records where domain_id=%d and ordername is not null");
+    declare(suffix,"get-order-name-query","DNSSEC Ordering Query, one name", "select ordername, name from records where domain_id=%d and name=E'%s' and ordername is not null");
     declare(suffix,"set-order-and-auth-query", "DNSSEC set ordering query", "update records set ordername=E'%s',auth=%d::bool where name=E'%s' and domain_id='%d'");
     declare(suffix,"set-auth-on-ds-record-query", "DNSSEC set auth on a DS record", "update records set auth=true where domain_id='%d' and name='%s' and type='DS'");
 
@@ -157,6 +157,70 @@ int SPgSQL::doQuery(const string &query, result_t &result)
   return result.size();
 }
 
+static void putCopyData(PGconn* db, const string& data)
+{
+  if(PQputCopyData(db, data.c_str(), data.size()) != 1)
+    throw SSqlException(string("PostgreSQL failed to send copy data: ")+PQerrorMessage(db));
+}
+
+// query is a 'copy ... from stdin', the rows go out in its text format, which needs no quoting, only a few escapes
+void SPgSQL::insertRows(const string &query, const result_t &rows)
+{
+  if(s_dolog)
+    L<<Logger::Warning<<"Copy: "<<query<<" ("<<rows.size()<<" rows)"<<endl;
+
+  if(!(d_result=PQexec(d_db,query.c_str())) || PQresultStatus(d_result)!=PGRES_COPY_IN) {
+    string error("unknown reason");
+    if(d_result) {
+      error=PQresultErrorMessage(d_result);
+      PQclear(d_result);
+    }
+    throw SSqlException("PostgreSQL failed to start copy: "+error);
+  }
+  PQclear(d_result);
+
+  string data, error;
+  try {
+    for(result_t::const_iterator row=rows.begin(); row!=rows.end(); ++row) {
+      for(row_t::const_iterator field=row->begin(); field!=row->end(); ++field) {
+        if(field!=row->begin())
+          data+='\t';
+        for(string::const_iterator c=field->begin(); c!=field->end(); ++c) {
+          switch(*c) {
+          case '\\': data+="\\\\"; break;
+          case '\t': data+="\\t"; break;
+          case '\n': data+="\\n"; break;
+          case '\r': data+="\\r"; break;
+          default: data+=*c;
+          }
+        }
+      }
+      data+='\n';
+      if(data.size() > 65536) {
+        putCopyData(d_db, data);
+        data.clear();
+      }
+    }
+    if(!data.empty())
+      putCopyData(d_db, data);
+  }
+  catch(SSqlException &e) {
+    error=e.txtReason();
+  }
+
+  if(PQputCopyEnd(d_db, error.empty() ? NULL : error.c_str()) != 1 && error.empty())
+    error=string("PostgreSQL failed to end copy: ")+PQerrorMessage(d_db);
+
+  while((d_result=PQgetResult(d_db))) {
+    if(PQresultStatus(d_result)!=PGRES_COMMAND_OK && error.empty())
+      error=string("PostgreSQL failed to copy rows: ")+PQresultErrorMessage(d_result);
+    PQclear(d_result);
+  }
+  d_count=0;
+  if(!error.empty())
+    throw SSqlException(error);
+}
+
 bool SPgSQL::getRow(row_t &row)
 {
   row.clear();
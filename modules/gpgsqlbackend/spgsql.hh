@@ -21,6 +21,7 @@ public:
   int doCommand(const string &query);
   bool getRow(row_t &row);
   string escape(const string &str);    
+  void insertRows(const string &query, const result_t &rows);
   void setLog(bool state);
 private:
   void ensureConnect();
@@ -2,22 +2,12 @@
 
 
 
-unsigned int ldap_host_index = 0;
-
-
-
 LdapBackend::LdapBackend( const string &suffix )
 {
-        string hoststr;
-        unsigned int i, idx;
-        vector<string> hosts;
-
-
         try
         {
         	m_msgid = 0;
         	m_qname = "";
-        	m_pldap = NULL;
         	m_qlog = arg().mustDo( "query-logging" );
         	m_default_ttl = arg().asNum( "default-ttl" );
         	m_myname = "[LdapBackend]";
@@ -41,20 +31,17 @@ LdapBackend::LdapBackend( const string &suffix )
         		m_prepare_fcnt = &LdapBackend::prepare_strict;
         	}
 
-        	stringtok( hosts, getArg( "host" ), ", " );
-        	idx = ldap_host_index++ % hosts.size();
-        	hoststr = hosts[idx];
+        	L << Logger::Info << m_myname << " LDAP servers = " << getArg( "host" ) << endl;
 
-        	for( i = 1; i < hosts.size(); i++ )
-        	{
-        		hoststr += " " + hosts[ ( idx + i ) % hosts.size() ];
-        	}
-
-        	L << Logger::Info << m_myname << " LDAP servers = " << hoststr << endl;
-
-        	m_pldap = new PowerLDAP( hoststr.c_str(), LDAP_PORT, mustDo( "starttls" ) );
-        	m_pldap->setOption( LDAP_OPT_DEREF, LDAP_DEREF_ALWAYS );
-        	m_pldap->bind( getArg( "binddn" ), getArg( "secret" ), LDAP_AUTH_SIMPLE, getArgAsNum( "timeout" ) );
+#ifdef HAVE_LIBLDAP_R
+        	m_pool = PowerLDAPPool::get( getArg( "host" ), mustDo( "starttls" ), getArg( "binddn" ), getArg( "secret" ), getArgAsNum( "timeout" ),
+        		getArgAsNum( "connections" ), getArgAsNum( "cache-ttl" ) );
+#else
+        	// plain libldap is not thread safe, so connections can not be shared with backends in other threads
+        	m_pool.reset( new PowerLDAPPool( getArg( "host" ), mustDo( "starttls" ), getArg( "binddn" ), getArg( "secret" ), getArgAsNum( "timeout" ),
+        		1, getArgAsNum( "cache-ttl" ) ) );
+#endif
+        	m_pool->pick();   // fail here if the servers can't be reached, not in the first lookup
 
         	L << Logger::Notice << m_myname << " Ldap connection succeeded" << endl;
         	return;
@@ -72,7 +59,6 @@ LdapBackend::LdapBackend( const string &suffix )
         	L << Logger::Error << m_myname << " Caught STL exception: " << e.what() << endl;
         }
 
-        if( m_pldap != NULL ) { delete( m_pldap ); }
         throw( PDNSException( "Unable to connect to ldap server" ) );
 }
 
@@ -80,12 +66,90 @@ LdapBackend::LdapBackend( const string &suffix )
 
 LdapBackend::~LdapBackend()
 {
-        if( m_pldap != NULL ) { delete( m_pldap ); }
+        if( m_msgid ) { m_pldap->abandon( m_msgid ); }
         L << Logger::Notice << m_myname << " Ldap connection closed" << endl;
 }
 
 
 
+/*
+ *  Starts a search on the least busy connection, or finds its results in the cache. A search of ours that was
+ *  not read to its end is abandoned first, or libldap would keep its remaining results around forever.
+ */
+
+void LdapBackend::search( const string& base, int scope, const string& filter, const char** attr, bool cache )
+{
+        if( m_msgid )
+        {
+        	m_pldap->abandon( m_msgid );
+        	m_msgid = 0;
+        }
+        m_pldap.reset();
+        m_cached.reset();
+        m_cachekey.clear();
+
+        if( cache && m_pool->getCacheTTL() )
+        {
+        	ostringstream key;
+        	key << base << "\t" << scope << "\t" << filter;
+        	for( const char** a = attr; a != NULL && *a != NULL; a++ )
+        	{
+        		key << "\t" << *a;
+        	}
+
+        	if( m_pool->getCached( key.str(), m_cached ) )
+        	{
+        		m_cachepos = m_cached->begin();
+        		return;
+        	}
+        	m_cachekey = key.str();
+        	m_collect.clear();
+        }
+
+        m_pldap = m_pool->pick();
+        m_msgid = m_pldap->search( base, scope, filter, attr );
+}
+
+
+
+// Reads the next entry of the current search into m_result, false at its end
+bool LdapBackend::getSearchEntry( bool dn )
+{
+        if( m_cached )
+        {
+        	if( m_cachepos == m_cached->end() )
+        	{
+        		return false;
+        	}
+        	m_result = *m_cachepos++;
+        	return true;
+        }
+
+        if( !m_msgid )
+        {
+        	return false;
+        }
+
+        if( m_pldap->getSearchEntry( m_msgid, m_result, dn ) )
+        {
+        	if( !m_cachekey.empty() ) { m_collect.push_back( m_result ); }
+        	return true;
+        }
+
+        m_msgid = 0;
+        m_pldap.reset();   // so pick() sees it is free again
+        if( !m_cachekey.empty() )
+        {
+        	boost::shared_ptr<PowerLDAP::sresult_t> result( new PowerLDAP::sresult_t );
+        	result->swap( m_collect );
+        	m_pool->putCached( m_cachekey, result );
+        	m_cachekey.clear();
+        }
+        return false;
+}
+
+
+
 bool LdapBackend::list( const string& target, int domain_id )
 {
         try
@@ -125,12 +189,12 @@ inline bool LdapBackend::list_simple( const string& target, int domain_id )
 
 
         dn = getArg( "basedn" );
-        qesc = toLower( m_pldap->escape( target ) );
+        qesc = toLower( PowerLDAP::escape( target ) );
 
         // search for SOARecord of target
         filter = strbind( ":target:", "&(associatedDomain=" + qesc + ")(sOARecord=*)", getArg( "filter-axfr" ) );
-        m_msgid = m_pldap->search( dn, LDAP_SCOPE_SUBTREE, filter, (const char**) ldap_attrany );
-        m_pldap->getSearchEntry( m_msgid, m_result, true );
+        search( dn, LDAP_SCOPE_SUBTREE, filter, (const char**) ldap_attrany );
+        getSearchEntry( true );
 
         if( m_result.count( "dn" ) && !m_result["dn"].empty() )
         {
@@ -144,7 +208,7 @@ inline bool LdapBackend::list_simple( const string& target, int domain_id )
         prepare();
         filter = strbind( ":target:", "associatedDomain=*." + qesc, getArg( "filter-axfr" ) );
         DLOG( L << Logger::Debug << m_myname << " Search = basedn: " << dn << ", filter: " << filter << endl );
-        m_msgid = m_pldap->search( dn, LDAP_SCOPE_SUBTREE, filter, (const char**) ldap_attrany );
+        search( dn, LDAP_SCOPE_SUBTREE, filter, (const char**) ldap_attrany );
 
         return true;
 }
@@ -202,7 +266,7 @@ void LdapBackend::lookup_simple( const QType &qtype, const string &qname, DNSPac
         const char* attronly[] = { NULL, "dNSTTL", "modifyTimestamp", NULL };
 
 
-        qesc = toLower( m_pldap->escape( qname ) );
+        qesc = toLower( PowerLDAP::escape( qname ) );
         filter = "associatedDomain=" + qesc;
 
         if( qtype.getCode() != QType::ANY )
@@ -216,7 +280,7 @@ void LdapBackend::lookup_simple( const QType &qtype, const string &qname, DNSPac
         filter = strbind( ":target:", filter, getArg( "filter-lookup" ) );
 
         DLOG( L << Logger::Debug << m_myname << " Search = basedn: " << getArg( "basedn" ) << ", filter: " << filter << ", qtype: " << qtype.getName() << endl );
-        m_msgid = m_pldap->search( getArg( "basedn" ), LDAP_SCOPE_SUBTREE, filter, attributes );
+        search( getArg( "basedn" ), LDAP_SCOPE_SUBTREE, filter, attributes, true );
 }
 
 
@@ -230,7 +294,7 @@ void LdapBackend::lookup_strict( const QType &qtype, const string &qname, DNSPac
         const char* attronly[] = { NULL, "dNSTTL", "modifyTimestamp", NULL };
 
 
-        qesc = toLower( m_pldap->escape( qname ) );
+        qesc = toLower( PowerLDAP::escape( qname ) );
         stringtok( parts, qesc, "." );
         len = qesc.length();
 
@@ -261,7 +325,7 @@ void LdapBackend::lookup_strict( const QType &qtype, const string &qname, DNSPac
         filter = strbind( ":target:", filter, getArg( "filter-lookup" ) );
 
         DLOG( L << Logger::Debug << m_myname << " Search = basedn: " << getArg( "basedn" ) << ", filter: " << filter << ", qtype: " << qtype.getName() << endl );
-        m_msgid = m_pldap->search( getArg( "basedn" ), LDAP_SCOPE_SUBTREE, filter, attributes );
+        search( getArg( "basedn" ), LDAP_SCOPE_SUBTREE, filter, attributes, true );
 }
 
 
@@ -275,7 +339,7 @@ void LdapBackend::lookup_tree( const QType &qtype, const string &qname, DNSPacke
         vector<string> parts;
 
 
-        qesc = toLower( m_pldap->escape( qname ) );
+        qesc = toLower( PowerLDAP::escape( qname ) );
         filter = "associatedDomain=" + qesc;
 
         if( qtype.getCode() != QType::ANY )
@@ -295,7 +359,7 @@ void LdapBackend::lookup_tree( const QType &qtype, const string &qname, DNSPacke
         }
 
         DLOG( L << Logger::Debug << m_myname << " Search = basedn: " << dn + getArg( "basedn" ) << ", filter: " << filter << ", qtype: " << qtype.getName() << endl );
-        m_msgid = m_pldap->search( dn + getArg( "basedn" ), LDAP_SCOPE_BASE, filter, attributes );
+        search( dn + getArg( "basedn" ), LDAP_SCOPE_BASE, filter, attributes, true );
 }
 
 
@@ -463,7 +527,7 @@ bool LdapBackend::get( DNSResourceRecord &rr )
         			m_value = m_attribute->second.begin();
         		}
         	}
-        	while( m_pldap->getSearchEntry( m_msgid, m_result, m_getdn ) && prepare() );
+        	while( getSearchEntry( m_getdn ) && prepare() );
 
         }
         catch( LDAPTimeout &lt )
@@ -495,9 +559,9 @@ bool LdapBackend::get( DNSResourceRecord &rr )
 
 
         // search for SOARecord of domain
-        filter = "(&(associatedDomain=" + toLower( m_pldap->escape( domain ) ) + ")(SOARecord=*))";
-        m_msgid = m_pldap->search( getArg( "basedn" ), LDAP_SCOPE_SUBTREE, filter, attronly );
-        m_pldap->getSearchEntry( m_msgid, m_result );
+        filter = "(&(associatedDomain=" + toLower( PowerLDAP::escape( domain ) ) + ")(SOARecord=*))";
+        search( getArg( "basedn" ), LDAP_SCOPE_SUBTREE, filter, attronly );
+        getSearchEntry();
 
         if( m_result.count( "sOARecord" ) && !m_result["sOARecord"].empty() )
         {
@@ -538,6 +602,8 @@ public:
         	declare( suffix, "binddn", "User dn for non anonymous binds","" );
         	declare( suffix, "secret", "User password for non anonymous binds", "" );
         	declare( suffix, "timeout", "Seconds before connecting to server fails", "5" );
+        	declare( suffix, "connections", "Maximum number of connections shared by the backends with the same servers and binddn", "2" );
+        	declare( suffix, "cache-ttl", "Seconds to cache the results of lookups, 0 to disable", "0" );
         	declare( suffix, "method", "How to search entries (simple, strict or tree)", "simple" );
         	declare( suffix, "filter-axfr", "LDAP filter for limiting AXFR results", "(:target:)" );
         	declare( suffix, "filter-lookup", "LDAP filter for limiting IP or name lookups", "(:target:)" );
@@ -104,7 +104,12 @@ class LdapBackend : public DNSBackend
         time_t m_last_modified;
         string m_myname;
         string m_qname;
-        PowerLDAP* m_pldap;
+        boost::shared_ptr<PowerLDAPPool> m_pool;
+        PowerLDAPPool::conn_t m_pldap;   // connection of the running search
+        PowerLDAPPool::cached_t m_cached;   // results of the current search if they came from the cache
+        PowerLDAP::sresult_t::const_iterator m_cachepos;
+        PowerLDAP::sresult_t m_collect;   // results so far of a search that goes into the cache
+        string m_cachekey;
         PowerLDAP::sentry_t m_result;
         PowerLDAP::sentry_t::iterator m_attribute;
         vector<string>::iterator m_value, m_adomain;
@@ -114,6 +119,9 @@ class LdapBackend : public DNSBackend
         void (LdapBackend::*m_lookup_fcnt)( const QType&, const string&, DNSPacket*, int );
         bool (LdapBackend::*m_prepare_fcnt)();
 
+        void search( const string& base, int scope, const string& filter, const char** attr, bool cache = false );
+        bool getSearchEntry( bool dn = false );
+
         bool list_simple( const string& target, int domain_id );
         bool list_strict( const string& target, int domain_id );
 
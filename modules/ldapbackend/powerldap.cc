@@ -1,5 +1,6 @@
 #include "powerldap.hh"
 #include <pdns/misc.hh>
+#include <pdns/lock.hh>
 #include <sys/time.h>
 
 
@@ -10,6 +11,7 @@ PowerLDAP::PowerLDAP( const string& hosts, uint16_t port, bool tls )
         d_hosts = hosts;
         d_port = port;
         d_tls = tls;
+        d_broken = false;
         ensureConnect();
 }
 
@@ -157,7 +159,8 @@ int PowerLDAP::waitResult( int msgid, int timeout, LDAPMessage** result )
         switch( rc )
         {
         	case -1:
-            ensureConnect();
+        		// other searches may be running on this connection, so it is not reconnected here but replaced by the pool
+        		d_broken = true;
         		throw LDAPException( "Error waiting for LDAP result: " + getError() );
         	case 0:
         		throw LDAPTimeout();
@@ -252,6 +255,17 @@ void PowerLDAP::getSearchResults( int msgid, sresult_t& result, bool dn, int tim
 }
 
 
+/**
+ * Tells the server we are not interested in the rest of a search, and drops
+ * what libldap already received of it
+ */
+
+void PowerLDAP::abandon( int msgid )
+{
+        ldap_abandon_ext( d_ld, msgid, NULL, NULL );
+}
+
+
 const string PowerLDAP::getError( int rc )
 {
         if( rc == -1 ) { getOption( LDAP_OPT_ERROR_NUMBER, &rc ); }
@@ -275,3 +289,137 @@ const string PowerLDAP::escape( const string& str )
 
         return a;
 }
+
+
+
+pthread_mutex_t PowerLDAPPool::s_lock = PTHREAD_MUTEX_INITIALIZER;
+map<string, boost::shared_ptr<PowerLDAPPool> > PowerLDAPPool::s_pools;
+
+
+PowerLDAPPool::PowerLDAPPool( const string& hosts, bool tls, const string& binddn, const string& secret, int timeout, unsigned int connections, unsigned int cachettl )
+{
+        stringtok( d_hosts, hosts, ", " );
+        if( d_hosts.empty() )
+        {
+        	throw LDAPException( "No LDAP server configured" );
+        }
+
+        d_tls = tls;
+        d_binddn = binddn;
+        d_secret = secret;
+        d_timeout = timeout;
+        d_connections = connections ? connections : 1;
+        d_cachettl = cachettl;
+        d_connects = 0;
+        d_puts = 0;
+
+        pthread_mutex_init( &d_lock, NULL );
+        pthread_mutex_init( &d_cachelock, NULL );
+}
+
+
+PowerLDAPPool::~PowerLDAPPool()
+{
+        pthread_mutex_destroy( &d_lock );
+        pthread_mutex_destroy( &d_cachelock );
+}
+
+
+boost::shared_ptr<PowerLDAPPool> PowerLDAPPool::get( const string& hosts, bool tls, const string& binddn, const string& secret, int timeout,
+        unsigned int connections, unsigned int cachettl )
+{
+        string key = hosts + "\t" + ( tls ? "tls" : "" ) + "\t" + binddn + "\t" + secret;
+
+        Lock l( &s_lock );
+        map<string, boost::shared_ptr<PowerLDAPPool> >::const_iterator i = s_pools.find( key );
+        if( i != s_pools.end() )
+        {
+        	return i->second;
+        }
+
+        boost::shared_ptr<PowerLDAPPool> pool( new PowerLDAPPool( hosts, tls, binddn, secret, timeout, connections, cachettl ) );
+        s_pools[key] = pool;
+        return pool;
+}
+
+
+PowerLDAPPool::conn_t PowerLDAPPool::pick()
+{
+        Lock l( &d_lock );
+
+        // a connection is referenced by d_conns and by every search running on it
+        size_t best = d_conns.size();
+        for( size_t i = 0; i < d_conns.size(); )
+        {
+        	if( d_conns[i]->isBroken() )   // searches still running on it find out by themselves
+        	{
+        		d_conns.erase( d_conns.begin() + i );
+        		continue;
+        	}
+        	if( best == d_conns.size() || d_conns[i].use_count() < d_conns[best].use_count() )
+        	{
+        		best = i;
+        	}
+        	i++;
+        }
+
+        if( best == d_conns.size() || ( d_conns[best].use_count() > 1 && d_conns.size() < d_connections ) )
+        {
+        	d_conns.push_back( connect() );
+        	return d_conns.back();
+        }
+
+        return d_conns[best];
+}
+
+
+PowerLDAPPool::conn_t PowerLDAPPool::connect()
+{
+        // every new connection tries another server first, the rest are the fallback
+        size_t idx = d_connects++ % d_hosts.size();
+        string hoststr = d_hosts[idx];
+        for( size_t i = 1; i < d_hosts.size(); i++ )
+        {
+        	hoststr += " " + d_hosts[( idx + i ) % d_hosts.size()];
+        }
+
+        conn_t conn( new PowerLDAP( hoststr.c_str(), LDAP_PORT, d_tls ) );
+        conn->setOption( LDAP_OPT_DEREF, LDAP_DEREF_ALWAYS );
+        conn->bind( d_binddn, d_secret, LDAP_AUTH_SIMPLE, d_timeout );
+        return conn;
+}
+
+
+bool PowerLDAPPool::getCached( const string& key, cached_t& result )
+{
+        Lock l( &d_cachelock );
+
+        map<string, std::pair<time_t, cached_t> >::const_iterator i = d_cache.find( key );
+        if( i == d_cache.end() || i->second.first < time( 0 ) )
+        {
+        	return false;
+        }
+
+        result = i->second.second;
+        return true;
+}
+
+
+void PowerLDAPPool::putCached( const string& key, const cached_t& result )
+{
+        time_t now = time( 0 );
+
+        Lock l( &d_cachelock );
+
+        if( !( ++d_puts % 1000 ) )   // nothing else removes expired entries
+        {
+        	map<string, std::pair<time_t, cached_t> >::iterator i = d_cache.begin();
+        	while( i != d_cache.end() )
+        	{
+        		if( i->second.first < now ) { d_cache.erase( i++ ); }
+        		else { ++i; }
+        	}
+        }
+
+        d_cache[key] = std::make_pair( now + d_cachettl, result );
+}
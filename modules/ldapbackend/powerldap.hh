@@ -26,8 +26,12 @@
 #include <stdexcept>
 #include <inttypes.h>
 #include <errno.h>
+#include <time.h>
+#include <pthread.h>
 #include <lber.h>
 #include <ldap.h>
+#include <boost/shared_ptr.hpp>
+#include <boost/utility.hpp>
 
 #ifdef HAVE_CONFIG_H
 #include <config.h>
@@ -60,6 +64,7 @@ class PowerLDAP
         string d_hosts;
         int d_port;
         bool d_tls;
+        bool d_broken;
 
         const string getError( int rc = -1 );
         int waitResult( int msgid = LDAP_RES_ANY, int timeout = 0, LDAPMessage** result = NULL );
@@ -81,10 +86,66 @@ public:
 
         bool getSearchEntry( int msgid, sentry_t& entry, bool dn = false, int timeout = 5 );
         void getSearchResults( int msgid, sresult_t& result, bool dn = false, int timeout = 5 );
+        void abandon( int msgid );
+
+        // true once waiting for a result failed, the connection is of no use anymore then
+        bool isBroken() const { return d_broken; }
 
         static const string escape( const string& tobe );
 };
 
 
 
+/*
+ *  Connections to one set of LDAP servers with one bind dn, shared by all backends with these settings.
+ *  Each search is started on the connection with the fewest searches running, a connection can have many
+ *  of them outstanding as every backend only waits for the results of its own message id. This requires
+ *  libldap_r, with plain libldap every backend has to keep a pool of its own.
+ *
+ *  The pool also caches the results of searches for cache-ttl seconds, keyed by the search itself.
+ */
+
+class PowerLDAPPool : public boost::noncopyable
+{
+public:
+        typedef boost::shared_ptr<PowerLDAP> conn_t;
+        typedef boost::shared_ptr<const PowerLDAP::sresult_t> cached_t;
+
+        PowerLDAPPool( const string& hosts, bool tls, const string& binddn, const string& secret, int timeout, unsigned int connections, unsigned int cachettl );
+        ~PowerLDAPPool();
+
+        static boost::shared_ptr<PowerLDAPPool> get( const string& hosts, bool tls, const string& binddn, const string& secret, int timeout,
+        	unsigned int connections, unsigned int cachettl );
+
+        // The connection to start a search on, hold on to it only until the search is done so the next pick() knows
+        conn_t pick();
+
+        bool getCached( const string& key, cached_t& result );
+        void putCached( const string& key, const cached_t& result );
+        unsigned int getCacheTTL() const { return d_cachettl; }
+
+private:
+        conn_t connect();
+
+        vector<string> d_hosts;
+        bool d_tls;
+        string d_binddn;
+        string d_secret;
+        int d_timeout;
+        unsigned int d_connections;
+        unsigned int d_cachettl;
+        unsigned int d_connects;   // rotates the server we try first, for every new connection
+        unsigned int d_puts;
+
+        pthread_mutex_t d_lock;   // protects d_conns and d_connects
+        vector<conn_t> d_conns;
+        pthread_mutex_t d_cachelock;
+        map<string, std::pair<time_t, cached_t> > d_cache;   // expiry time and result, by search
+
+        static pthread_mutex_t s_lock;
+        static map<string, boost::shared_ptr<PowerLDAPPool> > s_pools;
+};
+
+
+
 #endif
@@ -133,7 +133,7 @@ bool LUABackend::getBeforeAndAfterNamesAbsolute(uint32_t id, const std::string&
     if(logging)
 	L << Logger::Info << backend_name << "(getBeforeAndAfterNamesAbsolute) BEGIN id: '" << id << "' qname: '" << qname << "'" << endl;
 	
-    lua_rawgeti(lua, LUA_REGISTRYINDEX, f_lua_updatednssecorderandauthabsolute);
+    lua_rawgeti(lua, LUA_REGISTRYINDEX, f_lua_getbeforeandafternamesabsolute);
 
     lua_pushnumber(lua, id);
     lua_pushstring(lua, qname.c_str());
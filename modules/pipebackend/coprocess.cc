@@ -8,7 +8,11 @@
 #include <sys/types.h>
 #include <sys/wait.h>
 #include <sys/un.h>
+#include <sys/socket.h>
+#include <sys/time.h>
 #include <pdns/misc.hh>
+#include <pdns/lock.hh>
+#include <pdns/logger.hh>
 #include <pdns/pdnsexception.hh>
 #include <sys/stat.h>
 #include <unistd.h>
@@ -157,6 +161,11 @@ void CoProcess::receive(string &receive)
   trim_right(receive);
 }
 
+void CoProcess::terminate()
+{
+  kill(d_pid, 9); // our destructor reaps it
+}
+
 void CoProcess::sendReceive(const string &snd, string &rcv)
 {
   checkStatus();
@@ -202,6 +211,11 @@ void UnixRemote::receive(string& line)
   trim_right(line);
 }
 
+void UnixRemote::terminate()
+{
+  shutdown(d_fd, SHUT_RDWR);
+}
+
 void UnixRemote::sendReceive(const string &snd, string &rcv)
 {
   //  checkStatus();
@@ -218,6 +232,266 @@ bool isUnixSocket(const string& fname)
   return (st.st_mode & S_IFSOCK) == S_IFSOCK;
 }
 
+CoMultiplexer::CoMultiplexer(CoRemote *cp, int timeout) : d_cp(cp), d_timeout(timeout), d_tag(0), d_broken(false)
+{
+  pthread_mutex_init(&d_lock, 0);
+  pthread_mutex_init(&d_sendlock, 0);
+}
+
+CoMultiplexer::~CoMultiplexer()
+{
+  for(map<unsigned int, Slot*>::iterator iter = d_slots.begin(); iter != d_slots.end(); ++iter)
+    delete iter->second;
+  delete d_cp;
+  pthread_mutex_destroy(&d_lock);
+  pthread_mutex_destroy(&d_sendlock);
+}
+
+boost::shared_ptr<CoMultiplexer> CoMultiplexer::launch(const string &command, int timeout)
+{
+  CoRemote *cp;
+  if(isUnixSocket(command))
+    cp = new UnixRemote(command, timeout);
+  else
+    cp = new CoProcess(command); // no timeout, so it reads buffered; we time out waiting on the reader thread instead
+
+  boost::shared_ptr<CoMultiplexer> ret(new CoMultiplexer(cp, timeout));
+  ret->d_slots[0] = new Slot(); // the banner has no tag, the reader thread hands it to slot 0
+  pthread_t tid;
+  boost::shared_ptr<CoMultiplexer> *self = new boost::shared_ptr<CoMultiplexer>(ret); // the reader thread keeps us alive
+  if(pthread_create(&tid, 0, readerThread, self)) {
+    delete self;
+    throw PDNSException("Unable to start the reader thread for coprocess '"+command+"': "+stringerror());
+  }
+  pthread_detach(tid);
+
+  // waiting for the banner like for any answer means a coprocess that never says anything times out as well
+  string banner;
+  try {
+    cp->send("HELO\t4");
+    ret->receive(0, banner);
+    if(banner.empty() || banner.substr(0, 4) == "FAIL")
+      throw PDNSException("Coprocess '"+command+"' does not speak pipebackend-abi-version 4");
+  }
+  catch(PDNSException &ae) {
+    Lock l(&ret->d_lock);
+    ret->breakDown(ae.reason);
+    cp->terminate(); // lets the reader thread go
+    throw;
+  }
+  ret->forget(0);
+  L<<Logger::Error<<"Backend launched with banner: "<<banner<<endl;
+  return ret;
+}
+
+void *CoMultiplexer::readerThread(void *data)
+{
+  boost::shared_ptr<CoMultiplexer> self = *static_cast<boost::shared_ptr<CoMultiplexer>*>(data);
+  delete static_cast<boost::shared_ptr<CoMultiplexer>*>(data);
+
+  string line;
+  try {
+    self->d_cp->receive(line);
+    {
+      Lock l(&self->d_lock);
+      self->deliver(0, line);
+    }
+
+    for(;;) {
+      self->d_cp->receive(line);
+      if(line.empty()) // a tag is mandatory, this is a closed socket
+        throw PDNSException("Coprocess closed the connection");
+
+      string::size_type pos = line.find('\t');
+      unsigned int tag = atoi(line.c_str());
+
+      Lock l(&self->d_lock);
+      self->deliver(tag, pos == string::npos ? "" : line.substr(pos + 1));
+    }
+  }
+  catch(PDNSException &ae) {
+    Lock l(&self->d_lock);
+    self->breakDown(ae.reason);
+  }
+  return 0;
+}
+
+void CoMultiplexer::deliver(unsigned int tag, const string &line)
+{
+  map<unsigned int, Slot*>::iterator iter = d_slots.find(tag);
+  if(iter == d_slots.end()) // we gave up on this question
+    return;
+  iter->second->lines.push_back(line);
+  pthread_cond_signal(&iter->second->cond);
+}
+
+void CoMultiplexer::breakDown(const string &reason)
+{
+  if(d_broken)
+    return;
+  L<<Logger::Warning<<"Coprocess declared dead: "<<reason<<endl;
+  d_reason = reason;
+  d_broken = true;
+  for(map<unsigned int, Slot*>::iterator iter = d_slots.begin(); iter != d_slots.end(); ++iter)
+    pthread_cond_signal(&iter->second->cond);
+}
+
+void CoMultiplexer::removeSlot(unsigned int tag)
+{
+  map<unsigned int, Slot*>::iterator iter = d_slots.find(tag);
+  if(iter == d_slots.end())
+    return;
+  delete iter->second;
+  d_slots.erase(iter);
+}
+
+unsigned int CoMultiplexer::send(const string &line)
+{
+  unsigned int tag;
+  {
+    Lock l(&d_lock);
+    if(d_broken)
+      throw PDNSException(d_reason);
+    if(!++d_tag) // 0 is not a tag
+      ++d_tag;
+    tag = d_tag;
+    d_slots[tag] = new Slot();
+  }
+
+  try {
+    Lock l(&d_sendlock); // not d_lock, the reader thread must be able to deliver while a write blocks
+    d_cp->send(itoa(tag)+"\t"+line);
+  }
+  catch(PDNSException &ae) {
+    Lock l(&d_lock);
+    removeSlot(tag);
+    breakDown(ae.reason);
+    throw;
+  }
+  return tag;
+}
+
+void CoMultiplexer::receive(unsigned int tag, string &line)
+{
+  struct timeval now;
+  gettimeofday(&now, 0);
+  struct timespec deadline;
+  deadline.tv_sec = now.tv_sec + d_timeout / 1000;
+  deadline.tv_nsec = now.tv_usec * 1000 + (d_timeout % 1000) * 1000000;
+  if(deadline.tv_nsec >= 1000000000) {
+    deadline.tv_sec++;
+    deadline.tv_nsec -= 1000000000;
+  }
+
+  Lock l(&d_lock);
+  map<unsigned int, Slot*>::iterator iter = d_slots.find(tag);
+  if(iter == d_slots.end())
+    throw PDNSException("No question with tag "+itoa(tag)+" outstanding for coprocess");
+  Slot *slot = iter->second;
+  while(slot->lines.empty()) {
+    if(d_broken)
+      throw PDNSException(d_reason);
+    if(!d_timeout)
+      pthread_cond_wait(&slot->cond, &d_lock);
+    else if(pthread_cond_timedwait(&slot->cond, &d_lock, &deadline) == ETIMEDOUT && slot->lines.empty()) {
+      // like with a CoProcess, a coprocess that times out is replaced. Killing it makes the reader thread let go of us.
+      breakDown("Timeout waiting for data from coprocess");
+      d_cp->terminate();
+      throw PDNSException(d_reason);
+    }
+  }
+  line.swap(slot->lines.front());
+  slot->lines.pop_front();
+}
+
+void CoMultiplexer::forget(unsigned int tag)
+{
+  Lock l(&d_lock);
+  removeSlot(tag);
+}
+
+unsigned int CoMultiplexer::inFlight()
+{
+  Lock l(&d_lock);
+  return d_slots.size();
+}
+
+pthread_mutex_t CoPool::s_lock = PTHREAD_MUTEX_INITIALIZER;
+map<string, boost::shared_ptr<CoPool> > CoPool::s_pools;
+
+CoPool::CoPool(const string &command, unsigned int processes, int timeout) : d_command(command), d_timeout(timeout), d_processes(processes ? processes : 1), d_launching(d_processes.size(), false)
+{
+  pthread_mutex_init(&d_lock, 0);
+  pthread_cond_init(&d_launched, 0);
+}
+
+boost::shared_ptr<CoPool> CoPool::get(const string &command, unsigned int processes, int timeout)
+{
+  Lock l(&s_lock);
+  boost::shared_ptr<CoPool> &pool = s_pools[command];
+  if(!pool)
+    pool = boost::shared_ptr<CoPool>(new CoPool(command, processes, timeout));
+  return pool;
+}
+
+boost::shared_ptr<CoMultiplexer> CoPool::pick()
+{
+  bool failed = false; // we relaunch at most one coprocess per question
+  for(;;) {
+    unsigned int dead = 0;
+    {
+      Lock l(&d_lock);
+      for(;;) {
+        boost::shared_ptr<CoMultiplexer> best;
+        unsigned int bestload = 0;
+        bool launching = false, found = false;
+        for(unsigned int n = 0; n < d_processes.size(); ++n) {
+          if(d_launching[n])
+            launching = true;
+          else if(!d_processes[n] || d_processes[n]->isBroken()) {
+            if(!found) {
+              dead = n;
+              found = true;
+            }
+          }
+          else {
+            unsigned int load = d_processes[n]->inFlight();
+            if(!best || load < bestload) {
+              best = d_processes[n];
+              bestload = load;
+            }
+          }
+        }
+        if(best && (!found || failed))
+          return best;
+        if(found && !failed) {
+          d_launching[dead] = true; // others leave this one to us while we launch it without the lock
+          d_processes[dead].reset();
+          break;
+        }
+        if(!launching)
+          throw PDNSException("None of the coprocesses for '"+d_command+"' could be launched");
+        pthread_cond_wait(&d_launched, &d_lock);
+      }
+    }
+
+    boost::shared_ptr<CoMultiplexer> mux;
+    try {
+      mux = CoMultiplexer::launch(d_command, d_timeout);
+    }
+    catch(PDNSException &ae) {
+      L<<Logger::Error<<"Unable to launch coprocess '"<<d_command<<"': "<<ae.reason<<endl;
+    }
+
+    Lock l(&d_lock);
+    d_launching[dead] = false;
+    d_processes[dead] = mux;
+    pthread_cond_broadcast(&d_launched);
+    if(mux)
+      return mux;
+    failed = true;
+  }
+}
 
 #ifdef TESTDRIVER
 main()
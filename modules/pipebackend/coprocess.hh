@@ -4,6 +4,12 @@
 #include <iostream>
 #include <stdio.h>
 #include <string>
+#include <map>
+#include <deque>
+#include <vector>
+#include <pthread.h>
+#include <boost/shared_ptr.hpp>
+#include <boost/utility.hpp>
 
 #include "pdns/namespaces.hh"
 
@@ -14,6 +20,7 @@ public:
   virtual void sendReceive(const string &send, string &receive) = 0;
   virtual void receive(string &rcv) = 0;
   virtual void send(const string &send) = 0;
+  virtual void terminate() = 0; //!< makes a receive() that is blocked in another thread return with an error
 
 };
 
@@ -25,6 +32,7 @@ public:
   void sendReceive(const string &send, string &receive);
   void receive(string &rcv);
   void send(const string &send);
+  void terminate();
 private:
   void launch(const char **argv, int timeout=0, int infd=0, int outfd=1);
   void checkStatus();
@@ -44,9 +52,76 @@ public:
   void sendReceive(const string &send, string &receive);
   void receive(string &rcv);
   void send(const string &send);
+  void terminate();
 private:
   int d_fd;
   FILE *d_fp;
 };
 bool isUnixSocket(const string& fname);
+
+/** Speaks pipebackend-abi-version 4 with one coprocess. Every question carries a tag that the coprocess puts in front
+    of each line of its answer, so any number of threads can have a question outstanding and the coprocess may answer
+    them in any order. A thread of our own reads all answers, the HELO banner included, and hands each line to the
+    thread that asked. */
+class CoMultiplexer : public boost::noncopyable
+{
+public:
+  //! starts the coprocess or connects to the unix socket, and says HELO. Throws a PDNSException if that fails.
+  static boost::shared_ptr<CoMultiplexer> launch(const string &command, int timeout);
+  ~CoMultiplexer();
+  unsigned int send(const string &line); //!< returns the tag to receive() the answer with
+  void receive(unsigned int tag, string &line); //!< next line of the answer, throws if the coprocess died or timed out
+  void forget(unsigned int tag); //!< call when done with an answer, read to the end or not
+  unsigned int inFlight();
+  bool isBroken()
+  {
+    return d_broken;
+  }
+
+private:
+  struct Slot
+  {
+    Slot() { pthread_cond_init(&cond, 0); }
+    ~Slot() { pthread_cond_destroy(&cond); }
+    deque<string> lines;
+    pthread_cond_t cond;
+  };
+
+  CoMultiplexer(CoRemote *cp, int timeout);
+  static void *readerThread(void *data);
+  void breakDown(const string &reason); //!< fails everything in flight, call with d_lock held
+  void deliver(unsigned int tag, const string &line); //!< call with d_lock held
+  void removeSlot(unsigned int tag); //!< call with d_lock held
+
+  CoRemote *d_cp;
+  int d_timeout;
+  pthread_mutex_t d_lock; //!< protects d_slots, d_tag, d_broken and d_reason
+  pthread_mutex_t d_sendlock;
+  map<unsigned int, Slot*> d_slots;
+  unsigned int d_tag;
+  volatile bool d_broken;
+  string d_reason;
+};
+
+/** A fixed number of coprocesses, shared by all PipeBackend instances that run the same command. Each question goes
+    to the coprocess with the fewest questions outstanding, and coprocesses that died are started again. */
+class CoPool : public boost::noncopyable
+{
+public:
+  static boost::shared_ptr<CoPool> get(const string &command, unsigned int processes, int timeout);
+  boost::shared_ptr<CoMultiplexer> pick();
+
+private:
+  CoPool(const string &command, unsigned int processes, int timeout);
+
+  string d_command;
+  int d_timeout;
+  pthread_mutex_t d_lock; //!< protects d_processes and d_launching
+  pthread_cond_t d_launched;
+  vector<boost::shared_ptr<CoMultiplexer> > d_processes;
+  vector<bool> d_launching; //!< slots some thread is launching a coprocess for, outside d_lock
+
+  static pthread_mutex_t s_lock; //!< protects s_pools
+  static map<string, boost::shared_ptr<CoPool> > s_pools;
+};
 #endif
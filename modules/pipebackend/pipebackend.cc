@@ -91,7 +91,10 @@ PipeBackend::PipeBackend(const string &suffix)
    signal(SIGCHLD, SIG_IGN);
    setArgPrefix("pipe"+suffix);
    try {
-     d_coproc=shared_ptr<CoWrapper>(new CoWrapper(getArg("command"), getArgAsNum("timeout")));
+     if(::arg().asNum("pipebackend-abi-version") >= 4)
+       d_pool=CoPool::get(getArg("command"), getArgAsNum("processes"), getArgAsNum("timeout"));
+     else
+       d_coproc=shared_ptr<CoWrapper>(new CoWrapper(getArg("command"), getArgAsNum("timeout")));
      d_regex=getArg("regex").empty() ? 0 : new Regex(getArg("regex"));
      d_regexstr=getArg("regex");
    }
@@ -104,6 +107,43 @@ PipeBackend::PipeBackend(const string &suffix)
    }
 }
 
+void PipeBackend::ask(const string &question)
+{
+   if(!d_pool) {
+      d_coproc->send(question);
+      return;
+   }
+   forget(); // the answer to the previous question may not have been read to the end
+   d_mux=d_pool->pick();
+   d_tag=d_mux->send(question);
+}
+
+void PipeBackend::receive(string &line)
+{
+   if(!d_pool) {
+      d_coproc->receive(line);
+      return;
+   }
+   if(!d_mux)
+      throw PDNSException("Reading an answer from the coprocess without asking a question");
+   try {
+      d_mux->receive(d_tag, line);
+   }
+   catch(PDNSException &ae) {
+      L<<Logger::Warning<<kBackendId<<" unable to receive data from coprocess. "<<ae.reason<<endl;
+      forget();
+      throw;
+   }
+}
+
+void PipeBackend::forget()
+{
+   if(d_mux) {
+      d_mux->forget(d_tag);
+      d_mux.reset();
+   }
+}
+
 void PipeBackend::lookup(const QType &qtype,const string &qname, DNSPacket *pkt_p,  int zoneId)
 {
    try {
@@ -135,7 +175,7 @@ void PipeBackend::lookup(const QType &qtype,const string &qname, DNSPacket *pkt_
 
          if(::arg().mustDo("query-logging"))
             L<<Logger::Error<<"Query: '"<<query.str()<<"'"<<endl;
-         d_coproc->send(query.str());
+         ask(query.str());
       }
    }
    catch(PDNSException &ae) {
@@ -157,7 +197,7 @@ bool PipeBackend::list(const string &target, int inZoneId)
 
       query<<"AXFR\t"<<inZoneId;
 
-      d_coproc->send(query.str());
+      ask(query.str());
    }
    catch(PDNSException &ae) {
       L<<Logger::Error<<kBackendId<<" Error from coprocess: "<<ae.reason<<endl;
@@ -181,6 +221,7 @@ DNSBackend *PipeBackend::maker()
 
 PipeBackend::~PipeBackend()
 {
+   forget();
    delete d_regex;
 }
 
@@ -195,11 +236,11 @@ bool PipeBackend::get(DNSResourceRecord &r)
    // DATA    qname           qclass  qtype   ttl     id      content 
    int abiVersion = ::arg().asNum("pipebackend-abi-version");
    unsigned int extraFields = 0;
-   if(abiVersion == 3)
+   if(abiVersion >= 3)
      extraFields = 2;
      
    for(;;) {
-      d_coproc->receive(line);
+      receive(line);
       vector<string>parts;
       stringtok(parts,line,"\t");
       if(parts.empty()) {
@@ -207,9 +248,11 @@ bool PipeBackend::get(DNSResourceRecord &r)
          throw PDNSException("Format error communicating with coprocess");
       }
       else if(parts[0]=="FAIL") {
+         forget();
          throw DBException("coprocess returned a FAIL");
       }
       else if(parts[0]=="END") {
+         forget();
          return false;
       }
       else if(parts[0]=="LOG") {
@@ -223,7 +266,7 @@ bool PipeBackend::get(DNSResourceRecord &r)
             // now what?
          }
          
-         if(abiVersion == 3) {
+         if(abiVersion >= 3) {
            r.scopeMask = atoi(parts[1].c_str());
            r.auth = atoi(parts[2].c_str());
          } else {
@@ -274,6 +317,7 @@ class PipeFactory : public BackendFactory
          declare(suffix,"command","Command to execute for piping questions to","");
          declare(suffix,"timeout","Number of milliseconds to wait for an answer","2000");
          declare(suffix,"regex","Regular exception of queries to pass to coprocess","");
+         declare(suffix,"processes","Number of coprocesses to share between all threads, from pipebackend-abi-version 4 on","1");
       }
 
       DNSBackend *make(const string &suffix="")
@@ -43,7 +43,14 @@ public:
   static DNSBackend *maker();
   
 private:
-  shared_ptr<CoWrapper> d_coproc;
+  void ask(const string &question);
+  void receive(string &line);
+  void forget();
+
+  shared_ptr<CoWrapper> d_coproc; //!< up to pipebackend-abi-version 3, our own coprocess
+  shared_ptr<CoPool> d_pool; //!< from version 4 on, coprocesses shared with the other instances
+  shared_ptr<CoMultiplexer> d_mux; //!< the one that has our question
+  unsigned int d_tag;
   string d_qname;
   QType d_qtype;
   Regex* d_regex;
@@ -48,14 +48,15 @@ HTTPConnector::HTTPConnector(std::map<std::string,std::string> options) {
 }
 
 HTTPConnector::~HTTPConnector() {
+    if (this->d_c != NULL)
+      curl_easy_cleanup(this->d_c);
     this->d_c = NULL;
 }
 
 // friend method for writing data into our buffer
 size_t httpconnector_write_data(void *buffer, size_t size, size_t nmemb, void *userp) {
     HTTPConnector *tc = reinterpret_cast<HTTPConnector*>(userp);
-    std::string tmp(reinterpret_cast<char *>(buffer), size*nmemb);
-    tc->d_data += tmp;
+    tc->d_data.append(reinterpret_cast<char *>(buffer), size*nmemb);
     return nmemb;
 }
 
@@ -332,8 +333,11 @@ int HTTPConnector::send_message(const rapidjson::Document &input) {
     std::vector<std::string> members;
     std::string method;
 
-    // initialize curl
-    d_c = curl_easy_init();
+    // initialize curl, the handle is kept between requests so its connection to the server stays open (keep-alive)
+    if (d_c == NULL)
+      d_c = curl_easy_init();
+    else
+      curl_easy_reset(d_c);
     d_data = "";
     curl_easy_setopt(d_c, CURLOPT_NOSIGNAL, 1);
     curl_easy_setopt(d_c, CURLOPT_TIMEOUT, this->timeout);
@@ -380,21 +384,15 @@ int HTTPConnector::send_message(const rapidjson::Document &input) {
 
     // clean up resources
     curl_slist_free_all(slist);
-    curl_easy_cleanup(d_c);
 
     return rv;
 }
 
 int HTTPConnector::recv_message(rapidjson::Document &output) {
-    rapidjson::StringStream ss(d_data.c_str());
-    int rv = -1;
-    output.ParseStream<0>(ss);
-
     // offer whatever we read in send_message
-    if (output.HasParseError() == false)
-       rv = d_data.size();
+    int rv = parseReply(output, d_data.c_str(), d_data.size());
 
-    d_data = ""; // cleanup here
+    d_data.clear(); // cleanup here, but keep the memory for the next reply
     return rv;
 }
 
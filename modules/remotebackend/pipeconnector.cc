@@ -58,6 +58,7 @@ void PipeConnector::launch() {
   if((d_pid=fork())<0)
     throw PDNSException("Unable to fork for coprocess: "+stringerror());
   else if(d_pid>0) { // parent speaking
+    d_rbuf.clear(); // whatever the previous coprocess left behind
     close(d_fd1[0]);
     Utility::setCloseOnExec(d_fd1[1]);
     close(d_fd2[1]);
@@ -135,36 +136,42 @@ int PipeConnector::send_message(const rapidjson::Document &input)
 
 int PipeConnector::recv_message(rapidjson::Document &output) 
 {
-   std::string receive;
-   rapidjson::GenericReader<rapidjson::UTF8<> , rapidjson::MemoryPoolAllocator<> > r;
-   std::string tmp;
-   std::string s_output;
+   std::string::size_type pos, scanned = 0;
+   char buf[8192];
    launch();
 
+   // replies are terminated by a newline, but a reply that spans several lines is still accepted
    while(1) {
-     receive.clear();
+     while((pos = d_rbuf.find('\n', scanned)) != std::string::npos) {
+       scanned = pos+1;
+       int rv = parseReply(output, d_rbuf.c_str(), scanned);
+       if (rv >= 0) {
+         d_rbuf.erase(0, scanned);
+         return rv;
+       }
+     }
+
      if(d_timeout) {
        struct timeval tv;
        tv.tv_sec = d_timeout/1000;
        tv.tv_usec = (d_timeout % 1000) * 1000;
        fd_set rds;
        FD_ZERO(&rds);
-       FD_SET(fileno(d_fp),&rds);
-       int ret=select(fileno(d_fp)+1,&rds,0,0,&tv);
+       FD_SET(d_fd2[0],&rds);
+       int ret=select(d_fd2[0]+1,&rds,0,0,&tv);
        if(ret<0) 
          throw PDNSException("Error waiting on data from coprocess: "+stringerror());
        if(!ret)
          throw PDNSException("Timeout waiting for data from coprocess");
      }
 
-     if(!stringfgets(d_fp, receive))
+     // read as much as there is, instead of a byte at a time like fgets on an unbuffered pipe does
+     ssize_t len=read(d_fd2[0], buf, sizeof buf);
+     if(len<0)
+       throw PDNSException("Error reading from coprocess: "+stringerror());
+     if(!len)
        throw PDNSException("Child closed pipe");
-  
-      s_output.append(receive);
-      rapidjson::StringStream ss(s_output.c_str());
-      output.ParseStream<0>(ss); 
-      if (output.HasParseError() == false)
-        return s_output.size();
+     d_rbuf.append(buf, len);
    }
    return 0;
 }
@@ -0,0 +1,398 @@
+#include "remotebackend.hh"
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <pdns/lock.hh>
+
+/**
+ * One connection to the remote end, unix socket or coprocess, shared by
+ * every PipelinedConnector with the same connection string. Any number of
+ * threads can have a request outstanding. Each request gets an 'id' that
+ * the remote end copies into its reply, a reader thread hands every reply
+ * to the thread that waits for that id.
+ */
+class PipelineChannel : public boost::noncopyable {
+  public:
+    PipelineChannel(const std::string &type, const std::map<std::string,std::string> &options);
+    ~PipelineChannel();
+
+    void start(boost::shared_ptr<PipelineChannel> self);
+    uint64_t send(const std::string &json); // returns the id to wait for
+    bool wait(uint64_t id, int timeout, std::string &answer);
+    bool isBroken() {
+      return d_broken;
+    }
+
+  private:
+    struct Waiter {
+      Waiter() : done(false) { pthread_cond_init(&cond, 0); }
+      ~Waiter() { pthread_cond_destroy(&cond); }
+      pthread_cond_t cond;
+      bool done;
+      std::string answer;
+    };
+
+    void connectUnix(const std::string &path);
+    void launch(const std::string &command);
+    static void *readerThread(void *data);
+    void readAnswers();
+    void dispatch(const std::string &line);
+    void breakDown();
+
+    int d_rfd, d_wfd;
+    pid_t d_pid;
+    pthread_mutex_t d_lock; // protects d_waiters, d_lastid and d_broken
+    pthread_mutex_t d_writelock;
+    std::map<uint64_t, Waiter*> d_waiters;
+    uint64_t d_lastid;
+    volatile bool d_broken;
+};
+
+PipelineChannel::PipelineChannel(const std::string &type, const std::map<std::string,std::string> &options) {
+   d_rfd = d_wfd = -1;
+   d_pid = -1;
+   d_lastid = 0;
+   d_broken = false;
+   pthread_mutex_init(&d_lock, 0);
+   pthread_mutex_init(&d_writelock, 0);
+
+   signal(SIGPIPE, SIG_IGN);
+   if (type == "unix") {
+     if (options.count("path") == 0)
+       throw PDNSException("Cannot find 'path' option in connection string");
+     connectUnix(options.find("path")->second);
+   } else {
+     if (options.count("command") == 0)
+       throw PDNSException("Cannot find 'command' option in connection string");
+     launch(options.find("command")->second);
+   }
+}
+
+PipelineChannel::~PipelineChannel() {
+   if (d_wfd != d_rfd)
+     close(d_wfd);
+   close(d_rfd);
+   if (d_pid > 0) {
+     int status;
+     if(!waitpid(d_pid, &status, WNOHANG)) {
+       kill(d_pid, 9);
+       waitpid(d_pid, &status, 0);
+     }
+   }
+}
+
+void PipelineChannel::connectUnix(const std::string &path) {
+   struct sockaddr_un sock;
+   if (makeUNsockaddr(path, &sock))
+     throw PDNSException("Unable to create UNIX domain socket: Path '"+path+"' is not a valid UNIX socket path.");
+
+   int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+   if (fd < 0)
+     throw PDNSException("Cannot create socket: "+stringerror());
+   if (connect(fd, reinterpret_cast<struct sockaddr*>(&sock), sizeof sock) < 0) {
+     close(fd);
+     throw PDNSException("Cannot connect to socket '"+path+"': "+stringerror());
+   }
+   Utility::setCloseOnExec(fd);
+   d_rfd = d_wfd = fd;
+}
+
+void PipelineChannel::launch(const std::string &command) {
+   std::vector <std::string> v;
+   split(v, command, is_any_of(" "));
+
+   const char *argv[v.size()+1];
+   argv[v.size()]=0;
+   for (size_t n = 0; n < v.size(); n++)
+     argv[n]=v[n].c_str();
+
+   if(access(argv[0],X_OK)) // check before fork so we can throw
+     throw PDNSException("Command '"+string(argv[0])+"' cannot be executed: "+stringerror());
+
+   int fd1[2], fd2[2];
+   if(pipe(fd1)<0 || pipe(fd2)<0)
+     throw PDNSException("Unable to open pipe for coprocess: "+stringerror());
+
+   if((d_pid=fork())<0)
+     throw PDNSException("Unable to fork for coprocess: "+stringerror());
+   else if(d_pid>0) { // parent speaking
+     close(fd1[0]);
+     close(fd2[1]);
+     d_wfd = fd1[1];
+     d_rfd = fd2[0];
+     Utility::setCloseOnExec(d_wfd);
+     Utility::setCloseOnExec(d_rfd);
+     return;
+   }
+
+   // child
+   signal(SIGCHLD, SIG_DFL);
+   close(fd1[1]);
+   close(fd2[0]);
+   if(fd1[0]!= 0) {
+     dup2(fd1[0], 0);
+     close(fd1[0]);
+   }
+   if(fd2[1]!= 1) {
+     dup2(fd2[1], 1);
+     close(fd2[1]);
+   }
+   execv(argv[0], const_cast<char * const *>(argv));
+   exit(123); // our parent notices soon enough, when the pipe closes
+}
+
+// the reader thread holds on to the channel until the connection goes away
+void PipelineChannel::start(boost::shared_ptr<PipelineChannel> self) {
+   pthread_t tid;
+   pthread_create(&tid, 0, readerThread, new boost::shared_ptr<PipelineChannel>(self));
+   pthread_detach(tid);
+}
+
+void *PipelineChannel::readerThread(void *data) {
+   boost::shared_ptr<PipelineChannel> *channel = static_cast<boost::shared_ptr<PipelineChannel>*>(data);
+   (*channel)->readAnswers();
+   delete channel;
+   return 0;
+}
+
+void PipelineChannel::readAnswers() {
+   char buf[4096];
+   std::string pending;
+   for(;;) {
+     ssize_t len = ::read(d_rfd, buf, sizeof buf);
+     if (len < 0 && errno == EINTR)
+       continue;
+     if (len <= 0) {
+       L<<Logger::Error<<"Remote end closed the pipelined connection"<<(len < 0 ? ": "+stringerror() : "")<<std::endl;
+       break;
+     }
+     pending.append(buf, len);
+
+     std::string::size_type pos;
+     while((pos = pending.find('\n')) != std::string::npos) {
+       std::string line = pending.substr(0, pos);
+       pending.erase(0, pos+1);
+       if (line.find_first_not_of(" \r\t") != std::string::npos)
+         dispatch(line);
+     }
+   }
+   breakDown();
+}
+
+void PipelineChannel::dispatch(const std::string &line) {
+   rapidjson::Document doc;
+   doc.Parse<0>(line.c_str());
+   if (doc.HasParseError() || !doc.IsObject() || !doc.HasMember("id") || !doc["id"].IsUint64()) {
+     L<<Logger::Error<<"Reply from remote end without a valid id, ignoring it: "<<line<<std::endl;
+     return;
+   }
+
+   Lock l(&d_lock);
+   std::map<uint64_t, Waiter*>::iterator iter = d_waiters.find(doc["id"].GetUint64());
+   if (iter == d_waiters.end()) // we gave up on this one
+     return;
+   iter->second->answer = line;
+   iter->second->done = true;
+   pthread_cond_signal(&iter->second->cond);
+}
+
+// fails everything in flight, RemoteBackend builds a new connector which gets a new channel
+void PipelineChannel::breakDown() {
+   Lock l(&d_lock);
+   d_broken = true;
+   for(std::map<uint64_t, Waiter*>::iterator iter = d_waiters.begin(); iter != d_waiters.end(); ++iter)
+     pthread_cond_signal(&iter->second->cond);
+}
+
+uint64_t PipelineChannel::send(const std::string &json) {
+   uint64_t id;
+   {
+     Lock l(&d_lock);
+     if (d_broken)
+       throw PDNSException("Pipelined connection to remote end is broken");
+     id = ++d_lastid;
+     d_waiters[id] = new Waiter();
+   }
+
+   // tag the request by putting the id up front, '{"id":1,"method":...}'
+   std::string line = "{\"id\":" + boost::lexical_cast<std::string>(id) + (json.size() > 2 ? "," : "") + json.substr(1) + "\n";
+
+   Lock l(&d_writelock);
+   std::string::size_type sent = 0;
+   while(sent < line.size()) {
+     ssize_t bytes = ::write(d_wfd, line.c_str() + sent, line.size() - sent);
+     if (bytes < 0 && errno == EINTR)
+       continue;
+     if (bytes < 0) {
+       std::string reason = stringerror();
+       breakDown();
+       {
+         Lock wl(&d_lock);
+         delete d_waiters[id];
+         d_waiters.erase(id);
+       }
+       throw PDNSException("Writing to remote end failed: "+reason);
+     }
+     sent += bytes;
+   }
+   return id;
+}
+
+bool PipelineChannel::wait(uint64_t id, int timeout, std::string &answer) {
+   struct timeval now;
+   gettimeofday(&now, 0);
+   struct timespec deadline;
+   deadline.tv_sec = now.tv_sec + timeout / 1000;
+   deadline.tv_nsec = now.tv_usec * 1000 + (timeout % 1000) * 1000000;
+   if (deadline.tv_nsec >= 1000000000) {
+     deadline.tv_sec++;
+     deadline.tv_nsec -= 1000000000;
+   }
+
+   Lock l(&d_lock);
+   std::map<uint64_t, Waiter*>::iterator iter = d_waiters.find(id);
+   if (iter == d_waiters.end())
+     return false;
+   Waiter *waiter = iter->second;
+   while(!waiter->done && !d_broken) {
+     if (pthread_cond_timedwait(&waiter->cond, &d_lock, &deadline) == ETIMEDOUT)
+       break;
+   }
+   bool done = waiter->done;
+   answer.swap(waiter->answer);
+   d_waiters.erase(iter);
+   delete waiter;
+   return done;
+}
+
+// 'yes' means one connection, a number that many, 'no' or 0 none
+unsigned int PipelinedConnector::connections(const std::map<std::string,std::string> &options) {
+   std::map<std::string,std::string>::const_iterator iter = options.find("pipeline");
+   if (iter == options.end())
+     return 0;
+   const std::string &val = iter->second;
+   if (val == "yes" || val == "true" || val == "on")
+     return 1;
+   if (val == "no" || val == "false" || val == "off")
+     return 0;
+   if (val.empty() || val.find_first_not_of("0123456789") != std::string::npos)
+     throw PDNSException("Invalid value for the pipeline option: '"+val+"'");
+   return atoi(val.c_str());
+}
+
+struct ChannelSlot {
+   ChannelSlot() : initializing(false) {}
+   boost::shared_ptr<PipelineChannel> channel;
+   bool initializing; // somebody is setting up a new channel, wait on s_channelscond
+};
+
+static pthread_mutex_t s_channelslock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t s_channelscond = PTHREAD_COND_INITIALIZER;
+static std::map<std::string, ChannelSlot> s_channels;
+static unsigned int s_nextchannel;
+
+static void initializeChannel(boost::shared_ptr<PipelineChannel> channel, const std::map<std::string,std::string> &options) {
+   rapidjson::Document init;
+   rapidjson::Value val;
+   init.SetObject();
+   val = "initialize";
+   init.AddMember("method",val, init.GetAllocator());
+   val.SetObject();
+   init.AddMember("parameters", val, init.GetAllocator());
+   for(std::map<std::string,std::string>::const_iterator i = options.begin(); i != options.end(); i++) {
+     val = i->second.c_str();
+     init["parameters"].AddMember(i->first.c_str(), val, init.GetAllocator());
+   }
+
+   std::string answer;
+   rapidjson::Document res;
+   int timeout = options.count("timeout") ? boost::lexical_cast<int>(options.find("timeout")->second) : 2000;
+   bool ok = channel->wait(channel->send(makeStringFromDocument(init)), timeout, answer);
+   if (ok) {
+     res.Parse<0>(answer.c_str());
+     ok = !res.HasParseError() && res.HasMember("result") && !(res["result"].IsBool() && !res["result"].GetBool());
+   }
+   if (!ok)
+     L<<Logger::Warning<<"Failed to initialize pipelined connection to remote end"<<std::endl;
+}
+
+/**
+ * Hands out the channels for a connection string round robin. There are as many
+ * as the pipeline option says. A broken channel is replaced, the initialize call
+ * is made on every new channel. That round trip happens outside s_channelslock,
+ * only the threads that want the same slot wait for it.
+ */
+static boost::shared_ptr<PipelineChannel> getChannel(const std::string &type, const std::map<std::string,std::string> &options) {
+   unsigned int connections = std::max(1U, PipelinedConnector::connections(options));
+
+   std::string key = type;
+   for(std::map<std::string,std::string>::const_iterator i = options.begin(); i != options.end(); i++)
+     key += "," + i->first + "=" + i->second;
+
+   {
+     Lock l(&s_channelslock);
+     key += "#" + boost::lexical_cast<std::string>(s_nextchannel++ % connections);
+     ChannelSlot &slot = s_channels[key];
+     while (slot.initializing)
+       pthread_cond_wait(&s_channelscond, &s_channelslock);
+     if (slot.channel && !slot.channel->isBroken())
+       return slot.channel;
+     slot.initializing = true;
+   }
+
+   boost::shared_ptr<PipelineChannel> channel;
+   try {
+     channel = boost::shared_ptr<PipelineChannel>(new PipelineChannel(type, options));
+     channel->start(channel);
+     initializeChannel(channel, options);
+   }
+   catch(...) {
+     Lock l(&s_channelslock);
+     s_channels[key].initializing = false;
+     pthread_cond_broadcast(&s_channelscond);
+     throw;
+   }
+
+   Lock l(&s_channelslock);
+   ChannelSlot &slot = s_channels[key];
+   slot.channel = channel;
+   slot.initializing = false;
+   pthread_cond_broadcast(&s_channelscond);
+   return channel;
+}
+
+PipelinedConnector::PipelinedConnector(const std::string &type, std::map<std::string,std::string> options) {
+   d_type = type;
+   d_options = options;
+   d_timeout = 2000;
+   if (options.find("timeout") != options.end()) {
+     d_timeout = boost::lexical_cast<int>(options.find("timeout")->second);
+   }
+   d_id = 0;
+   d_channel = getChannel(d_type, d_options);
+}
+
+PipelinedConnector::~PipelinedConnector() {
+}
+
+int PipelinedConnector::send_message(const rapidjson::Document &input) {
+   if (d_channel->isBroken())
+     d_channel = getChannel(d_type, d_options);
+
+   std::string json = makeStringFromDocument(input);
+   d_id = d_channel->send(json);
+   return json.size();
+}
+
+int PipelinedConnector::recv_message(rapidjson::Document &output) {
+   std::string answer;
+   if (!d_channel->wait(d_id, d_timeout, answer)) {
+     if (d_channel->isBroken())
+       throw PDNSException("Pipelined connection to remote end broke while waiting for an answer");
+     throw PDNSException("Timeout waiting for answer "+boost::lexical_cast<std::string>(d_id)+" from remote end");
+   }
+
+   return parseReply(output, answer.c_str(), answer.size());
+}
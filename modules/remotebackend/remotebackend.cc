@@ -43,6 +43,20 @@ bool Connector::recv(rapidjson::Document &value) {
     return false;
 }
 
+/**
+ * Parses a complete reply in place, in d_reply, so that strings
+ * are not copied out of it one by one. Returns -1 if it is not
+ * valid JSON, len otherwise.
+ */
+int Connector::parseReply(rapidjson::Document &output, const char *data, size_t len) {
+    d_reply.assign(data, data+len);
+    d_reply.push_back(0);
+    output.ParseInsitu<0>(&d_reply[0]);
+    if (output.HasParseError())
+       return -1;
+    return len;
+}
+
 /** 
  * Standard ctor and dtor
  */
@@ -136,7 +150,9 @@ int RemoteBackend::build() {
       }
 
       // connectors know what they are doing
-      if (type == "unix") {
+      if ((type == "unix" || type == "pipe") && PipelinedConnector::connections(options)) {
+        this->connector = new PipelinedConnector(type, options);
+      } else if (type == "unix") {
         this->connector = new UnixsocketConnector(options);
       } else if (type == "http") {
 #ifdef REMOTEBACKEND_HTTP
@@ -204,6 +220,8 @@ void RemoteBackend::lookup(const QType &qtype, const std::string &qdomain, DNSPa
       return;
    }
 
+   // the records are read in get(), after other calls may have reused the connector's buffer
+   connector->keepReply(d_resultbuf);
    d_index = 0;
 }
 
@@ -233,6 +251,7 @@ bool RemoteBackend::list(const std::string &target, int domain_id) {
       return false;
    }
 
+   connector->keepReply(d_resultbuf);
    d_index = 0;
    return true;
 }
@@ -241,23 +260,24 @@ bool RemoteBackend::get(DNSResourceRecord &rr) {
    if (d_index == -1) return false;
 
    rapidjson::Value value;
+   rapidjson::Value &row = (*d_result)["result"][d_index];
 
    value = "";
-   rr.qtype = getString(JSON_GET((*d_result)["result"][d_index], "qtype", value));
-   rr.qname = getString(JSON_GET((*d_result)["result"][d_index], "qname", value));
+   rr.qtype = getString(JSON_GET(row, "qtype", value));
+   rr.qname = getString(JSON_GET(row, "qname", value));
    rr.qclass = QClass::IN;
-   rr.content = getString(JSON_GET((*d_result)["result"][d_index], "content",value));
+   rr.content = getString(JSON_GET(row, "content",value));
    value = -1;
-   rr.ttl = getInt(JSON_GET((*d_result)["result"][d_index], "ttl",value));
-   rr.domain_id = getInt(JSON_GET((*d_result)["result"][d_index],"domain_id",value));
-   rr.priority = getInt(JSON_GET((*d_result)["result"][d_index],"priority",value));
+   rr.ttl = getInt(JSON_GET(row, "ttl",value));
+   rr.domain_id = getInt(JSON_GET(row,"domain_id",value));
+   rr.priority = getInt(JSON_GET(row,"priority",value));
    value = 1;
    if (d_dnssec) 
-     rr.auth = getInt(JSON_GET((*d_result)["result"][d_index],"auth", value));
+     rr.auth = getInt(JSON_GET(row,"auth", value));
    else
      rr.auth = 1;
    value = 0;
-   rr.scopeMask = getInt(JSON_GET((*d_result)["result"][d_index],"scopeMask", value));
+   rr.scopeMask = getInt(JSON_GET(row,"scopeMask", value));
 
    d_index++;
    
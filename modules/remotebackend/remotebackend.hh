@@ -11,6 +11,7 @@
 #include <pdns/logger.hh>
 #include <pdns/arguments.hh>
 #include <boost/lexical_cast.hpp>
+#include <boost/shared_ptr.hpp>
 #include <rapidjson/rapidjson.h>
 #include <rapidjson/document.h>
 #include "pdns/json.hh"
@@ -31,9 +32,14 @@ class Connector {
     bool recv(rapidjson::Document &value);
     virtual int send_message(const rapidjson::Document &input) = 0;
     virtual int recv_message(rapidjson::Document &output) = 0;
+    // Replies are parsed in place, so the strings in a Document from recv() point into a buffer of the connector
+    // and are only good until the next recv(). This hands that buffer over to the caller, who gets buf's in return.
+    void keepReply(std::vector<char> &buf) { buf.swap(d_reply); }
    protected:
     bool getBool(rapidjson::Value &value);
     std::string getString(rapidjson::Value &value);
+    int parseReply(rapidjson::Document &output, const char *data, size_t len);
+    std::vector<char> d_reply; // the last reply, reused for the next one
 };
 
 // fwd declarations
@@ -48,6 +54,7 @@ class UnixsocketConnector: public Connector {
     ssize_t write(const std::string &data);
     void reconnect();
     std::map<std::string,std::string> options;
+    std::string d_rbuf; // what we read so far
     int fd;
     std::string path;
     bool connected;
@@ -120,6 +127,26 @@ class PipeConnector: public Connector {
   int d_pid;
   int d_timeout;
   FILE *d_fp;
+  std::string d_rbuf; // read from the coprocess but not yet parsed
+};
+
+class PipelineChannel;
+
+// Shares one connection per connection string with every other instance, for unix and pipe connectors with the
+// pipeline option. Requests carry an "id" that the remote end copies into its reply, so many can be in flight.
+class PipelinedConnector: public Connector {
+  public:
+    PipelinedConnector(const std::string &type, std::map<std::string,std::string> options);
+    virtual ~PipelinedConnector();
+    virtual int send_message(const rapidjson::Document &input);
+    virtual int recv_message(rapidjson::Document &output);
+    static unsigned int connections(const std::map<std::string,std::string> &options); // 0 if pipelining is off
+  private:
+    boost::shared_ptr<PipelineChannel> d_channel;
+    std::string d_type;
+    std::map<std::string,std::string> d_options;
+    uint64_t d_id; // of the request we are waiting for
+    int d_timeout;
 };
 
 class RemoteBackend : public DNSBackend
@@ -165,6 +192,7 @@ class RemoteBackend : public DNSBackend
     Connector *connector;
     bool d_dnssec;
     rapidjson::Document *d_result;
+    std::vector<char> d_resultbuf; // d_result was parsed in place in here
     int d_index;
     int64_t d_trxid;
     std::string d_connstr;
@@ -0,0 +1,230 @@
+#define BOOST_TEST_DYN_LINK
+#define BOOST_TEST_MAIN
+#define BOOST_TEST_MODULE unit
+
+#include <boost/test/unit_test.hpp>
+#include <boost/assign/list_of.hpp>
+#include <boost/foreach.hpp>
+#include <boost/tuple/tuple.hpp>
+#include "pdns/namespaces.hh"
+#include <pdns/dns.hh>
+#include <pdns/dnsbackend.hh>
+#include <pdns/dnspacket.hh>
+#include <pdns/ueberbackend.hh>
+#include <pdns/pdnsexception.hh>
+#include <pdns/logger.hh>
+#include <pdns/arguments.hh>
+#include "pdns/dnsrecords.hh"
+#include <boost/lexical_cast.hpp>
+#include <rapidjson/rapidjson.h>
+#include <rapidjson/document.h>
+#include "pdns/json.hh"
+#include "pdns/statbag.hh"
+#include "pdns/packetcache.hh"
+#include <sys/socket.h>
+#include <sys/un.h>
+#include "remotebackend.hh"
+
+StatBag S;
+PacketCache PC;
+ArgvMap &arg()
+{
+  static ArgvMap arg;
+  return arg;
+};
+
+class RemoteLoader
+{
+   public:
+      RemoteLoader();
+};
+
+DNSBackend *be;
+
+struct RemotebackendSetup {
+    RemotebackendSetup()  {
+	be = 0; 
+	try {
+		// setup minimum arguments
+		::arg().set("module-dir")="";
+                new RemoteLoader();
+		BackendMakers().launch("remote");
+                // then get us a instance of it 
+                ::arg().set("remote-connection-string")="pipe:command=unittest_pipe.rb,pipeline=yes";
+                ::arg().set("remote-dnssec")="yes";
+                be = BackendMakers().all()[0];
+		// load few record types to help out
+		SOARecordContent::report();
+		NSRecordContent::report();
+                ARecordContent::report();
+	} catch (PDNSException &ex) {
+		BOOST_TEST_MESSAGE("Cannot start remotebackend: " << ex.reason );
+	};
+    }
+    ~RemotebackendSetup()  {  }
+};
+
+BOOST_GLOBAL_FIXTURE( RemotebackendSetup );
+
+
+/* A remote end on a unix socket that waits for a request from every client thread before
+   it answers any, then answers them last to first. Each thread only gets its own answer
+   back if the replies are matched to the requests by id. */
+struct ReorderingRemote {
+    ReorderingRemote(const std::string &path_, unsigned int batch_, unsigned int total_) : path(path_), batch(batch_), total(total_), initializations(0), shortWrites(0) {
+      struct sockaddr_un sock;
+      unlink(path.c_str());
+      BOOST_REQUIRE(!makeUNsockaddr(path, &sock));
+      listenfd = socket(AF_UNIX, SOCK_STREAM, 0);
+      BOOST_REQUIRE(listenfd >= 0);
+      BOOST_REQUIRE(!bind(listenfd, reinterpret_cast<struct sockaddr*>(&sock), sizeof sock));
+      BOOST_REQUIRE(!listen(listenfd, 5));
+      pthread_create(&tid, 0, serveThread, this);
+    }
+    ~ReorderingRemote() {
+      pthread_join(tid, 0);
+      close(listenfd);
+      unlink(path.c_str());
+    }
+
+    static void *serveThread(void *self) {
+      static_cast<ReorderingRemote*>(self)->serve();
+      return 0;
+    }
+
+    void serve() {
+      int fd = accept(listenfd, 0, 0);
+      if (fd < 0)
+        return;
+      char buf[4096];
+      std::string pending;
+      std::vector<std::string> ids, results;
+      unsigned int answered = 0;
+      ssize_t len;
+      while(answered < total && (len = read(fd, buf, sizeof buf)) > 0) {
+        pending.append(buf, len);
+        std::string::size_type pos;
+        while((pos = pending.find('\n')) != std::string::npos) {
+          rapidjson::Document req;
+          req.Parse<0>(pending.substr(0, pos).c_str());
+          pending.erase(0, pos+1);
+          std::string id = boost::lexical_cast<std::string>(req["id"].GetUint64());
+          if (std::string(req["method"].GetString()) == "initialize") {
+            initializations++;
+            reply(fd, id, "true");
+            continue;
+          }
+          ids.push_back(id);
+          results.push_back(boost::lexical_cast<std::string>(req["parameters"]["n"].GetInt()));
+          if (ids.size() < batch)
+            continue;
+          while(!ids.empty()) {
+            reply(fd, ids.back(), results.back());
+            answered++;
+            ids.pop_back();
+            results.pop_back();
+          }
+        }
+      }
+      close(fd); // the channel breaks now, but everybody has what they wanted
+    }
+
+    void reply(int fd, const std::string &id, const std::string &result) {
+      std::string line = "{\"id\":" + id + ",\"result\":" + result + "}\n";
+      if (write(fd, line.c_str(), line.size()) != (ssize_t)line.size())
+        shortWrites++;
+    }
+
+    std::string path;
+    unsigned int batch, total;
+    int listenfd;
+    pthread_t tid;
+    int initializations, shortWrites;
+};
+
+static const int s_clients = 8;
+static const int s_rounds = 25;
+static std::map<std::string,std::string> s_clientoptions;
+
+struct ClientResult {
+  ClientResult() : thread(0), answered(0), mismatches(0) {}
+  int thread, answered, mismatches;
+  std::string error;
+};
+
+static void *clientThread(void *data) {
+  ClientResult *res = static_cast<ClientResult*>(data);
+  try {
+    PipelinedConnector connector("unix", s_clientoptions);
+    for(int round = 0; round < s_rounds; round++) {
+      int n = res->thread * 1000 + round;
+      rapidjson::Document query, answer;
+      query.SetObject();
+      JSON_ADD_MEMBER(query, "method", "echo", query.GetAllocator());
+      rapidjson::Value parameters;
+      parameters.SetObject();
+      JSON_ADD_MEMBER(parameters, "n", n, query.GetAllocator());
+      query.AddMember("parameters", parameters, query.GetAllocator());
+
+      connector.send_message(query);
+      if (connector.recv_message(answer) < 0 || !answer.HasMember("result") || !answer["result"].IsInt())
+        res->mismatches++;
+      else if (answer["result"].GetInt() != n)
+        res->mismatches++;
+      res->answered++;
+    }
+  }
+  catch(PDNSException &ae) {
+    res->error = ae.reason;
+  }
+  return 0;
+}
+
+BOOST_AUTO_TEST_SUITE(test_remotebackend_pipeline_cc)
+
+BOOST_AUTO_TEST_CASE(test_pipeline_option) {
+  std::map<std::string,std::string> options;
+  BOOST_CHECK_EQUAL(PipelinedConnector::connections(options), 0);
+  options["pipeline"] = "yes";
+  BOOST_CHECK_EQUAL(PipelinedConnector::connections(options), 1);
+  options["pipeline"] = "4";
+  BOOST_CHECK_EQUAL(PipelinedConnector::connections(options), 4);
+  options["pipeline"] = "no";
+  BOOST_CHECK_EQUAL(PipelinedConnector::connections(options), 0);
+  options["pipeline"] = "0";
+  BOOST_CHECK_EQUAL(PipelinedConnector::connections(options), 0);
+  options["pipeline"] = "maybe";
+  BOOST_CHECK_THROW(PipelinedConnector::connections(options), PDNSException);
+}
+
+BOOST_AUTO_TEST_CASE(test_concurrent_out_of_order) {
+  BOOST_TEST_MESSAGE("Testing concurrent callers with replies out of order");
+  std::string path = "/tmp/pdns-test-pipeline." + boost::lexical_cast<std::string>(getpid());
+  ReorderingRemote remote(path, s_clients, s_clients * s_rounds);
+
+  s_clientoptions["path"] = path;
+  s_clientoptions["pipeline"] = "yes";
+  s_clientoptions["timeout"] = "5000";
+
+  // the clients all set up their connector at the same time, only one of them may initialize the shared channel
+  pthread_t tids[s_clients];
+  ClientResult results[s_clients];
+  for(int i = 0; i < s_clients; i++) {
+    results[i].thread = i;
+    pthread_create(&tids[i], 0, clientThread, &results[i]);
+  }
+  for(int i = 0; i < s_clients; i++)
+    pthread_join(tids[i], 0);
+
+  for(int i = 0; i < s_clients; i++) {
+    BOOST_CHECK_EQUAL(results[i].error, "");
+    BOOST_CHECK_EQUAL(results[i].answered, s_rounds);
+    BOOST_CHECK_EQUAL(results[i].mismatches, 0);
+  }
+  BOOST_CHECK_EQUAL(remote.initializations, 1);
+  BOOST_CHECK_EQUAL(remote.shortWrites, 0);
+
+  shutdown(remote.listenfd, SHUT_RDWR); // in case nobody ever connected
+}
+
+BOOST_AUTO_TEST_SUITE_END();
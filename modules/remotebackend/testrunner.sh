@@ -94,6 +94,10 @@ case "$mode" in
     ./test_remotebackend_pipe
     rv=$?
   ;;
+  test_remotebackend_pipeline)
+    ./test_remotebackend_pipeline
+    rv=$?
+  ;;
   test_remotebackend_unix)
     start_unix
     ./test_remotebackend_unix
@@ -125,7 +129,7 @@ case "$mode" in
     stop_zeromq
   ;;
   *)
-     echo "Usage: $0 test_remotebackend_(pipe|http|post|json)"
+     echo "Usage: $0 test_remotebackend_(pipe|pipeline|unix|http|post|json|zeromq)"
   ;;
 esac
 
@@ -28,8 +28,10 @@ begin
       else
          res, log = h.send(method)
       end
-      puts ({:result => res, :log => log}).to_json
-      f.puts({:result => res, :log => log}).to_json
+      reply = {:result => res, :log => log}
+      reply[:id] = input["id"] if input.has_key?("id") # pipelined connections tag every request
+      puts reply.to_json
+      f.puts reply.to_json
     rescue JSON::ParserError
       puts ({:result => false, :log => "Cannot parse input #{line}"}).to_json
       next
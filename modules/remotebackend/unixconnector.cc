@@ -33,7 +33,7 @@ int UnixsocketConnector::send_message(const rapidjson::Document &input) {
         std::string data;
         int rv;
         data = makeStringFromDocument(input);
-        data = data + "\n";
+        data.append(1,'\n');
         rv = this->write(data);
         if (rv == -1)
           return -1;
@@ -41,32 +41,31 @@ int UnixsocketConnector::send_message(const rapidjson::Document &input) {
 }
 
 int UnixsocketConnector::recv_message(rapidjson::Document &output) {
-        int rv,nread;
-        std::string s_output;
-        rapidjson::GenericReader<rapidjson::UTF8<> , rapidjson::MemoryPoolAllocator<> > r;
+        int rv;
+        std::string::size_type end;
 
         struct timeval t0,t;
 
-        nread = 0;
         gettimeofday(&t0, NULL);
         memcpy(&t,&t0,sizeof(t0));
-        s_output = "";       
+        d_rbuf.clear();
 
         while((t.tv_sec - t0.tv_sec)*1000 + (t.tv_usec - t0.tv_usec)/1000 < this->timeout) { 
-          std::string temp;
-          temp.clear();
-
-          rv = this->read(temp);
+          rv = this->read(d_rbuf);
           if (rv == -1) 
             return -1;
+          if (rv == 0) { // nothing there yet, sleep until there is instead of spinning
+            waitForData(fd, 0, 100000);
+            gettimeofday(&t, NULL);
+            continue;
+          }
 
-          if (rv>0) {
-            nread += rv;
-            s_output.append(temp);
-            rapidjson::StringStream ss(s_output.c_str());
-            output.ParseStream<0>(ss); 
-            if (output.HasParseError() == false)
-              return s_output.size();
+          // a reply can only be complete when it ends with a }, so don't parse all we have after every read
+          end = d_rbuf.find_last_not_of(" \r\n\t");
+          if (end != std::string::npos && d_rbuf[end] == '}') {
+            rv = parseReply(output, d_rbuf.c_str(), d_rbuf.size());
+            if (rv >= 0)
+              return rv;
           }
           gettimeofday(&t, NULL);
         }
@@ -76,7 +75,7 @@ int UnixsocketConnector::recv_message(rapidjson::Document &output) {
 
 ssize_t UnixsocketConnector::read(std::string &data) {
     ssize_t nread;
-    char buf[1500] = {0};
+    char buf[8192];
 
     reconnect();
     if (!connected) return -1;
@@ -85,7 +84,7 @@ ssize_t UnixsocketConnector::read(std::string &data) {
     // just try again later...
     if (nread==-1 && errno == EAGAIN) return 0;
 
-    if (nread==-1) {
+    if (nread==-1 || nread==0) { // error or the remote end went away
        connected = false;
        close(fd);
        return -1;
@@ -96,25 +95,27 @@ ssize_t UnixsocketConnector::read(std::string &data) {
 }
 
 ssize_t UnixsocketConnector::write(const std::string &data) {
-    ssize_t nwrite, nbuf;
+    ssize_t nwrite;
     size_t pos;
-    char buf[1500];
 
     reconnect();
     if (!connected) return -1;
     pos = 0;
     nwrite = 0;
     while(pos < data.size()) {
-      nbuf = data.copy(buf, sizeof buf, pos); // copy data and write
-      nwrite = ::write(fd, buf, nbuf);
-      pos = pos + sizeof(buf);
+      nwrite = ::write(fd, data.c_str()+pos, data.size()-pos);
+      if (nwrite == -1 && errno == EAGAIN) { // socket is non-blocking, wait until it takes more
+        if (waitForRWData(fd, false, timeout/1000, (timeout%1000)*1000) > 0)
+          continue;
+      }
       if (nwrite == -1) {
         connected = false;
         close(fd);
         return -1;
       }
+      pos += nwrite;
     }
-    return nwrite;
+    return pos;
 }
 
 void UnixsocketConnector::reconnect() {
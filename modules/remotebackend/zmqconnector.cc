@@ -98,19 +98,11 @@ int ZeroMQConnector::recv_message(rapidjson::Document &output) {
        if (zmq::poll(&item, 1, 1000)>0) {
          // we have an event
          if ((item.revents & ZMQ_POLLIN) == ZMQ_POLLIN) {
-           char *data;
            // read something
              if (d_sock.recv(&message, 0) && message.size() > 0) {
-               data = new char[message.size()+1];
                // convert it into json
-               memcpy(data, message.data(), message.size());
-               data[message.size()]=0;
-               rapidjson::StringStream ss(data);
-               output.ParseStream<0>(ss);
-               delete [] data;
-               if (output.HasParseError() == false)
-                 rv = message.size();
-               else 
+               rv = parseReply(output, reinterpret_cast<const char*>(message.data()), message.size());
+               if (rv < 0)
                  L<<Logger::Error<<"Cannot parse JSON reply from " << this->d_endpoint;
                break;
              } else if (errno == EAGAIN) { continue; // try again }
@@ -2,46 +2,123 @@
 #include <cdb.h>
 #include <pdns/misc.hh>
 #include <pdns/iputils.hh>
+#include <pdns/lock.hh>
 #include <utility>
 
+pthread_mutex_t CDBMapping::s_lock=PTHREAD_MUTEX_INITIALIZER;
+map<string, CDBMappingPtr> CDBMapping::s_mappings;
+volatile unsigned int CDBMapping::s_generation;
+bool CDBMapping::s_watching;
 
-CDB::CDB(const string &cdbfile)
+CDBMapping::CDBMapping(const string &cdbfile) : d_cdbfile(cdbfile)
 {
-	
 	d_fd = open(cdbfile.c_str(), O_RDONLY);
 	if (d_fd < 0)
 	{
 		L<<Logger::Error<<"Failed to open cdb database file '"<<cdbfile<<"'. Error: "<<stringerror()<<endl;
-		throw new PDNSException("Failed to open cdb database file '"+cdbfile+"'. Error: " + stringerror());
+		throw PDNSException("Failed to open cdb database file '"+cdbfile+"'. Error: " + stringerror());
 	}
 
+	fstat(d_fd, &d_stat);
 	int cdbinit = cdb_init(&d_cdb, d_fd);
-	if (cdbinit < 0) 
+	if (cdbinit < 0)
 	{
+		close(d_fd);
 		L<<Logger::Error<<"Failed to initialize cdb structure. ErrorNr: '"<<cdbinit<<endl;
-		throw new PDNSException("Failed to initialize cdb structure.");
+		throw PDNSException("Failed to initialize cdb structure.");
 	}
 }
 
-CDB::~CDB() {
+CDBMapping::~CDBMapping() {
 	cdb_free(&d_cdb);
 	close(d_fd);
 }
 
-int CDB::searchKey(const string &key) {
-	d_searchType = SearchKey; 
+CDBMappingPtr CDBMapping::get(const string &cdbfile)
+{
+	Lock l(&s_lock);
+	map<string, CDBMappingPtr>::const_iterator iter = s_mappings.find(cdbfile);
+	if (iter != s_mappings.end()) {
+		return iter->second;
+	}
+
+	CDBMappingPtr mapping(new CDBMapping(cdbfile));
+	s_mappings[cdbfile] = mapping;
+	if (!s_watching) {
+		pthread_t tid;
+		pthread_create(&tid, 0, watchThread, 0);
+		s_watching = true;
+	}
+	return mapping;
+}
+
+bool CDBMapping::isCurrent()
+{
+	struct stat st;
+	if (stat(d_cdbfile.c_str(), &st) < 0) { // gone for now, keep serving what we have
+		return true;
+	}
+	return st.st_dev == d_stat.st_dev && st.st_ino == d_stat.st_ino && st.st_mtime == d_stat.st_mtime && st.st_size == d_stat.st_size;
+}
+
+void *CDBMapping::watchThread(void *)
+{
+	for(;;) {
+		sleep(1);
+
+		vector<CDBMappingPtr> mappings;
+		{
+			Lock l(&s_lock);
+			for (map<string, CDBMappingPtr>::const_iterator iter = s_mappings.begin(); iter != s_mappings.end(); ++iter) {
+				mappings.push_back(iter->second);
+			}
+		}
 
-	// A 'bug' in tinycdb (the lib used for reading the CDB files) means we have to copy the key because the cdb_find struct
-	// keeps a pointer to it.
-	d_key = strdup(key.c_str());
-	return cdb_findinit(&d_cdbf, &d_cdb, d_key, key.size());
+		for (vector<CDBMappingPtr>::const_iterator iter = mappings.begin(); iter != mappings.end(); ++iter) {
+			if ((*iter)->isCurrent()) {
+				continue;
+			}
+			try {
+				CDBMappingPtr fresh(new CDBMapping((*iter)->d_cdbfile)); // map it before we take the lock
+				Lock l(&s_lock);
+				s_mappings[fresh->d_cdbfile] = fresh;
+				s_generation++;
+				L<<Logger::Info<<"cdb database file '"<<fresh->d_cdbfile<<"' changed, reloaded it"<<endl;
+			}
+			catch(PDNSException &ae) {
+				L<<Logger::Error<<"cdb database file '"<<(*iter)->d_cdbfile<<"' changed but could not be reloaded, still serving the old one"<<endl;
+			}
+		}
+	}
+	return 0;
+}
+
+CDB::CDB(const string &cdbfile) : d_cdbfile(cdbfile)
+{
+	d_generation = CDBMapping::getGeneration();
+	d_mapping = CDBMapping::get(d_cdbfile);
+	d_cdb = d_mapping->getCDB(); // searches write to the cdb structure, so every reader needs its own
+}
+
+void CDB::refresh()
+{
+	if (d_generation == CDBMapping::getGeneration()) {
+		return;
+	}
+	d_generation = CDBMapping::getGeneration();
+	d_mapping = CDBMapping::get(d_cdbfile);
+	d_cdb = d_mapping->getCDB();
+}
+
+int CDB::searchKey(const string &key) {
+	d_searchType = SearchKey;
+	d_key = key;
+	return cdb_findinit(&d_cdbf, &d_cdb, d_key.c_str(), d_key.size());
 }
 
 bool CDB::searchSuffix(const string &key) {
 	d_searchType = SearchSuffix;
-
-	//See CDB::searchKey() 
-	d_key = strdup(key.c_str());
+	d_key = key;
 
 	// We are ok with a search on things, but we do want to know if a record with that key exists.........
 	bool hasDomain = (cdb_find(&d_cdb, key.c_str(), key.size()) == 1);
@@ -67,41 +144,20 @@ bool CDB::moveToNext() {
 	return (hasNext > 0);
 }
 
+// Keys and values are copied straight out of the mapping, without going through read()
 bool CDB::readNext(pair<string, string> &value) {
 	while (moveToNext()) {
-		unsigned int pos;
-		unsigned int len;
-		
-		pos = cdb_keypos(&d_cdb);
-		len = cdb_keylen(&d_cdb);
-		
-		char *key = (char *)malloc(len);
-		cdb_read(&d_cdb, key, len, pos);
-		
-		if (d_searchType == SearchSuffix) {
-			char *p = strstr(key, d_key);
-        	        if (p == NULL) {
-                        	free(key);
-	                        continue;
-        	        }
-		}
-		string skey(key, len);
-		free(key);
+		const char *key = (const char *)cdb_getkey(&d_cdb);
+		string skey(key, cdb_keylen(&d_cdb));
 
-		pos = cdb_datapos(&d_cdb);
-		len = cdb_datalen(&d_cdb);
-		char *val = (char *)malloc(len);
-		cdb_read(&d_cdb, val, len, pos);
-		string sval(val, len);
-		free(val);
+		if (d_searchType == SearchSuffix && skey.find(d_key) == string::npos) {
+			continue;
+		}
 
-		value = make_pair(skey, sval);
+		const char *val = (const char *)cdb_getdata(&d_cdb);
+		value = make_pair(skey, string(val, cdb_datalen(&d_cdb)));
 		return true;
 	}
-	// We're done searching, so we can clean up d_key
-	if (d_searchType != SearchAll) {
-		free(d_key);
-	}
 	return false;
 }
 
@@ -110,18 +166,11 @@ vector<string> CDB::findall(string &key)
 {
 	vector<string> ret;
 	struct cdb_find cdbf;
-	
+
 	cdb_findinit(&cdbf, &d_cdb, key.c_str(), key.size());
-	int x=0;
 	while(cdb_findnext(&cdbf) > 0) {
-		x++;
-		unsigned int vpos = cdb_datapos(&d_cdb);
-		unsigned int vlen = cdb_datalen(&d_cdb);
-		char *val = (char *)malloc(vlen);
-		cdb_read(&d_cdb, val, vlen, vpos);
-		string sval(val, vlen);
-		ret.push_back(sval);
-		free(val);
+		const char *val = (const char *)cdb_getdata(&d_cdb);
+		ret.push_back(string(val, cdb_datalen(&d_cdb)));
 	}
 	return ret;
 }
@@ -6,14 +6,59 @@
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <fcntl.h>
+#include <pthread.h>
+#include <boost/shared_ptr.hpp>
+#include <boost/utility.hpp>
 
-// This class is responsible for the reading of a CDB file.
-// The constructor opens the CDB file, the destructor closes it, so make sure you call that.
+class CDBMapping;
+typedef boost::shared_ptr<CDBMapping> CDBMappingPtr;
+
+// One read-only mapping of a CDB file, shared by every reader of that file in the process.
+// A thread checks the mapped files every second and swaps in a new mapping when a file is replaced, like tinydns-data
+// does. Readers hold a CDBMappingPtr, so the old mapping stays around until the last of them is done with it.
+class CDBMapping : public boost::noncopyable
+{
+public:
+	~CDBMapping();
+
+	// Returns the current mapping of cdbfile, mapping it the first time. Throws a PDNSException if that fails.
+	static CDBMappingPtr get(const string &cdbfile);
+	// Changes every time a mapping is replaced, so readers can see if they need to get() again without taking a lock.
+	static unsigned int getGeneration()
+	{
+		return s_generation;
+	}
+
+	const struct cdb &getCDB() const
+	{
+		return d_cdb;
+	}
+
+private:
+	CDBMapping(const string &cdbfile);
+	bool isCurrent(); // false if the file on disk is not the one we mapped
+	static void *watchThread(void *);
+
+	int d_fd;
+	struct cdb d_cdb;
+	string d_cdbfile;
+	struct stat d_stat;
+
+	static pthread_mutex_t s_lock; // protects s_mappings
+	static map<string, CDBMappingPtr> s_mappings;
+	static volatile unsigned int s_generation;
+	static bool s_watching;
+};
+
+// This class is responsible for the reading of a CDB file. Searches run on a private copy of the cdb structure,
+// straight from the shared mapping, so a reader can be kept around and reused for many searches.
 class CDB
 {
 public:
 	CDB(const string &cdbfile);
-	~CDB();
+
+	// Moves to the current mapping if the file was replaced since. Call this between searches, never during one.
+	void refresh();
 
 	int searchKey(const string &key);
 	bool searchSuffix(const string &key);
@@ -22,13 +67,15 @@ public:
 	vector<string> findall(string &key);
 
 private:
-	int d_fd;
 	bool moveToNext();
+	string d_cdbfile;
+	CDBMappingPtr d_mapping;
+	unsigned int d_generation;
 	struct cdb d_cdb;
 	struct cdb_find d_cdbf;
-	char *d_key;
+	string d_key; // cdb_find keeps a pointer to the key, so it has to outlive the search
 	unsigned d_seqPtr;
 	enum SearchType { SearchSuffix, SearchKey, SearchAll } d_searchType;
 };
 
-#endif // CDB_HH 
+#endif // CDB_HH
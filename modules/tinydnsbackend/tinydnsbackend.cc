@@ -39,11 +39,10 @@ vector<string> TinyDNSBackend::getLocations()
 	key[4] = (addr >> 16)&0xff;
 	key[5] = (addr >> 24)&0xff;
 
+	CDB *reader = getReader(d_locationReader);
 	for (int i=4;i>=0;i--) {
 		string searchkey(key, i+2);
-		CDB *reader = new CDB(getArg("dbfile"));
 		ret = reader->findall(searchkey);
-		delete reader;
 
 		//Biggest item wins, so when we find something, we can jump out.
 		if (ret.size() > 0) {
@@ -63,10 +62,27 @@ TinyDNSBackend::TinyDNSBackend(const string &suffix)
 	d_taiepoch = 4611686018427387904ULL + getArgAsNum("tai-adjust");
 	d_dnspacket = NULL;
 	d_cdbReader = NULL;
+	d_locationReader = NULL;
 	d_isAxfr = false;
 	d_isWildcardQuery = false;
 }
 
+TinyDNSBackend::~TinyDNSBackend()
+{
+	delete d_cdbReader;
+	delete d_locationReader;
+}
+
+CDB *TinyDNSBackend::getReader(CDB *&reader)
+{
+	if (!reader) {
+		reader = new CDB(getArg("dbfile"));
+	} else {
+		reader->refresh();
+	}
+	return reader;
+}
+
 void TinyDNSBackend::getUpdatedMasters(vector<DomainInfo>* retDomains) {
 	Lock l(&s_domainInfoLock); //TODO: We could actually lock less if we do it per suffix.
 	
@@ -130,7 +146,7 @@ void TinyDNSBackend::getAllDomains(vector<DomainInfo> *domains) {
 	d_isAxfr=true;
 	d_dnspacket = NULL;
 
-	d_cdbReader=new CDB(getArg("dbfile"));
+	getReader(d_cdbReader);
 	d_cdbReader->searchAll();
 	DNSResourceRecord rr;
 
@@ -155,7 +171,7 @@ void TinyDNSBackend::getAllDomains(vector<DomainInfo> *domains) {
 bool TinyDNSBackend::list(const string &target, int domain_id) {
 	d_isAxfr=true;
 	string key = simpleCompress(target);
-	d_cdbReader=new CDB(getArg("dbfile"));
+	getReader(d_cdbReader);
 	return d_cdbReader->searchSuffix(key);
 }
 
@@ -176,7 +192,7 @@ void TinyDNSBackend::lookup(const QType &qtype, const string &qdomain, DNSPacket
 
 	d_qtype=qtype;
 
-	d_cdbReader=new CDB(getArg("dbfile"));
+	getReader(d_cdbReader);
 	d_cdbReader->searchKey(key);
 	d_dnspacket = pkt_p;
 }
@@ -304,7 +320,6 @@ bool TinyDNSBackend::get(DNSResourceRecord &rr)
 	} // end of while
 	DLOG(L<<Logger::Debug<<backendname<<"No more records to return."<<endl);
 	
-	delete d_cdbReader;
 	return false;
 }
 
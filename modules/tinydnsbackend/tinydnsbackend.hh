@@ -47,16 +47,19 @@ class TinyDNSBackend : public DNSBackend
 public:
 	// Methods for simple operation
 	TinyDNSBackend(const string &suffix);
+	~TinyDNSBackend();
 	void lookup(const QType &qtype, const string &qdomain, DNSPacket *pkt_p=0, int zoneId=-1);
 	bool list(const string &target, int domain_id);
 	bool get(DNSResourceRecord &rr);
 	void getAllDomains(vector<DomainInfo> *domains);
+	bool listsAllDomains() { return true; }
 
 	//Master mode operation
 	void getUpdatedMasters(vector<DomainInfo>* domains);
 	void setNotified(uint32_t id, uint32_t serial);
 private:
 	vector<string> getLocations();
+	CDB *getReader(CDB *&reader); // creates reader the first time, refreshes it after that
 
 	//TypeDefs
 	struct tag_zone{};
@@ -76,6 +79,7 @@ private:
 	uint64_t d_taiepoch;
 	QType d_qtype;
 	CDB *d_cdbReader;
+	CDB *d_locationReader; // getLocations() searches while d_cdbReader is busy with the records
 	DNSPacket *d_dnspacket; // used for location and edns-client support.
 	bool d_isWildcardQuery; // Indicate if the query received was a wildcard query.
 	bool d_isAxfr; // Indicate if we received a list() and not a lookup().
@@ -39,11 +39,110 @@
 #include <sstream>
 #include <boost/foreach.hpp>
 #include <boost/format.hpp>
+#include "pdns/lock.hh"
 
+pthread_mutex_t SSqlPool::s_lock=PTHREAD_MUTEX_INITIALIZER;
+map<string, SSqlPool*> SSqlPool::s_pools;
+
+SSqlPool::SSqlPool(unsigned int size, const connector_t& connector) : d_connector(connector), d_size(size), d_open(0)
+{
+  pthread_mutex_init(&d_lock, 0);
+  pthread_cond_init(&d_cond, 0);
+}
+
+SSqlPool* SSqlPool::get(const string& name, unsigned int size, const connector_t& connector)
+{
+  Lock l(&s_lock);
+  map<string, SSqlPool*>::const_iterator iter=s_pools.find(name);
+  if(iter!=s_pools.end())
+    return iter->second;
+
+  SSql* db=connector(); // so a broken configuration shows at launch, like it does without a pool
+  SSqlPool* pool=new SSqlPool(size, connector);
+  pool->d_idle.push_back(db);
+  pool->d_open=1;
+  s_pools[name]=pool;
+  return pool;
+}
+
+/* Pooled connections this thread holds, of any pool. A thread that holds one never waits for another: it may be
+   waiting for itself, through a second backend instance like the one behind DNSSECKeeper during an update, or for
+   another thread that waits for what this one holds. It gets a connection beyond the size instead. Threads that do
+   wait hold nothing, so whoever they wait for can always finish. */
+static __thread unsigned int t_held;
+
+SSql* SSqlPool::acquire()
+{
+  {
+    Lock l(&d_lock);
+    while(d_idle.empty() && d_open >= d_size && !t_held)
+      pthread_cond_wait(&d_cond, &d_lock);
+    if(!d_idle.empty()) {
+      SSql* db=d_idle.back();
+      d_idle.pop_back();
+      t_held++;
+      return db;
+    }
+    d_open++; // ours, we connect outside of the lock
+  }
+
+  try {
+    SSql* db=d_connector();
+    t_held++;
+    return db;
+  }
+  catch(SSqlException &e) {
+    Lock l(&d_lock);
+    d_open--;
+    pthread_cond_signal(&d_cond);
+    throw PDNSException("Unable to make a new database connection: "+e.txtReason());
+  }
+}
+
+void SSqlPool::release(SSql* db, bool broken)
+{
+  if(t_held)
+    t_held--;
+
+  {
+    Lock l(&d_lock);
+    if(!broken && d_open <= d_size) {
+      d_idle.push_back(db);
+      pthread_cond_signal(&d_cond);
+      return;
+    }
+    d_open--; // broken, or one more than the size
+    pthread_cond_signal(&d_cond);
+  }
+  delete db;
+}
+
+/* Every method that uses d_db starts with one of these. The connection goes back to the pool when the outermost one
+   ends, unless a transaction is open or a lookup still has rows for get(). */
+class GSQLBackend::Hold
+{
+public:
+  Hold(GSQLBackend* backend) : d_backend(backend)
+  {
+    if(d_backend->d_pool && !d_backend->d_db)
+      d_backend->d_db=d_backend->d_pool->acquire();
+    d_backend->d_holds++;
+  }
+  ~Hold()
+  {
+    if(--d_backend->d_holds == 0 && d_backend->d_pool && d_backend->d_db && !d_backend->d_inTransaction && !d_backend->d_reading) {
+      d_backend->d_pool->release(d_backend->d_db);
+      d_backend->d_db=0;
+    }
+  }
+private:
+  GSQLBackend* d_backend;
+};
 
 
 void GSQLBackend::setNotified(uint32_t domain_id, uint32_t serial)
 {
+  Hold h(this);
   char output[1024];
   snprintf(output,sizeof(output)-1,
 	   d_UpdateSerialOfZoneQuery.c_str(),
@@ -59,6 +158,7 @@ void GSQLBackend::setNotified(uint32_t domain_id, uint32_t serial)
 
 void GSQLBackend::setFresh(uint32_t domain_id)
 {
+  Hold h(this);
   char output[1024];
   snprintf(output,sizeof(output)-1,d_UpdateLastCheckofZoneQuery.c_str(),
 	   time(0),
@@ -74,6 +174,7 @@ void GSQLBackend::setFresh(uint32_t domain_id)
 
 bool GSQLBackend::isMaster(const string &domain, const string &ip)
 {
+  Hold h(this);
   char output[1024];
   snprintf(output,sizeof(output)-1,
 	   d_MasterOfDomainsZoneQuery.c_str(),
@@ -106,6 +207,7 @@ bool GSQLBackend::isMaster(const string &domain, const string &ip)
 
 bool GSQLBackend::setMaster(const string &domain, const string &ip)
 {
+  Hold h(this);
   string query = (boost::format(d_UpdateMasterOfZoneQuery) % sqlEscape(ip) % sqlEscape(toLower(domain))).str();
 
   try {
@@ -119,6 +221,7 @@ bool GSQLBackend::setMaster(const string &domain, const string &ip)
 
 bool GSQLBackend::setKind(const string &domain, const DomainInfo::DomainKind kind)
 {
+  Hold h(this);
   string kind_str = toUpper(DomainInfo::getKindString(kind));
   string query = (boost::format(d_UpdateKindOfZoneQuery) % sqlEscape(kind_str) % sqlEscape(toLower(domain))).str();
 
@@ -133,6 +236,7 @@ bool GSQLBackend::setKind(const string &domain, const DomainInfo::DomainKind kin
 
 bool GSQLBackend::getDomainInfo(const string &domain, DomainInfo &di)
 {
+  Hold h(this);
   /* fill DomainInfo from database info:
      id,name,master IP(s),last_check,notified_serial,type */
   char output[1024];
@@ -176,6 +280,7 @@ bool GSQLBackend::getDomainInfo(const string &domain, DomainInfo &di)
 
 void GSQLBackend::getUnfreshSlaveInfos(vector<DomainInfo> *unfreshDomains)
 {
+  Hold h(this);
   /* list all domains that need refreshing for which we are slave, and insert into SlaveDomain:
      id,name,master IP,serial */
   try {
@@ -212,6 +317,7 @@ void GSQLBackend::getUnfreshSlaveInfos(vector<DomainInfo> *unfreshDomains)
 
 void GSQLBackend::getUpdatedMasters(vector<DomainInfo> *updatedDomains)
 {
+  Hold h(this);
   /* list all domains that need notifications for which we are master, and insert into updatedDomains
      id,name,master IP,serial */
   try {
@@ -266,6 +372,11 @@ GSQLBackend::GSQLBackend(const string &mode, const string &suffix)
 {
   setArgPrefix(mode+suffix);
   d_db=0;
+  d_pool=0;
+  d_holds=0;
+  d_reading=false;
+  d_indexname=mode+suffix;
+  d_inTransaction=false;
   d_logprefix="["+mode+"Backend"+suffix+"] ";
 	
   try
@@ -300,6 +411,7 @@ GSQLBackend::GSQLBackend(const string &mode, const string &suffix)
   d_InsertSlaveZoneQuery=getArg("insert-slave-query");
   d_InsertRecordQuery=getArg("insert-record-query"+authswitch);
   d_InsertEntQuery=getArg("insert-ent-query"+authswitch);
+  d_BulkInsertRecordQuery=getArg("bulk-insert-record-query"+authswitch);
   d_UpdateMasterOfZoneQuery=getArg("update-master-query");
   d_UpdateKindOfZoneQuery=getArg("update-kind-query");
   d_UpdateSerialOfZoneQuery=getArg("update-serial-query");
@@ -319,11 +431,14 @@ GSQLBackend::GSQLBackend(const string &mode, const string &suffix)
   {
     d_InsertRecordOrderQuery=getArg("insert-record-order-query-auth");
     d_InsertEntOrderQuery=getArg("insert-ent-order-query-auth");
+    d_BulkInsertRecordOrderQuery=getArg("bulk-insert-record-order-query-auth");
 
     d_firstOrderQuery = getArg("get-order-first-query");
     d_beforeOrderQuery = getArg("get-order-before-query");
     d_afterOrderQuery = getArg("get-order-after-query");
     d_lastOrderQuery = getArg("get-order-last-query");
+    d_listOrderQuery = getArg("get-order-list-query");
+    d_nameOrderQuery = getArg("get-order-name-query");
     d_setOrderAuthQuery = getArg("set-order-and-auth-query");
     d_nullifyOrderNameAndUpdateAuthQuery = getArg("nullify-ordername-and-update-auth-query");
     d_nullifyOrderNameAndAuthQuery = getArg("nullify-ordername-and-auth-query");
@@ -350,6 +465,46 @@ GSQLBackend::GSQLBackend(const string &mode, const string &suffix)
   }
 }
 
+GSQLBackend::~GSQLBackend()
+{
+  if(!d_pool) {
+    delete d_db;
+    return;
+  }
+  if(!d_db)
+    return;
+
+  // we may be going away in the middle of something, the next user of this connection should not notice
+  bool broken=false;
+  try {
+    SSql::row_t row;
+    if(d_reading)
+      while(d_db->getRow(row))
+        ;
+    if(d_inTransaction)
+      d_db->doCommand("rollback");
+  }
+  catch(SSqlException &e) {
+    broken=true;
+  }
+  d_pool->release(d_db, broken);
+}
+
+void GSQLBackend::setConnector(const SSqlPool::connector_t& connector)
+{
+  unsigned int connections=0;
+  try {
+    connections=getArgAsNum("connections");
+  }
+  catch (ArgException e) {
+  }
+
+  if(connections)
+    d_pool=SSqlPool::get(d_indexname, connections, connector);
+  else
+    setDB(connector());
+}
+
 bool GSQLBackend::updateDNSSECOrderAndAuth(uint32_t domain_id, const std::string& zonename, const std::string& qname, bool auth)
 {
   if(!d_dnssecQueries)
@@ -360,6 +515,7 @@ bool GSQLBackend::updateDNSSECOrderAndAuth(uint32_t domain_id, const std::string
 
 bool GSQLBackend::updateDNSSECOrderAndAuthAbsolute(uint32_t domain_id, const std::string& qname, const std::string& ordername, bool auth)
 {
+  Hold h(this);
   if(!d_dnssecQueries)
     return false;
   char output[1024];
@@ -371,11 +527,13 @@ bool GSQLBackend::updateDNSSECOrderAndAuthAbsolute(uint32_t domain_id, const std
   catch(SSqlException &e) {
     throw PDNSException("GSQLBackend unable to update ordername/auth for domain_id "+itoa(domain_id)+": "+e.txtReason());
   }
+  indexChange(OrderNameIndex::Change(OrderNameIndex::Change::Set, domain_id, qname, ordername));
   return true;
 }
 
 bool GSQLBackend::nullifyDNSSECOrderNameAndUpdateAuth(uint32_t domain_id, const std::string& qname, bool auth)
 {
+  Hold h(this);
   if(!d_dnssecQueries)
     return false;
   char output[1024];
@@ -387,11 +545,13 @@ bool GSQLBackend::nullifyDNSSECOrderNameAndUpdateAuth(uint32_t domain_id, const
   catch(SSqlException &e) {
     throw PDNSException("GSQLBackend unable to nullify ordername and update auth for domain_id "+itoa(domain_id)+": "+e.txtReason());
   }
+  indexChange(OrderNameIndex::Change(OrderNameIndex::Change::Remove, domain_id, qname));
   return true;
 }
 
 bool GSQLBackend::nullifyDNSSECOrderNameAndAuth(uint32_t domain_id, const std::string& qname, const std::string& type)
 {
+  Hold h(this);
   if(!d_dnssecQueries)
     return false;
   char output[1024];
@@ -403,11 +563,13 @@ bool GSQLBackend::nullifyDNSSECOrderNameAndAuth(uint32_t domain_id, const std::s
   catch(SSqlException &e) {
     throw PDNSException("GSQLBackend unable to nullify ordername/auth for domain_id "+itoa(domain_id)+": "+e.txtReason());
   }
+  recheckOrderName(domain_id, qname); // records of other types may still carry the ordername
   return true;
 }
 
 bool GSQLBackend::setDNSSECAuthOnDsRecord(uint32_t domain_id, const std::string& qname)
 {
+  Hold h(this);
   if(!d_dnssecQueries)
     return false;
   char output[1024];
@@ -424,6 +586,7 @@ bool GSQLBackend::setDNSSECAuthOnDsRecord(uint32_t domain_id, const std::string&
 
 bool GSQLBackend::updateEmptyNonTerminals(uint32_t domain_id, const std::string& zonename, set<string>& insert, set<string>& erase, bool remove)
 {
+  Hold h(this);
   char output[1024];
 
   if(remove) {
@@ -435,6 +598,8 @@ bool GSQLBackend::updateEmptyNonTerminals(uint32_t domain_id, const std::string&
       throw PDNSException("GSQLBackend unable to delete empty non-terminal records from domain_id "+itoa(domain_id)+": "+e.txtReason());
       return false;
     }
+    // we don't know which names were ENTs, but only pdnssec rectify-zone gets here and it doesn't use the index
+    indexChange(OrderNameIndex::Change(OrderNameIndex::Change::Invalidate, domain_id));
   }
   else
   {
@@ -447,6 +612,7 @@ bool GSQLBackend::updateEmptyNonTerminals(uint32_t domain_id, const std::string&
         throw PDNSException("GSQLBackend unable to delete empty non-terminal rr "+qname+" from domain_id "+itoa(domain_id)+": "+e.txtReason());
         return false;
       }
+      indexChange(OrderNameIndex::Change(OrderNameIndex::Change::Remove, domain_id, qname));
     }
   }
 
@@ -469,10 +635,80 @@ bool GSQLBackend::doesDNSSEC()
     return d_dnssecQueries;
 }
 
+void GSQLBackend::indexChange(const OrderNameIndex::Change& change)
+{
+  if(!g_ordernameindex.enabled())
+    return;
+  if(d_inTransaction)
+    d_indexChanges.push_back(change);
+  else
+    g_ordernameindex.apply(d_indexname, change);
+}
+
+void GSQLBackend::loadOrderNameIndex(uint32_t domain_id)
+{
+  uint64_t generation;
+  if(!g_ordernameindex.needsLoad(d_indexname, domain_id, generation))
+    return;
+
+  vector<pair<string, string> > ordernames;
+  SSql::row_t row;
+  char output[1024];
+
+  snprintf(output, sizeof(output)-1, d_listOrderQuery.c_str(), domain_id);
+  try {
+    d_db->doQuery(output);
+    while(d_db->getRow(row))
+      ordernames.push_back(make_pair(row[0], row[1]));
+  }
+  catch(SSqlException &e) {
+    g_ordernameindex.loadFailed(d_indexname, domain_id);
+    throw PDNSException("GSQLBackend unable to list ordernames for domain_id "+itoa(domain_id)+": "+e.txtReason());
+  }
+  g_ordernameindex.load(d_indexname, domain_id, generation, ordernames);
+}
+
+void GSQLBackend::recheckOrderName(uint32_t domain_id, const string& qname)
+{
+  if(!g_ordernameindex.enabled())
+    return;
+
+  string ordername;
+  bool found=false;
+  SSql::row_t row;
+  char output[1024];
+
+  snprintf(output, sizeof(output)-1, d_nameOrderQuery.c_str(), domain_id, sqlEscape(qname).c_str());
+  try {
+    d_db->doQuery(output);
+    while(d_db->getRow(row)) {
+      if(!found)
+        ordername=row[0];
+      found=true;
+    }
+  }
+  catch(SSqlException &e) {
+    throw PDNSException("GSQLBackend unable to get ordername of "+qname+" in domain_id "+itoa(domain_id)+": "+e.txtReason());
+  }
+
+  if(found)
+    indexChange(OrderNameIndex::Change(OrderNameIndex::Change::Set, domain_id, qname, ordername));
+  else
+    indexChange(OrderNameIndex::Change(OrderNameIndex::Change::Remove, domain_id, qname));
+}
+
 bool GSQLBackend::getBeforeAndAfterNamesAbsolute(uint32_t id, const std::string& qname, std::string& unhashed, std::string& before, std::string& after)
 {
+  Hold h(this);
   if(!d_dnssecQueries)
     return false;
+
+  if(g_ordernameindex.enabled() && !d_inTransaction) { // in a transaction we'd miss our own uncommitted changes
+    loadOrderNameIndex(id);
+    if(g_ordernameindex.getBeforeAndAfterNamesAbsolute(d_indexname, id, qname, unhashed, before, after))
+      return true;
+  }
+
   // cerr<<"gsql before/after called for id="<<id<<", qname='"<<qname<<"'"<<endl;
   after.clear();
   string lcqname=toLower(qname);
@@ -546,6 +782,7 @@ bool GSQLBackend::getBeforeAndAfterNamesAbsolute(uint32_t id, const std::string&
 
 int GSQLBackend::addDomainKey(const string& name, const KeyData& key)
 {
+  Hold h(this);
   if(!d_dnssecQueries)
     return -1;
   char output[16384];  
@@ -563,6 +800,7 @@ int GSQLBackend::addDomainKey(const string& name, const KeyData& key)
 
 bool GSQLBackend::activateDomainKey(const string& name, unsigned int id)
 {
+  Hold h(this);
   if(!d_dnssecQueries)
     return false;
   char output[1024];
@@ -579,6 +817,7 @@ bool GSQLBackend::activateDomainKey(const string& name, unsigned int id)
 
 bool GSQLBackend::deactivateDomainKey(const string& name, unsigned int id)
 {
+  Hold h(this);
   if(!d_dnssecQueries)
     return false;
   char output[1024];
@@ -595,6 +834,7 @@ bool GSQLBackend::deactivateDomainKey(const string& name, unsigned int id)
 
 bool GSQLBackend::removeDomainKey(const string& name, unsigned int id)
 {
+  Hold h(this);
   if(!d_dnssecQueries)
     return false;
   char output[1024];
@@ -611,6 +851,7 @@ bool GSQLBackend::removeDomainKey(const string& name, unsigned int id)
 
 bool GSQLBackend::getTSIGKey(const string& name, string* algorithm, string* content)
 {
+  Hold h(this);
   if(!d_dnssecQueries)
     return false;
     
@@ -637,6 +878,7 @@ bool GSQLBackend::getTSIGKey(const string& name, string* algorithm, string* cont
 
 bool GSQLBackend::setTSIGKey(const string& name, const string& algorithm, const string& content)
 {
+  Hold h(this);
   if(!d_dnssecQueries)
     return false;
 
@@ -653,6 +895,7 @@ bool GSQLBackend::setTSIGKey(const string& name, const string& algorithm, const
 
 bool GSQLBackend::deleteTSIGKey(const string& name)
 {
+  Hold h(this);
   if(!d_dnssecQueries)
     return false;
 
@@ -669,6 +912,7 @@ bool GSQLBackend::deleteTSIGKey(const string& name)
 
 bool GSQLBackend::getTSIGKeys(std::vector< struct TSIGKey > &keys)
 {
+  Hold h(this);
   if(!d_dnssecQueries)
     return false;
 
@@ -697,6 +941,7 @@ bool GSQLBackend::getTSIGKeys(std::vector< struct TSIGKey > &keys)
 
 bool GSQLBackend::getDomainKeys(const string& name, unsigned int kind, std::vector<KeyData>& keys)
 {
+  Hold h(this);
   if(!d_dnssecQueries)
     return false;
   char output[1024];  
@@ -739,6 +984,7 @@ void GSQLBackend::alsoNotifies(const string &domain, set<string> *ips)
 
 bool GSQLBackend::getDomainMetadata(const string& name, const std::string& kind, std::vector<std::string>& meta)
 {
+  Hold h(this);
   if(!d_dnssecQueries)
     return false;
   char output[1024];  
@@ -761,6 +1007,7 @@ bool GSQLBackend::getDomainMetadata(const string& name, const std::string& kind,
 
 bool GSQLBackend::setDomainMetadata(const string& name, const std::string& kind, const std::vector<std::string>& meta)
 {
+  Hold h(this);
   char output[16384];  
   if(!d_dnssecQueries)
     return false;
@@ -786,6 +1033,7 @@ bool GSQLBackend::setDomainMetadata(const string& name, const std::string& kind,
 
 void GSQLBackend::lookup(const QType &qtype,const string &qname, DNSPacket *pkt_p, int domain_id)
 {
+  Hold h(this);
   string format;
   char output[1024];
 
@@ -840,11 +1088,13 @@ void GSQLBackend::lookup(const QType &qtype,const string &qname, DNSPacket *pkt_
     throw PDNSException(e.txtReason());
   }
 
+  d_reading=true;
   d_qname=qname;
 }
 
 bool GSQLBackend::list(const string &target, int domain_id )
 {
+  Hold h(this);
   DLOG(L<<"GSQLBackend constructing handle for list of domain id '"<<domain_id<<"'"<<endl);
 
   char output[1024];
@@ -856,11 +1106,13 @@ bool GSQLBackend::list(const string &target, int domain_id )
     throw PDNSException("GSQLBackend list query: "+e.txtReason());
   }
 
+  d_reading=true;
   d_qname="";
   return true;
 }
 
 bool GSQLBackend::listSubZone(const string &zone, int domain_id) {
+  Hold h(this);
   string wildzone = "%." + zone;
   string listSubZone = "select content,ttl,prio,type,domain_id,name from records where (name='%s' OR name like '%s') and domain_id=%d";
   if (d_dnssecQueries)
@@ -872,6 +1124,7 @@ bool GSQLBackend::listSubZone(const string &zone, int domain_id) {
   catch(SSqlException &e) {
     throw PDNSException("GSQLBackend listSubZone query: "+e.txtReason());
   }
+  d_reading=true;
   d_qname="";
   return true;
 }
@@ -880,6 +1133,7 @@ bool GSQLBackend::listSubZone(const string &zone, int domain_id) {
 
 bool GSQLBackend::superMasterBackend(const string &ip, const string &domain, const vector<DNSResourceRecord>&nsset, string *account, DNSBackend **ddb)
 {
+  Hold h(this);
   string format;
   char output[1024];
   format = d_SuperMasterInfoQuery;
@@ -904,6 +1158,7 @@ bool GSQLBackend::superMasterBackend(const string &ip, const string &domain, con
 
 bool GSQLBackend::createDomain(const string &domain)
 {
+  Hold h(this);
   string query = (boost::format(d_InsertZoneQuery) % toLower(sqlEscape(domain))).str();
   try {
     d_db->doCommand(query);
@@ -916,6 +1171,7 @@ bool GSQLBackend::createDomain(const string &domain)
 
 bool GSQLBackend::createSlaveDomain(const string &ip, const string &domain, const string &account)
 {
+  Hold h(this);
   string format;
   string name;
   string masters=ip;
@@ -954,6 +1210,7 @@ bool GSQLBackend::createSlaveDomain(const string &ip, const string &domain, cons
 
 bool GSQLBackend::deleteDomain(const string &domain)
 {
+  Hold h(this);
   string sqlDomain = sqlEscape(toLower(domain));
 
   DomainInfo di;
@@ -982,11 +1239,13 @@ bool GSQLBackend::deleteDomain(const string &domain)
   catch(SSqlException &e) {
     throw PDNSException("Database error trying to delete domain '"+domain+"': "+ e.txtReason());
   }
+  indexChange(OrderNameIndex::Change(OrderNameIndex::Change::Invalidate, di.id));
   return true;
 }
 
 void GSQLBackend::getAllDomains(vector<DomainInfo> *domains) 
 {
+  Hold h(this);
   DLOG(L<<"GSQLBackend retrieving all domains."<<endl);
 
   try {
@@ -1030,9 +1289,20 @@ void GSQLBackend::getAllDomains(vector<DomainInfo> *domains)
 
 bool GSQLBackend::get(DNSResourceRecord &r)
 {
+  if(!d_reading)
+    return false;
+
+  Hold h(this);
   // L << "GSQLBackend get() was called for "<<qtype.getName() << " record: ";
   SSql::row_t row;
-  if(d_db->getRow(row)) {
+  try {
+    d_reading=d_db->getRow(row);
+  }
+  catch(...) {
+    d_reading=false;
+    throw;
+  }
+  if(d_reading) {
     r.content=row[0];
     if (row[1].empty())
         r.ttl = ::arg().asNum( "default-ttl" );
@@ -1060,6 +1330,7 @@ bool GSQLBackend::get(DNSResourceRecord &r)
 
 bool GSQLBackend::replaceRRSet(uint32_t domain_id, const string& qname, const QType& qt, const vector<DNSResourceRecord>& rrset)
 {
+  Hold h(this);
   string deleteQuery;
   string deleteRRSet;
   if (qt != QType::ANY) {
@@ -1073,12 +1344,18 @@ bool GSQLBackend::replaceRRSet(uint32_t domain_id, const string& qname, const QT
   BOOST_FOREACH(const DNSResourceRecord& rr, rrset) {
     feedRecord(rr);
   }
+  // the new records come without ordername, callers usually set it again afterwards
+  if (qt != QType::ANY)
+    recheckOrderName(domain_id, qname);
+  else
+    indexChange(OrderNameIndex::Change(OrderNameIndex::Change::Remove, domain_id, qname));
   
   return true;
 }
 
 bool GSQLBackend::feedRecord(const DNSResourceRecord &r, string *ordername)
 {
+  Hold h(this);
   string output;
   if(d_dnssecQueries) {
     if(ordername)
@@ -1095,11 +1372,62 @@ bool GSQLBackend::feedRecord(const DNSResourceRecord &r, string *ordername)
   catch (SSqlException &e) {
     throw PDNSException("GSQLBackend unable to feed record: "+e.txtReason());
   }
+  if(d_dnssecQueries && ordername)
+    indexChange(OrderNameIndex::Change(OrderNameIndex::Change::Set, r.domain_id, r.qname, *ordername));
   return true; // XXX FIXME this API should not return 'true' I think -ahu 
 }
 
+/* The rows go out through SSql::insertRows, as one COPY or a few multi-row inserts instead of a statement per record.
+   Their fields are in the order of insert-record-query. Without bulk queries we feed the records one by one. */
+bool GSQLBackend::feedRecords(const vector<FeedRecord>& records)
+{
+  Hold h(this);
+  if(d_BulkInsertRecordQuery.empty() || (d_dnssecQueries && d_BulkInsertRecordOrderQuery.empty()))
+    return DNSBackend::feedRecords(records);
+
+  SSql::result_t plain, ordered;
+  BOOST_FOREACH(const FeedRecord& fr, records) {
+    const DNSResourceRecord& r=fr.rr;
+    bool hasOrdername = d_dnssecQueries && fr.hasOrdername;
+    SSql::result_t& rows = hasOrdername ? ordered : plain;
+
+    rows.push_back(SSql::row_t());
+    SSql::row_t& row=rows.back();
+    row.reserve(8);
+    row.push_back(r.content);
+    row.push_back(uitoa(r.ttl));
+    row.push_back(itoa(r.priority));
+    row.push_back(r.qtype.getName());
+    row.push_back(itoa(r.domain_id));
+    row.push_back(toLower(r.qname));
+    if(hasOrdername)
+      row.push_back(fr.ordername);
+    if(d_dnssecQueries)
+      row.push_back(itoa((int)r.auth));
+  }
+
+  try {
+    if(!plain.empty())
+      d_db->insertRows(d_BulkInsertRecordQuery, plain);
+    if(!ordered.empty())
+      d_db->insertRows(d_BulkInsertRecordOrderQuery, ordered);
+  }
+  catch (SSqlException &e) {
+    throw PDNSException("GSQLBackend unable to feed records: "+e.txtReason());
+  }
+
+  if(d_dnssecQueries) {
+    BOOST_FOREACH(const FeedRecord& fr, records) {
+      if(fr.hasOrdername)
+        indexChange(OrderNameIndex::Change(OrderNameIndex::Change::Set, fr.rr.domain_id, fr.rr.qname, fr.ordername));
+    }
+  }
+  return true;
+}
+
 bool GSQLBackend::feedEnts(int domain_id, set<string>& nonterm)
 {
+  Hold h(this);
   string output;
   BOOST_FOREACH(const string qname, nonterm) {
     output = (boost::format(d_InsertEntQuery) % domain_id % toLower(sqlEscape(qname))).str();
@@ -1116,6 +1444,7 @@ bool GSQLBackend::feedEnts(int domain_id, set<string>& nonterm)
 
 bool GSQLBackend::feedEnts3(int domain_id, const string &domain, set<string> &nonterm, unsigned int times, const string &salt, bool narrow)
 {
+  Hold h(this);
   if(!d_dnssecQueries)
       return false;
 
@@ -1134,12 +1463,15 @@ bool GSQLBackend::feedEnts3(int domain_id, const string &domain, set<string> &no
     catch (SSqlException &e) {
       throw PDNSException("GSQLBackend unable to feed empty non-terminal: "+e.txtReason());
     }
+    if(!narrow)
+      indexChange(OrderNameIndex::Change(OrderNameIndex::Change::Set, domain_id, qname, toLower(ordername)));
   }
   return true;
 }
 
 bool GSQLBackend::startTransaction(const string &domain, int domain_id)
 {
+  Hold h(this);
   char output[1024];
   if(domain_id >= 0) 
    snprintf(output,sizeof(output)-1,d_DeleteZoneQuery.c_str(),domain_id);
@@ -1151,23 +1483,36 @@ bool GSQLBackend::startTransaction(const string &domain, int domain_id)
   catch (SSqlException &e) {
     throw PDNSException("Database failed to start transaction: "+e.txtReason());
   }
+  d_inTransaction=true;
+  d_indexChanges.clear();
+  if(domain_id >= 0)
+    indexChange(OrderNameIndex::Change(OrderNameIndex::Change::Clear, domain_id)); // the records fed next bring their ordernames back
 
   return true;
 }
 
 bool GSQLBackend::commitTransaction()
 {
+  Hold h(this);
   try {
     d_db->doCommand("commit");
   }
   catch (SSqlException &e) {
     throw PDNSException("Database failed to commit transaction: "+e.txtReason());
   }
+  d_inTransaction=false;
+  BOOST_FOREACH(const OrderNameIndex::Change& change, d_indexChanges) {
+    g_ordernameindex.apply(d_indexname, change);
+  }
+  d_indexChanges.clear();
   return true;
 }
 
 bool GSQLBackend::abortTransaction()
 {
+  Hold h(this);
+  d_inTransaction=false;
+  d_indexChanges.clear();
   try {
     d_db->doCommand("rollback");
   }
@@ -1179,6 +1524,7 @@ bool GSQLBackend::abortTransaction()
 
 bool GSQLBackend::calculateSOASerial(const string& domain, const SOAData& sd, time_t& serial)
 {
+  Hold h(this);
   if (d_ZoneLastChangeQuery.empty()) {
     // query not set => fall back to default impl
     return DNSBackend::calculateSOASerial(domain, sd, serial);
@@ -1,9 +1,42 @@
 #include <string>
 #include <map>
+#include <pthread.h>
+#include <boost/utility.hpp>
 #include "ssql.hh"
+#include "pdns/ordernameindex.hh"
 
 #include "../../namespaces.hh"
 
+/* The connections of all GSQLBackends of one launch, when its 'connections' setting is not 0. A backend takes one for
+   a call, or from a lookup until its last row, or from the start to the end of a transaction, and then gives it back.
+   So the number of distributor threads no longer decides the number of database connections. A thread that already
+   holds a pooled connection is never made to wait for another one, it gets an extra connection for as long as it
+   needs it, so the size is a limit on the steady state and not a hard one. */
+class SSqlPool : public boost::noncopyable
+{
+public:
+  typedef function<SSql*()> connector_t;
+
+  //! Returns the pool of launch 'name', creating it with one connection if it does not exist yet
+  static SSqlPool* get(const string& name, unsigned int size, const connector_t& connector);
+
+  SSql* acquire(); //!< waits for an idle connection, makes a new one while there are fewer than 'size', or if we hold one
+  void release(SSql* db, bool broken=false); //!< broken and extra connections are closed, the next acquire() replaces them
+
+private:
+  SSqlPool(unsigned int size, const connector_t& connector);
+
+  connector_t d_connector;
+  unsigned int d_size;
+  unsigned int d_open; //!< idle and in use
+  vector<SSql*> d_idle;
+  pthread_mutex_t d_lock; //!< protects d_open and d_idle
+  pthread_cond_t d_cond;
+
+  static pthread_mutex_t s_lock;
+  static map<string, SSqlPool*> s_pools;
+};
+
 /* 
 GSQLBackend is a generic backend used by other sql backends
 */
@@ -11,28 +44,27 @@ class GSQLBackend : public DNSBackend
 {
 public:
   GSQLBackend(const string &mode, const string &suffix); //!< Makes our connection to the database. Throws an exception if it fails.
-  virtual ~GSQLBackend()
-  {
-    if(d_db)
-      delete d_db;
-  }
+  virtual ~GSQLBackend();
   
   void setDB(SSql *db)
   {
     d_db=db;
   }
+  void setConnector(const SSqlPool::connector_t& connector); //!< pooled connections if 'connections' is set, else setDB(connector())
   
   virtual string sqlEscape(const string &name);
   void lookup(const QType &, const string &qdomain, DNSPacket *p=0, int zoneId=-1);
   bool list(const string &target, int domain_id);
   bool get(DNSResourceRecord &r);
   void getAllDomains(vector<DomainInfo> *domains);
+  bool listsAllDomains() { return true; }
   bool isMaster(const string &domain, const string &ip);
   void alsoNotifies(const string &domain, set<string> *ips);
   bool startTransaction(const string &domain, int domain_id=-1);
   bool commitTransaction();
   bool abortTransaction();
   bool feedRecord(const DNSResourceRecord &r, string *ordername=0);
+  bool feedRecords(const vector<FeedRecord>& records);
   bool feedEnts(int domain_id, set<string>& nonterm);
   bool feedEnts3(int domain_id, const string &domain, set<string> &nonterm, unsigned int times, const string &salt, bool narrow);
   bool createDomain(const string &domain);
@@ -76,8 +108,18 @@ public:
   bool getTSIGKeys(std::vector< struct TSIGKey > &keys);
 
 private:
+  class Hold; //!< makes sure d_db is there for the length of a call
+  friend class Hold;
+
+  void indexChange(const OrderNameIndex::Change& change); //!< applied right away, or on commit if we are in a transaction
+  void loadOrderNameIndex(uint32_t domain_id);
+  void recheckOrderName(uint32_t domain_id, const string& qname);
+
   string d_qname;
-  SSql *d_db;
+  SSql *d_db; //!< with a pool, only set while we hold a connection
+  SSqlPool *d_pool;
+  unsigned int d_holds; //!< nested Holds
+  bool d_reading; //!< rows of a lookup or list are still to be read by get()
   SSql::result_t d_result;
 
   string d_wildCardNoIDQuery;
@@ -104,6 +146,8 @@ private:
   string d_InsertEntQuery;
   string d_InsertRecordOrderQuery;
   string d_InsertEntOrderQuery;
+  string d_BulkInsertRecordQuery;
+  string d_BulkInsertRecordOrderQuery;
   string d_UpdateMasterOfZoneQuery;
   string d_UpdateKindOfZoneQuery;
   string d_UpdateSerialOfZoneQuery;
@@ -118,6 +162,8 @@ private:
   string d_beforeOrderQuery;
   string d_afterOrderQuery;
   string d_lastOrderQuery;
+  string d_listOrderQuery;
+  string d_nameOrderQuery;
   string d_setOrderAuthQuery;
   string d_nullifyOrderNameAndUpdateAuthQuery;
   string d_nullifyOrderNameAndAuthQuery;
@@ -146,6 +192,10 @@ private:
 
   string d_getAllDomainsQuery;
 
+  string d_indexname;
+  vector<OrderNameIndex::Change> d_indexChanges;
+  bool d_inTransaction;
+
 protected:
   bool d_dnssecQueries;
 };
@@ -42,6 +42,27 @@ public:
   virtual bool getRow(row_t &row)=0;
   virtual string escape(const string &name)=0;
   virtual void setLog(bool state){}
+
+  //! Adds many rows at once. query is a multi-row insert up to and including 'values', the rows are sent in batches
+  virtual void insertRows(const string &query, const result_t &rows)
+  {
+    string statement;
+    for(result_t::const_iterator row=rows.begin(); row!=rows.end(); ++row) {
+      statement+=statement.empty() ? query+" (" : ",(";
+      for(row_t::const_iterator field=row->begin(); field!=row->end(); ++field) {
+        if(field!=row->begin())
+          statement+=',';
+        statement+="'"+escape(*field)+"'";
+      }
+      statement+=')';
+      if(statement.size() > 256*1024) { // stay well below max_allowed_packet and friends
+        doCommand(statement);
+        statement.clear();
+      }
+    }
+    if(!statement.empty())
+      doCommand(statement);
+  }
   virtual ~SSql(){};
 };
 
@@ -7,6 +7,7 @@
 #include <botan/sha2_64.h>
 #include <botan/pubkey.h>
 #include <botan/look_pk.h>
+#include <boost/foreach.hpp>
 #include "dnssecinfra.hh"
 
 using namespace Botan;
@@ -32,6 +33,7 @@ public:
   storvector_t convertToISCVector() const;
   std::string getPubKeyHash() const;
   std::string sign(const std::string& hash) const; 
+  std::vector<std::string> signBatch(const std::vector<std::string>& msgs) const;
   std::string hash(const std::string& hash) const; 
   bool verify(const std::string& hash, const std::string& signature) const;
   std::string getPublicKeyString() const;
@@ -190,22 +192,34 @@ std::string GOSTDNSCryptoKeyEngine::getPublicKeyString() const
  ~ Tak bylo, tak yest' i tak budet vsegda!     ~  
  */
 
+RandomNumberGenerator& getThreadRNG(); // botansigners.cc
+
 std::string GOSTDNSCryptoKeyEngine::sign(const std::string& msg) const
+{
+  return signBatch(std::vector<std::string>(1, msg))[0];
+}
+
+std::vector<std::string> GOSTDNSCryptoKeyEngine::signBatch(const std::vector<std::string>& msgs) const
 {
   GOST_3410_Signature_Operation ops(*d_key);
-  AutoSeeded_RNG rng;
-  
-  string hash= this->hash(msg);
+  RandomNumberGenerator& rng = getThreadRNG();
+  std::vector<std::string> ret;
+  ret.reserve(msgs.size());
+
+  BOOST_FOREACH(const std::string& msg, msgs) {
+    string hash= this->hash(msg);
   
-  SecureVector<byte> signature=ops.sign((byte*)hash.c_str(), hash.length(), rng);
+    SecureVector<byte> signature=ops.sign((byte*)hash.c_str(), hash.length(), rng);
 
 #if BOTAN_VERSION_CODE <= BOTAN_VERSION_CODE_FOR(1,9,12)  // see http://bit.ly/gTytUf
-  string reversed((const char*)signature.begin()+ signature.size()/2, signature.size()/2);
-  reversed.append((const char*)signature.begin(), signature.size()/2);
-  return reversed;
+    string reversed((const char*)signature.begin()+ signature.size()/2, signature.size()/2);
+    reversed.append((const char*)signature.begin(), signature.size()/2);
+    ret.push_back(reversed);
 #else  
-  return string((const char*)signature.begin(), (const char*) signature.end());
+    ret.push_back(string((const char*)signature.begin(), (const char*) signature.end()));
 #endif
+  }
+  return ret;
 }
 
 std::string GOSTDNSCryptoKeyEngine::hash(const std::string& orig) const
@@ -261,6 +275,7 @@ public:
   storvector_t convertToISCVector() const;
   std::string getPubKeyHash() const;
   std::string sign(const std::string& hash) const; 
+  std::vector<std::string> signBatch(const std::vector<std::string>& msgs) const;
   std::string hash(const std::string& hash) const; 
   bool verify(const std::string& hash, const std::string& signature) const;
   std::string getPublicKeyString() const;
@@ -392,12 +407,22 @@ void ECDSADNSCryptoKeyEngine::fromPublicKeyString(const std::string&input)
 
 std::string ECDSADNSCryptoKeyEngine::sign(const std::string& msg) const
 {
-  string hash = this->hash(msg);
+  return signBatch(std::vector<std::string>(1, msg))[0];
+}
+
+std::vector<std::string> ECDSADNSCryptoKeyEngine::signBatch(const std::vector<std::string>& msgs) const
+{
   ECDSA_Signature_Operation ops(*d_key);
-  AutoSeeded_RNG rng;
-  SecureVector<byte> signature=ops.sign((byte*)hash.c_str(), hash.length(), rng);
-  
-  return string((const char*)signature.begin(), (const char*) signature.end());
+  RandomNumberGenerator& rng = getThreadRNG();
+  std::vector<std::string> ret;
+  ret.reserve(msgs.size());
+
+  BOOST_FOREACH(const std::string& msg, msgs) {
+    string hash = this->hash(msg);
+    SecureVector<byte> signature=ops.sign((byte*)hash.c_str(), hash.length(), rng);
+    ret.push_back(string((const char*)signature.begin(), (const char*) signature.end()));
+  }
+  return ret;
 }
 
 std::string ECDSADNSCryptoKeyEngine::hash(const std::string& orig) const
@@ -6,6 +6,7 @@
 #include <botan/sha2_64.h>
 #include <botan/pubkey.h>
 #include <botan/look_pk.h>
+#include <boost/foreach.hpp>
 #include "dnssecinfra.hh"
 
 using namespace Botan;
@@ -20,6 +21,7 @@ public:
   storvector_t convertToISCVector() const;
   std::string getPubKeyHash() const;
   std::string sign(const std::string& hash) const; 
+  std::vector<std::string> signBatch(const std::vector<std::string>& msgs) const;
   std::string hash(const std::string& hash) const; 
   bool verify(const std::string& msg, const std::string& signature) const;
   std::string getPublicKeyString() const;
@@ -172,13 +174,26 @@ void ECDSADNSCryptoKeyEngine::fromPublicKeyString(const std::string&input)
   d_key.reset();
 }
 
+RandomNumberGenerator& getThreadRNG(); // botansigners.cc
+
 std::string ECDSADNSCryptoKeyEngine::sign(const std::string& msg) const
 {
-  AutoSeeded_RNG rng;
-  string hash = this->hash(msg);
+  return signBatch(std::vector<std::string>(1, msg))[0];
+}
+
+std::vector<std::string> ECDSADNSCryptoKeyEngine::signBatch(const std::vector<std::string>& msgs) const
+{
+  RandomNumberGenerator& rng = getThreadRNG();
   Default_ECDSA_Op ops(d_key->domain_parameters(), d_key->private_value(), d_key->public_point());
-  SecureVector<byte> signature=ops.sign((byte*)hash.c_str(), hash.length(), rng);
-  return string((const char*)signature.begin(), (const char*) signature.end());
+  std::vector<std::string> ret;
+  ret.reserve(msgs.size());
+
+  BOOST_FOREACH(const std::string& msg, msgs) {
+    string hash = this->hash(msg);
+    SecureVector<byte> signature=ops.sign((byte*)hash.c_str(), hash.length(), rng);
+    ret.push_back(string((const char*)signature.begin(), (const char*) signature.end()));
+  }
+  return ret;
 }
 
 std::string ECDSADNSCryptoKeyEngine::hash(const std::string& orig) const
@@ -7,6 +7,8 @@
 #include <botan/pubkey.h>
 #include <botan/look_pk.h>
 #include <botan/numthry.h>
+#include <boost/foreach.hpp>
+#include <pthread.h>
 #include "dnssecinfra.hh"
 
 using namespace Botan;
@@ -26,6 +28,7 @@ public:
   storvector_t convertToISCVector() const;
   std::string getPubKeyHash() const;
   std::string sign(const std::string& msg) const; 
+  std::vector<std::string> signBatch(const std::vector<std::string>& msgs) const;
   std::string hash(const std::string& hash) const; 
   bool verify(const std::string& msg, const std::string& signature) const;
   std::string getPublicKeyString() const;
@@ -179,7 +182,38 @@ void BotanRSADNSCryptoKeyEngine::fromPublicKeyString(const std::string& rawStrin
   d_key.reset();
 }
 
+// seeding an RNG is expensive and they are not thread safe, so every signing thread keeps one until it exits.
+// Shared with the ECDSA and GOST signers, the pthread key makes sure exiting threads free theirs
+static pthread_key_t s_rngkey;
+static pthread_once_t s_rngonce = PTHREAD_ONCE_INIT;
+
+static void deleteThreadRNG(void* rng)
+{
+  delete static_cast<AutoSeeded_RNG*>(rng);
+}
+
+static void makeRNGKey()
+{
+  pthread_key_create(&s_rngkey, deleteThreadRNG);
+}
+
+RandomNumberGenerator& getThreadRNG()
+{
+  pthread_once(&s_rngonce, makeRNGKey);
+  AutoSeeded_RNG* rng = static_cast<AutoSeeded_RNG*>(pthread_getspecific(s_rngkey));
+  if(!rng) {
+    rng = new AutoSeeded_RNG;
+    pthread_setspecific(s_rngkey, rng);
+  }
+  return *rng;
+}
+
 std::string BotanRSADNSCryptoKeyEngine::sign(const std::string& msg) const
+{  
+  return signBatch(std::vector<std::string>(1, msg))[0];
+}
+
+std::vector<std::string> BotanRSADNSCryptoKeyEngine::signBatch(const std::vector<std::string>& msgs) const
 {  
 #if BOTAN_VERSION_CODE < BOTAN_VERSION_CODE_FOR(1,9,0)  
   EMSA* emsaptr;
@@ -201,9 +235,14 @@ std::string BotanRSADNSCryptoKeyEngine::sign(const std::string& msg) const
   PK_Signer pks(*d_key, emsa);
 #endif
 
-  AutoSeeded_RNG rng;
-  SecureVector<byte> signature= pks.sign_message((byte*)msg.c_str(), msg.length(), rng);
-  return string((const char*)signature.begin(), (const char*) signature.end());
+  RandomNumberGenerator& rng = getThreadRNG();
+  std::vector<std::string> ret;
+  ret.reserve(msgs.size());
+  BOOST_FOREACH(const std::string& msg, msgs) {
+    SecureVector<byte> signature= pks.sign_message((byte*)msg.c_str(), msg.length(), rng);
+    ret.push_back(string((const char*)signature.begin(), (const char*) signature.end()));
+  }
+  return ret;
 }
 
 std::string BotanRSADNSCryptoKeyEngine::hash(const std::string& orig) const
@@ -21,6 +21,13 @@
 */
 #include "common_startup.hh"
 #include "ws.hh"
+#include "dnssecinfra.hh"
+#include "ixfr.hh"
+#include "zoneindex.hh"
+#include "nsec3cache.hh"
+#include "ordernameindex.hh"
+#include "querylog.hh"
+#include <climits>
 
 bool g_anyToTcp;
 bool g_addSuperfluousNSEC3;
@@ -35,6 +42,7 @@ DynListener *dl;
 CommunicatorClass Communicator;
 UDPNameserver *N;
 int avg_latency;
+static LatencyHistogram* s_answerlatency;
 TCPNameserver *TN;
 
 ArgvMap &arg()
@@ -50,6 +58,11 @@ void declareArguments()
   ::arg().setSwitch("forward-2136","A global setting to allow RFC2136 packages that are for a Slave domain, to be forwarded to the master.")="yes";
   ::arg().setSwitch("log-dns-details","If PDNS should log DNS non-erroneous details")="";
   ::arg().setSwitch("log-dns-queries","If PDNS should log all incoming DNS queries")="no";
+  ::arg().set("query-log-file","If set, log answered queries to this file in binary form, without slowing down answering them")="";
+  ::arg().set("query-log-sample","Log one in this many answered queries to the query log")="1";
+  ::arg().set("query-log-buffer","Number of query log records each thread can have waiting to be written")="8192";
+  ::arg().set("query-log-max-size","Rotate the query log when it grows over this many megabytes, 0 to never rotate")="100";
+  ::arg().set("query-log-files","Number of rotated query logs to keep")="5";
   ::arg().set("urlredirector","Where we send hosts to that need to be url redirected")="127.0.0.1";
   ::arg().set("smtpredirector","Our smtpredir MX host")="a.misconfigured.powerdns.smtp.server";
   ::arg().set("local-address","Local IP addresses to which we bind")="0.0.0.0";
@@ -78,6 +91,13 @@ void declareArguments()
   ::arg().set("default-soa-mail","mail address to insert in the SOA record if none set in the backend")="";
   ::arg().set("distributor-threads","Default number of Distributor (backend) threads to start")="3";
   ::arg().set("signing-threads","Default number of signer threads to start")="3";
+  ::arg().set("signature-cache-size","Maximum amount of memory in megabytes used to cache RRSIGs")="256";
+  ::arg().set("dnssec-key-cache-ttl","Seconds to cache the DNSSEC keys of a zone")="30";
+  ::arg().set("domain-metadata-cache-ttl","Seconds to cache domain metadata like NSEC3PARAM and PRESIGNED")="60";
+  ::arg().setSwitch("dnssec-cache-refresh","Reload DNSSEC keys and domain metadata in the background before they expire")="no";
+  ::arg().set("nsec3-cache-entries","Maximum number of NSEC3 hashes, ranges and records each cached per zone, 0 to disable")="10000";
+  ::arg().set("nsec3-cache-ttl","Seconds to cache NSEC3 ranges and records if the zone serial does not change")="60";
+  ::arg().set("ordername-index-ttl","Seconds before the in-memory ordername index of a DNSSEC zone is reloaded from the database, 0 to disable")="0";
   ::arg().set("receiver-threads","Default number of receiver threads to start")="1";
   ::arg().set("queue-limit","Maximum number of milliseconds to queue a query")="1500"; 
   ::arg().set("recursor","If recursion is desired, IP address of a recursing nameserver")="no"; 
@@ -93,6 +113,8 @@ void declareArguments()
   ::arg().setSwitch("disable-axfr","Disable zonetransfers but do allow TCP queries")="no";
   ::arg().set("allow-axfr-ips","Allow zonetransfers only to these subnets")="0.0.0.0/0,::/0";
   ::arg().set("slave-cycle-interval","Reschedule failed SOA serial checks once every .. seconds")="60";
+  ::arg().set("slave-check-spread","Spread routine SOA serial checks of stale slave zones over this many seconds")="60";
+  ::arg().set("slave-transfers-per-master","Maximum number of simultaneous zone transfers from a single master, 0 for no limit")="2";
 
   ::arg().set("tcp-control-address","If set, PowerDNS can be controlled over TCP on this address")="";
   ::arg().set("tcp-control-port","If set, PowerDNS can be controlled over TCP on this address")="53000";
@@ -129,9 +151,17 @@ void declareArguments()
 
   ::arg().set("trusted-notification-proxy", "IP address of incoming notification proxy")="";
   ::arg().set("slave-renotify", "If we should send out notifications for slaved updates")="no";
+  ::arg().set("notify-coalesce-interval", "Seconds to wait before notifying a slave again about a zone that changed while a NOTIFY was outstanding")="5";
+  ::arg().set("notify-rate-per-destination", "Maximum number of NOTIFYs per second sent to a single address, 0 for no limit")="50";
+  ::arg().setSwitch("slave-ixfr", "Ask masters for an IXFR before falling back to a full AXFR")="no";
+  ::arg().set("ixfr-journal-size", "Number of changes per zone kept in memory to answer IXFR queries, 0 to disable")="100";
 
   ::arg().set("default-ttl","Seconds a result is valid if not set otherwise")="3600";
+  ::arg().set("zone-index-refresh","Seconds between rebuilds of the in-memory index of zone apexes used to find the authoritative zone, 0 to disable")="0";
   ::arg().set("max-tcp-connections","Maximum number of TCP connections")="10";
+  ::arg().set("max-tcp-per-client","Maximum number of simultaneous TCP connections per client, 0 for no limit")="0";
+  ::arg().set("tcp-threads","Number of threads answering questions over TCP")="2";
+  ::arg().set("tcp-idle-timeout","Seconds after which an idle TCP connection is closed")="5";
   ::arg().setSwitch("no-shuffle","Set this to prevent random shuffling of answers - for regression testing")="off";
 
   ::arg().set("experimental-logfile", "Filename of the log file for JSON parser" )= "/var/log/pdns.log";
@@ -187,10 +217,46 @@ void declareStats(void)
   S.declare("rfc2136-refused", "RFC2136 packets that are refused.");
   S.declare("rfc2136-changes", "RFC2136 changes to records in total.");
 
+  S.declare("signature-cache-hit","Number of RRSIGs served from the signature cache");
+  S.declare("signature-cache-miss","Number of RRSIGs that had to be calculated");
+  S.declare("signature-cache-evictions","Number of live RRSIGs evicted from the signature cache to make room");
+  S.declare("signature-cache-entries","Number of RRSIGs in the signature cache");
+  S.declare("signature-cache-bytes","Approximate memory in bytes used by the signature cache, at most 4294967295");
+
+  S.declare("key-cache-hit","Number of DNSSEC keysets found in the key cache");
+  S.declare("key-cache-miss","Number of DNSSEC keysets that had to be loaded from the backend");
+  S.declare("key-cache-size","Number of zones in the DNSSEC key cache");
+  S.declare("meta-cache-hit","Number of domain metadata lookups answered from the metadata cache");
+  S.declare("meta-cache-miss","Number of domain metadata lookups that had to go to the backend");
+  S.declare("meta-cache-size","Number of entries in the domain metadata cache");
+  S.declare("dnssec-cache-refresh","Number of DNSSEC keysets and domain metadata reloaded in the background");
+
+  S.declare("nsec3-cache-hit","Number of NSEC3 ranges found in the NSEC3 cache");
+  S.declare("nsec3-cache-miss","Number of NSEC3 ranges that had to be looked up in the backend");
+  S.declare("nsec3-cache-size","Number of hashes, ranges and records in the NSEC3 cache");
+  S.declare("ordername-index-size","Number of ordernames in the ordername index");
+
+  S.declare("query-log-written","Number of records written to the query log");
+  S.declare("query-log-dropped","Number of query log records dropped because the writer could not keep up");
+
+  S.declare("notify-queue","Number of NOTIFYs waiting to be sent or answered");
+  S.declare("notify-latency","Average number of milliseconds between queueing a NOTIFY and its answer");
+  S.declare("notify-sent","Number of NOTIFY packets sent");
+  S.declare("notify-coalesced","Number of NOTIFYs merged into one that was already pending");
+
+  S.declare("slave-freshness-lag","Seconds the longest waiting stale slave zone has been queued for or in transfer");
+  S.declare("slave-transfer-queue","Number of stale slave zones waiting for a transfer");
+  S.declare("slave-check-queue","Number of slave zones scheduled for a SOA serial check");
+
   S.declare("servfail-packets","Number of times a server-failed packet was sent out");
   S.declare("latency","Average number of microseconds needed to answer a question");
   S.declare("timedout-packets","Number of packets which weren't answered within timeout set");
 
+  S.declareHistogram("answer-latency","Time between receiving a question and sending the answer");
+  S.declareHistogram("backend-latency","Time backends needed to produce all records of a lookup");
+  S.declareHistogram("signing-latency","Time needed to sign the records of an answer or a transfer chunk");
+  s_answerlatency=S.getHistogram("answer-latency");
+
   S.declareRing("queries","UDP Queries Received");
   S.declareRing("nxdomain-queries","Queries for non-existent records within existent domains");
   S.declareRing("noerror-queries","Queries for existing records, but for type we don't have");
@@ -211,17 +277,43 @@ int isGuarded(char **argv)
   return !!p;
 }
 
+//! feeds the answer-latency histogram, the response stats of TCP answers and the query log, q is the question, r the answer we sent for it. Call before q->d_dt gets reset
+void accountAnswer(DNSPacket* q, DNSPacket* r)
+{
+  s_answerlatency->submit(q->d_dt.udiffNoReset());
+  const string& raw=r->getString();
+  if(q->d_tcp) // UDPNameserver::send counts the UDP ones
+    g_rs.submitResponse(q->qtype.getCode(), raw.size(), raw.size() > 3 ? raw[3] & 0x0f : 0, false);
+  if(!g_querylog.enabled())
+    return;
+
+  uint8_t flags=0, rcode=0;
+  if(q->d_tcp)
+    flags|=QueryLog::TCP;
+  if(q->d.rd)
+    flags|=QueryLog::RD;
+  if(q->d_dnssecOk)
+    flags|=QueryLog::DO;
+  if(raw.size() > 3) {
+    if(raw[2] & 0x02)
+      flags|=QueryLog::TC;
+    rcode=raw[3] & 0x0f;
+  }
+  g_querylog.log(q->d_remote, q->qdomain, q->qtype.getCode(), ntohs(q->d.id), flags, rcode, raw.size(), q->d_dt.getTimeval(), q->d_dt.udiffNoReset());
+}
+
 void sendout(const DNSDistributor::AnswerData &AD)
 {
   if(!AD.A)
     return;
   
   N->send(AD.A);
+  accountAnswer(AD.A, AD.A);
 
   int diff=AD.A->d_dt.udiff();
   avg_latency=(int)(1023*avg_latency/1024+diff/1024);
 
-  delete AD.A;  
+  DNSPacket::release(AD.A);
 }
 
 //! The qthread receives questions over the internet via the Nameserver class, and hands them to the Distributor for further processing
@@ -255,6 +347,25 @@ void *qthread(void *number)
         int qcount, acount;
         distributor->getQueueSizes(qcount, acount);
         S.set("qsize-q",qcount);
+
+        SignatureCacheStats scs = getSignatureCacheStats();
+        S.set("signature-cache-hit", scs.hits);
+        S.set("signature-cache-miss", scs.misses);
+        S.set("signature-cache-evictions", scs.evictions);
+        S.set("signature-cache-entries", scs.entries);
+        S.set("signature-cache-bytes", (unsigned int)min(scs.bytes, (uint64_t)UINT_MAX)); // statistics are 32 bits
+        DNSSECKeeper::CacheStats dcs = DNSSECKeeper::getCacheStats();
+        S.set("key-cache-hit", dcs.keyHits);
+        S.set("key-cache-miss", dcs.keyMisses);
+        S.set("key-cache-size", dcs.keyEntries);
+        S.set("meta-cache-hit", dcs.metaHits);
+        S.set("meta-cache-miss", dcs.metaMisses);
+        S.set("meta-cache-size", dcs.metaEntries);
+        S.set("dnssec-cache-refresh", dcs.refreshes);
+        S.set("nsec3-cache-size", (unsigned int)g_nsec3cache.size());
+        S.set("ordername-index-size", (unsigned int)g_ordernameindex.size());
+        S.set("query-log-written", (unsigned int)g_querylog.getWritten());
+        S.set("query-log-dropped", (unsigned int)g_querylog.getDropped());
       }
     }
 
@@ -298,6 +409,7 @@ void *qthread(void *number)
       cached.commitD(); // commit d to the packet                        inlined
 
       N->send(&cached);   // answer it then                              inlined
+      accountAnswer(P, &cached);
       diff=P->d_dt.udiff();                                                    
       avg_latency=(int)(0.999*avg_latency+0.001*diff); // 'EWMA'
       
@@ -333,6 +445,12 @@ void mainthread()
    g_addSuperfluousNSEC3 = ::arg().mustDo("add-superfluous-nsec3-for-old-bind");
    DNSPacket::s_udpTruncationThreshold = std::max(512, ::arg().asNum("udp-truncation-threshold"));
    DNSPacket::s_doEDNSSubnetProcessing = ::arg().mustDo("edns-subnet-processing");
+   setSignatureCacheSize((uint64_t)::arg().asNum("signature-cache-size")*1024*1024);
+   g_ixfrjournal.setMaxDiffs(::arg().asNum("ixfr-journal-size"));
+   g_zoneindex.setRefreshInterval(::arg().asNum("zone-index-refresh"));
+   DNSSECKeeper::setCacheTTLs(::arg().asNum("dnssec-key-cache-ttl"), ::arg().asNum("domain-metadata-cache-ttl"));
+   g_nsec3cache.setLimits(::arg().asNum("nsec3-cache-entries"), ::arg().asNum("nsec3-cache-ttl"));
+   g_ordernameindex.setTTL(::arg().asNum("ordername-index-ttl"));
    {
       std::vector<std::string> codes;
       stringtok(codes, ::arg()["edns-subnet-option-numbers"], "\t ,");
@@ -370,6 +488,13 @@ void mainthread()
   if(::arg().mustDo("slave") || ::arg().mustDo("master"))
     Communicator.go(); 
 
+  if(::arg().mustDo("dnssec-cache-refresh"))
+    DNSSECKeeper::startRefresher();
+
+  if(!::arg()["query-log-file"].empty())
+    g_querylog.start(::arg()["query-log-file"], ::arg().asNum("query-log-sample"), ::arg().asNum("query-log-buffer"),
+                     ::arg().asNum("query-log-max-size")*1024ULL*1024, ::arg().asNum("query-log-files"));
+
   if(TN)
     TN->go(); // tcp nameserver launch
     
@@ -49,6 +49,7 @@ extern void declareArguments();
 extern void declareStats();
 extern void mainthread();
 extern int isGuarded( char ** );
+extern void accountAnswer(DNSPacket* q, DNSPacket* r);
 
 extern bool g_anyToTcp;
 extern bool g_addSuperfluousNSEC3;
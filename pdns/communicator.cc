@@ -38,20 +38,44 @@
 
 // #include "namespaces.hh"
 
+//! how many transfers from this master are running now, call with d_lock held
+unsigned int CommunicatorClass::transfersFrom(const string& master)
+{
+  unsigned int ret=0;
+  for(std::list<SuckRequest>::const_iterator i=d_transferring.begin(); i!=d_transferring.end(); ++i)
+    if(i->master == master)
+      ret++;
+  return ret;
+}
+
 void CommunicatorClass::retrievalLoopThread(void)
 {
   for(;;) {
     d_suck_sem.wait();
     SuckRequest sr;
+    std::list<SuckRequest>::iterator us;
     {
       Lock l(&d_lock);
-      if(d_suckdomains.empty()) 
-        continue;
-        
-      sr=d_suckdomains.front();
-      d_suckdomains.pop_front();
+      // take the first zone whose master has room, so one slow master can't occupy every retrieval thread
+      UniQueue::iterator i;
+      for(i=d_suckdomains.begin(); i!=d_suckdomains.end(); ++i)
+        if(!d_maxtransferspermaster || transfersFrom(i->master) < d_maxtransferspermaster)
+          break;
+
+      if(i==d_suckdomains.end())
+        continue; // nothing we may start now, the next transfer to finish wakes us again
+
+      sr=*i;
+      d_suckdomains.erase(i);
+      us=d_transferring.insert(d_transferring.end(), sr);
     }
     suck(sr.domain,sr.master);
+    {
+      Lock l(&d_lock);
+      d_transferring.erase(us);
+      if(!d_suckdomains.empty())
+        d_suck_sem.post();
+    }
   }
 }
 
@@ -59,6 +83,7 @@ void CommunicatorClass::go()
 {
   pthread_t tid;
   pthread_create(&tid,0,&launchhelper,this); // Starts CommunicatorClass::mainloop()
+  d_maxtransferspermaster=::arg().asNum("slave-transfers-per-master");
   for(int n=0; n < ::arg().asNum("retrieval-threads"); ++n)
     pthread_create(&tid, 0, &retrieveLaunchhelper, this); // Starts CommunicatorClass::retrievalLoopThread()
 
@@ -72,17 +97,19 @@ void CommunicatorClass::mainloop(void)
     L<<Logger::Error<<"Master/slave communicator launching"<<endl;
     PacketHandler P;
     d_tickinterval=::arg().asNum("slave-cycle-interval");
+    d_slavecheckspread=::arg().asNum("slave-check-spread");
     makeNotifySockets();
 
     int rc;
-    time_t next, tick;
+    time_t next, tick, slavetick;
 
     for(;;) {
-      slaveRefresh(&P);
+      slavetick=slaveRefresh(&P);
       masterUpdateCheck(&P);
       tick=doNotifications(); // this processes any notification acknowledgements and actually send out our own notifications
       
       tick = min (tick, d_tickinterval); 
+      tick = min (tick, slavetick); // wake up when the next slave check is due
       
       next=time(0)+tick;
 
@@ -96,6 +123,7 @@ void CommunicatorClass::mainloop(void)
         }
         // this gets executed at least once every second
         doNotifications();
+        updateSlaveStats();
       }
     }
   }
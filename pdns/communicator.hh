@@ -31,11 +31,14 @@
 #include <boost/multi_index_container.hpp>
 #include <boost/multi_index/identity.hpp>
 #include <boost/multi_index/sequenced_index.hpp>
+#include <boost/multi_index/ordered_index.hpp>
+#include <boost/multi_index/member.hpp>
 using namespace boost::multi_index;
 
 #include <unistd.h>
 #include <fcntl.h>
 #include <netdb.h>
+#include <sys/time.h>
 
 #include "lock.hh"
 #include "packethandler.hh"
@@ -46,6 +49,7 @@ struct SuckRequest
 {
   string domain;
   string master;
+  time_t queued; //!< when we found out the zone was stale, for the freshness lag
   bool operator<(const SuckRequest& b) const
   {
     return tie(domain, master) < tie(b.domain, b.master);
@@ -63,65 +67,57 @@ typedef multi_index_container<
 > UniQueue;
 typedef UniQueue::index<IDTag>::type domains_by_name_t;
 
+//! a slave zone waiting for its SOA check, due at 'deadline'. NOTIFY'd zones get deadline 0 so they go first
+struct SlaveCheck
+{
+  string zone;
+  time_t deadline;
+  bool priority;
+  DomainInfo di;
+};
+
+struct DeadlineTag{};
+
+typedef multi_index_container<
+  SlaveCheck,
+  indexed_by<
+    ordered_unique<member<SlaveCheck, string, &SlaveCheck::zone>, CIStringCompare>,
+    ordered_non_unique<tag<DeadlineTag>, member<SlaveCheck, time_t, &SlaveCheck::deadline> >
+  >
+> SlaveCheckQueue;
+typedef SlaveCheckQueue::index<DeadlineTag>::type checks_by_deadline_t;
+
+/** NOTIFYs waiting to go out or waiting for their answer. Queueing a zone again while a NOTIFY for it is
+    still pending to the same destination coalesces the two. Sending is paced per destination IP with a
+    token bucket, so a bulk update of many zones doesn't flood the slaves with packets they'll drop anyway. */
 class NotificationQueue
 {
 public:
-  void add(const string &domain, const string &ip)
+  NotificationQueue() : d_coalesce(0), d_rate(0)
+  {}
+
+  void setLimits(unsigned int coalesce, unsigned int rate)
   {
-    NotificationRequest nr;
-    nr.domain   = domain;
-    nr.ip       = ip;
-    nr.attempts = 0;
-    nr.id       = Utility::random()%0xffff;
-    nr.next     = time(0);
-
-    d_nqueue.push_back(nr);
+    d_coalesce = coalesce;
+    d_rate = rate;
   }
+
+  bool add(const string &domain, const string &ip); //!< returns false if this was merged with a pending NOTIFY
+  bool removeIf(const string &remote, uint16_t id, const string &domain, unsigned int* msec=0);
+  bool getOne(string &domain, string &ip, uint16_t *id, bool &purged);
   
-  bool removeIf(const string &remote, uint16_t id, const string &domain)
+  time_t earliest()
   {
-    for(d_nqueue_t::iterator i=d_nqueue.begin(); i!=d_nqueue.end(); ++i) {
-      //      cout<<i->id<<" "<<id<<endl;
-      //cout<<i->ip<<" "<<remote<<endl;
-      //cout<<i->domain<<" "<<domain<<endl;
-      string remoteIP, ourIP, port;
-      tie(remoteIP, port)=splitField(remote, ':');
-      tie(ourIP, port)=splitField(i->ip, ':');
-      if(i->id==id && ourIP == remoteIP && i->domain==domain) {
-        d_nqueue.erase(i);
-        return true;
-      }
-    }
-    return false;
+    if(d_nqueue.empty())
+      return std::numeric_limits<time_t>::max() - 1 - time(0);
+    return d_nqueue.get<NextTag>().begin()->next - time(0);
   }
 
-  bool getOne(string &domain, string &ip, uint16_t *id, bool &purged)
-  {
-    for(d_nqueue_t::iterator i=d_nqueue.begin();i!=d_nqueue.end();++i) 
-      if(i->next <= time(0)) {
-        i->attempts++;
-        purged=false;
-        i->next=time(0)+1+(1<<i->attempts);
-        domain=i->domain;
-        ip=i->ip;
-        *id=i->id;
-        purged=false;
-        if(i->attempts>4) {
-          purged=true;
-          d_nqueue.erase(i);
-        }
-        return true;
-      }
-    return false;
-  }
-  
-  time_t earliest()
+  unsigned int size() const
   {
-    time_t early=std::numeric_limits<time_t>::max() - 1; 
-    for(d_nqueue_t::const_iterator i=d_nqueue.begin();i!=d_nqueue.end();++i) 
-      early=min(early,i->next);
-    return early-time(0);
+    return d_nqueue.size();
   }
+
   void dump();
 private:
   struct NotificationRequest
@@ -131,11 +127,30 @@ private:
     int attempts;
     uint16_t id;
     time_t next;
+    time_t lastsent;
+    struct timeval queued;
   };
 
-  typedef std::list<NotificationRequest> d_nqueue_t;
+  struct NextTag{};
+  typedef multi_index_container<
+    NotificationRequest,
+    indexed_by<
+      ordered_non_unique<member<NotificationRequest, string, &NotificationRequest::domain> >,
+      ordered_non_unique<tag<NextTag>, member<NotificationRequest, time_t, &NotificationRequest::next> >
+    >
+  > d_nqueue_t;
   d_nqueue_t d_nqueue;
 
+  struct TokenBucket
+  {
+    double tokens;
+    struct timeval last;
+  };
+  map<string, TokenBucket> d_buckets;
+  bool takeToken(const string& ip);
+
+  unsigned int d_coalesce; //!< seconds to wait after the last NOTIFY for a zone before sending the next
+  unsigned int d_rate; //!< NOTIFYs per second per destination, 0 for no limit
 };
 
 /** this class contains a thread that communicates with other nameserver and does housekeeping.
@@ -151,6 +166,10 @@ public:
 
     d_tickinterval=60;
     d_masterschanged=d_slaveschanged=true;
+    d_lastslavediscovery=0;
+    d_slavecheckspread=0;
+    d_maxtransferspermaster=0;
+    d_notifylatency=0;
   }
   time_t doNotifications();    
   void go();
@@ -158,13 +177,20 @@ public:
   
   void drillHole(const string &domain, const string &ip);
   bool justNotified(const string &domain, const string &ip);
-  void addSuckRequest(const string &domain, const string &master);
+  void addSuckRequest(const string &domain, const string &master, bool priority=false);
   void addSlaveCheckRequest(const DomainInfo& di, const ComboAddress& remote);
   void addTrySuperMasterRequest(DNSPacket *p);
   void notify(const string &domain, const string &ip);
   void mainloop();
   void retrievalLoopThread();
-  void sendNotification(int sock, const string &domain, const ComboAddress& remote, uint16_t id);
+  struct PendingNotification
+  {
+    string domain;
+    string ip;
+    ComboAddress remote;
+    uint16_t id;
+  };
+  void sendNotifications(int sock, const vector<PendingNotification>& todo);
 
   static void *launchhelper(void *p)
   {
@@ -185,17 +211,27 @@ private:
   pthread_mutex_t d_holelock;
   void launchRetrievalThreads();
   void suck(const string &domain, const string &remote);
-  void slaveRefresh(PacketHandler *P);
+  bool ixfrSuck(PacketHandler& P, const DomainInfo& di, const ComboAddress& raddr, const string& tsigkeyname, const string& tsigalgorithm, const string& tsigsecret, const ComboAddress* laddr);
+  time_t slaveRefresh(PacketHandler *P);
+  void scheduleSlaveCheck(const DomainInfo& di, time_t deadline, bool priority);
+  void updateSlaveStats();
+  unsigned int transfersFrom(const string& master);
   void masterUpdateCheck(PacketHandler *P);
   pthread_mutex_t d_lock;
   
   UniQueue d_suckdomains;
+  std::list<SuckRequest> d_transferring; //!< zones being retrieved right now, protected by d_lock like d_suckdomains
+  unsigned int d_maxtransferspermaster;
+  SlaveCheckQueue d_slavechecks; //!< only touched by the communicator thread
+  time_t d_lastslavediscovery;
+  unsigned int d_slavecheckspread;
   
   bool d_havepriosuckrequest;
   Semaphore d_suck_sem;
   Semaphore d_any_sem;
   time_t d_tickinterval;
   NotificationQueue d_nq;
+  double d_notifylatency; //!< average msec from queueing a NOTIFY to its answer, a double so answers under a second count too
   bool d_masterschanged, d_slaveschanged;
   set<DomainInfo> d_tocheck;
   vector<DNSPacket> d_potentialsupermasters;
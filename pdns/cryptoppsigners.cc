@@ -5,6 +5,8 @@
 #include <cryptopp/eccrypto.h>
 #include <cryptopp/oids.h>
 #include <cryptopp/filters.h>
+#include <boost/foreach.hpp>
+#include <pthread.h>
 #include "dnssecinfra.hh"
 using namespace CryptoPP;
 
@@ -19,6 +21,7 @@ public:
   storvector_t convertToISCVector() const;
   std::string getPubKeyHash() const;
   std::string sign(const std::string& msg) const; 
+  std::vector<std::string> signBatch(const std::vector<std::string>& msgs) const;
   std::string hash(const std::string& hash) const; 
   bool verify(const std::string& msg, const std::string& signature) const;
   std::string getPublicKeyString() const;
@@ -136,19 +139,51 @@ void CryptoPPECDSADNSCryptoKeyEngine<HASHER,CURVE,BITS>::fromPublicKeyString(con
   d_pubkey = shared_ptr<publickey_t>(pubkey);
   d_key.reset();
 }
+// seeding a pool is expensive and they are not thread safe, so every signing thread keeps one until it exits
+static pthread_key_t s_prngkey;
+static pthread_once_t s_prngonce = PTHREAD_ONCE_INIT;
+
+static void deleteThreadPRNG(void* prng)
+{
+  delete static_cast<AutoSeededRandomPool*>(prng);
+}
+
+static void makePRNGKey()
+{
+  pthread_key_create(&s_prngkey, deleteThreadPRNG);
+}
+
+static RandomNumberGenerator& getThreadPRNG()
+{
+  pthread_once(&s_prngonce, makePRNGKey);
+  AutoSeededRandomPool* prng = static_cast<AutoSeededRandomPool*>(pthread_getspecific(s_prngkey));
+  if(!prng) {
+    prng = new AutoSeededRandomPool;
+    pthread_setspecific(s_prngkey, prng);
+  }
+  return *prng;
+}
+
 template<class HASHER, class CURVE, int BITS>
 std::string CryptoPPECDSADNSCryptoKeyEngine<HASHER,CURVE,BITS>::sign(const std::string& msg) const
 {  
-  string signature;
-  AutoSeededRandomPool prng;
-  StringSource( msg, true /*pump all*/,
-    new SignerFilter( prng,
-        typename ECDSA<ECP,HASHER>::Signer( *d_key ),
-        new StringSink( signature )
-    ) // SignerFilter
-  ); // StringSource
-  return signature;
+  return signBatch(std::vector<std::string>(1, msg))[0];
+}
 
+template<class HASHER, class CURVE, int BITS>
+std::vector<std::string> CryptoPPECDSADNSCryptoKeyEngine<HASHER,CURVE,BITS>::signBatch(const std::vector<std::string>& msgs) const
+{  
+  typename ECDSA<ECP,HASHER>::Signer signer(*d_key);
+  RandomNumberGenerator& prng = getThreadPRNG();
+  std::vector<std::string> ret;
+  ret.reserve(msgs.size());
+
+  string signature(signer.MaxSignatureLength(), '\0');
+  BOOST_FOREACH(const std::string& msg, msgs) {
+    size_t len = signer.SignMessage(prng, (const byte*)msg.c_str(), msg.length(), (byte*)&signature[0]);
+    ret.push_back(signature.substr(0, len));
+  }
+  return ret;
 }
 template<class HASHER, class CURVE, int BITS>
 std::string CryptoPPECDSADNSCryptoKeyEngine<HASHER,CURVE,BITS>::hash(const std::string& orig) const
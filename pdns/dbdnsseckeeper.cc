@@ -36,18 +36,117 @@
 #include "base64.hh"
 #include "cachecleaner.hh"
 #include "arguments.hh"
+#include "logger.hh"
+#include "lock.hh"
 
 
 using namespace boost::assign;
 #include "namespaces.hh"
 
 
-DNSSECKeeper::keycache_t DNSSECKeeper::s_keycache;
-DNSSECKeeper::metacache_t DNSSECKeeper::s_metacache;
-pthread_rwlock_t DNSSECKeeper::s_metacachelock = PTHREAD_RWLOCK_INITIALIZER;
-pthread_rwlock_t DNSSECKeeper::s_keycachelock = PTHREAD_RWLOCK_INITIALIZER;
+DNSSECKeeper::KeyCacheShard DNSSECKeeper::s_keycache[DNSSECKeeper::s_shardcount];
+DNSSECKeeper::METACacheShard DNSSECKeeper::s_metacache[DNSSECKeeper::s_shardcount];
 AtomicCounter DNSSECKeeper::s_ops;
 time_t DNSSECKeeper::s_last_prune;
+unsigned int DNSSECKeeper::s_keyttl = 30;
+unsigned int DNSSECKeeper::s_metattl = 60;
+AtomicCounter DNSSECKeeper::s_keyhits, DNSSECKeeper::s_keymisses, DNSSECKeeper::s_metahits, DNSSECKeeper::s_metamisses, DNSSECKeeper::s_refreshes;
+set<pair<string, string> > DNSSECKeeper::s_refreshqueue;
+pthread_mutex_t DNSSECKeeper::s_refreshlock = PTHREAD_MUTEX_INITIALIZER;
+bool DNSSECKeeper::s_refresher;
+
+unsigned int DNSSECKeeper::getShard(const std::string& zname)
+{
+  unsigned int hash = 0;
+  for(string::const_iterator c = zname.begin(); c != zname.end(); ++c)
+    hash = hash * 31 + (unsigned char)dns_tolower(*c);
+  return hash % s_shardcount;
+}
+
+void DNSSECKeeper::setCacheTTLs(unsigned int keyttl, unsigned int metattl)
+{
+  s_keyttl = keyttl;
+  s_metattl = metattl;
+}
+
+DNSSECKeeper::CacheStats DNSSECKeeper::getCacheStats()
+{
+  CacheStats ret;
+  ret.keyHits = s_keyhits;
+  ret.keyMisses = s_keymisses;
+  ret.metaHits = s_metahits;
+  ret.metaMisses = s_metamisses;
+  ret.refreshes = s_refreshes;
+  ret.keyEntries = ret.metaEntries = 0;
+  for(unsigned int n = 0; n < s_shardcount; ++n) {
+    {
+      ReadLock l(&s_keycache[n].d_lock);
+      ret.keyEntries += s_keycache[n].d_cache.size();
+    }
+    ReadLock l(&s_metacache[n].d_lock);
+    ret.metaEntries += s_metacache[n].d_cache.size();
+  }
+  return ret;
+}
+
+DNSSECKeeper::CacheState DNSSECKeeper::getCacheState(unsigned int ttd, unsigned int ttl, unsigned int now)
+{
+  if(!s_refresher)
+    return ttd > now ? Fresh : Missing;
+  if(now + ttl/5 < ttd)
+    return Fresh;
+  if(now < ttd + ttl) // about to expire or just expired, keep using it until the refresher has a new one
+    return Stale;
+  return Missing;
+}
+
+void DNSSECKeeper::queueRefresh(const std::string& zname, const std::string& key)
+{
+  Lock l(&s_refreshlock);
+  s_refreshqueue.insert(make_pair(toLower(zname), key));
+}
+
+void* DNSSECKeeper::refresherThread(void*)
+{
+  try {
+    DNSSECKeeper dk; // with backends of its own
+    for(;;) {
+      sleep(1);
+      set<pair<string, string> > todo;
+      {
+        Lock l(&s_refreshlock);
+        todo.swap(s_refreshqueue);
+      }
+      for(set<pair<string, string> >::const_iterator iter = todo.begin(); iter != todo.end(); ++iter) {
+        try {
+          if(iter->second.empty())
+            dk.loadKeys(iter->first);
+          else
+            dk.loadMeta(iter->first, iter->second);
+          s_refreshes++;
+        }
+        catch(PDNSException& ae) {
+          L<<Logger::Error<<"Unable to refresh DNSSEC keys or metadata of '"<<iter->first<<"': "<<ae.reason<<endl;
+        }
+      }
+    }
+  }
+  catch(std::exception& e) {
+    L<<Logger::Error<<"DNSSEC key and metadata refresher exiting: "<<e.what()<<endl;
+  }
+  catch(PDNSException& ae) {
+    L<<Logger::Error<<"DNSSEC key and metadata refresher exiting: "<<ae.reason<<endl;
+  }
+  s_refresher = false; // lookups go back to waiting for the backend themselves
+  return 0;
+}
+
+void DNSSECKeeper::startRefresher()
+{
+  pthread_t tid;
+  s_refresher = true;
+  pthread_create(&tid, 0, refresherThread, 0);
+}
 
 bool DNSSECKeeper::isSecuredZone(const std::string& zone) 
 {
@@ -59,16 +158,16 @@ bool DNSSECKeeper::isSecuredZone(const std::string& zone)
   }
 
   {
-    ReadLock l(&s_keycachelock);
-    keycache_t::const_iterator iter = s_keycache.find(zone);
-    if(iter != s_keycache.end() && iter->d_ttd > (unsigned int)time(0)) { 
-      if(iter->d_keys.empty())
-        return false;
-      else
-        return true;
+    KeyCacheShard& shard = s_keycache[getShard(zone)];
+    ReadLock l(&shard.d_lock);
+    keycache_t::const_iterator iter = shard.d_cache.find(zone);
+    CacheState state = iter != shard.d_cache.end() ? getCacheState(iter->d_ttd, s_keyttl, time(0)) : Missing;
+    if(state != Missing) {
+      s_keyhits++;
+      if(state == Stale)
+        queueRefresh(zone, "");
+      return !iter->d_keys.empty(); // unsigned zones are cached as an empty keyset
     }
-    else
-      ; 
   }  
   keyset_t keys = getKeys(zone, true); // does the cache
   
@@ -112,24 +211,27 @@ bool DNSSECKeeper::addKey(const std::string& name, bool keyOrZone, int algorithm
 }
 
 void DNSSECKeeper::clearAllCaches() {
-  {
-    WriteLock l(&s_keycachelock);
-    s_keycache.clear();
+  for(unsigned int n = 0; n < s_shardcount; ++n) {
+    {
+      WriteLock l(&s_keycache[n].d_lock);
+      s_keycache[n].d_cache.clear();
+    }
+    WriteLock l(&s_metacache[n].d_lock);
+    s_metacache[n].d_cache.clear();
   }
-  WriteLock l(&s_metacachelock);
-  s_metacache.clear();
 }
 
 void DNSSECKeeper::clearCaches(const std::string& name)
 {
+  unsigned int n = getShard(name);
   {
-    WriteLock l(&s_keycachelock);
-    s_keycache.erase(name); 
+    WriteLock l(&s_keycache[n].d_lock);
+    s_keycache[n].d_cache.erase(name); 
   }
-  WriteLock l(&s_metacachelock);
-  pair<metacache_t::iterator, metacache_t::iterator> range = s_metacache.equal_range(name);
+  WriteLock l(&s_metacache[n].d_lock);
+  pair<metacache_t::iterator, metacache_t::iterator> range = s_metacache[n].d_cache.equal_range(name);
   while(range.first != range.second)
-    s_metacache.erase(range.first++);
+    s_metacache[n].d_cache.erase(range.first++);
 }
 
 
@@ -204,14 +306,26 @@ void DNSSECKeeper::getFromMeta(const std::string& zname, const std::string& key,
   }
 
   {
-    ReadLock l(&s_metacachelock); 
+    METACacheShard& shard = s_metacache[getShard(zname)];
+    ReadLock l(&shard.d_lock); 
     
-    metacache_t::const_iterator iter = s_metacache.find(tie(zname, key));
-    if(iter != s_metacache.end() && iter->d_ttd > now) {
+    metacache_t::const_iterator iter = shard.d_cache.find(tie(zname, key));
+    CacheState state = iter != shard.d_cache.end() ? getCacheState(iter->d_ttd, s_metattl, now) : Missing;
+    if(state != Missing) {
+      s_metahits++;
+      if(state == Stale)
+        queueRefresh(zname, key);
       value = iter->d_value;
       return;
     }
   }
+  s_metamisses++;
+  value = loadMeta(zname, key);
+}
+
+string DNSSECKeeper::loadMeta(const std::string& zname, const std::string& key)
+{
+  string value;
   vector<string> meta;
   d_keymetadb->getDomainMetadata(zname, key, meta);
   if(!meta.empty())
@@ -219,13 +333,15 @@ void DNSSECKeeper::getFromMeta(const std::string& zname, const std::string& key,
     
   METACacheEntry nce;
   nce.d_domain=zname;
-  nce.d_ttd = now+60;
+  nce.d_ttd = time(0)+s_metattl;
   nce.d_key= key;
-  nce.d_value = value;
+  nce.d_value = value; // also when empty, most zones have no metadata at all
   { 
-    WriteLock l(&s_metacachelock);
-    replacing_insert(s_metacache, nce);
+    METACacheShard& shard = s_metacache[getShard(zname)];
+    WriteLock l(&shard.d_lock);
+    replacing_insert(shard.d_cache, nce);
   }
+  return value;
 }
 
 bool DNSSECKeeper::getNSEC3PARAM(const std::string& zname, NSEC3PARAMRecordContent* ns3p, bool* narrow)
@@ -296,10 +412,15 @@ DNSSECKeeper::keyset_t DNSSECKeeper::getKeys(const std::string& zone, boost::tri
   }
 
   {
-    ReadLock l(&s_keycachelock);
-    keycache_t::const_iterator iter = s_keycache.find(zone);
+    KeyCacheShard& shard = s_keycache[getShard(zone)];
+    ReadLock l(&shard.d_lock);
+    keycache_t::const_iterator iter = shard.d_cache.find(zone);
+    CacheState state = iter != shard.d_cache.end() ? getCacheState(iter->d_ttd, s_keyttl, now) : Missing;
       
-    if(iter != s_keycache.end() && iter->d_ttd > now) { 
+    if(state != Missing) { 
+      s_keyhits++;
+      if(state == Stale)
+        queueRefresh(zone, "");
       keyset_t ret;
       BOOST_FOREACH(const keyset_t::value_type& value, iter->d_keys) {
         if(boost::indeterminate(allOrKeyOrZone) || allOrKeyOrZone == value.second.keyOrZone)
@@ -308,7 +429,19 @@ DNSSECKeeper::keyset_t DNSSECKeeper::getKeys(const std::string& zone, boost::tri
       return ret;
     }
   }    
-  keyset_t retkeyset, allkeyset;
+  s_keymisses++;
+
+  keyset_t retkeyset;
+  BOOST_FOREACH(const keyset_t::value_type& value, loadKeys(zone)) {
+    if(boost::indeterminate(allOrKeyOrZone) || allOrKeyOrZone == value.second.keyOrZone)
+      retkeyset.push_back(value);
+  }
+  return retkeyset;
+}
+
+DNSSECKeeper::keyset_t DNSSECKeeper::loadKeys(const std::string& zone)
+{
+  keyset_t allkeyset;
   vector<UeberBackend::KeyData> dbkeyset;
   
   d_keymetadb->getDomainKeys(zone, 0, dbkeyset);
@@ -332,23 +465,21 @@ DNSSECKeeper::keyset_t DNSSECKeeper::getKeys(const std::string& zone, boost::tri
     kmd.keyOrZone = (kd.flags == 257);
     kmd.id = kd.id;
     
-    if(boost::indeterminate(allOrKeyOrZone) || allOrKeyOrZone == kmd.keyOrZone)
-      retkeyset.push_back(make_pair(dpk, kmd));
     allkeyset.push_back(make_pair(dpk, kmd));
   }
-  sort(retkeyset.begin(), retkeyset.end(), keyCompareByKindAndID);
   sort(allkeyset.begin(), allkeyset.end(), keyCompareByKindAndID);
   
   KeyCacheEntry kce;
   kce.d_domain=zone;
   kce.d_keys = allkeyset;
-  kce.d_ttd = now + 30;
+  kce.d_ttd = time(0) + s_keyttl;
   {
-    WriteLock l(&s_keycachelock);
-    replacing_insert(s_keycache, kce);
+    KeyCacheShard& shard = s_keycache[getShard(zone)];
+    WriteLock l(&shard.d_lock);
+    replacing_insert(shard.d_cache, kce);
   }
   
-  return retkeyset;
+  return allkeyset;
 }
 
 bool DNSSECKeeper::secureZone(const std::string& name, int algorithm, int size)
@@ -420,13 +551,14 @@ void DNSSECKeeper::cleanup()
   Utility::gettimeofday(&now, 0);
 
   if(now.tv_sec - s_last_prune > (time_t)(30)) {
-    {
-        WriteLock l(&s_metacachelock);
-        pruneCollection(s_metacache, ::arg().asNum("max-cache-entries"));
-    }
-    {
-        WriteLock l(&s_keycachelock);
-        pruneCollection(s_keycache, ::arg().asNum("max-cache-entries"));
+    unsigned int maxentries = ::arg().asNum("max-cache-entries") / s_shardcount + 1;
+    for(unsigned int n = 0; n < s_shardcount; ++n) {
+      {
+        WriteLock l(&s_metacache[n].d_lock);
+        pruneCollection(s_metacache[n].d_cache, maxentries);
+      }
+      WriteLock l(&s_keycache[n].d_lock);
+      pruneCollection(s_keycache[n].d_cache, maxentries);
     }
     s_last_prune=time(0);
   }
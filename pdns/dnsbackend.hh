@@ -81,6 +81,17 @@ struct DomainInfo
 
 };
 
+//! A record for DNSBackend::feedRecords, with the NSEC or NSEC3 ordername it gets, if any
+struct FeedRecord
+{
+  FeedRecord(const DNSResourceRecord& rr_) : rr(rr_), hasOrdername(false) {}
+  FeedRecord(const DNSResourceRecord& rr_, const string& ordername_) : rr(rr_), ordername(ordername_), hasOrdername(true) {}
+
+  DNSResourceRecord rr;
+  string ordername;
+  bool hasOrdername;
+};
+
 struct TSIGKey {
    std::string name;
    std::string algorithm;
@@ -139,6 +150,7 @@ public:
   virtual bool setDomainMetadata(const string& name, const std::string& kind, const std::vector<std::string>& meta) {return false;}
 
   virtual void getAllDomains(vector<DomainInfo> *domains) { }
+  virtual bool listsAllDomains() { return false; } //!< true if getAllDomains() returns every zone this backend serves
 
   struct KeyData {
     unsigned int id;
@@ -241,6 +253,16 @@ public:
   {
     return false; // no problem!
   }
+  //! feeds many records at once, needs a call to startTransaction first. The default feeds them one by one
+  virtual bool feedRecords(const vector<FeedRecord>& records)
+  {
+    for(vector<FeedRecord>::const_iterator i=records.begin(); i!=records.end(); ++i) {
+      string ordername(i->ordername);
+      if(!feedRecord(i->rr, i->hasOrdername ? &ordername : 0))
+        return false;
+    }
+    return true;
+  }
   virtual bool feedEnts(int domain_id, set<string> &nonterm)
   {
     return false;
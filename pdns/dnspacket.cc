@@ -48,6 +48,10 @@
 bool DNSPacket::s_doEDNSSubnetProcessing;
 std::vector<int> DNSPacket::s_ednssubnetcodes;
 uint16_t DNSPacket::s_udpTruncationThreshold;
+
+// replies are created and released by the same distributor thread, so each thread keeps a few around for the next
+// question instead of going through malloc for the packet, its record vector and its buffers every time
+static __thread vector<DNSPacket*>* t_packetpool;
  
 DNSPacket::DNSPacket() 
 {
@@ -177,14 +181,6 @@ void DNSPacket::addRecord(const DNSResourceRecord &rr)
 
 
 
-static int rrcomp(const DNSResourceRecord &A, const DNSResourceRecord &B)
-{
-  if(A.d_place < B.d_place)
-    return 1;
-
-  return 0;
-}
-
 vector<DNSResourceRecord*> DNSPacket::getAPRecords()
 {
   vector<DNSResourceRecord*> arrs;
@@ -236,7 +232,7 @@ bool DNSPacket::couldBeCached()
 unsigned int DNSPacket::getMinTTL()
 {
   unsigned int minttl = UINT_MAX;
-  BOOST_FOREACH(DNSResourceRecord rr, d_rrs) {
+  BOOST_FOREACH(const DNSResourceRecord& rr, d_rrs) {
   if (rr.ttl < minttl)
       minttl = rr.ttl;
   }
@@ -258,22 +254,16 @@ void DNSPacket::wrapup()
     return;
   }
 
-  DNSResourceRecord rr;
   vector<DNSResourceRecord>::iterator pos;
 
   // we now need to order rrs so that the different sections come at the right place
-  // we want a stable sort, based on the d_place field
+  // we want a stable order, based on the d_place field. d_rrs itself stays as it is, we write out the records via d_rrorder
 
-  stable_sort(d_rrs.begin(),d_rrs.end(), rrcomp);
   static bool mustNotShuffle = ::arg().mustDo("no-shuffle");
-
-  if(!d_tcp && !mustNotShuffle) {
-    shuffle(d_rrs);
-  }
+  orderAndShuffle(d_rrs, d_rrorder, !d_tcp && !mustNotShuffle);
   d_wrapped=true;
 
-  vector<uint8_t> packet;
-  DNSPacketWriter pw(packet, qdomain, qtype.getCode(), qclass);
+  DNSPacketWriter pw(d_packetbuffer, qdomain, qtype.getCode(), qclass);
 
   pw.getHeader()->rcode=d.rcode;
   pw.getHeader()->opcode = d.opcode;
@@ -297,7 +287,8 @@ void DNSPacket::wrapup()
   if(!d_rrs.empty() || !opts.empty() || d_haveednssubnet || d_haveednssection) {
     try {
       uint8_t maxScopeMask=0;
-      for(pos=d_rrs.begin(); pos < d_rrs.end(); ++pos) {
+      for(vector<unsigned int>::const_iterator place=d_rrorder.begin(); place != d_rrorder.end(); ++place) {
+        pos=d_rrs.begin() + *place;
         maxScopeMask = max(maxScopeMask, pos->scopeMask);
         // this needs to deal with the 'prio' mismatch:
         if(pos->qtype.getCode()==QType::MX || pos->qtype.getCode() == QType::SRV) {  
@@ -352,7 +343,7 @@ void DNSPacket::wrapup()
   if(!d_trc.d_algoName.empty())
     addTSIG(pw, &d_trc, d_tsigkeyname, d_tsigsecret, d_tsigprevious, d_tsigtimersonly);
   
-  d_rawpacket.assign((char*)&packet[0], packet.size());
+  d_rawpacket.assign((char*)&d_packetbuffer[0], d_packetbuffer.size());
 }
 
 void DNSPacket::setQuestion(int op, const string &qd, int newqtype)
@@ -368,10 +359,17 @@ void DNSPacket::setQuestion(int op, const string &qd, int newqtype)
   qtype=newqtype;
 }
 
-/** convenience function for creating a reply packet from a question packet. Do not forget to delete it after use! */
+/** convenience function for creating a reply packet from a question packet. Do not forget to release() it after use! */
 DNSPacket *DNSPacket::replyPacket() const
 {
-  DNSPacket *r=new DNSPacket;
+  DNSPacket *r;
+  if(t_packetpool && !t_packetpool->empty()) {
+    r=t_packetpool->back();
+    t_packetpool->pop_back();
+  }
+  else
+    r=new DNSPacket;
+
   r->setSocket(d_socket);
   r->d_anyLocal=d_anyLocal;
   r->setRemote(&d_remote);
@@ -408,6 +406,48 @@ DNSPacket *DNSPacket::replyPacket() const
   return r;
 }
 
+void DNSPacket::release(DNSPacket* p)
+{
+  if(!p)
+    return;
+
+  if(!t_packetpool)
+    t_packetpool=new vector<DNSPacket*>;
+
+  // don't hang on to the odd giant packet
+  if(t_packetpool->size() >= s_maxpooled || p->d_rrs.capacity() > 1024 || p->d_packetbuffer.capacity() > 65535) {
+    delete p;
+    return;
+  }
+  p->reset();
+  t_packetpool->push_back(p);
+}
+
+void DNSPacket::reset()
+{
+  d_wrapped=false;
+  d_compress=true;
+  d_tcp=false;
+  d_wantsnsid=false;
+  d_haveednssubnet=false;
+  d_haveednssection=false;
+  d_dnssecOk=false;
+  d_havetsig=false;
+  d_tsigtimersonly=false;
+  d_anyLocal.reset();
+  qdomain.clear();
+  d_ednsping.clear();
+  d_eso=EDNSSubnetOpts();
+  d_trc=TSIGRecordContent();
+  d_tsigsecret.clear();
+  d_tsigkeyname.clear();
+  d_tsigprevious.clear();
+
+  // clear() keeps the capacity, which is the whole point
+  d_rrs.clear();
+  d_rawpacket.clear();
+}
+
 void DNSPacket::spoofQuestion(const DNSPacket *qd)
 {
   d_wrapped=true; // if we do this, don't later on wrapup
@@ -450,24 +490,21 @@ void DNSPacket::setTSIGDetails(const TSIGRecordContent& tr, const string& keynam
 
 bool DNSPacket::getTSIGDetails(TSIGRecordContent* trc, string* keyname, string* message) const
 {
-  MOADNSParser mdp(d_rawpacket);
+  DNSPacketView mdp(d_rawpacket.c_str(), d_rawpacket.size());
 
-  if(!mdp.getTSIGPos()) 
+  const DNSPacketView::Record* tsig=mdp.getTSIG();
+  if(!tsig)
     return false;
-  
-  bool gotit=false;
-  for(MOADNSParser::answers_t::const_iterator i=mdp.d_answers.begin(); i!=mdp.d_answers.end(); ++i) {          
-    if(i->first.d_type == QType::TSIG) {
-      *trc = *boost::dynamic_pointer_cast<TSIGRecordContent>(i->first.d_content);
-      
-      gotit=true;
-      *keyname = i->first.d_label;
-      if(!keyname->empty())
-        keyname->resize(keyname->size()-1); // drop the trailing dot
-    }
-  }
-  if(!gotit)
+
+  shared_ptr<TSIGRecordContent> content=boost::dynamic_pointer_cast<TSIGRecordContent>(mdp.getContent(*tsig));
+  if(!content)
     return false;
+  *trc = *content;
+
+  mdp.getName(tsig->d_nameoffset, *keyname);
+  if(!keyname->empty())
+    keyname->resize(keyname->size()-1); // drop the trailing dot
+
   if(message)
     *message = makeTSIGMessageFromTSIGPacket(d_rawpacket, mdp.getTSIGPos(), *keyname, *trc, d_tsigprevious, false); // if you change rawpacket to getString it breaks!
   
@@ -489,7 +526,7 @@ try
     return -1;
   }
 
-  MOADNSParser mdp(d_rawpacket);
+  DNSPacketView mdp(d_rawpacket.c_str(), d_rawpacket.size()); // d_rawpacket outlives it
   EDNSOpts edo;
 
   // ANY OPTION WHICH *MIGHT* BE SET DOWN BELOW SHOULD BE CLEARED FIRST!
@@ -535,7 +572,7 @@ try
   }
 
   memcpy((void *)&d,(const void *)d_rawpacket.c_str(),12);
-  qdomain=mdp.d_qname;
+  mdp.getQName(qdomain);
   if(!qdomain.empty()) // strip dot
     boost::erase_tail(qdomain, 1);
 
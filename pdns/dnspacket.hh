@@ -126,6 +126,7 @@ public:
   void setCompress(bool compress);
 
   DNSPacket *replyPacket() const; //!< convenience function that creates a virgin answer packet to this question
+  static void release(DNSPacket* p); //!< done with a packet from replyPacket(), keeps it for reuse by this thread or deletes it
 
   void commitD(); //!< copies 'd' into the stringbuffer
   unsigned int getMaxReplyLen(); //!< retrieve the maximum length of the packet we should send in response
@@ -157,6 +158,9 @@ public:
   static std::vector<int> s_ednssubnetcodes;
 private:
   void pasteQ(const char *question, int length); //!< set the question of this packet, useful for crafting replies
+  void reset(); //!< back to what the constructor made of us, but holding on to the memory we have
+
+  static const unsigned int s_maxpooled = 16; //!< packets kept around per thread
 
   bool d_wrapped; // 1
   bool d_compress; // 1
@@ -178,6 +182,8 @@ private:
   bool d_tsigtimersonly;
 
   vector<DNSResourceRecord> d_rrs; // 4
+  vector<uint8_t> d_packetbuffer; // scratch space for wrapup(), kept to save on allocations
+  vector<unsigned int> d_rrorder; // ditto
 };
 
 
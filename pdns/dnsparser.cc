@@ -310,6 +310,192 @@ void MOADNSParser::init(const char *packet, unsigned int len)
 }
 
 
+DNSPacketView::DNSPacketView(const char *packet, unsigned int len)
+  : d_qclass(0), d_qtype(0), d_packet(packet), d_len(len), d_numrecords(0), d_qnameoffset(0), d_tsigPos(0), d_haveopt(false)
+{
+  if(len < sizeof(dnsheader))
+    throw MOADNSException("Packet shorter than minimal header");
+  if(len > 65535)
+    throw MOADNSException("Packet larger than 65535 bytes");
+
+  memcpy(&d_header, packet, sizeof(dnsheader));
+
+  if(d_header.opcode != Opcode::Query && d_header.opcode != Opcode::Notify && d_header.opcode != Opcode::Update)
+    throw MOADNSException("Can't parse non-query packet with opcode="+ lexical_cast<string>(d_header.opcode));
+
+  d_header.qdcount=ntohs(d_header.qdcount);
+  d_header.ancount=ntohs(d_header.ancount);
+  d_header.nscount=ntohs(d_header.nscount);
+  d_header.arcount=ntohs(d_header.arcount);
+
+  unsigned int pos=sizeof(dnsheader);
+  unsigned int n=0;
+  bool validPacket=false;
+  try {
+    for(n=0; n < d_header.qdcount; ++n) {
+      d_qnameoffset=pos;
+      pos=skipName(pos);
+      d_qtype=get16BitInt(pos);
+      d_qclass=get16BitInt(pos+2);
+      pos+=4;
+    }
+
+    validPacket=true;
+    Record rec;
+    for(n=0; n < (unsigned int)(d_header.ancount + d_header.nscount + d_header.arcount); ++n) {
+      if(n < d_header.ancount)
+        rec.d_place=DNSRecord::Answer;
+      else if(n < d_header.ancount + d_header.nscount)
+        rec.d_place=DNSRecord::Nameserver;
+      else
+        rec.d_place=DNSRecord::Additional;
+
+      unsigned int recordStartPos=pos;
+      rec.d_nameoffset=pos;
+      pos=skipName(pos);
+      rec.d_type=get16BitInt(pos);
+      rec.d_class=get16BitInt(pos+2);
+      rec.d_ttl=((uint32_t)get16BitInt(pos+4) << 16) + get16BitInt(pos+6);
+      rec.d_clen=get16BitInt(pos+8);
+      pos+=sizeof(dnsrecordheader);
+      if(pos + rec.d_clen > d_len)
+        throw std::out_of_range("DNSPacketView record content beyond end of packet");
+      rec.d_contentoffset=pos;
+      pos+=rec.d_clen;
+
+      // parse what MOADNSParser would, so a packet it rejects is rejected here too. Queries hardly
+      // carry anything besides OPT, whose options getEDNSOpts() checks when it reads them
+      shared_ptr<DNSRecordContent> content;
+      if(rec.d_place == DNSRecord::Additional && rec.d_type == QType::OPT) {
+        string name;
+        getName(rec.d_nameoffset, name);
+      }
+      else
+        content=getContent(rec);
+
+      if(d_numrecords < s_maxrecords)
+        d_records[d_numrecords++]=rec;
+
+      if(!d_haveopt && rec.d_place == DNSRecord::Additional && rec.d_type == QType::OPT) {
+        d_opt=rec;
+        d_haveopt=true;
+      }
+      if(rec.d_type == QType::TSIG && rec.d_class == 0xff) {
+        d_tsig=rec;
+        d_tsigPos=recordStartPos;
+        d_tsigcontent=content; // so checking the signature doesn't parse it again
+      }
+    }
+  }
+  catch(std::out_of_range &re) {
+    if(validPacket && d_header.tc) { // same leniency as MOADNSParser
+      if(n < d_header.ancount) {
+        d_header.ancount=n; d_header.nscount = d_header.arcount = 0;
+      }
+      else if(n < d_header.ancount + d_header.nscount) {
+        d_header.nscount = n - d_header.ancount; d_header.arcount=0;
+      }
+      else {
+        d_header.arcount = n - d_header.ancount - d_header.nscount;
+      }
+    }
+    else {
+      throw MOADNSException("Error parsing packet of "+lexical_cast<string>(len)+" bytes (rd="+
+                            lexical_cast<string>(d_header.rd)+
+                            "), out of bounds: "+string(re.what()));
+    }
+  }
+}
+
+//! returns the position just beyond the name at pos, without following compression pointers
+unsigned int DNSPacketView::skipName(unsigned int pos) const
+{
+  for(;;) {
+    uint8_t labellen=at(pos++);
+    if(!labellen)
+      return pos;
+    if((labellen & 0xc0) == 0xc0) {
+      at(pos); // second byte of the pointer must be there, where it points is checked when somebody asks
+      return pos+1;
+    }
+    pos+=labellen; // the next at() checks these were all in the packet
+  }
+}
+
+void DNSPacketView::getQName(string& qname) const
+{
+  if(d_header.qdcount)
+    getName(d_qnameoffset, qname);
+  else
+    qname.clear();
+}
+
+// produces exactly what PacketReader::getLabelFromContent does
+void DNSPacketView::getName(uint16_t offset, string& ret) const
+{
+  ret.clear();
+  unsigned int pos=offset;
+  for(;;) {
+    uint8_t labellen=at(pos++);
+
+    if(!labellen) {
+      if(ret.empty())
+        ret.append(1,'.');
+      return;
+    }
+    if((labellen & 0xc0) == 0xc0) {
+      unsigned int target=256*(labellen & ~0xc0) + at(pos);
+      if(target < sizeof(dnsheader) || target >= pos-1) // only ever backwards, so this terminates
+        throw MOADNSException("forward reference during label decompression");
+      pos=target;
+      continue;
+    }
+    ret.reserve(ret.size() + labellen + 2);
+    for(unsigned int n = 0; n < labellen; ++n, ++pos) {
+      char c=(char)at(pos);
+      if(c=='.' || c=='\\') {
+        ret.append(1, '\\');
+        ret.append(1, c);
+      }
+      else if(c==' ') {
+        ret+="\\032";
+      }
+      else
+        ret.append(1, c);
+    }
+    ret.append(1,'.');
+  }
+}
+
+shared_ptr<DNSRecordContent> DNSPacketView::getContent(const Record& rec) const
+{
+  if(d_tsigcontent && rec.d_contentoffset == d_tsig.d_contentoffset)
+    return d_tsigcontent;
+
+  if(d_content.empty()) // copied once, the first time a record needs it
+    d_content.assign(d_packet + sizeof(dnsheader), d_packet + d_len);
+  PacketReader pr(d_content);
+  pr.d_pos=rec.d_contentoffset - sizeof(dnsrecordheader) - sizeof(dnsheader);
+
+  struct dnsrecordheader ah;
+  pr.getDnsrecordheader(ah);
+
+  DNSRecord dr;
+  getName(rec.d_nameoffset, dr.d_label);
+  dr.d_type=ah.d_type;
+  dr.d_class=ah.d_class;
+  dr.d_ttl=ah.d_ttl;
+  dr.d_clen=ah.d_clen;
+  if(rec.d_place == DNSRecord::Answer)
+    dr.d_place=DNSRecord::Answer;
+  else if(rec.d_place == DNSRecord::Nameserver)
+    dr.d_place=DNSRecord::Nameserver;
+  else
+    dr.d_place=DNSRecord::Additional;
+
+  return shared_ptr<DNSRecordContent>(DNSRecordContent::mastermake(dr, pr, d_header.opcode));
+}
+
 void PacketReader::getDnsrecordheader(struct dnsrecordheader &ah)
 {
   unsigned int n;
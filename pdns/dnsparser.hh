@@ -343,6 +343,91 @@ private:
   uint16_t d_tsigPos;
 };
 
+/** Non-owning counterpart of MOADNSParser for the query paths. It notes where the question and the records are
+    and only builds names and record contents when asked for them. Records other than OPT are still parsed once
+    and thrown away, so malformed packets fail the same way as with MOADNSParser; queries rarely have any.
+    Parsing needs a copy of the packet, which is made once the first record needs it.
+    The packet has to stay around for as long as the view is used. */
+class DNSPacketView : public boost::noncopyable
+{
+public:
+  struct Record
+  {
+    uint16_t d_nameoffset;    //!< from the start of the packet, so compression pointers can be followed as they are
+    uint16_t d_type, d_class;
+    uint32_t d_ttl;
+    uint16_t d_contentoffset; //!< also from the start of the packet
+    uint16_t d_clen;
+    uint8_t d_place;          //!< DNSRecord::Answer, Nameserver or Additional
+  };
+
+  DNSPacketView(const char *packet, unsigned int len);
+
+  dnsheader d_header;         //!< counts are in host byte order, like in MOADNSParser
+  uint16_t d_qclass, d_qtype;
+
+  void getQName(string& qname) const; //!< with the trailing dot, like MOADNSParser::d_qname
+  void getName(uint16_t offset, string& name) const;
+  //! builds the DNSRecordContent for one record, this is where the copying and allocating happens. The packet is
+  //! copied only the first time, and the TSIG record the constructor parsed is handed out again
+  shared_ptr<DNSRecordContent> getContent(const Record& rec) const;
+  const char* getContentData(const Record& rec) const //!< d_clen raw bytes
+  {
+    return d_packet + rec.d_contentoffset;
+  }
+
+  //! only the first few records are indexed, OPT and TSIG are always found
+  unsigned int size() const
+  {
+    return d_numrecords;
+  }
+  bool complete() const
+  {
+    return d_numrecords == (unsigned int)d_header.ancount + d_header.nscount + d_header.arcount;
+  }
+  const Record& operator[](unsigned int n) const
+  {
+    return d_records[n];
+  }
+  const Record* getOPT() const
+  {
+    return d_haveopt ? &d_opt : 0;
+  }
+  const Record* getTSIG() const
+  {
+    return d_tsigPos ? &d_tsig : 0;
+  }
+  uint16_t getTSIGPos() const
+  {
+    return d_tsigPos;
+  }
+
+private:
+  enum { s_maxrecords = 16 };
+  unsigned int skipName(unsigned int pos) const;
+  uint8_t at(unsigned int pos) const
+  {
+    if(pos >= d_len)
+      throw std::out_of_range("DNSPacketView access beyond end of packet");
+    return (uint8_t)d_packet[pos];
+  }
+  uint16_t get16BitInt(unsigned int pos) const
+  {
+    return 256 * at(pos) + at(pos+1);
+  }
+
+  const char *d_packet;
+  unsigned int d_len;
+  Record d_records[s_maxrecords];
+  Record d_opt, d_tsig;
+  unsigned int d_numrecords;
+  uint16_t d_qnameoffset;
+  uint16_t d_tsigPos;
+  bool d_haveopt;
+  mutable vector<uint8_t> d_content; //!< the packet past the header, for PacketReader
+  shared_ptr<DNSRecordContent> d_tsigcontent;
+};
+
 string simpleCompress(const string& label, const string& root="");
 void simpleExpandTo(const string& label, unsigned int frompos, string& ret);
 void ageDNSPacket(std::string& packet, uint32_t seconds);
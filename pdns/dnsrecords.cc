@@ -473,6 +473,40 @@ bool getEDNSOpts(const MOADNSParser& mdp, EDNSOpts* eo)
   return false;
 }
 
+bool getEDNSOpts(const DNSPacketView& view, EDNSOpts* eo)
+{
+  const DNSPacketView::Record* opt=view.getOPT();
+  if(!opt)
+    return false;
+
+  eo->d_packetsize=opt->d_class;
+
+  EDNS0Record stuff;
+  uint32_t ttl=ntohl(opt->d_ttl);
+  memcpy(&stuff, &ttl, sizeof(stuff));
+
+  eo->d_extRCode=stuff.extRCode;
+  eo->d_version=stuff.version;
+  eo->d_Z = ntohs(stuff.Z);
+
+  // same walk as OPTRecordContent::getData, straight from the packet
+  const unsigned char* data=(const unsigned char*)view.getContentData(*opt);
+  unsigned int pos=0;
+  uint16_t code, len;
+  while(opt->d_clen >= 4 + pos) {
+    code = 256 * data[pos] + data[pos+1];
+    len = 256 * data[pos+2] + data[pos+3];
+    pos+=4;
+
+    if(pos + len > opt->d_clen)
+      break;
+
+    eo->d_options.push_back(make_pair(code, string((const char*)data + pos, len)));
+    pos+=len;
+  }
+  return true;
+}
+
 
 void reportBasicTypes()
 {
@@ -605,6 +605,8 @@ struct EDNSOpts
 
 class MOADNSParser;
 bool getEDNSOpts(const MOADNSParser& mdp, EDNSOpts* eo);
+class DNSPacketView;
+bool getEDNSOpts(const DNSPacketView& view, EDNSOpts* eo);
 
 void reportBasicTypes();
 void reportOtherTypes();
@@ -94,6 +94,16 @@ void DNSCryptoKeyEngine::report(unsigned int algo, maker_t* maker, bool fallback
   getMakers()[algo]=maker;
 }
 
+std::vector<std::string> DNSCryptoKeyEngine::signBatch(const std::vector<std::string>& msgs) const
+{
+  std::vector<std::string> ret;
+  ret.reserve(msgs.size());
+  BOOST_FOREACH(const std::string& msg, msgs) {
+    ret.push_back(sign(msg));
+  }
+  return ret;
+}
+
 void DNSCryptoKeyEngine::testAll()
 {
   BOOST_FOREACH(const allmakers_t::value_type& value, getAllMakers())
@@ -196,6 +206,15 @@ pair<unsigned int, unsigned int> DNSCryptoKeyEngine::testMakers(unsigned int alg
   else {
     throw runtime_error("Verification of creator "+dckeCreate->getName()+" with signer "+dckeSign->getName()+" and verifier "+dckeVerify->getName()+" failed");
   }
+
+  vector<string> messages, signatures;
+  for(unsigned int n = 0; n < 10; ++n)
+    messages.push_back(message + lexical_cast<string>(n));
+  signatures = dckeSign->signBatch(messages);
+  for(unsigned int n = 0; n < messages.size(); ++n) {
+    if(n >= signatures.size() || !dckeVerify->verify(messages[n], signatures[n]))
+      throw runtime_error("Verification of batch signatures of creator "+dckeCreate->getName()+" with signer "+dckeSign->getName()+" and verifier "+dckeVerify->getName()+" failed");
+  }
   return make_pair(udiffSign, udiffVerify);
 }
 
@@ -330,14 +349,18 @@ std::string hashQNameWithSalt(unsigned int times, const std::string& salt, const
 
 //  cerr<<makeHexDump(toHash)<<endl;
   unsigned char hash[20];
-  for(;;) {
-    sha1((unsigned char*)toHash.c_str(), toHash.length(), hash);
-    if(!times--) 
-      break;
-    toHash.assign((char*)hash, sizeof(hash));
-    toHash.append(salt);
-  }
-  return string((char*)hash, sizeof(hash));
+  sha1((unsigned char*)toHash.c_str(), toHash.length(), hash);
+  if(!times)
+    return string((char*)hash, sizeof(hash));
+
+  // every further iteration hashes the previous hash plus the salt, so keep both in one buffer and hash in place
+  vector<unsigned char> buf(sizeof(hash) + salt.size());
+  memcpy(&buf[0], hash, sizeof(hash));
+  if(!salt.empty())
+    memcpy(&buf[sizeof(hash)], salt.c_str(), salt.size());
+  while(times--)
+    sha1(&buf[0], buf.size(), &buf[0]); // polarssl reads all input before it writes the digest
+  return string((char*)&buf[0], sizeof(hash));
 }
 DNSKEYRecordContent DNSSECPrivateKey::getDNSKEY() const
 {
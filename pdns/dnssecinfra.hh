@@ -22,6 +22,8 @@ class DNSCryptoKeyEngine
     virtual storvector_t convertToISCVector() const =0;
     std::string convertToISC() const ;
     virtual std::string sign(const std::string& msg) const =0;
+    //! signs all of msgs, engines that have per signature setup to do override this to only do it once
+    virtual std::vector<std::string> signBatch(const std::vector<std::string>& msgs) const;
     virtual std::string hash(const std::string& msg) const =0;
     virtual bool verify(const std::string& msg, const std::string& signature) const =0;
     
@@ -117,6 +119,16 @@ class DNSSECKeeper;
 struct DNSSECPrivateKey;
 
 void fillOutRRSIG(DNSSECPrivateKey& dpk, const std::string& signQName, RRSIGRecordContent& rrc, vector<shared_ptr<DNSRecordContent> >& toSign);
+
+struct SignatureCacheStats
+{
+  unsigned int hits, misses, evictions, entries;
+  uint64_t bytes;
+};
+
+void setSignatureCacheSize(uint64_t maxbytes);
+SignatureCacheStats getSignatureCacheStats();
+unsigned int purgeSignatureCache(); //!< returns the number of signatures dropped
 uint32_t getStartOfWeek();
 void addSignature(DNSSECKeeper& dk, DNSBackend& db, const std::string& signer, const std::string signQName, const std::string& wildcardname, uint16_t signQType, uint32_t signTTL, DNSPacketWriter::Place signPlace, 
   vector<shared_ptr<DNSRecordContent> >& toSign, vector<DNSResourceRecord>& outsigned, uint32_t origTTL);
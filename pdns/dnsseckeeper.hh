@@ -105,6 +105,19 @@ public:
   }
   
   void getFromMeta(const std::string& zname, const std::string& key, std::string& value);
+
+  struct CacheStats
+  {
+    unsigned int keyHits, keyMisses, keyEntries;
+    unsigned int metaHits, metaMisses, metaEntries;
+    unsigned int refreshes;
+  };
+
+  static void setCacheTTLs(unsigned int keyttl, unsigned int metattl);
+  static CacheStats getCacheStats();
+  /** starts the thread that reloads keys and metadata about to expire, from then on lookups keep serving
+      the previous value while that happens instead of waiting for the backend themselves */
+  static void startRefresher();
 private:
 
   
@@ -156,14 +169,47 @@ private:
     >
   > metacache_t;
 
-  void cleanup();
+  struct KeyCacheShard
+  {
+    KeyCacheShard()
+    {
+      pthread_rwlock_init(&d_lock, 0);
+    }
+    keycache_t d_cache;
+    pthread_rwlock_t d_lock;
+  };
 
-  static keycache_t s_keycache;
-  static metacache_t s_metacache;
-  static pthread_rwlock_t s_metacachelock;
-  static pthread_rwlock_t s_keycachelock;
+  struct METACacheShard
+  {
+    METACacheShard()
+    {
+      pthread_rwlock_init(&d_lock, 0);
+    }
+    metacache_t d_cache;
+    pthread_rwlock_t d_lock;
+  };
+
+  enum CacheState { Missing, Fresh, Stale }; //!< Stale means serve it, but have it reloaded
+
+  void cleanup();
+  keyset_t loadKeys(const std::string& zone);
+  string loadMeta(const std::string& zname, const std::string& key);
+  static CacheState getCacheState(unsigned int ttd, unsigned int ttl, unsigned int now);
+  static void queueRefresh(const std::string& zname, const std::string& key); //!< empty key means the keys
+  static void* refresherThread(void*);
+  static unsigned int getShard(const std::string& zname);
+
+  static const unsigned int s_shardcount = 16;
+  static KeyCacheShard s_keycache[s_shardcount];
+  static METACacheShard s_metacache[s_shardcount];
   static AtomicCounter s_ops;
   static time_t s_last_prune;
+  static unsigned int s_keyttl, s_metattl;
+  static AtomicCounter s_keyhits, s_keymisses, s_metahits, s_metamisses, s_refreshes;
+
+  static set<pair<string, string> > s_refreshqueue;
+  static pthread_mutex_t s_refreshlock;
+  static bool s_refresher;
 };
 
 class DNSPacket;
@@ -24,18 +24,16 @@
 #include <boost/foreach.hpp>
 #include "md5.hh"
 #include "dnsseckeeper.hh"
-#include "dns_random.hh"
 #include "lock.hh"
+#include "cachecleaner.hh"
+#include "statbag.hh"
+#include <boost/multi_index/hashed_index.hpp>
 
-/* this is where the RRSIGs begin, keys are retrieved,
-   but the actual signing happens in fillOutRRSIG */
-int getRRSIGsForRRSET(DNSSECKeeper& dk, const std::string& signer, const std::string signQName, uint16_t signQType, uint32_t signTTL, 
-                     vector<shared_ptr<DNSRecordContent> >& toSign, vector<RRSIGRecordContent>& rrcs, bool ksk)
+extern StatBag S;
+
+static void fillOutRRSIGTemplate(RRSIGRecordContent& rrc, const std::string& signer, const std::string& signQName, uint16_t signQType, uint32_t signTTL)
 {
-  if(toSign.empty())
-    return -1;
   uint32_t startOfWeek = getStartOfWeek();
-  RRSIGRecordContent rrc;
   rrc.d_type=signQType;
 
   rrc.d_labels=countLabels(signQName); 
@@ -44,17 +42,16 @@ int getRRSIGsForRRSET(DNSSECKeeper& dk, const std::string& signer, const std::st
   rrc.d_sigexpire=startOfWeek + 14*86400;
   rrc.d_signer = signer.empty() ? "." : toLower(signer);
   rrc.d_tag = 0;
-  
-  // we sign the RRSET in toSign + the rrc w/o hash
-  
+}
+
+// if ksk==1, only get KSKs
+// if ksk==0, get ZSKs, unless there is no ZSK, then get KSK
+static void getSigningKeys(DNSSECKeeper& dk, const std::string& signer, bool ksk, vector<DNSSECPrivateKey>& signingKeys)
+{
   DNSSECKeeper::keyset_t keys = dk.getKeys(signer); // we don't want the . for the root!
   vector<DNSSECPrivateKey> KSKs, ZSKs;
-  vector<DNSSECPrivateKey>* signingKeys;
   
-  // if ksk==1, only get KSKs
-  // if ksk==0, get ZSKs, unless there is no ZSK, then get KSK
   BOOST_FOREACH(DNSSECKeeper::keyset_t::value_type& keymeta, keys) {
-    rrc.d_algorithm = keymeta.first.d_algorithm;
     if(!keymeta.second.active) 
       continue;
       
@@ -63,22 +60,51 @@ int getRRSIGsForRRSET(DNSSECKeeper& dk, const std::string& signer, const std::st
     else if(!ksk)
       ZSKs.push_back(keymeta.first);
   }
-  if(ksk)
-    signingKeys = &KSKs;
-  else {
-    if(ZSKs.empty())
-      signingKeys = &KSKs;
-    else
-      signingKeys =&ZSKs;
-  }
+  if(ksk || ZSKs.empty())
+    signingKeys.swap(KSKs);
+  else
+    signingKeys.swap(ZSKs);
+}
+
+/* this is where the RRSIGs begin, keys are retrieved,
+   but the actual signing happens in fillOutRRSIG */
+int getRRSIGsForRRSET(DNSSECKeeper& dk, const std::string& signer, const std::string signQName, uint16_t signQType, uint32_t signTTL, 
+                     vector<shared_ptr<DNSRecordContent> >& toSign, vector<RRSIGRecordContent>& rrcs, bool ksk)
+{
+  if(toSign.empty())
+    return -1;
+  RRSIGRecordContent rrc;
+  fillOutRRSIGTemplate(rrc, signer, signQName, signQType, signTTL);
   
-  BOOST_FOREACH(DNSSECPrivateKey& dpk, *signingKeys) {
+  // we sign the RRSET in toSign + the rrc w/o hash
+  vector<DNSSECPrivateKey> signingKeys;
+  getSigningKeys(dk, signer, ksk, signingKeys);
+  
+  BOOST_FOREACH(DNSSECPrivateKey& dpk, signingKeys) {
     fillOutRRSIG(dpk, signQName, rrc, toSign);
     rrcs.push_back(rrc);
   }
   return 0;
 }
 
+static void addRRSIGRecords(const std::string& signQName, uint32_t signTTL, uint32_t origTTL, DNSPacketWriter::Place signPlace, 
+  const vector<RRSIGRecordContent>& rrcs, vector<DNSResourceRecord>& outsigned)
+{
+  DNSResourceRecord rr;
+  rr.qname=signQName;
+  rr.qtype=QType::RRSIG;
+  if(origTTL)
+    rr.ttl=origTTL;
+  else
+    rr.ttl=signTTL;
+  rr.auth=false;
+  rr.d_place = (DNSResourceRecord::Place) signPlace;
+  BOOST_FOREACH(const RRSIGRecordContent& rrc, rrcs) {
+    rr.content = rrc.getZoneRepresentation();
+    outsigned.push_back(rr);
+  }
+}
+
 // this is the entrypoint from DNSPacket
 void addSignature(DNSSECKeeper& dk, DNSBackend& db, const std::string& signer, const std::string signQName, const std::string& wildcardname, uint16_t signQType, 
   uint32_t signTTL, DNSPacketWriter::Place signPlace, 
@@ -97,65 +123,165 @@ void addSignature(DNSSECKeeper& dk, DNSBackend& db, const std::string& signer, c
       // cerr<<"Error signing a record!"<<endl;
       return;
     } 
-  
-    DNSResourceRecord rr;
-    rr.qname=signQName;
-    rr.qtype=QType::RRSIG;
-    if(origTTL)
-      rr.ttl=origTTL;
-    else
-      rr.ttl=signTTL;
-    rr.auth=false;
-    rr.d_place = (DNSResourceRecord::Place) signPlace;
-    BOOST_FOREACH(RRSIGRecordContent& rrc, rrcs) {
-      rr.content = rrc.getZoneRepresentation();
-      outsigned.push_back(rr);
-    }
+    addRRSIGRecords(signQName, signTTL, origTTL, signPlace, rrcs, outsigned);
   }
   toSign.clear();
 }
 
-static pthread_rwlock_t g_signatures_lock = PTHREAD_RWLOCK_INITIALIZER;
-typedef map<pair<string, string>, string> signaturecache_t;
-static signaturecache_t g_signatures;
-static int g_cacheweekno;
+/* The signature cache is split in shards so signers on different cores rarely contend
+   for the same lock. Each shard is an LRU (hashed lookup + sequence) bounded by a byte budget,
+   entries expire when the signing window they were made for rolls over. */
 
-void fillOutRRSIG(DNSSECPrivateKey& dpk, const std::string& signQName, RRSIGRecordContent& rrc, vector<shared_ptr<DNSRecordContent> >& toSign) 
+struct SignatureCacheEntry
+{
+  uint32_t getTTD() const
+  {
+    return d_ttd;
+  }
+
+  string d_key;       // md5 of the key + md5 of the message, 32 bytes
+  string d_signature;
+  uint32_t d_ttd;
+};
+
+typedef multi_index_container<
+  SignatureCacheEntry,
+  indexed_by<
+    hashed_unique<member<SignatureCacheEntry, string, &SignatureCacheEntry::d_key> >,
+    sequenced<>
+  >
+> signaturecache_t;
+
+struct SignatureCacheShard
+{
+  SignatureCacheShard() : d_bytes(0)
+  {
+    pthread_mutex_init(&d_lock, 0);
+  }
+
+  pthread_mutex_t d_lock;
+  signaturecache_t d_entries;
+  uint64_t d_bytes;
+};
+
+static const unsigned int s_sigshardcount = 64;
+static SignatureCacheShard s_sigshards[s_sigshardcount];
+static uint64_t s_sigcachemaxbytes = 256*1024*1024;
+static AtomicCounter s_sigcachehits, s_sigcachemisses, s_sigcacheevictions;
+
+static unsigned int signatureCacheEntrySize(const SignatureCacheEntry& sce)
+{
+  // the strings plus a rough guess of the node overhead of both indexes
+  return sizeof(SignatureCacheEntry) + sce.d_key.size() + sce.d_signature.size() + 4*sizeof(void*);
+}
+
+/* needs the shard lock. Walks from the least recently used end, dropping expired entries 
+   and evicting live ones until the shard fits its part of the budget again */
+static void pruneSignatureCacheShard(SignatureCacheShard& shard, uint32_t now)
+{
+  uint64_t maxbytes = s_sigcachemaxbytes / s_sigshardcount;
+  typedef signaturecache_t::nth_index<1>::type sequence_t;
+  sequence_t& sidx = shard.d_entries.get<1>();
+
+  while(!sidx.empty() && (shard.d_bytes > maxbytes || sidx.front().getTTD() < now)) {
+    if(sidx.front().getTTD() >= now)
+      s_sigcacheevictions++;
+    shard.d_bytes -= signatureCacheEntrySize(sidx.front());
+    sidx.pop_front();
+  }
+}
+
+void setSignatureCacheSize(uint64_t maxbytes)
+{
+  s_sigcachemaxbytes = maxbytes;
+}
+
+SignatureCacheStats getSignatureCacheStats()
+{
+  SignatureCacheStats scs;
+  scs.hits = s_sigcachehits;
+  scs.misses = s_sigcachemisses;
+  scs.evictions = s_sigcacheevictions;
+  scs.entries = 0;
+  scs.bytes = 0;
+  for(unsigned int n = 0; n < s_sigshardcount; ++n) {
+    Lock l(&s_sigshards[n].d_lock);
+    scs.entries += s_sigshards[n].d_entries.size();
+    scs.bytes += s_sigshards[n].d_bytes;
+  }
+  return scs;
+}
+
+unsigned int purgeSignatureCache()
+{
+  unsigned int ret = 0;
+  for(unsigned int n = 0; n < s_sigshardcount; ++n) {
+    Lock l(&s_sigshards[n].d_lock);
+    ret += s_sigshards[n].d_entries.size();
+    s_sigshards[n].d_entries.clear();
+    s_sigshards[n].d_bytes = 0;
+  }
+  return ret;
+}
+
+/* fills out rrc for dpk, including the signature if we have it cached. If not, msg is what needs
+   signing and lookup is where the signature goes in the cache */
+static bool getCachedRRSIG(DNSSECPrivateKey& dpk, const std::string& signQName, RRSIGRecordContent& rrc, vector<shared_ptr<DNSRecordContent> >& toSign, 
+  string& msg, string& lookup)
 {
   DNSKEYRecordContent drc = dpk.getDNSKEY(); 
   const DNSCryptoKeyEngine* rc = dpk.getKey();
   rrc.d_tag = drc.getTag();
   rrc.d_algorithm = drc.d_algorithm;
   
-  string msg=getMessageForRRSET(signQName, rrc, toSign); // this is what we will hash & sign
-  pair<string, string> lookup(rc->getPubKeyHash(), pdns_md5sum(msg));  // this hash is a memory saving exercise
-  
-  bool doCache=1;
-  if(doCache)
+  msg=getMessageForRRSET(signQName, rrc, toSign); // this is what we will hash & sign
+  string msghash=pdns_md5sum(msg);
+  lookup=pdns_md5sum(rc->getPubKeyHash()) + msghash;  // this hash is a memory saving exercise
+
+  SignatureCacheShard& shard = s_sigshards[(unsigned char)msghash[0] % s_sigshardcount];
+  uint32_t now = time(0);
   {
-    ReadLock l(&g_signatures_lock);
-    signaturecache_t::const_iterator iter = g_signatures.find(lookup);
-    if(iter != g_signatures.end()) {
-      rrc.d_signature=iter->second;
-      return;
+    Lock l(&shard.d_lock);
+    signaturecache_t::iterator iter = shard.d_entries.find(lookup);
+    if(iter != shard.d_entries.end() && iter->getTTD() >= now) {
+      rrc.d_signature=iter->d_signature;
+      moveCacheItemToBack(shard.d_entries, iter);
+      s_sigcachehits++;
+      return true;
     }
-    else
-      ; // cerr<<"Miss!"<<endl;
   }
-  
-  rrc.d_signature = rc->sign(msg);
+  s_sigcachemisses++;
+  return false;
+}
 
-  if(doCache) {
-    WriteLock l(&g_signatures_lock);
-    /* we add some jitter here so not all your slaves start pruning their caches at the very same millisecond */
-    int weekno = (time(0) - dns_random(3600)) / (86400*7);  // we just spent milliseconds doing a signature, microsecond more won't kill us
-  
-    if(g_cacheweekno < weekno) {  // blunt but effective (C) Habbie
-      g_signatures.clear();
-      g_cacheweekno = weekno;
-    }
-    g_signatures[lookup] = rrc.d_signature;
-  }
+static void cacheRRSIG(const string& lookup, const RRSIGRecordContent& rrc)
+{
+  SignatureCacheShard& shard = s_sigshards[(unsigned char)lookup[16] % s_sigshardcount]; // first byte of the message hash
+  uint32_t now = time(0);
+
+  SignatureCacheEntry sce;
+  sce.d_key = lookup;
+  sce.d_signature = rrc.d_signature;
+  /* once the signing window moves on, the message changes and this entry will never be hit again */
+  sce.d_ttd = std::min(rrc.d_sigexpire, getStartOfWeek() + 7*86400);
+
+  Lock l(&shard.d_lock);
+  pair<signaturecache_t::iterator, bool> res = shard.d_entries.insert(sce);
+  if(!res.second)  // somebody beat us to it
+    return;
+  shard.d_bytes += signatureCacheEntrySize(sce);
+  if(shard.d_bytes > s_sigcachemaxbytes / s_sigshardcount)
+    pruneSignatureCacheShard(shard, now);
+}
+
+void fillOutRRSIG(DNSSECPrivateKey& dpk, const std::string& signQName, RRSIGRecordContent& rrc, vector<shared_ptr<DNSRecordContent> >& toSign) 
+{
+  string msg, lookup;
+  if(getCachedRRSIG(dpk, signQName, rrc, toSign, msg, lookup))
+    return;
+
+  rrc.d_signature = dpk.getKey()->sign(msg);
+  cacheRRSIG(lookup, rrc);
 }
 
 static bool rrsigncomp(const DNSResourceRecord& a, const DNSResourceRecord& b)
@@ -178,36 +304,52 @@ static bool getBestAuthFromSet(const set<string, CIStringCompare>& authSet, cons
   return false;
 }
 
-void addRRSigs(DNSSECKeeper& dk, DNSBackend& db, const set<string, CIStringCompare>& authSet, vector<DNSResourceRecord>& rrs)
+namespace {
+// an RRset of addRRSigs and the RRSIGs that will follow it
+struct RRSetToSign
 {
-  stable_sort(rrs.begin(), rrs.end(), rrsigncomp);
-  
-  string signQName, wildcardQName;
-  uint16_t signQType=0;
-  uint32_t signTTL=0;
-  uint32_t origTTL=0;
-  
-  DNSPacketWriter::Place signPlace=DNSPacketWriter::ANSWER;
+  RRSetToSign() : signQType(0), signTTL(0), origTTL(0), signPlace(DNSPacketWriter::ANSWER), presigned(false) {}
+  string signer, signQName, wildcardQName;
+  uint16_t signQType;
+  uint32_t signTTL, origTTL;
+  DNSPacketWriter::Place signPlace;
   vector<shared_ptr<DNSRecordContent> > toSign;
+  vector<DNSResourceRecord> records;
+  vector<RRSIGRecordContent> rrcs;
+  bool presigned;
+};
 
-  vector<DNSResourceRecord> signedRecords;
+// the messages one key still has to sign, and which RRSIG of which RRset each signature goes in
+struct SigningBatch
+{
+  DNSSECPrivateKey dpk;
+  vector<string> msgs, lookups;
+  vector<pair<unsigned int, unsigned int> > targets;
+};
+}
+
+/* Signs all RRsets in rrs. The signatures that are not in the cache are collected per key first and then
+   made with one signBatch call for each key, so engines only set up their signing context once per chunk */
+void addRRSigs(DNSSECKeeper& dk, DNSBackend& db, const set<string, CIStringCompare>& authSet, vector<DNSResourceRecord>& rrs)
+{
+  stable_sort(rrs.begin(), rrs.end(), rrsigncomp);
   
-  string signer;
+  vector<RRSetToSign> rrsets;
   for(vector<DNSResourceRecord>::const_iterator pos = rrs.begin(); pos != rrs.end(); ++pos) {
-    if(pos != rrs.begin() && (signQType != pos->qtype.getCode()  || signQName != pos->qname)) {
-      if(getBestAuthFromSet(authSet, signQName, signer))
-        addSignature(dk, db, signer, signQName, wildcardQName, signQType, signTTL, signPlace, toSign, signedRecords, origTTL);
-    }
-    signedRecords.push_back(*pos);
-    signQName= pos->qname;
-    wildcardQName = pos->wildcardname;
-    signQType = pos ->qtype.getCode();
+    if(pos == rrs.begin() || rrsets.back().signQType != pos->qtype.getCode() || rrsets.back().signQName != pos->qname)
+      rrsets.push_back(RRSetToSign());
+    RRSetToSign& rrset = rrsets.back();
+
+    rrset.records.push_back(*pos);
+    rrset.signQName= pos->qname;
+    rrset.wildcardQName = pos->wildcardname;
+    rrset.signQType = pos ->qtype.getCode();
     if(pos->signttl)
-      signTTL = pos->signttl;
+      rrset.signTTL = pos->signttl;
     else
-      signTTL = pos->ttl;
-    origTTL = pos->ttl;
-    signPlace = (DNSPacketWriter::Place) pos->d_place;
+      rrset.signTTL = pos->ttl;
+    rrset.origTTL = pos->ttl;
+    rrset.signPlace = (DNSPacketWriter::Place) pos->d_place;
     if(pos->auth || pos->qtype.getCode() == QType::DS) {
       string content = pos->content;
       if(pos->qtype.getCode()==QType::MX || pos->qtype.getCode() == QType::SRV) {  
@@ -220,10 +362,63 @@ void addRRSigs(DNSSECKeeper& dk, DNSBackend& db, const set<string, CIStringCompa
         content=".";
       
       shared_ptr<DNSRecordContent> drc(DNSRecordContent::mastermake(pos->qtype.getCode(), 1, content)); 
-      toSign.push_back(drc);
+      rrset.toSign.push_back(drc);
     }
   }
-  if(getBestAuthFromSet(authSet, signQName, signer))
-    addSignature(dk, db, signer, signQName, wildcardQName, signQType, signTTL, signPlace, toSign, signedRecords, origTTL);
+
+  map<string, SigningBatch> batches; // by the md5 of the public key, as used in the signature cache
+  string msg, lookup;
+  for(unsigned int n = 0; n < rrsets.size(); ++n) {
+    RRSetToSign& rrset = rrsets[n];
+    if(rrset.toSign.empty() || !getBestAuthFromSet(authSet, rrset.signQName, rrset.signer))
+      continue;
+    if(dk.isPresigned(rrset.signer)) {
+      rrset.presigned = true;
+      continue;
+    }
+
+    const string& signQName = rrset.wildcardQName.empty() ? rrset.signQName : rrset.wildcardQName;
+    RRSIGRecordContent rrc;
+    fillOutRRSIGTemplate(rrc, rrset.signer, signQName, rrset.signQType, rrset.signTTL);
+    vector<DNSSECPrivateKey> signingKeys;
+    getSigningKeys(dk, rrset.signer, rrset.signQType == QType::DNSKEY, signingKeys);
+
+    BOOST_FOREACH(DNSSECPrivateKey& dpk, signingKeys) {
+      bool cached = getCachedRRSIG(dpk, signQName, rrc, rrset.toSign, msg, lookup);
+      rrset.rrcs.push_back(rrc);
+      if(cached)
+        continue;
+      SigningBatch& batch = batches[lookup.substr(0, 16)];
+      batch.dpk = dpk;
+      batch.msgs.push_back(msg);
+      batch.lookups.push_back(lookup);
+      batch.targets.push_back(make_pair(n, rrset.rrcs.size() - 1));
+    }
+  }
+
+  static LatencyHistogram* latency = S.getHistogram("signing-latency"); // 0 in tools that don't declare it
+  DTime dt;
+  dt.set();
+  for(map<string, SigningBatch>::iterator iter = batches.begin(); iter != batches.end(); ++iter) {
+    SigningBatch& batch = iter->second;
+    vector<string> signatures = batch.dpk.getKey()->signBatch(batch.msgs);
+    for(unsigned int n = 0; n < signatures.size(); ++n) {
+      RRSIGRecordContent& rrc = rrsets[batch.targets[n].first].rrcs[batch.targets[n].second];
+      rrc.d_signature = signatures[n];
+      cacheRRSIG(batch.lookups[n], rrc);
+    }
+  }
+  if(latency && !batches.empty())
+    latency->submit(dt.udiffNoReset());
+
+  vector<DNSResourceRecord> signedRecords;
+  signedRecords.reserve(rrs.size());
+  BOOST_FOREACH(const RRSetToSign& rrset, rrsets) {
+    signedRecords.insert(signedRecords.end(), rrset.records.begin(), rrset.records.end());
+    if(rrset.presigned)
+      dk.getPreRRSIGs(db, rrset.signer, rrset.signQName, rrset.wildcardQName, QType(rrset.signQType), rrset.signPlace, signedRecords, rrset.origTTL);
+    else
+      addRRSIGRecords(rrset.signQName, rrset.signTTL, rrset.origTTL, rrset.signPlace, rrset.rrcs, signedRecords);
+  }
   rrs.swap(signedRecords);
 }
@@ -31,6 +31,8 @@
 #include "communicator.hh"
 #include "dnsseckeeper.hh"
 #include "nameserver.hh"
+#include "ueberbackend.hh"
+#include "signingpipe.hh"
 
 static bool s_pleasequit;
 static string d_status;
@@ -130,6 +132,75 @@ string DLPurgeHandler(const vector<string>&parts, Utility::pid_t ppid)
   return os.str();
 }
 
+static void* warmSignatureCacheThread(void* p)
+{
+  string zone(*(string*)p);
+  delete (string*)p;
+
+  try {
+    UeberBackend B;
+    DNSSECKeeper dk(&B);
+    SOAData sd;
+    sd.db=(DNSBackend *)-1; // force uncached answer
+    if(!B.getSOA(zone, sd) || !sd.db || sd.db==(DNSBackend *)-1) {
+      L<<Logger::Error<<"Unable to warm signature cache for '"<<zone<<"': not authoritative"<<endl;
+      return 0;
+    }
+    if(!dk.isSecuredZone(zone) || dk.isPresigned(zone)) {
+      L<<Logger::Warning<<"Not warming signature cache for '"<<zone<<"': zone is not signed by us"<<endl;
+      return 0;
+    }
+
+    // same pipe and record selection as an AXFR, so the signatures we cache are the ones that will be asked for
+    ChunkedSigningPipe csp(zone, true, "", ::arg().asNum("signing-threads"));
+    if(!sd.db->list(zone, sd.domain_id)) {
+      L<<Logger::Error<<"Unable to warm signature cache for '"<<zone<<"': backend signals error condition"<<endl;
+      return 0;
+    }
+
+    DNSResourceRecord rr;
+    unsigned int records=0;
+    while(sd.db->get(rr)) {
+      if(!rr.qtype.getCode() || rr.qtype.getCode() == QType::RRSIG)
+        continue;
+      records++;
+      if(csp.submit(rr))
+        while(!csp.getChunk().empty())
+          ;
+    }
+    while(!csp.getChunk(true).empty())
+      ;
+    L<<Logger::Warning<<"Warmed signature cache for '"<<zone<<"': "<<records<<" records, "<<csp.d_signed<<" signatures"<<endl;
+  }
+  catch(PDNSException &ae) {
+    L<<Logger::Error<<"Unable to warm signature cache for '"<<zone<<"': "<<ae.reason<<endl;
+  }
+  return 0;
+}
+
+string DLWarmSignatureCacheHandler(const vector<string>&parts, Utility::pid_t ppid)
+{
+  if(parts.size()!=2)
+    return "syntax: warm-signature-cache domain";
+
+  pthread_t tid;
+  string* zone=new string(parts[1]);
+  if(pthread_create(&tid, 0, warmSignatureCacheThread, zone)) {
+    delete zone;
+    return "Unable to start warming thread: "+stringerror();
+  }
+  pthread_detach(tid);
+  L<<Logger::Warning<<"Signature cache warming for domain '"<<parts[1]<<"' requested by operator"<<endl;
+  return "Warming started - see log";
+}
+
+string DLPurgeSignatureCacheHandler(const vector<string>&parts, Utility::pid_t ppid)
+{
+  unsigned int purged = purgeSignatureCache();
+  L<<Logger::Warning<<"Signature cache purge requested by operator"<<endl;
+  return "Purged "+uitoa(purged)+" signatures";
+}
+
 string DLCCHandler(const vector<string>&parts, Utility::pid_t ppid)
 {
   extern PacketCache PC;  
@@ -182,6 +253,42 @@ string DLRSizesHandler(const vector<string>&parts, Utility::pid_t ppid)
   return os.str();
 }
 
+string DLRCodesHandler(const vector<string>&parts, Utility::pid_t ppid)
+{
+  typedef map<uint8_t, uint64_t> rcodenums_t;
+  rcodenums_t rcodenums = g_rs.getRCodeResponseCounts();
+  ostringstream os;
+  boost::format fmt("%s\t%d\n");
+  BOOST_FOREACH(const rcodenums_t::value_type& val, rcodenums) {
+    os << (fmt % strrcode(val.first) % val.second).str();
+  }
+  return os.str();
+}
+
+string DLHistogramHandler(const vector<string>&parts, Utility::pid_t ppid)
+{
+  extern StatBag S;
+  if(parts.size()!=2) {
+    string ret="syntax: histogram";
+    BOOST_FOREACH(const string& name, S.listHistograms())
+      ret+=" "+name;
+    return ret+"\n";
+  }
+  LatencyHistogram* histogram=S.getHistogram(parts[1]);
+  if(!histogram)
+    return "Unknown histogram '"+parts[1]+"'\n";
+
+  LatencyHistogram::Snapshot snap=histogram->get();
+  ostringstream os;
+  os<<"count\t"<<snap.count<<"\nmean\t"<<snap.mean()<<"\np50\t"<<snap.percentile(50)<<"\np90\t"<<snap.percentile(90);
+  os<<"\np99\t"<<snap.percentile(99)<<"\np999\t"<<snap.percentile(99.9)<<"\np9999\t"<<snap.percentile(99.99)<<"\n";
+  boost::format fmt("<%d\t%d\n");
+  for(unsigned int n=0; n < LatencyHistogram::s_buckets; ++n)
+    if(snap.counts[n])
+      os << (fmt % LatencyHistogram::upperBound(n) % snap.counts[n]).str();
+  return os.str();
+}
+
 string DLRemotesHandler(const vector<string>&parts, Utility::pid_t ppid)
 {
   extern StatBag S;
@@ -238,7 +345,7 @@ string DLNotifyRetrieveHandler(const vector<string>&parts, Utility::pid_t ppid)
     return "Domain '"+domain+"' is not a slave domain (or has no master defined)";
 
   random_shuffle(di.masters.begin(), di.masters.end());
-  Communicator.addSuckRequest(domain, di.masters.front());
+  Communicator.addSuckRequest(domain, di.masters.front(), true);
   return "Added retrieval request for '"+domain+"' from master "+di.masters.front();
 }
 
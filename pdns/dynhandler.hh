@@ -45,6 +45,8 @@ string DLRespSizeHandler(const vector<string>&parts, Utility::pid_t ppid);
 string DLCCHandler(const vector<string>&parts, Utility::pid_t ppid);
 string DLQTypesHandler(const vector<string>&parts, Utility::pid_t ppid);
 string DLRSizesHandler(const vector<string>&parts, Utility::pid_t ppid);
+string DLRCodesHandler(const vector<string>&parts, Utility::pid_t ppid);
+string DLHistogramHandler(const vector<string>&parts, Utility::pid_t ppid);
 string DLRemotesHandler(const vector<string>&parts, Utility::pid_t ppid);
 string DLStatusHandler(const vector<string>&parts, Utility::pid_t ppid);
 string DLNotifyHandler(const vector<string>&parts, Utility::pid_t ppid);
@@ -53,6 +55,8 @@ string DLReloadHandler(const vector<string>&parts, Utility::pid_t ppid);
 string DLRediscoverHandler(const vector<string>&parts, Utility::pid_t ppid);
 string DLVersionHandler(const vector<string>&parts, Utility::pid_t ppid);
 string DLPurgeHandler(const vector<string>&parts, Utility::pid_t ppid);
+string DLWarmSignatureCacheHandler(const vector<string>&parts, Utility::pid_t ppid);
+string DLPurgeSignatureCacheHandler(const vector<string>&parts, Utility::pid_t ppid);
 string DLNotifyRetrieveHandler(const vector<string>&parts, Utility::pid_t ppid);
 string DLCurrentConfigHandler(const vector<string>&parts, Utility::pid_t ppid);
 #endif /* PDNS_DYNHANDLER_HH */
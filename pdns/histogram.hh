@@ -0,0 +1,142 @@
+#ifndef PDNS_HISTOGRAM_HH
+#define PDNS_HISTOGRAM_HH
+#include <pthread.h>
+#include <stdint.h>
+#include <vector>
+#include <algorithm>
+#include <boost/utility.hpp>
+#include "lock.hh"
+#include "namespaces.hh"
+
+/** Histogram of latencies in microseconds, laid out like an HdrHistogram: values under s_subbuckets get a bucket each,
+    every power of two above that is split in s_subbuckets equal buckets, so a value is never off by more than
+    1/s_subbuckets. Each thread counts in buckets of its own, without locks or atomic operations, and readers add up the
+    buckets of all threads. A reader may miss an increment that is in flight, which is fine for statistics.
+    Buckets of threads that exit are folded into d_retired, so short lived threads can submit too. */
+class LatencyHistogram : public boost::noncopyable
+{
+public:
+  static const unsigned int s_subbits = 4;
+  static const unsigned int s_subbuckets = 1 << s_subbits;
+  static const unsigned int s_maxbits = 32; //!< values of 2^32 usec (over an hour) and up all land in the last bucket
+  static const unsigned int s_buckets = (s_maxbits - s_subbits + 1) * s_subbuckets;
+
+  struct Snapshot
+  {
+    Snapshot() : counts(s_buckets), count(0), sum(0) {}
+    vector<uint64_t> counts;
+    uint64_t count;
+    uint64_t sum; //!< of all values, for the mean
+
+    //! upper bound of the bucket holding the value below which percent (0-100) of the values are
+    uint64_t percentile(double percent) const
+    {
+      if(!count)
+        return 0;
+      uint64_t wanted = (uint64_t)(count * percent / 100.0 + 0.5);
+      if(!wanted)
+        wanted = 1;
+      uint64_t seen = 0;
+      for(unsigned int n = 0; n < s_buckets; ++n) {
+        seen += counts[n];
+        if(seen >= wanted)
+          return upperBound(n);
+      }
+      return upperBound(s_buckets - 1);
+    }
+    uint64_t mean() const
+    {
+      return count ? sum / count : 0;
+    }
+  };
+
+  LatencyHistogram() : d_retired(s_buckets + 1)
+  {
+    pthread_mutex_init(&d_lock, 0);
+    pthread_key_create(&d_key, retire);
+  }
+
+  void submit(uint64_t usec)
+  {
+    Counts* counts = static_cast<Counts*>(pthread_getspecific(d_key));
+    if(!counts)
+      counts = addThread();
+    counts->buckets[bucketFor(usec)]++;
+    counts->buckets[s_buckets] += usec;
+  }
+
+  Snapshot get()
+  {
+    Snapshot ret;
+    Lock l(&d_lock);
+    add(ret, &d_retired[0]);
+    for(vector<Counts*>::const_iterator iter = d_threads.begin(); iter != d_threads.end(); ++iter)
+      add(ret, (*iter)->buckets);
+    return ret;
+  }
+
+  static unsigned int bucketFor(uint64_t usec)
+  {
+    if(usec < s_subbuckets)
+      return usec;
+    unsigned int bits = 63 - __builtin_clzll(usec); // position of the highest bit that is set
+    if(bits >= s_maxbits)
+      return s_buckets - 1;
+    return (bits - s_subbits + 1) * s_subbuckets + ((usec >> (bits - s_subbits)) & (s_subbuckets - 1));
+  }
+
+  //! first value that no longer lands in this bucket
+  static uint64_t upperBound(unsigned int bucket)
+  {
+    if(bucket < s_subbuckets)
+      return bucket + 1;
+    unsigned int shift = bucket / s_subbuckets - 1;
+    return ((uint64_t)(s_subbuckets + bucket % s_subbuckets + 1)) << shift;
+  }
+
+private:
+  struct Counts
+  {
+    LatencyHistogram* parent;
+    uint64_t buckets[s_buckets + 1]; //!< the last one holds the sum of the values
+  };
+
+  Counts* addThread()
+  {
+    Counts* counts = new Counts();
+    counts->parent = this;
+    pthread_setspecific(d_key, counts);
+    Lock l(&d_lock);
+    d_threads.push_back(counts);
+    return counts;
+  }
+
+  static void retire(void* data)
+  {
+    Counts* counts = static_cast<Counts*>(data);
+    LatencyHistogram* parent = counts->parent;
+    {
+      Lock l(&parent->d_lock);
+      for(unsigned int n = 0; n <= s_buckets; ++n)
+        parent->d_retired[n] += counts->buckets[n];
+      parent->d_threads.erase(std::remove(parent->d_threads.begin(), parent->d_threads.end(), counts), parent->d_threads.end());
+    }
+    delete counts;
+  }
+
+  static void add(Snapshot& snap, const uint64_t* buckets)
+  {
+    for(unsigned int n = 0; n < s_buckets; ++n) {
+      snap.counts[n] += buckets[n];
+      snap.count += buckets[n];
+    }
+    snap.sum += buckets[s_buckets];
+  }
+
+  pthread_key_t d_key;
+  pthread_mutex_t d_lock; //!< protects d_threads and d_retired
+  vector<Counts*> d_threads;
+  vector<uint64_t> d_retired;
+};
+
+#endif
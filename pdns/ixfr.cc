@@ -0,0 +1,144 @@
+#include "ixfr.hh"
+#include "lock.hh"
+#include <boost/foreach.hpp>
+#include "namespaces.hh"
+
+IXFRJournal g_ixfrjournal;
+
+IXFRJournal::IXFRJournal() : d_maxdiffs(0)
+{
+  pthread_mutex_init(&d_lock, 0);
+}
+
+IXFRJournal::~IXFRJournal()
+{
+  pthread_mutex_destroy(&d_lock);
+}
+
+void IXFRJournal::setMaxDiffs(unsigned int maxdiffs)
+{
+  Lock l(&d_lock);
+  d_maxdiffs = maxdiffs;
+  if(!d_maxdiffs) {
+    d_journal.clear();
+    return;
+  }
+  for(journal_t::iterator i = d_journal.begin(); i != d_journal.end(); ++i)
+    while(i->second.size() > d_maxdiffs)
+      i->second.pop_front();
+}
+
+void IXFRJournal::addDiff(const string& zone, const IXFRDiff& diff)
+{
+  Lock l(&d_lock);
+  if(!d_maxdiffs)
+    return;
+
+  std::deque<IXFRDiff>& diffs = d_journal[zone];
+  if(!diffs.empty() && diffs.back().toSerial != diff.fromSerial) // zone changed behind our back, the old chain is useless
+    diffs.clear();
+
+  diffs.push_back(diff);
+  while(diffs.size() > d_maxdiffs)
+    diffs.pop_front();
+}
+
+bool IXFRJournal::getDiffs(const string& zone, uint32_t fromSerial, uint32_t toSerial, vector<IXFRDiff>& ret)
+{
+  ret.clear();
+  Lock l(&d_lock);
+  journal_t::const_iterator iter = d_journal.find(zone);
+  if(iter == d_journal.end())
+    return false;
+
+  const std::deque<IXFRDiff>& diffs = iter->second;
+  if(diffs.empty() || diffs.back().toSerial != toSerial)
+    return false;
+
+  std::deque<IXFRDiff>::const_iterator start;
+  for(start = diffs.begin(); start != diffs.end(); ++start)
+    if(start->fromSerial == fromSerial)
+      break;
+
+  if(start == diffs.end())
+    return false;
+
+  ret.assign(start, diffs.end());
+  return true;
+}
+
+void IXFRJournal::purge(const string& zone)
+{
+  Lock l(&d_lock);
+  d_journal.erase(zone);
+}
+
+unsigned int IXFRJournal::size()
+{
+  Lock l(&d_lock);
+  unsigned int ret = 0;
+  for(journal_t::const_iterator i = d_journal.begin(); i != d_journal.end(); ++i)
+    ret += i->second.size();
+  return ret;
+}
+
+namespace {
+  bool sameRecord(const DNSResourceRecord& a, const DNSResourceRecord& b)
+  {
+    return a.qtype == b.qtype && a.ttl == b.ttl && a.priority == b.priority &&
+      pdns_iequals(a.qname, b.qname) && pdns_iequals(a.content, b.content);
+  }
+
+  bool contains(const vector<DNSResourceRecord>& rrs, const DNSResourceRecord& rr)
+  {
+    BOOST_FOREACH(const DNSResourceRecord& i, rrs)
+      if(sameRecord(i, rr))
+        return true;
+    return false;
+  }
+
+  // backends may store a SOA with fields left out, what goes into the journal is what we'd put on the wire
+  void setSOA(const DNSResourceRecord& rr, DNSResourceRecord& soa, uint32_t& serial)
+  {
+    SOAData sd;
+    fillSOAData(rr.content, sd);
+    soa = rr;
+    soa.content = serializeSOAData(sd);
+    soa.d_place = DNSResourceRecord::ANSWER;
+    soa.auth = true;
+    serial = sd.serial;
+  }
+}
+
+bool makeIXFRDiff(const string& zone, const vector<DNSResourceRecord>& before, const vector<DNSResourceRecord>& after, IXFRDiff& diff)
+{
+  bool haveOld = false, haveNew = false;
+
+  BOOST_FOREACH(const DNSResourceRecord& rr, before) {
+    if(rr.qtype.getCode() == QType::SOA) {
+      if(pdns_iequals(rr.qname, zone)) {
+        setSOA(rr, diff.oldSOA, diff.fromSerial);
+        haveOld = true;
+      }
+    }
+    else if(!contains(after, rr)) {
+      diff.removed.push_back(rr);
+      diff.removed.back().d_place = DNSResourceRecord::ANSWER;
+    }
+  }
+
+  BOOST_FOREACH(const DNSResourceRecord& rr, after) {
+    if(rr.qtype.getCode() == QType::SOA) {
+      if(pdns_iequals(rr.qname, zone)) {
+        setSOA(rr, diff.newSOA, diff.toSerial);
+        haveNew = true;
+      }
+    }
+    else if(!contains(before, rr)) {
+      diff.added.push_back(rr);
+      diff.added.back().d_place = DNSResourceRecord::ANSWER;
+    }
+  }
+
+  return haveOld && haveNew && diff.fromSerial != diff.toSerial;
+}
@@ -0,0 +1,52 @@
+#ifndef PDNS_IXFR_HH
+#define PDNS_IXFR_HH
+#include <deque>
+#include <pthread.h>
+#include <boost/utility.hpp>
+#include "dns.hh"
+#include "misc.hh"
+
+/** One step in the history of a zone: the SOA before and after, and the records that went away and came in (RFC 1995) */
+struct IXFRDiff
+{
+  IXFRDiff() : fromSerial(0), toSerial(0) {}
+
+  uint32_t fromSerial, toSerial;
+  DNSResourceRecord oldSOA, newSOA;
+  vector<DNSResourceRecord> removed, added;
+};
+
+/** Keeps the last few diffs per zone in memory so we can answer IXFR queries without sending the whole zone.
+    Diffs for a zone always form one unbroken chain, adding a diff that does not follow on the newest one
+    starts the chain over. Nothing is persisted, after a restart slaves get a full AXFR once. */
+class IXFRJournal : public boost::noncopyable
+{
+public:
+  IXFRJournal();
+  ~IXFRJournal();
+
+  void setMaxDiffs(unsigned int maxdiffs); //!< per zone, 0 disables the journal
+  bool enabled() const
+  {
+    return d_maxdiffs > 0;
+  }
+
+  void addDiff(const string& zone, const IXFRDiff& diff);
+  //! fills diffs with the chain from fromSerial up to toSerial, returns false if we don't have all of it
+  bool getDiffs(const string& zone, uint32_t fromSerial, uint32_t toSerial, vector<IXFRDiff>& diffs);
+  void purge(const string& zone);
+  unsigned int size(); //!< total number of diffs held
+
+private:
+  typedef map<string, std::deque<IXFRDiff>, CIStringCompare> journal_t;
+  journal_t d_journal;
+  pthread_mutex_t d_lock;
+  unsigned int d_maxdiffs;
+};
+
+/** compares two snapshots of the same names taken before and after a change, returns false if
+    they don't describe a complete step (no SOA on either side, or the serial did not move) */
+bool makeIXFRDiff(const string& zone, const vector<DNSResourceRecord>& before, const vector<DNSResourceRecord>& after, IXFRDiff& diff);
+
+extern IXFRJournal g_ixfrjournal;
+#endif
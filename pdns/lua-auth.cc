@@ -42,16 +42,16 @@ AuthLua::AuthLua(const std::string &fname)
   : PowerDNSLua(fname)
 {
   registerLuaDNSPacket();
+  d_axfrfilter = getFunction("axfrfilter");
+  d_prequery = getFunction("prequery");
 }
 
 bool AuthLua::axfrfilter(const ComboAddress& remote, const string& zone, const DNSResourceRecord& in, vector<DNSResourceRecord>& out)
 {
-  lua_getglobal(d_lua,  "axfrfilter");
-  if(!lua_isfunction(d_lua, -1)) {
-    // cerr<<"No such function 'axfrfilter'\n";
-    lua_pop(d_lua, 1);
+  if(d_axfrfilter == LUA_NOREF)
     return false;
-  }
+
+  lua_rawgeti(d_lua, LUA_REGISTRYINDEX, d_axfrfilter);
   
   lua_pushstring(d_lua,  remote.toString().c_str() );
   lua_pushstring(d_lua,  zone.c_str() );
@@ -207,12 +207,10 @@ void AuthLua::registerLuaDNSPacket(void) {
 
 DNSPacket* AuthLua::prequery(DNSPacket *p)
 {
-  lua_getglobal(d_lua,"prequery");
-  if(!lua_isfunction(d_lua, -1)) {
-    // cerr<<"No such function 'prequery'\n";
-    lua_pop(d_lua, 1);
+  if(d_prequery == LUA_NOREF)
     return 0;
-  }
+
+  lua_rawgeti(d_lua, LUA_REGISTRYINDEX, d_prequery);
   
   DNSPacket *r=0;
   // allocate a fresh packet and prefill the question
@@ -15,6 +15,8 @@ public:
 
 private:
   void registerLuaDNSPacket(void);
+
+  int d_axfrfilter, d_prequery; // registry references to the hooks of the script
 };
 
 #endif
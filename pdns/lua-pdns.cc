@@ -82,8 +82,8 @@ static bool getFromTable(lua_State *lua, const std::string &key, uint32_t& value
 
 void pushResourceRecordsTable(lua_State* lua, const vector<DNSResourceRecord>& records)
 {  
-  // make a table of tables
-  lua_newtable(lua);
+  // make a table of tables, sized up front so filling them in does not allocate again and again
+  lua_createtable(lua, records.size(), 0);
   
   int pos=0;
   BOOST_FOREACH(const DNSResourceRecord& rr, records)
@@ -91,7 +91,7 @@ void pushResourceRecordsTable(lua_State* lua, const vector<DNSResourceRecord>& r
     // row number, used by 'lua_settable' below
     lua_pushnumber(lua, ++pos);
     // "row" table
-    lua_newtable(lua);
+    lua_createtable(lua, 0, 5);
     
     lua_pushstring(lua, rr.qname.c_str());
     lua_setfield(lua, -2, "qname");  // pushes value at the top of the stack to the table immediately below that (-1 = top, -2 is below)
@@ -231,10 +231,10 @@ int netmaskMatchLua(lua_State *lua)
   return 1;
 }
 
+// these get their PowerDNSLua as upvalue, which is cheaper than looking it up in the registry on every call
 int getLocalAddressLua(lua_State* lua)
 {
-  lua_getfield(lua, LUA_REGISTRYINDEX, "__PowerDNSLua"); 
-  PowerDNSLua* pl = (PowerDNSLua*)lua_touserdata(lua, -1);
+  PowerDNSLua* pl = (PowerDNSLua*)lua_touserdata(lua, lua_upvalueindex(1));
   
   lua_pushstring(lua, pl->getLocal().toString().c_str());
   return 1;
@@ -243,8 +243,7 @@ int getLocalAddressLua(lua_State* lua)
 // called by lua to indicate that this answer is 'variable' and should not be cached
 int setVariableLua(lua_State* lua)
 {
-  lua_getfield(lua, LUA_REGISTRYINDEX, "__PowerDNSLua"); 
-  PowerDNSLua* pl = (PowerDNSLua*)lua_touserdata(lua, -1);
+  PowerDNSLua* pl = (PowerDNSLua*)lua_touserdata(lua, lua_upvalueindex(1));
   pl->setVariable();
   return 0;
 }
@@ -315,16 +314,30 @@ PowerDNSLua::PowerDNSLua(const std::string& fname)
 
   lua_settop(d_lua, 0);
 
-  lua_pushcfunction(d_lua, setVariableLua);
+  lua_pushlightuserdata(d_lua, (void*)this);
+  lua_pushcclosure(d_lua, setVariableLua, 1);
   lua_setglobal(d_lua, "setvariable");
 
-  lua_pushcfunction(d_lua, getLocalAddressLua);
+  lua_pushlightuserdata(d_lua, (void*)this);
+  lua_pushcclosure(d_lua, getLocalAddressLua, 1);
   lua_setglobal(d_lua, "getlocaladdress");
   
   lua_pushlightuserdata(d_lua, (void*)this); 
   lua_setfield(d_lua, LUA_REGISTRYINDEX, "__PowerDNSLua");
 }
 
+// Returns a registry reference to the function the script defines as 'name', or LUA_NOREF. Hooks are looked up
+// once like this when the script is loaded, and not by name on every query
+int PowerDNSLua::getFunction(const char* name)
+{
+  lua_getglobal(d_lua, name);
+  if(!lua_isfunction(d_lua, -1)) {
+    lua_pop(d_lua, 1);
+    return LUA_NOREF;
+  }
+  return luaL_ref(d_lua, LUA_REGISTRYINDEX);
+}
+
 bool PowerDNSLua::getFromTable(const std::string& key, std::string& value)
 {
   return ::getFromTable(d_lua, key, value);
@@ -26,6 +26,7 @@ protected: // FIXME?
   bool passthrough(const string& func, const ComboAddress& remote,const ComboAddress& local, const string& query, const QType& qtype, vector<DNSResourceRecord>& ret, int& res, bool* variable);
   bool getFromTable(const std::string& key, std::string& value);
   bool getFromTable(const std::string& key, uint32_t& value);
+  int getFunction(const char* name);
   bool d_failed;
   bool d_variable;  
   ComboAddress d_local;
@@ -55,7 +55,10 @@ extern "C" {
 RecursorLua::RecursorLua(const std::string &fname)
   : PowerDNSLua(fname)
 {
-  // empty
+  d_preresolve = getFunction("preresolve");
+  d_nxdomain = getFunction("nxdomain");
+  d_nodata = getFunction("nodata");
+  d_postresolve = getFunction("postresolve");
 }
 
 int getFakeAAAARecords(const std::string& qname, const std::string& prefix, vector<DNSResourceRecord>& ret)
@@ -111,35 +114,33 @@ int getFakePTRRecords(const std::string& qname, const std::string& prefix, vecto
 
 bool RecursorLua::nxdomain(const ComboAddress& remote, const ComboAddress& local,const string& query, const QType& qtype, vector<DNSResourceRecord>& ret, int& res, bool* variable)
 {
-  return passthrough("nxdomain", remote, local, query, qtype, ret, res, variable);
+  return passthrough("nxdomain", d_nxdomain, remote, local, query, qtype, ret, res, variable);
 }
 
 bool RecursorLua::preresolve(const ComboAddress& remote, const ComboAddress& local,const string& query, const QType& qtype, vector<DNSResourceRecord>& ret, int& res, bool* variable)
 {
-  return passthrough("preresolve", remote, local, query, qtype, ret, res, variable);
+  return passthrough("preresolve", d_preresolve, remote, local, query, qtype, ret, res, variable);
 }
 
 bool RecursorLua::nodata(const ComboAddress& remote, const ComboAddress& local,const string& query, const QType& qtype, vector<DNSResourceRecord>& ret, int& res, bool* variable)
 {
-  return passthrough("nodata", remote, local, query, qtype, ret, res, variable);
+  return passthrough("nodata", d_nodata, remote, local, query, qtype, ret, res, variable);
 }
 
 bool RecursorLua::postresolve(const ComboAddress& remote, const ComboAddress& local,const string& query, const QType& qtype, vector<DNSResourceRecord>& ret, int& res, bool* variable)
 {
-  return passthrough("postresolve", remote, local, query, qtype, ret, res, variable);
+  return passthrough("postresolve", d_postresolve, remote, local, query, qtype, ret, res, variable);
 }
 
 
-bool RecursorLua::passthrough(const string& func, const ComboAddress& remote, const ComboAddress& local, const string& query, const QType& qtype, vector<DNSResourceRecord>& ret, 
+bool RecursorLua::passthrough(const char* func, int ref, const ComboAddress& remote, const ComboAddress& local, const string& query, const QType& qtype, vector<DNSResourceRecord>& ret, 
   int& res, bool* variable)
 {
-  d_variable = false;
-  lua_getglobal(d_lua,  func.c_str());
-  if(!lua_isfunction(d_lua, -1)) {
-    //  cerr<<"No such function '"<<func<<"'\n";
-    lua_pop(d_lua, 1);
+  if(ref == LUA_NOREF) // the script does not have this hook
     return false;
-  }
+
+  d_variable = false;
+  lua_rawgeti(d_lua, LUA_REGISTRYINDEX, ref);
   
   d_local = local; 
   /* the first argument */
@@ -148,18 +149,18 @@ bool RecursorLua::passthrough(const string& func, const ComboAddress& remote, co
   lua_pushnumber(d_lua,  qtype.getCode() );
 
   int extraParameter = 0;
-  if(!strcmp(func.c_str(),"nodata")) {
+  if(ref == d_nodata) {
     pushResourceRecordsTable(d_lua, ret);
     extraParameter++;
   }
-  else if(!strcmp(func.c_str(),"postresolve")) {
+  else if(ref == d_postresolve) {
     pushResourceRecordsTable(d_lua, ret);
     lua_pushnumber(d_lua, res);
     extraParameter+=2;
   }
 
   if(lua_pcall(d_lua,  3 + extraParameter, 3, 0)) { 
-    string error=string("lua error in '"+func+"' while processing query for '"+query+"|"+qtype.getName()+": ")+lua_tostring(d_lua, -1);
+    string error=string("lua error in '")+func+"' while processing query for '"+query+"|"+qtype.getName()+": "+lua_tostring(d_lua, -1);
     lua_pop(d_lua, 1);
     throw runtime_error(error);
     return false;
@@ -15,7 +15,10 @@ public:
   bool postresolve(const ComboAddress& remote, const ComboAddress& local, const string& query, const QType& qtype, vector<DNSResourceRecord>& res, int& ret, bool* variable);
 
 private:
-  bool passthrough(const string& func, const ComboAddress& remote,const ComboAddress& local, const string& query, const QType& qtype, vector<DNSResourceRecord>& ret, int& res, bool* variable);
+  bool passthrough(const char* func, int ref, const ComboAddress& remote,const ComboAddress& local, const string& query, const QType& qtype, vector<DNSResourceRecord>& ret, int& res, bool* variable);
+
+  // registry references to the hooks of the script
+  int d_preresolve, d_nxdomain, d_nodata, d_postresolve;
 };
 
 #endif
@@ -37,9 +37,12 @@
 #include "session.hh"
 #include "packetcache.hh"
 #include <boost/lexical_cast.hpp>
+#include "statbag.hh"
 
 #include "namespaces.hh"
 
+extern StatBag S;
+
 
 void CommunicatorClass::queueNotifyDomain(const string &domain, DNSBackend *B)
 {
@@ -63,16 +66,20 @@ void CommunicatorClass::queueNotifyDomain(const string &domain, DNSBackend *B)
   
   // make calls to d_nq.add(domain, ip);
   for(set<string>::const_iterator j=ips.begin();j!=ips.end();++j) {
-    L<<Logger::Warning<<"Queued notification of domain '"<<domain<<"' to "<<*j<<endl;
-    d_nq.add(domain,*j);
+    if(d_nq.add(domain,*j))
+      L<<Logger::Warning<<"Queued notification of domain '"<<domain<<"' to "<<*j<<endl;
+    else
+      S.inc("notify-coalesced");
     hasQueuedItem=true;
   }
   set<string>alsoNotify;
   B->alsoNotifies(domain, &alsoNotify);
   
   for(set<string>::const_iterator j=alsoNotify.begin();j!=alsoNotify.end();++j) {
-    L<<Logger::Warning<<"Queued also-notification of domain '"<<domain<<"' to "<<*j<<endl;
-    d_nq.add(domain,*j);
+    if(d_nq.add(domain,*j))
+      L<<Logger::Warning<<"Queued also-notification of domain '"<<domain<<"' to "<<*j<<endl;
+    else
+      S.inc("notify-coalesced");
     hasQueuedItem=true;
   }
   if (!hasQueuedItem)
@@ -98,11 +105,119 @@ bool CommunicatorClass::notifyDomain(const string &domain)
 void NotificationQueue::dump()
 {
   cerr<<"Waiting for notification responses: "<<endl;
-  BOOST_FOREACH(NotificationRequest& nr, d_nqueue) {
+  BOOST_FOREACH(const NotificationRequest& nr, d_nqueue) {
     cerr<<nr.domain<<", "<<nr.ip<<endl;
   }
 }
 
+bool NotificationQueue::add(const string &domain, const string &ip)
+{
+  time_t now = time(0);
+  pair<d_nqueue_t::iterator, d_nqueue_t::iterator> range = d_nqueue.equal_range(domain);
+  for(d_nqueue_t::iterator i = range.first; i != range.second; ++i) {
+    if(i->ip != ip)
+      continue;
+    if(!i->attempts) // not sent yet, that one will do
+      return false;
+
+    // already out there, but the slave may have looked before this latest change. Ask again once the dust settles
+    NotificationRequest nr = *i;
+    nr.attempts = 0;
+    nr.id = Utility::random()%0xffff;
+    nr.next = max(now, nr.lastsent + (time_t)d_coalesce);
+    gettimeofday(&nr.queued, 0);
+    d_nqueue.replace(i, nr);
+    return false;
+  }
+
+  NotificationRequest nr;
+  nr.domain   = domain;
+  nr.ip       = ip;
+  nr.attempts = 0;
+  nr.id       = Utility::random()%0xffff;
+  nr.next     = now;
+  nr.lastsent = 0;
+  gettimeofday(&nr.queued, 0);
+
+  d_nqueue.insert(nr);
+  return true;
+}
+
+bool NotificationQueue::removeIf(const string &remote, uint16_t id, const string &domain, unsigned int* msec)
+{
+  string remoteIP, ourIP, port;
+  tie(remoteIP, port)=splitField(remote, ':');
+  pair<d_nqueue_t::iterator, d_nqueue_t::iterator> range = d_nqueue.equal_range(domain);
+  for(d_nqueue_t::iterator i = range.first; i != range.second; ++i) {
+    tie(ourIP, port)=splitField(i->ip, ':');
+    if(i->id==id && ourIP == remoteIP) {
+      if(msec) {
+        struct timeval now;
+        gettimeofday(&now, 0);
+        *msec = (now.tv_sec - i->queued.tv_sec)*1000 + (now.tv_usec - i->queued.tv_usec)/1000;
+      }
+      d_nqueue.erase(i);
+      return true;
+    }
+  }
+  return false;
+}
+
+bool NotificationQueue::takeToken(const string& ip)
+{
+  if(!d_rate)
+    return true;
+
+  string dest, port;
+  tie(dest, port)=splitField(ip, ':');
+  struct timeval now;
+  gettimeofday(&now, 0);
+
+  map<string, TokenBucket>::iterator iter = d_buckets.find(dest);
+  if(iter == d_buckets.end()) {
+    TokenBucket tb;
+    tb.tokens = d_rate;
+    tb.last = now;
+    iter = d_buckets.insert(make_pair(dest, tb)).first;
+  }
+  TokenBucket& tb = iter->second;
+  tb.tokens = min((double)d_rate, tb.tokens + d_rate * ((now.tv_sec - tb.last.tv_sec) + (now.tv_usec - tb.last.tv_usec)/1000000.0));
+  tb.last = now;
+  if(tb.tokens < 1)
+    return false;
+  tb.tokens--;
+  return true;
+}
+
+bool NotificationQueue::getOne(string &domain, string &ip, uint16_t *id, bool &purged)
+{
+  time_t now = time(0);
+  typedef d_nqueue_t::index<NextTag>::type bynext_t;
+  bynext_t& bynext = d_nqueue.get<NextTag>();
+  for(bynext_t::iterator i = bynext.begin(); i != bynext.end() && i->next <= now; ) {
+    NotificationRequest nr = *i;
+    if(!takeToken(nr.ip)) { // this destination had its share for now, look again in a second
+      nr.next = now + 1;
+      bynext.replace(i++, nr);
+      continue;
+    }
+
+    nr.attempts++;
+    nr.next = now+1+(1<<nr.attempts);
+    nr.lastsent = now;
+    domain = nr.domain;
+    ip = nr.ip;
+    *id = nr.id;
+    purged = nr.attempts>4;
+    if(purged)
+      bynext.erase(i);
+    else
+      bynext.replace(i, nr);
+    return true;
+  }
+  return false;
+}
+
 void CommunicatorClass::masterUpdateCheck(PacketHandler *P)
 {
   if(!::arg().mustDo("master"))
@@ -159,53 +274,100 @@ time_t CommunicatorClass::doNotifications()
     if(p.d.rcode)
       L<<Logger::Warning<<"Received unsuccessful notification report for '"<<p.qdomain<<"' from "<<from.toStringWithPort()<<", rcode: "<<p.d.rcode<<endl;      
     
-    if(d_nq.removeIf(from.toStringWithPort(), p.d.id, p.qdomain))
+    unsigned int msec;
+    if(d_nq.removeIf(from.toStringWithPort(), p.d.id, p.qdomain, &msec)) {
       L<<Logger::Warning<<"Removed from notification list: '"<<p.qdomain<<"' to "<<from.toStringWithPort()<< (p.d.rcode ? "" : " (was acknowledged)")<<endl;      
+      d_notifylatency = 0.999*d_notifylatency + 0.001*msec; // 'EWMA'
+    }
     else {
       L<<Logger::Warning<<"Received spurious notify answer for '"<<p.qdomain<<"' from "<< from.toStringWithPort()<<endl;
       //d_nq.dump();
     }
   }
 
-  // send out possible new notifications
-  string domain, ip;
-  uint16_t id;
+  // send out possible new notifications, a batch per address family
+  PendingNotification pn;
+  vector<PendingNotification> todo4, todo6;
+  const vector<PendingNotification>::size_type batchsize = 64;
 
   bool purged;
-  while(d_nq.getOne(domain, ip, &id, purged)) {
+  while(d_nq.getOne(pn.domain, pn.ip, &pn.id, purged)) {
     if(!purged) {
       try {
-        ComboAddress remote(ip, 53); // default to 53
-        if((d_nsock6 < 0 && remote.sin4.sin_family == AF_INET6) ||
-           (d_nsock4 < 0 && remote.sin4.sin_family == AF_INET))
+        pn.remote = ComboAddress(pn.ip, 53); // default to 53
+        if((d_nsock6 < 0 && pn.remote.sin4.sin_family == AF_INET6) ||
+           (d_nsock4 < 0 && pn.remote.sin4.sin_family == AF_INET))
              continue; // don't try to notify what we can't!
-        if(d_preventSelfNotification && AddressIsUs(remote))
+        if(d_preventSelfNotification && AddressIsUs(pn.remote))
           continue;
 
-        sendNotification(remote.sin4.sin_family == AF_INET ? d_nsock4 : d_nsock6, domain, remote, id); 
-        drillHole(domain, ip);
+        vector<PendingNotification>& todo = pn.remote.sin4.sin_family == AF_INET ? todo4 : todo6;
+        todo.push_back(pn);
+        if(todo.size() == batchsize) {
+          sendNotifications(pn.remote.sin4.sin_family == AF_INET ? d_nsock4 : d_nsock6, todo);
+          todo.clear();
+        }
       }
       catch(ResolverException &re) {
-        L<<Logger::Error<<"Error trying to resolve '"+ip+"' for notifying '"+domain+"' to server: "+re.reason<<endl;
+        L<<Logger::Error<<"Error trying to resolve '"+pn.ip+"' for notifying '"+pn.domain+"' to server: "+re.reason<<endl;
       }
     }
     else
-      L<<Logger::Error<<Logger::NTLog<<"Notification for "<<domain<<" to "<<ip<<" failed after retries"<<endl;
+      L<<Logger::Error<<Logger::NTLog<<"Notification for "<<pn.domain<<" to "<<pn.ip<<" failed after retries"<<endl;
   }
+  if(!todo4.empty())
+    sendNotifications(d_nsock4, todo4);
+  if(!todo6.empty())
+    sendNotifications(d_nsock6, todo6);
 
+  S.set("notify-queue", d_nq.size());
+  S.set("notify-latency", (unsigned int)(d_notifylatency + 0.5));
   return d_nq.earliest();
 }
 
-void CommunicatorClass::sendNotification(int sock, const string& domain, const ComboAddress& remote, uint16_t id)
+void CommunicatorClass::sendNotifications(int sock, const vector<PendingNotification>& todo)
 {
-  vector<uint8_t> packet;
-  DNSPacketWriter pw(packet, domain, QType::SOA, 1, Opcode::Notify);
-  pw.getHeader()->id = id;
-  pw.getHeader()->aa = true; 
+  vector<vector<uint8_t> > packets(todo.size());
+  for(vector<PendingNotification>::size_type n = 0; n < todo.size(); ++n) {
+    DNSPacketWriter pw(packets[n], todo[n].domain, QType::SOA, 1, Opcode::Notify);
+    pw.getHeader()->id = todo[n].id;
+    pw.getHeader()->aa = true; 
+  }
 
-  if(sendto(sock, &packet[0], packet.size(), 0, (struct sockaddr*)(&remote), remote.getSocklen()) < 0) {
-    throw ResolverException("Unable to send notify to "+remote.toStringWithPort()+": "+stringerror());
+  unsigned int sent = 0;
+#ifdef HAVE_SENDMMSG
+  vector<struct mmsghdr> msgs(todo.size());
+  vector<struct iovec> iovs(todo.size());
+  memset(&msgs[0], 0, sizeof(struct mmsghdr)*msgs.size());
+  for(vector<PendingNotification>::size_type n = 0; n < todo.size(); ++n) {
+    iovs[n].iov_base = &packets[n][0];
+    iovs[n].iov_len = packets[n].size();
+    msgs[n].msg_hdr.msg_name = (void*)&todo[n].remote;
+    msgs[n].msg_hdr.msg_namelen = todo[n].remote.getSocklen();
+    msgs[n].msg_hdr.msg_iov = &iovs[n];
+    msgs[n].msg_hdr.msg_iovlen = 1;
   }
+  while(sent < todo.size()) {
+    int ret = sendmmsg(sock, &msgs[sent], todo.size() - sent, 0);
+    if(ret <= 0) {
+      L<<Logger::Error<<"Unable to send notify to "<<todo[sent].remote.toStringWithPort()<<": "<<stringerror()<<endl;
+      break; // what didn't go out gets retried like a lost NOTIFY
+    }
+    sent += ret;
+  }
+#else
+  for(vector<PendingNotification>::size_type n = 0; n < todo.size(); ++n) {
+    if(sendto(sock, &packets[n][0], packets[n].size(), 0, (struct sockaddr*)(&todo[n].remote), todo[n].remote.getSocklen()) < 0) {
+      L<<Logger::Error<<"Unable to send notify to "<<todo[n].remote.toStringWithPort()<<": "<<stringerror()<<endl;
+      continue;
+    }
+    sent++;
+  }
+#endif
+  S.deposit("notify-sent", sent);
+
+  BOOST_FOREACH(const PendingNotification& pn, todo)
+    drillHole(pn.domain, pn.ip);
 }
 
 void CommunicatorClass::drillHole(const string &domain, const string &ip)
@@ -230,10 +392,15 @@ bool CommunicatorClass::justNotified(const string &domain, const string &ip)
 void CommunicatorClass::makeNotifySockets()
 {
   d_nsock4 = makeQuerySocket(ComboAddress(::arg()["query-local-address"]), true);
-  if(!::arg()["query-local-address6"].empty())
+  Utility::setNonBlocking(d_nsock4);
+  if(!::arg()["query-local-address6"].empty()) {
     d_nsock6 = makeQuerySocket(ComboAddress(::arg()["query-local-address6"]), true);
+    Utility::setNonBlocking(d_nsock6);
+  }
   else
     d_nsock6 = -1;
+
+  d_nq.setLimits(::arg().asNum("notify-coalesce-interval"), ::arg().asNum("notify-rate-per-destination"));
 }
 
 void CommunicatorClass::notify(const string &domain, const string &ip)
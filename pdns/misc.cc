@@ -524,7 +524,7 @@ void shuffle(vector<DNSResourceRecord>& rrs)
   // we don't shuffle the rest
 }
 
-static bool comparePlace(DNSResourceRecord a, DNSResourceRecord b)
+static bool comparePlace(const DNSResourceRecord& a, const DNSResourceRecord& b)
 {
   return (a.d_place < b.d_place);
 }
@@ -537,6 +537,42 @@ void orderAndShuffle(vector<DNSResourceRecord>& rrs)
   shuffle(rrs);
 }
 
+// same as orderAndShuffle, but leaves rrs alone and fills order with offsets into rrs in the order the records should go out.
+// Saves copying records around, which is what sorting them costs us
+void orderAndShuffle(const vector<DNSResourceRecord>& rrs, vector<unsigned int>& order, bool doShuffle)
+{
+  order.clear();
+  order.reserve(rrs.size());
+  for(int place=DNSResourceRecord::QUESTION; place <= DNSResourceRecord::ADDITIONAL; ++place)
+    for(unsigned int n=0; n < rrs.size(); ++n)
+      if(rrs[n].d_place == place)
+        order.push_back(n);
+
+  if(!doShuffle)
+    return;
+
+  vector<unsigned int>::iterator first, second;
+  for(first=order.begin();first!=order.end();++first)
+    if(rrs[*first].d_place==DNSResourceRecord::ANSWER && rrs[*first].qtype.getCode() != QType::CNAME) // CNAME must come first
+      break;
+  for(second=first;second!=order.end();++second)
+    if(rrs[*second].d_place!=DNSResourceRecord::ANSWER)
+      break;
+
+  if(second-first>1)
+    random_shuffle(first,second);
+
+  for(first=second;first!=order.end();++first)
+    if(rrs[*first].d_place==DNSResourceRecord::ADDITIONAL && rrs[*first].qtype.getCode() != QType::CNAME)
+      break;
+  for(second=first;second!=order.end();++second)
+    if(rrs[*second].d_place!=DNSResourceRecord::ADDITIONAL)
+      break;
+
+  if(second-first>1)
+    random_shuffle(first,second);
+}
+
 void normalizeTV(struct timeval& tv)
 {
   if(tv.tv_usec > 1000000) {
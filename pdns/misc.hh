@@ -292,6 +292,7 @@ inline void unixDie(const string &why)
 string makeHexDump(const string& str);
 void shuffle(vector<DNSResourceRecord>& rrs);
 void orderAndShuffle(vector<DNSResourceRecord>& rrs);
+void orderAndShuffle(const vector<DNSResourceRecord>& rrs, vector<unsigned int>& order, bool doShuffle);
 
 void normalizeTV(struct timeval& tv);
 const struct timeval operator+(const struct timeval& lhs, const struct timeval& rhs);
@@ -255,7 +255,7 @@ void UDPNameserver::send(DNSPacket *p)
   static unsigned int &numanswered6=*S.getPointer("udp6-answers");
   static unsigned int &bytesanswered=*S.getPointer("udp-answers-bytes");
 
-  g_rs.submitResponse(p->qtype.getCode(), buffer.length(), true);
+  g_rs.submitResponse(p->qtype.getCode(), buffer.length(), buffer.length() > 3 ? buffer[3] & 0x0f : 0, true);
 
   struct msghdr msgh;
   struct cmsghdr *cmsg;
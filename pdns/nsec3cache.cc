@@ -0,0 +1,180 @@
+#include "nsec3cache.hh"
+#include "dnssecinfra.hh"
+#include "dnsrecords.hh"
+#include "lock.hh"
+#include "namespaces.hh"
+
+NSEC3Cache g_nsec3cache;
+
+NSEC3Cache::NSEC3Cache() : d_maxentries(0), d_ttl(0)
+{
+}
+
+NSEC3Cache::~NSEC3Cache()
+{
+  for(unsigned int n = 0; n < s_shardcount; ++n)
+    pthread_mutex_destroy(&d_shards[n].d_lock);
+}
+
+void NSEC3Cache::setLimits(unsigned int maxentries, unsigned int ttl)
+{
+  d_maxentries = maxentries;
+  d_ttl = ttl;
+  purge();
+}
+
+NSEC3Cache::Zone& NSEC3Cache::getZone(Shard& shard, int domain_id, uint32_t serial)
+{
+  Zone& zone = shard.d_zones[domain_id];
+  time_t now = time(0);
+  if(zone.serial != serial || zone.created + (time_t)d_ttl < now) {
+    zone.ranges.clear();
+    zone.records.clear();
+    zone.serial = serial;
+    zone.created = now;
+  }
+  return zone;
+}
+
+string NSEC3Cache::getHash(int domain_id, const NSEC3PARAMRecordContent& ns3prc, const string& qname)
+{
+  if(!enabled())
+    return hashQNameWithSalt(ns3prc.d_iterations, ns3prc.d_salt, qname);
+
+  Shard& shard = getShard(domain_id);
+  {
+    Lock l(&shard.d_lock);
+    Zone& zone = shard.d_zones[domain_id];
+    if(zone.iterations == ns3prc.d_iterations && zone.salt == ns3prc.d_salt) {
+      map<string, string, CIStringCompare>::const_iterator iter = zone.hashes.find(qname);
+      if(iter != zone.hashes.end())
+        return iter->second;
+    }
+  }
+
+  string hashed = hashQNameWithSalt(ns3prc.d_iterations, ns3prc.d_salt, qname); // not under the lock, this is the expensive bit
+
+  Lock l(&shard.d_lock);
+  Zone& zone = shard.d_zones[domain_id];
+  if(zone.iterations != ns3prc.d_iterations || zone.salt != ns3prc.d_salt) {
+    zone.hashes.clear();
+    zone.iterations = ns3prc.d_iterations;
+    zone.salt = ns3prc.d_salt;
+  }
+  if(zone.hashes.size() >= d_maxentries)
+    zone.hashes.clear();
+  zone.hashes[qname] = hashed;
+  return hashed;
+}
+
+// ranges that wrap around the end of the zone have after <= before
+static bool rangeHolds(const string& before, const string& after, const string& hashed)
+{
+  if(before < after)
+    return before <= hashed && hashed < after;
+  return hashed >= before || hashed < after;
+}
+
+bool NSEC3Cache::getRange(int domain_id, uint32_t serial, const string& hashed, bool needBefore, string& unhashed, string& before, string& after)
+{
+  if(!enabled())
+    return false;
+
+  Shard& shard = getShard(domain_id);
+  Lock l(&shard.d_lock);
+  Zone& zone = getZone(shard, domain_id, serial);
+  if(zone.ranges.empty())
+    return false;
+
+  map<string, Range>::const_iterator iter = zone.ranges.upper_bound(hashed);
+  if(iter == zone.ranges.begin()) // nothing starts at or before hashed, only the range wrapping around can hold it
+    iter = zone.ranges.end();
+  --iter;
+
+  if(!rangeHolds(iter->first, iter->second.after, hashed))
+    return false;
+  if(needBefore && iter->second.unhashed.empty())
+    return false;
+
+  unhashed = iter->second.unhashed;
+  before = iter->first;
+  after = iter->second.after;
+  return true;
+}
+
+void NSEC3Cache::addRange(int domain_id, uint32_t serial, const string& unhashed, const string& before, const string& after)
+{
+  if(!enabled() || unhashed.empty())
+    return;
+
+  Shard& shard = getShard(domain_id);
+  Lock l(&shard.d_lock);
+  Zone& zone = getZone(shard, domain_id, serial);
+  if(zone.ranges.size() >= d_maxentries)
+    zone.ranges.clear();
+  Range& range = zone.ranges[before];
+  range.after = after;
+  range.unhashed = unhashed;
+}
+
+void NSEC3Cache::addSuccessor(int domain_id, uint32_t serial, const string& hashed, const string& after)
+{
+  if(!enabled())
+    return;
+
+  Shard& shard = getShard(domain_id);
+  Lock l(&shard.d_lock);
+  Zone& zone = getZone(shard, domain_id, serial);
+  if(zone.ranges.count(hashed)) // never replace a range we know more about
+    return;
+  if(zone.ranges.size() >= d_maxentries)
+    zone.ranges.clear();
+  zone.ranges[hashed].after = after;
+}
+
+bool NSEC3Cache::getRecord(int domain_id, uint32_t serial, const string& begin, const string& end, DNSResourceRecord& rr)
+{
+  if(!enabled())
+    return false;
+
+  Shard& shard = getShard(domain_id);
+  Lock l(&shard.d_lock);
+  Zone& zone = getZone(shard, domain_id, serial);
+  map<string, pair<string, DNSResourceRecord> >::const_iterator iter = zone.records.find(begin);
+  if(iter == zone.records.end() || iter->second.first != end)
+    return false;
+  rr = iter->second.second;
+  return true;
+}
+
+void NSEC3Cache::addRecord(int domain_id, uint32_t serial, const string& begin, const string& end, const DNSResourceRecord& rr)
+{
+  if(!enabled())
+    return;
+
+  Shard& shard = getShard(domain_id);
+  Lock l(&shard.d_lock);
+  Zone& zone = getZone(shard, domain_id, serial);
+  if(zone.records.size() >= d_maxentries)
+    zone.records.clear();
+  zone.records[begin] = make_pair(end, rr);
+}
+
+void NSEC3Cache::purge()
+{
+  for(unsigned int n = 0; n < s_shardcount; ++n) {
+    Lock l(&d_shards[n].d_lock);
+    d_shards[n].d_zones.clear();
+  }
+}
+
+uint64_t NSEC3Cache::size()
+{
+  uint64_t ret = 0;
+  for(unsigned int n = 0; n < s_shardcount; ++n) {
+    Lock l(&d_shards[n].d_lock);
+    for(zones_t::const_iterator iter = d_shards[n].d_zones.begin(); iter != d_shards[n].d_zones.end(); ++iter)
+      ret += iter->second.hashes.size() + iter->second.ranges.size() + iter->second.records.size();
+  }
+  return ret;
+}
@@ -0,0 +1,87 @@
+#ifndef PDNS_NSEC3CACHE_HH
+#define PDNS_NSEC3CACHE_HH
+#include <pthread.h>
+#include <boost/utility.hpp>
+#include "dns.hh"
+#include "misc.hh"
+
+class NSEC3PARAMRecordContent;
+
+/** Keeps negative answers from NSEC3 zones cheap. Per zone it remembers the hashes of names we had to hash,
+    the ranges between consecutive hashes we learned from the backend, and the NSEC3 records we built for them.
+    Denying another name that falls in a range we know then takes no hashing and no backend queries.
+    Ranges and records are thrown out when the serial of the zone changes, and after a few seconds regardless,
+    so edits that don't touch the serial show up soon enough. Each zone holds at most maxentries of each. */
+class NSEC3Cache : public boost::noncopyable
+{
+public:
+  NSEC3Cache();
+  ~NSEC3Cache();
+
+  void setLimits(unsigned int maxentries, unsigned int ttl); //!< maxentries 0 disables the cache
+  bool enabled() const
+  {
+    return d_maxentries > 0;
+  }
+
+  //! hashQNameWithSalt, but remembered
+  string getHash(int domain_id, const NSEC3PARAMRecordContent& ns3prc, const string& qname);
+
+  /** finds the range [before, after) that holds hashed. Ranges are learned from backend lookups, if needBefore is
+      set only ranges where before is known to be the hash of unhashed qualify */
+  bool getRange(int domain_id, uint32_t serial, const string& hashed, bool needBefore, string& unhashed, string& before, string& after);
+  void addRange(int domain_id, uint32_t serial, const string& unhashed, const string& before, const string& after);
+  //! like addRange, when we only know nothing lives between hashed and after
+  void addSuccessor(int domain_id, uint32_t serial, const string& hashed, const string& after);
+
+  //! the NSEC3 record we built for the range starting at begin
+  bool getRecord(int domain_id, uint32_t serial, const string& begin, const string& end, DNSResourceRecord& rr);
+  void addRecord(int domain_id, uint32_t serial, const string& begin, const string& end, const DNSResourceRecord& rr);
+
+  void purge();
+  uint64_t size(); //!< entries over all zones
+
+private:
+  struct Range
+  {
+    string after;
+    string unhashed; //!< empty if we don't know what name before is the hash of
+  };
+
+  struct Zone
+  {
+    Zone() : serial(0), created(0), iterations(0) {}
+    uint32_t serial;
+    time_t created;
+    unsigned int iterations;
+    string salt;
+    map<string, string, CIStringCompare> hashes;
+    map<string, Range> ranges;          //!< keyed by the raw hash that starts the range
+    map<string, pair<string, DNSResourceRecord> > records; //!< begin -> end, record
+  };
+  typedef map<int, Zone> zones_t;
+
+  struct Shard
+  {
+    Shard()
+    {
+      pthread_mutex_init(&d_lock, 0);
+    }
+    pthread_mutex_t d_lock;
+    zones_t d_zones;
+  };
+
+  Zone& getZone(Shard& shard, int domain_id, uint32_t serial); //!< needs the shard lock, resets the zone if it went stale
+  Shard& getShard(int domain_id)
+  {
+    return d_shards[(unsigned int)domain_id % s_shardcount];
+  }
+
+  static const unsigned int s_shardcount = 16;
+  Shard d_shards[s_shardcount];
+  unsigned int d_maxentries;
+  unsigned int d_ttl;
+};
+
+extern NSEC3Cache g_nsec3cache;
+#endif
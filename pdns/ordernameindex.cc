@@ -0,0 +1,158 @@
+#include "ordernameindex.hh"
+#include "lock.hh"
+#include "namespaces.hh"
+
+OrderNameIndex g_ordernameindex;
+
+OrderNameIndex::OrderNameIndex() : d_ttl(0)
+{
+  pthread_rwlock_init(&d_lock, 0);
+}
+
+OrderNameIndex::~OrderNameIndex()
+{
+  pthread_rwlock_destroy(&d_lock);
+}
+
+void OrderNameIndex::setTTL(unsigned int ttl)
+{
+  WriteLock wl(&d_lock);
+  d_ttl = ttl;
+  if(!d_ttl)
+    d_zones.clear();
+}
+
+bool OrderNameIndex::needsLoad(const string& backend, uint32_t domain_id, uint64_t& generation)
+{
+  if(!enabled())
+    return false;
+
+  time_t now = time(0);
+  {
+    ReadLock rl(&d_lock);
+    zones_t::const_iterator iter = d_zones.find(make_pair(backend, domain_id));
+    if(iter != d_zones.end() && (iter->second.loading || (iter->second.loaded && iter->second.loadedAt + (time_t)d_ttl >= now)))
+      return false;
+  }
+
+  WriteLock wl(&d_lock);
+  Zone& zone = d_zones[make_pair(backend, domain_id)];
+  if(zone.loading || (zone.loaded && zone.loadedAt + (time_t)d_ttl >= now)) // somebody beat us to it
+    return false;
+  zone.loading = true;
+  generation = zone.generation;
+  return true;
+}
+
+void OrderNameIndex::load(const string& backend, uint32_t domain_id, uint64_t generation, const vector<pair<string, string> >& ordernames)
+{
+  // build outside the lock, the zone may be big
+  map<string, string> byorder, byname;
+  for(vector<pair<string, string> >::const_iterator iter = ordernames.begin(); iter != ordernames.end(); ++iter) {
+    string name = toLower(iter->second);
+    byorder[iter->first] = name;
+    byname[name] = iter->first;
+  }
+
+  WriteLock wl(&d_lock);
+  Zone& zone = d_zones[make_pair(backend, domain_id)];
+  zone.loading = false;
+  if(zone.generation != generation) // changed while we were reading, what we have may already be stale
+    return;
+  zone.byorder.swap(byorder);
+  zone.byname.swap(byname);
+  zone.loaded = true;
+  zone.loadedAt = time(0);
+}
+
+void OrderNameIndex::loadFailed(const string& backend, uint32_t domain_id)
+{
+  WriteLock wl(&d_lock);
+  d_zones[make_pair(backend, domain_id)].loading = false;
+}
+
+void OrderNameIndex::apply(const string& backend, const Change& change)
+{
+  if(!enabled())
+    return;
+
+  WriteLock wl(&d_lock);
+  zones_t::iterator iter = d_zones.find(make_pair(backend, change.domain_id));
+  if(iter == d_zones.end())
+    return;
+
+  Zone& zone = iter->second;
+  zone.generation++;
+  if(!zone.loaded)
+    return;
+
+  if(change.kind == Change::Invalidate || change.kind == Change::Clear) {
+    zone.loaded = change.kind == Change::Clear;
+    zone.byorder.clear();
+    zone.byname.clear();
+    return;
+  }
+
+  string name = toLower(change.qname);
+  map<string, string>::iterator old = zone.byname.find(name);
+  if(old != zone.byname.end()) {
+    map<string, string>::iterator oldorder = zone.byorder.find(old->second);
+    if(oldorder != zone.byorder.end() && oldorder->second == name)
+      zone.byorder.erase(oldorder);
+    zone.byname.erase(old);
+  }
+
+  if(change.kind == Change::Set) {
+    zone.byorder[change.ordername] = name;
+    zone.byname[name] = change.ordername;
+  }
+}
+
+bool OrderNameIndex::getBeforeAndAfterNamesAbsolute(const string& backend, uint32_t domain_id, const string& qname, string& unhashed, string& before, string& after)
+{
+  if(!enabled())
+    return false;
+
+  ReadLock rl(&d_lock);
+  zones_t::const_iterator zone = d_zones.find(make_pair(backend, domain_id));
+  if(zone == d_zones.end() || !zone->second.loaded)
+    return false;
+
+  const map<string, string>& byorder = zone->second.byorder;
+  string lcqname = toLower(qname);
+
+  // first ordername after qname, wrapping around to the first one
+  after.clear();
+  map<string, string>::const_iterator iter = byorder.upper_bound(lcqname);
+  if(iter != byorder.end())
+    after = iter->first;
+  else if(!lcqname.empty() && !byorder.empty())
+    after = byorder.begin()->first;
+
+  if(!before.empty()) {
+    before = lcqname;
+    return true;
+  }
+
+  // last ordername at or before qname, wrapping around to the last one that isn't the apex
+  unhashed.clear();
+  if(iter != byorder.begin()) {
+    --iter;
+    before = iter->first;
+    unhashed = iter->second;
+  }
+  else if(!byorder.empty() && !byorder.rbegin()->first.empty()) {
+    before = byorder.rbegin()->first;
+    unhashed = byorder.rbegin()->second;
+  }
+  return true;
+}
+
+uint64_t OrderNameIndex::size()
+{
+  uint64_t ret = 0;
+  ReadLock rl(&d_lock);
+  for(zones_t::const_iterator iter = d_zones.begin(); iter != d_zones.end(); ++iter)
+    ret += iter->second.byorder.size();
+  return ret;
+}
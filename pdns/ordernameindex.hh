@@ -0,0 +1,65 @@
+#ifndef PDNS_ORDERNAMEINDEX_HH
+#define PDNS_ORDERNAMEINDEX_HH
+#include <pthread.h>
+#include <boost/utility.hpp>
+#include "misc.hh"
+
+/** In-memory copy of the ordernames of DNSSEC zones, so backends that keep ordernames in a database can answer
+    getBeforeAndAfterNamesAbsolute without a round trip. A zone is loaded in one go by the first thread that needs it,
+    after that the backend reports every change it makes to ordernames, and the whole zone is reloaded every ttl
+    seconds to pick up changes made by other processes, like pdnssec rectify-zone.
+    Zones are identified by the argument prefix of the backend instance and the domain id. */
+class OrderNameIndex : public boost::noncopyable
+{
+public:
+  struct Change
+  {
+    enum Kind { Set, Remove, Clear, Invalidate }; //!< Clear empties a loaded zone, Invalidate drops it until the next load
+    Change(Kind kind_, uint32_t domain_id_, const string& qname_="", const string& ordername_="")
+      : kind(kind_), domain_id(domain_id_), qname(qname_), ordername(ordername_) {}
+    Kind kind;
+    uint32_t domain_id;
+    string qname, ordername;
+  };
+
+  OrderNameIndex();
+  ~OrderNameIndex();
+
+  void setTTL(unsigned int ttl); //!< 0 disables the index
+  bool enabled() const
+  {
+    return d_ttl > 0;
+  }
+
+  /** returns true if the zone is missing or due for a reload and nobody is busy loading it yet. The caller then has to
+      call load() or loadFailed() with the generation we hand out */
+  bool needsLoad(const string& backend, uint32_t domain_id, uint64_t& generation);
+  void load(const string& backend, uint32_t domain_id, uint64_t generation, const vector<pair<string, string> >& ordernames); //!< ordername, name
+  void loadFailed(const string& backend, uint32_t domain_id);
+
+  void apply(const string& backend, const Change& change);
+
+  //! exactly what GSQLBackend::getBeforeAndAfterNamesAbsolute would answer, returns false if the zone is not loaded
+  bool getBeforeAndAfterNamesAbsolute(const string& backend, uint32_t domain_id, const string& qname, string& unhashed, string& before, string& after);
+
+  uint64_t size(); //!< ordernames over all zones
+
+private:
+  struct Zone
+  {
+    Zone() : loaded(false), loading(false), loadedAt(0), generation(0) {}
+    bool loaded, loading;
+    time_t loadedAt;
+    uint64_t generation; //!< bumped by every change, so a load that raced with one is thrown away
+    map<string, string> byorder; //!< ordername -> name
+    map<string, string> byname;  //!< name -> ordername
+  };
+  typedef map<pair<string, uint32_t>, Zone> zones_t;
+
+  zones_t d_zones;
+  pthread_rwlock_t d_lock;
+  unsigned int d_ttl;
+};
+
+extern OrderNameIndex g_ordernameindex;
+#endif
@@ -89,7 +89,7 @@ int PacketCache::get(DNSPacket *p, DNSPacket *cached)
     }
 
     uint16_t maxReplyLen = p->d_tcp ? 0xffff : p->getMaxReplyLen();
-    haveSomething=getEntryLocked(p->qdomain, p->qtype, PacketCache::PACKETCACHE, value, -1, packetMeritsRecursion, maxReplyLen, p->d_dnssecOk, p->hasEDNS());
+    haveSomething=getEntryLocked(p->qdomain, p->qtype, PacketCache::PACKETCACHE, value, -1, packetMeritsRecursion, maxReplyLen, p->d_dnssecOk, p->hasEDNS(), p);
   }
   if(haveSomething) {
     (*d_statnumhit)++;
@@ -133,13 +133,59 @@ void PacketCache::insert(DNSPacket *q, DNSPacket *r, unsigned int maxttl)
   unsigned int ourttl = packetMeritsRecursion ? d_recursivettl : d_ttl;
   if(maxttl<ourttl)
     ourttl=maxttl;
+
+  // an answer the backend tailored to the client is only good for the client's network, as far as the backend says
+  uint8_t scopeMask=0;
+  const vector<DNSResourceRecord>& rrs=r->getRRS();
+  for(vector<DNSResourceRecord>::const_iterator i=rrs.begin(); i!=rrs.end(); ++i)
+    scopeMask=max(scopeMask, i->scopeMask);
+
+  string scope;
+  if(scopeMask) {
+    Netmask remote=q->getRealRemote();
+    if(q->hasEDNSSubnet()) // the answer echoes the subnet, so it can only go to that exact subnet again
+      scope=scopeKey(remote.getNetwork(), remote.getBits(), true);
+    else
+      scope=scopeKey(remote.getNetwork(), scopeMask, false);
+  }
+
   insert(q->qdomain, q->qtype, PacketCache::PACKETCACHE, r->getString(), ourttl, -1, packetMeritsRecursion,
-    maxReplyLen, q->d_dnssecOk, q->hasEDNS());
+    maxReplyLen, q->d_dnssecOk, q->hasEDNS(), scope);
+}
+
+/* The key for an answer that holds for the first 'bits' bits of remote: a byte for the family, with the top bit set
+   if remote is the EDNS subnet of the client, a byte for the number of bits, then the masked address. For one
+   question, the scoped entries thus sort by family and then by prefix length, see getEntryLocked(). */
+string PacketCache::scopeKey(const ComboAddress& remote, unsigned int bits, bool ednsSubnet)
+{
+  const unsigned char *addr;
+  unsigned int len;
+  if(remote.sin4.sin_family == AF_INET) {
+    addr=(const unsigned char*)&remote.sin4.sin_addr.s_addr;
+    len=4;
+  }
+  else {
+    addr=(const unsigned char*)&remote.sin6.sin6_addr.s6_addr;
+    len=16;
+  }
+  bits=min(bits, len*8);
+
+  string ret;
+  ret.reserve(2+(bits+7)/8);
+  ret.append(1, (char)((len==4 ? 4 : 6) | (ednsSubnet ? 0x80 : 0)));
+  ret.append(1, (char)bits);
+  for(unsigned int n=0; n*8 < bits; ++n) {
+    unsigned char c=addr[n];
+    if(bits-n*8 < 8)
+      c&=0xff << (8-(bits-n*8));
+    ret.append(1, (char)c);
+  }
+  return ret;
 }
 
 // universal key appears to be: qname, qtype, kind (packet, query cache), optionally zoneid, meritsRecursion
 void PacketCache::insert(const string &qname, const QType& qtype, CacheEntryType cet, const string& value, unsigned int ttl, int zoneID, 
-  bool meritsRecursion, unsigned int maxReplyLen, bool dnssecOk, bool EDNS)
+  bool meritsRecursion, unsigned int maxReplyLen, bool dnssecOk, bool EDNS, const string& scope)
 {
   if(!((++d_ops) % 300000)) {
     cleanup();
@@ -160,6 +206,7 @@ void PacketCache::insert(const string &qname, const QType& qtype, CacheEntryType
   val.dnssecOk = dnssecOk;
   val.zoneID = zoneID;
   val.hasEDNS = EDNS;
+  val.scope = scope;
   
   TryWriteLock l(&d_mut);
   if(l.gotIt()) { 
@@ -281,13 +328,42 @@ bool PacketCache::getEntry(const string &qname, const QType& qtype, CacheEntryTy
 
 
 bool PacketCache::getEntryLocked(const string &qname, const QType& qtype, CacheEntryType cet, string& value, int zoneID, bool meritsRecursion,
-  unsigned int maxReplyLen, bool dnssecOK, bool hasEDNS)
+  unsigned int maxReplyLen, bool dnssecOK, bool hasEDNS, DNSPacket *p)
 {
   uint16_t qt = qtype.getCode();
   //cerr<<"Lookup for maxReplyLen: "<<maxReplyLen<<endl;
-  cmap_t::const_iterator i=d_map.find(tie(qname, qt, cet, zoneID, meritsRecursion, maxReplyLen, dnssecOK, hasEDNS));
+  string scope;
+  cmap_t::const_iterator i=d_map.find(tie(qname, qt, cet, zoneID, meritsRecursion, maxReplyLen, dnssecOK, hasEDNS, scope));
   time_t now=time(0);
   bool ret=(i!=d_map.end() && i->ttd > now);
+
+  if(!ret && p) { // perhaps there is an answer for the network of p
+    Netmask remote=p->getRealRemote();
+    if(p->hasEDNSSubnet()) {
+      scope=scopeKey(remote.getNetwork(), remote.getBits(), true);
+      i=d_map.find(tie(qname, qt, cet, zoneID, meritsRecursion, maxReplyLen, dnssecOK, hasEDNS, scope));
+      ret=(i!=d_map.end() && i->ttd > now);
+    }
+    else {
+      // look once for every prefix length in use for this question, skipping the entries in between. The longest match wins
+      cmap_t::const_iterator end=d_map.upper_bound(tie(qname, qt, cet, zoneID, meritsRecursion, maxReplyLen, dnssecOK, hasEDNS));
+      string from=scopeKey(remote.getNetwork(), 0, false);
+      cmap_t::const_iterator j=d_map.lower_bound(tie(qname, qt, cet, zoneID, meritsRecursion, maxReplyLen, dnssecOK, hasEDNS, from));
+      while(j!=end && j->scope[0]==from[0]) {
+        unsigned int bits=(uint8_t)j->scope[1];
+        scope=scopeKey(remote.getNetwork(), bits, false);
+        cmap_t::const_iterator k=d_map.find(tie(qname, qt, cet, zoneID, meritsRecursion, maxReplyLen, dnssecOK, hasEDNS, scope));
+        if(k!=d_map.end() && k->ttd > now) {
+          i=k;
+          ret=true;
+        }
+
+        from[1]=(char)(bits+1);
+        j=d_map.lower_bound(tie(qname, qt, cet, zoneID, meritsRecursion, maxReplyLen, dnssecOK, hasEDNS, from));
+      }
+    }
+  }
+
   if(ret)
     value = i->value;
   
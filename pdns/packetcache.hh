@@ -45,6 +45,12 @@ using namespace ::boost::multi_index;
 
     The cache itself is protected by a read/write lock. Because deleting is a two step process, which 
     first marks and then sweeps, a second lock is present to prevent simultaneous inserts and deletes.
+
+    Scoping!
+
+    Answers that depend on who is asking (a backend set scopeMask on a record) are stored with a scope key: the
+    address of the client, or the EDNS subnet it sent, cut down to that many bits. They are only handed out to
+    clients in the same network.
 */
 
 struct CIBackwardsStringCompare: public std::binary_function<string, string, bool>  
@@ -75,7 +81,7 @@ public:
   void insert(DNSPacket *q, DNSPacket *r, unsigned int maxttl=UINT_MAX);  //!< We copy the contents of *p into our cache. Do not needlessly call this to insert questions already in the cache as it wastes resources
 
   void insert(const string &qname, const QType& qtype, CacheEntryType cet, const string& value, unsigned int ttl, int zoneID=-1, bool meritsRecursion=false,
-    unsigned int maxReplyLen=512, bool dnssecOk=false, bool EDNS=false);
+    unsigned int maxReplyLen=512, bool dnssecOk=false, bool EDNS=false, const string& scope="");
 
   int get(DNSPacket *p, DNSPacket *q); //!< We return a dynamically allocated copy out of our cache. You need to delete it. You also need to spoof in the right ID with the DNSPacket.spoofID() method.
   bool getEntry(const string &content, const QType& qtype, CacheEntryType cet, string& entry, int zoneID=-1, 
@@ -89,7 +95,8 @@ public:
   map<char,int> getCounts();
 private:
   bool getEntryLocked(const string &content, const QType& qtype, CacheEntryType cet, string& entry, int zoneID=-1, 
-    bool meritsRecursion=false, unsigned int maxReplyLen=512, bool dnssecOk=false, bool hasEDNS=false);
+    bool meritsRecursion=false, unsigned int maxReplyLen=512, bool dnssecOk=false, bool hasEDNS=false, DNSPacket *p=0);
+  static string scopeKey(const ComboAddress& remote, unsigned int bits, bool ednsSubnet);
   struct CacheEntry
   {
     CacheEntry() { qtype = ctype = 0; zoneID = -1; meritsRecursion=false; dnssecOk=false; hasEDNS=false;}
@@ -103,6 +110,7 @@ private:
     unsigned int maxReplyLen;
     bool dnssecOk;
     bool hasEDNS;
+    string scope; //!< empty if the answer is the same for everybody, see scopeKey()
     string value;
   };
 
@@ -121,10 +129,11 @@ private:
                         member<CacheEntry,bool, &CacheEntry::meritsRecursion>,
                         member<CacheEntry,unsigned int, &CacheEntry::maxReplyLen>,
                         member<CacheEntry,bool, &CacheEntry::dnssecOk>,
-                        member<CacheEntry,bool, &CacheEntry::hasEDNS>
+                        member<CacheEntry,bool, &CacheEntry::hasEDNS>,
+                        member<CacheEntry,string, &CacheEntry::scope>
                         >,
                         composite_key_compare<CIBackwardsStringCompare, std::less<uint16_t>, std::less<uint16_t>, std::less<int>, std::less<bool>, 
-                          std::less<unsigned int>, std::less<bool>, std::less<bool> >
+                          std::less<unsigned int>, std::less<bool>, std::less<bool>, std::less<string> >
                             >,
                            sequenced<>
                            >
@@ -43,6 +43,8 @@
 #include "dnsproxy.hh"
 #include "version.hh"
 #include "common_startup.hh"
+#include "zoneindex.hh"
+#include "nsec3cache.hh"
 
 #if 0
 #undef DLOG
@@ -292,6 +294,30 @@ bool PacketHandler::getAuth(DNSPacket *p, SOAData *sd, const string &target, int
 {
   bool found=false;
   string subdomain(target);
+  string zone;
+  if(g_zoneindex.enabled()) {
+    g_zoneindex.refreshIfNeeded(B);
+    // only ask the backends about zones the index knows, which is all of them as it switches itself off otherwise.
+    // A zone created below a known apex is not seen until the next refresh or invalidate(), names under no apex at all get the full walk below
+    if(g_zoneindex.getClosestZone(subdomain, zone)) {
+      do {
+        if( B.getSOA( zone, *sd, p ) ) {
+          sd->qname = zone;
+          if(zoneId)
+            *zoneId = sd->domain_id;
+
+          if(p->qtype.getCode() == QType::DS && pdns_iequals(zone, target))
+            found=true;
+          else
+            return true;
+        }
+        subdomain = zone; // gone since the index was built, or we need the parent for DS
+      }
+      while( chopOff( subdomain ) && g_zoneindex.getClosestZone(subdomain, zone) );
+      return found;
+    }
+  }
+
   do {
     if( B.getSOA( subdomain, *sd, p ) ) {
       sd->qname = subdomain;
@@ -453,6 +479,13 @@ void PacketHandler::emitNSEC(const std::string& begin, const std::string& end, c
 }
 
 void emitNSEC3(DNSBackend& B, const NSEC3PARAMRecordContent& ns3prc, const SOAData& sd, const std::string& unhashed, const std::string& begin, const std::string& end, const std::string& toNSEC3, DNSPacket *r, int mode)
+{
+  DNSResourceRecord rr;
+  makeNSEC3(B, ns3prc, sd, unhashed, begin, end, mode, rr);
+  r->addRecord(rr);
+}
+
+void makeNSEC3(DNSBackend& B, const NSEC3PARAMRecordContent& ns3prc, const SOAData& sd, const std::string& unhashed, const std::string& begin, const std::string& end, int mode, DNSResourceRecord& rr)
 {
 //  cerr<<"We should emit NSEC3 '"<<toBase32Hex(begin)<<"' - ('"<<toNSEC3<<"') - '"<<toBase32Hex(end)<<"' (unhashed: '"<<unhashed<<"')"<<endl;
   NSEC3RecordContent n3rc;
@@ -461,7 +494,6 @@ void emitNSEC3(DNSBackend& B, const NSEC3PARAMRecordContent& ns3prc, const SOADa
   n3rc.d_iterations = ns3prc.d_iterations;
   n3rc.d_algorithm = 1; // SHA1, fixed in PowerDNS for now
 
-  DNSResourceRecord rr;
   if(!unhashed.empty()) {
     B.lookup(QType(QType::ANY), unhashed, NULL, sd.domain_id);
     while(B.get(rr)) {
@@ -486,14 +518,56 @@ void emitNSEC3(DNSBackend& B, const NSEC3PARAMRecordContent& ns3prc, const SOADa
   rr.content=n3rc.getZoneRepresentation();
   rr.d_place = (mode == 5 ) ? DNSResourceRecord::ANSWER: DNSResourceRecord::AUTHORITY;
   rr.auth = true;
-  
+}
+
+void PacketHandler::emitNSEC3(const NSEC3PARAMRecordContent& ns3prc, bool narrow, const SOAData& sd, const std::string& unhashed, const std::string& begin, const std::string& end, const std::string& toNSEC3, DNSPacket *r, int mode)
+{
+  if(narrow) { // every hash gets its own made up range, nothing worth remembering
+    ::emitNSEC3(B, ns3prc, sd, unhashed, begin, end, toNSEC3, r, mode);
+    return;
+  }
+
+  DNSResourceRecord rr;
+  if(g_nsec3cache.getRecord(sd.domain_id, sd.serial, begin, end, rr)) {
+    rr.d_place = (mode == 5 ) ? DNSResourceRecord::ANSWER: DNSResourceRecord::AUTHORITY;
+  }
+  else {
+    makeNSEC3(B, ns3prc, sd, unhashed, begin, end, mode, rr);
+    g_nsec3cache.addRecord(sd.domain_id, sd.serial, begin, end, rr);
+  }
   r->addRecord(rr);
 }
 
-void PacketHandler::emitNSEC3(const NSEC3PARAMRecordContent& ns3prc, const SOAData& sd, const std::string& unhashed, const std::string& begin, const std::string& end, const std::string& toNSEC3, DNSPacket *r, int mode)
+//! getNSEC3Hashes, answered from the NSEC3 cache when we learned the range before
+bool PacketHandler::getNSEC3Range(bool narrow, const SOAData& sd, const std::string& hashed, bool decrement, string& unhashed, string& before, string& after, int mode)
 {
-  ::emitNSEC3(B, ns3prc, sd, unhashed, begin, end, toNSEC3, r, mode);
-  
+  if(narrow)
+    return getNSEC3Hashes(narrow, sd.db, sd.domain_id, hashed, decrement, unhashed, before, after, mode);
+
+  // this is what the backend does for us: when we ask for the record before, it tells us which name it is the hash of,
+  // otherwise the name we were given is assumed to exist and only the hash after it is looked up
+  bool wantBefore = decrement || mode == 1;
+  string cachedUnhashed, cachedBefore;
+  if(g_nsec3cache.getRange(sd.domain_id, sd.serial, hashed, wantBefore, cachedUnhashed, cachedBefore, after)) {
+    S.inc("nsec3-cache-hit");
+    if(wantBefore) {
+      unhashed=cachedUnhashed;
+      before=cachedBefore;
+    }
+    else
+      before=hashed;
+    return true;
+  }
+  S.inc("nsec3-cache-miss");
+
+  bool ret=getNSEC3Hashes(narrow, sd.db, sd.domain_id, hashed, decrement, unhashed, before, after, mode);
+  if(ret && !after.empty()) {
+    if(wantBefore)
+      g_nsec3cache.addRange(sd.domain_id, sd.serial, unhashed, before, after);
+    else
+      g_nsec3cache.addSuccessor(sd.domain_id, sd.serial, hashed, after);
+  }
+  return ret;
 }
 
 /*
@@ -606,10 +680,10 @@ void PacketHandler::addNSEC3(DNSPacket *p, DNSPacket *r, const string& target, c
   // see https://github.com/PowerDNS/pdns/issues/814
   if (mode != 3 || g_addSuperfluousNSEC3) {
     unhashed=(mode == 0 || mode == 1 || mode == 5) ? target : closest;
-    hashed=hashQNameWithSalt(ns3rc.d_iterations, ns3rc.d_salt, unhashed);
+    hashed=g_nsec3cache.getHash(sd.domain_id, ns3rc, unhashed);
     DLOG(L<<"1 hash: "<<toBase32Hex(hashed)<<" "<<unhashed<<endl);
 
-    getNSEC3Hashes(narrow, sd.db, sd.domain_id,  hashed, false, unhashed, before, after, mode);
+    getNSEC3Range(narrow, sd, hashed, false, unhashed, before, after, mode);
 
     if (mode == 1 && (hashed != before)) {
       DLOG(L<<"No matching NSEC3 for DS, do closest (provable) encloser"<<endl);
@@ -624,14 +698,14 @@ void PacketHandler::addNSEC3(DNSPacket *p, DNSPacket *r, const string& target, c
       }
       doNextcloser = true;
       unhashed=closest;
-      hashed=hashQNameWithSalt(ns3rc.d_iterations, ns3rc.d_salt, unhashed);
+      hashed=g_nsec3cache.getHash(sd.domain_id, ns3rc, unhashed);
       DLOG(L<<"1 hash: "<<toBase32Hex(hashed)<<" "<<unhashed<<endl);
 
-      getNSEC3Hashes(narrow, sd.db, sd.domain_id,  hashed, false, unhashed, before, after);
+      getNSEC3Range(narrow, sd, hashed, false, unhashed, before, after);
     }
 
     DLOG(L<<"Done calling for matching, hashed: '"<<toBase32Hex(hashed)<<"' before='"<<toBase32Hex(before)<<"', after='"<<toBase32Hex(after)<<"'"<<endl);
-    emitNSEC3(ns3rc, sd, unhashed, before, after, target, r, mode);
+    emitNSEC3(ns3rc, narrow, sd, unhashed, before, after, target, r, mode);
   }
 
   // add covering NSEC3 RR
@@ -642,24 +716,24 @@ void PacketHandler::addNSEC3(DNSPacket *p, DNSPacket *r, const string& target, c
     }
     while( chopOff( next ) && !pdns_iequals(next, closest));
 
-    hashed=hashQNameWithSalt(ns3rc.d_iterations, ns3rc.d_salt, unhashed);
+    hashed=g_nsec3cache.getHash(sd.domain_id, ns3rc, unhashed);
     DLOG(L<<"2 hash: "<<toBase32Hex(hashed)<<" "<<unhashed<<endl);
 
-    getNSEC3Hashes(narrow, sd.db,sd.domain_id,  hashed, true, unhashed, before, after);
+    getNSEC3Range(narrow, sd, hashed, true, unhashed, before, after);
     DLOG(L<<"Done calling for covering, hashed: '"<<toBase32Hex(hashed)<<"' before='"<<toBase32Hex(before)<<"', after='"<<toBase32Hex(after)<<"'"<<endl);
-    emitNSEC3( ns3rc, sd, unhashed, before, after, target, r, mode);
+    emitNSEC3( ns3rc, narrow, sd, unhashed, before, after, target, r, mode);
   }
 
   // wildcard denial
   if (mode == 2 || mode == 4) {
     unhashed=dotConcat("*", closest);
 
-    hashed=hashQNameWithSalt(ns3rc.d_iterations, ns3rc.d_salt, unhashed);
+    hashed=g_nsec3cache.getHash(sd.domain_id, ns3rc, unhashed);
     DLOG(L<<"3 hash: "<<toBase32Hex(hashed)<<" "<<unhashed<<endl);
 
-    getNSEC3Hashes(narrow, sd.db, sd.domain_id,  hashed, (mode != 2), unhashed, before, after);
+    getNSEC3Range(narrow, sd, hashed, (mode != 2), unhashed, before, after);
     DLOG(L<<"Done calling for '*', hashed: '"<<toBase32Hex(hashed)<<"' before='"<<toBase32Hex(before)<<"', after='"<<toBase32Hex(after)<<"'"<<endl);
-    emitNSEC3( ns3rc, sd, unhashed, before, after, target, r, mode);
+    emitNSEC3( ns3rc, narrow, sd, unhashed, before, after, target, r, mode);
   }
 }
 
@@ -772,7 +846,8 @@ int PacketHandler::trySuperMasterSynchronous(DNSPacket *p)
     L<<Logger::Error<<"Database error trying to create "<<p->qdomain<<" for potential supermaster "<<p->getRemote()<<": "<<ae.reason<<endl;
     return RCode::ServFail;
   }
-  Communicator.addSuckRequest(p->qdomain, p->getRemote());  
+  g_zoneindex.invalidate();
+  Communicator.addSuckRequest(p->qdomain, p->getRemote(), true);  
   L<<Logger::Warning<<"Created new slave zone '"<<p->qdomain<<"' from supermaster "<<p->getRemote()<<", queued AXFR"<<endl;
   return RCode::NoError;
 }
@@ -1181,7 +1256,7 @@ DNSPacket *PacketHandler::questionOrRecurse(DNSPacket *p, bool *shouldRecurse)
           r->setOpcode(Opcode::Notify);
           return r;
         }
-        delete r;
+        DNSPacket::release(r);
         return 0;
       }
       
@@ -1225,7 +1300,7 @@ DNSPacket *PacketHandler::questionOrRecurse(DNSPacket *p, bool *shouldRecurse)
   retargeted:;
     if(retargetcount > 10) {    // XXX FIXME, retargetcount++?
       L<<Logger::Warning<<"Abort CNAME chain resolution after "<<--retargetcount<<" redirects, sending out servfail. Initial query: '"<<p->qdomain<<"'"<<endl;
-      delete r;
+      DNSPacket::release(r);
       r=p->replyPacket();
       r->setRcode(RCode::ServFail);
       return r;
@@ -1236,7 +1311,7 @@ DNSPacket *PacketHandler::questionOrRecurse(DNSPacket *p, bool *shouldRecurse)
       if(r->d.ra) {
         DLOG(L<<Logger::Error<<"Recursion is available for this remote, doing that"<<endl);
         *shouldRecurse=true;
-        delete r;
+        DNSPacket::release(r);
         return 0;
       }
       
@@ -1425,24 +1500,18 @@ DNSPacket *PacketHandler::questionOrRecurse(DNSPacket *p, bool *shouldRecurse)
     
   sendit:;
     if(doAdditionalProcessingAndDropAA(p, r, sd)<0) {
-      delete r;
+      DNSPacket::release(r);
       return 0;
     }
 
     editSOA(d_dk, sd.qname, r);
     
-    BOOST_FOREACH(const DNSResourceRecord& rr, r->getRRS()) {
-      if(rr.scopeMask) {
-        noCache=1;
-        break;
-      }
-    }
     if(p->d_dnssecOk)
       addRRSigs(d_dk, B, authSet, r->getRRS());
       
     r->wrapup(); // needed for inserting in cache
     if(!noCache)
-      PC.insert(p, r, r->getMinTTL()); // in the packet cache
+      PC.insert(p, r, r->getMinTTL()); // in the packet cache, scoped to the client's network if a backend says so
   }
   catch(DBException &e) {
     L<<Logger::Error<<"Backend reported condition which prevented lookup ("+e.reason+") sending out servfail"<<endl;
@@ -1456,7 +1525,7 @@ DNSPacket *PacketHandler::questionOrRecurse(DNSPacket *p, bool *shouldRecurse)
   }
   catch(std::exception &e) {
     L<<Logger::Error<<"Exception building answer packet ("<<e.what()<<") sending out servfail"<<endl;
-    delete r;
+    DNSPacket::release(r);
     r=p->replyPacket();  // generate an empty reply packet    
     r->setRcode(RCode::ServFail);
     S.inc("servfail-packets");
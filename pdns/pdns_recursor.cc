@@ -64,6 +64,7 @@
 #include "config.h"
 #include "lua-recursor.hh"
 #include "version.hh"
+#include "querylog.hh"
 
 #ifndef RECURSOR
 #include "statbag.hh"
@@ -126,10 +127,14 @@ unsigned int g_numThreads;
 
 //! used to send information to a newborn mthread
 struct DNSComboWriter {
-  DNSComboWriter(const char* data, uint16_t len, const struct timeval& now) : d_mdp(data, len), d_now(now), 
+  DNSComboWriter(const char* data, uint16_t len, const struct timeval& now) : d_query(data, len), d_mdp(d_query.c_str(), d_query.size()), d_now(now), 
                                                                                                         d_tcp(false), d_socket(-1)
-  {}
-  MOADNSParser d_mdp;
+  {
+    d_mdp.getQName(d_qname);
+  }
+  string d_query; // d_mdp points into this, so it has to come first
+  DNSPacketView d_mdp;
+  string d_qname;
   void setRemote(const ComboAddress* sa)
   {
     d_remote=*sa;
@@ -495,7 +500,7 @@ void startDoResolve(void *p)
 
   try {
     loginfo=" (while setting loginfo)";
-    loginfo=" ("+dc->d_mdp.d_qname+"/"+lexical_cast<string>(dc->d_mdp.d_qtype)+" from "+(dc->d_remote.toString())+")";
+    loginfo=" ("+dc->d_qname+"/"+lexical_cast<string>(dc->d_mdp.d_qtype)+" from "+(dc->d_remote.toString())+")";
     uint32_t maxanswersize= dc->d_tcp ? 65535 : min((uint16_t) 512, g_udpTruncationThreshold);
     EDNSOpts edo;
     if(getEDNSOpts(dc->d_mdp, &edo) && !dc->d_tcp) {
@@ -505,7 +510,7 @@ void startDoResolve(void *p)
     vector<DNSResourceRecord> ret;
     vector<uint8_t> packet;
 
-    DNSPacketWriter pw(packet, dc->d_mdp.d_qname, dc->d_mdp.d_qtype, dc->d_mdp.d_qclass); 
+    DNSPacketWriter pw(packet, dc->d_qname, dc->d_mdp.d_qtype, dc->d_mdp.d_qclass); 
 
     pw.getHeader()->aa=0;
     pw.getHeader()->ra=1;
@@ -529,13 +534,13 @@ void startDoResolve(void *p)
       goto sendit;
     }
 
-    if(t_traceRegex->get() && (*t_traceRegex)->match(dc->d_mdp.d_qname)) {
+    if(t_traceRegex->get() && (*t_traceRegex)->match(dc->d_qname)) {
       sr.setLogMode(SyncRes::Store);
       tracedQuery=true;
     }
     
     if(!g_quiet || tracedQuery)
-      L<<Logger::Warning<<t_id<<" ["<<MT->getTid()<<"] " << (dc->d_tcp ? "TCP " : "") << "question for '"<<dc->d_mdp.d_qname<<"|"
+      L<<Logger::Warning<<t_id<<" ["<<MT->getTid()<<"] " << (dc->d_tcp ? "TCP " : "") << "question for '"<<dc->d_qname<<"|"
        <<DNSRecordContent::NumberToType(dc->d_mdp.d_qtype)<<"' from "<<dc->getRemote()<<endl;
 
     sr.setId(MT->getTid());
@@ -544,8 +549,8 @@ void startDoResolve(void *p)
 
 
     // if there is a RecursorLua active, and it 'took' the query in preResolve, we don't launch beginResolve
-    if(!t_pdl->get() || !(*t_pdl)->preresolve(dc->d_remote, g_listenSocketsAddresses[dc->d_socket], dc->d_mdp.d_qname, QType(dc->d_mdp.d_qtype), ret, res, &variableAnswer)) {
-       res = sr.beginResolve(dc->d_mdp.d_qname, QType(dc->d_mdp.d_qtype), dc->d_mdp.d_qclass, ret);
+    if(!t_pdl->get() || !(*t_pdl)->preresolve(dc->d_remote, g_listenSocketsAddresses[dc->d_socket], dc->d_qname, QType(dc->d_mdp.d_qtype), ret, res, &variableAnswer)) {
+       res = sr.beginResolve(dc->d_qname, QType(dc->d_mdp.d_qtype), dc->d_mdp.d_qclass, ret);
 
       if(t_pdl->get()) {
         if(res == RCode::NoError) {
@@ -554,12 +559,12 @@ void startDoResolve(void *p)
                   if(i->qtype.getCode() == dc->d_mdp.d_qtype && i->d_place == DNSResourceRecord::ANSWER)
                           break;
                 if(i == ret.end())
-                  (*t_pdl)->nodata(dc->d_remote, g_listenSocketsAddresses[dc->d_socket], dc->d_mdp.d_qname, QType(dc->d_mdp.d_qtype), ret, res, &variableAnswer);
+                  (*t_pdl)->nodata(dc->d_remote, g_listenSocketsAddresses[dc->d_socket], dc->d_qname, QType(dc->d_mdp.d_qtype), ret, res, &variableAnswer);
               }
               else if(res == RCode::NXDomain)
-          (*t_pdl)->nxdomain(dc->d_remote, g_listenSocketsAddresses[dc->d_socket], dc->d_mdp.d_qname, QType(dc->d_mdp.d_qtype), ret, res, &variableAnswer);
+          (*t_pdl)->nxdomain(dc->d_remote, g_listenSocketsAddresses[dc->d_socket], dc->d_qname, QType(dc->d_mdp.d_qtype), ret, res, &variableAnswer);
       
-      (*t_pdl)->postresolve(dc->d_remote, g_listenSocketsAddresses[dc->d_socket], dc->d_mdp.d_qname, QType(dc->d_mdp.d_qtype), ret, res, &variableAnswer);
+      (*t_pdl)->postresolve(dc->d_remote, g_listenSocketsAddresses[dc->d_socket], dc->d_qname, QType(dc->d_mdp.d_qtype), ret, res, &variableAnswer);
       }
     }
     
@@ -643,7 +648,7 @@ void startDoResolve(void *p)
       else if(ret < 0 )  
         L<<Logger::Error<<"Error writing TCP answer to "<<dc->getRemote()<<": "<< strerror(errno) <<endl;
       else if((unsigned int)ret != 2 + packet.size())
-        L<<Logger::Error<<"Oops, partial answer sent to "<<dc->getRemote()<<" for "<<dc->d_mdp.d_qname<<" (size="<< (2 + packet.size()) <<", sent "<<ret<<")"<<endl;
+        L<<Logger::Error<<"Oops, partial answer sent to "<<dc->getRemote()<<" for "<<dc->d_qname<<" (size="<< (2 + packet.size()) <<", sent "<<ret<<")"<<endl;
       else
         hadError=false;
       
@@ -662,7 +667,7 @@ void startDoResolve(void *p)
     }
     
     if(!g_quiet) {
-      L<<Logger::Error<<t_id<<" ["<<MT->getTid()<<"] answer to "<<(dc->d_mdp.d_header.rd?"":"non-rd ")<<"question '"<<dc->d_mdp.d_qname<<"|"<<DNSRecordContent::NumberToType(dc->d_mdp.d_qtype);
+      L<<Logger::Error<<t_id<<" ["<<MT->getTid()<<"] answer to "<<(dc->d_mdp.d_header.rd?"":"non-rd ")<<"question '"<<dc->d_qname<<"|"<<DNSRecordContent::NumberToType(dc->d_mdp.d_qtype);
       L<<"': "<<ntohs(pw.getHeader()->ancount)<<" answers, "<<ntohs(pw.getHeader()->arcount)<<" additional, took "<<sr.d_outqueries<<" packets, "<<
       sr.d_throttledqueries<<" throttled, "<<sr.d_timeouts<<" timeouts, "<<sr.d_tcpoutqueries<<" tcp connections, rcode="<<res<<endl;
     }
@@ -683,6 +688,12 @@ void startDoResolve(void *p)
     uint64_t newLat=(uint64_t)(spent*1000000);
     if(newLat < 1000000)  // outliers of several minutes exist..
       g_stats.avgLatencyUsec=(uint64_t)((1-0.0001)*g_stats.avgLatencyUsec + 0.0001*newLat);
+    g_stats.answerLatency.submit(newLat);
+
+    if(g_querylog.enabled()) {
+      uint8_t flags=(dc->d_tcp ? QueryLog::TCP : 0) | (dc->d_mdp.d_header.rd ? QueryLog::RD : 0) | (pw.getHeader()->tc ? QueryLog::TC : 0);
+      g_querylog.log(dc->d_remote, dc->d_qname, dc->d_mdp.d_qtype, ntohs(dc->d_mdp.d_header.id), flags, pw.getHeader()->rcode, packet.size(), dc->d_now, newLat);
+    }
 
     delete dc;
     dc=0;
@@ -692,7 +703,7 @@ void startDoResolve(void *p)
     delete dc;
   }
   catch(MOADNSException& e) {
-    L<<Logger::Error<<"DNS parser error"<<loginfo<<": "<<dc->d_mdp.d_qname<<", "<<e.what()<<endl;
+    L<<Logger::Error<<"DNS parser error"<<loginfo<<": "<<dc->d_qname<<", "<<e.what()<<endl;
     delete dc;
   }
   catch(std::exception& e) {
@@ -875,6 +886,9 @@ string* doProcessUDPQuestion(const std::string& question, const ComboAddress& fr
         updateRcodeStats(dh.rcode);
       }
       g_stats.avgLatencyUsec=(uint64_t)((1-0.0001)*g_stats.avgLatencyUsec + 0); // we assume 0 usec
+      g_stats.answerLatency.submit(0);
+      if(g_querylog.enabled())
+        g_querylog.logPacket(fromaddr, question, response, 0, g_now); // g_now is what d_now would have been
       return 0;
     }
   } 
@@ -1842,6 +1856,10 @@ int serviceMain(int argc, char*argv[])
   g_maxTCPPerClient=::arg().asNum("max-tcp-per-client");
   g_maxMThreads=::arg().asNum("max-mthreads");
 
+  if(!::arg()["query-log-file"].empty())
+    g_querylog.start(::arg()["query-log-file"], ::arg().asNum("query-log-sample"), ::arg().asNum("query-log-buffer"),
+                     ::arg().asNum("query-log-max-size")*1024ULL*1024, ::arg().asNum("query-log-files"));
+
   if(g_numThreads == 1) {
     L<<Logger::Warning<<"Operating unthreaded"<<endl;
     recursorThread(0);
@@ -2025,6 +2043,11 @@ int main(int argc, char **argv)
     ::arg().set( "experimental-logfile", "Filename of the log file for JSON parser" )= "/var/log/pdns.log"; 
     ::arg().setSwitch( "experimental-json-interface", "If we should run a JSON webserver") = "no";
     ::arg().set("quiet","Suppress logging of questions and answers")="";
+    ::arg().set("query-log-file","If set, log answered queries to this file in binary form, without slowing down answering them")="";
+    ::arg().set("query-log-sample","Log one in this many answered queries to the query log")="1";
+    ::arg().set("query-log-buffer","Number of query log records each thread can have waiting to be written")="8192";
+    ::arg().set("query-log-max-size","Rotate the query log when it grows over this many megabytes, 0 to never rotate")="100";
+    ::arg().set("query-log-files","Number of rotated query logs to keep")="5";
     ::arg().set("logging-facility","Facility to log messages as. 0 corresponds to local0")="";
     ::arg().set("config-dir","Location of configuration directory (recursor.conf)")=SYSCONFDIR;
     ::arg().set("socket-owner","Owner of socket")="";
@@ -617,7 +617,7 @@ void testAlgorithms()
   DNSCryptoKeyEngine::testAll();
 }
 
-void testSpeed(DNSSECKeeper& dk, const string& zone, const string& remote, int cores)
+void testSpeed(DNSSECKeeper& dk, const string& zone, const string& remote, int cores, unsigned int records)
 {
   DNSResourceRecord rr;
   rr.qname="blah."+zone;
@@ -643,7 +643,7 @@ void testSpeed(DNSSECKeeper& dk, const string& zone, const string& remote, int c
   char tmp[25];
   DTime dt;
   dt.set();
-  for(unsigned int n=0; n < 100000; ++n) {
+  for(unsigned int n=0; n < records; ++n) {
     rnd = random();
     snprintf(tmp, sizeof(tmp), "%d.%d.%d.%d", 
       octets[0], octets[1], octets[2], octets[3]);
@@ -660,8 +660,86 @@ void testSpeed(DNSSECKeeper& dk, const string& zone, const string& remote, int c
   cerr<<"Net speed: "<<csp.d_signed/ (dt.udiffNoReset()/1000000.0) << " sigs/s"<<endl;
   while(signatures = csp.getChunk(true), !signatures.empty())
       ;
+  double secs = dt.udiff()/1000000.0;
   cerr<<"Done, "<<csp.d_signed<<" signed, "<<csp.d_queued<<" queued, "<<csp.d_outstanding<<" outstanding"<< endl;
-  cerr<<"Net speed: "<<csp.d_signed/ (dt.udiff()/1000000.0) << " sigs/s"<<endl;
+  cerr<<"Net speed: "<<csp.d_signed/secs << " sigs/s, "<<records/secs<<" records/s"<<endl;
+}
+
+struct SigningSpeedWork
+{
+  const DNSCryptoKeyEngine* dcke;
+  unsigned int signatures;
+  bool batched;
+};
+
+static void* signingSpeedThread(void* p)
+{
+  const SigningSpeedWork* work = (const SigningSpeedWork*) p;
+  const unsigned int batchsize = 100;
+  vector<string> msgs;
+  for(unsigned int n = 0; n < work->signatures; n += batchsize) {
+    msgs.clear();
+    for(unsigned int m = n; m < n + batchsize && m < work->signatures; ++m)
+      msgs.push_back("Hi! How is life? "+lexical_cast<string>(m));
+    if(work->batched)
+      work->dcke->signBatch(msgs);
+    else {
+      BOOST_FOREACH(const string& msg, msgs) {
+        work->dcke->sign(msg);
+      }
+    }
+  }
+  return 0;
+}
+
+static double runSigningSpeed(const DNSCryptoKeyEngine* dcke, unsigned int threads, unsigned int signatures, bool batched)
+{
+  vector<pthread_t> tids(threads);
+  SigningSpeedWork work;
+  work.dcke = dcke;
+  work.signatures = signatures / threads;
+  work.batched = batched;
+
+  DTime dt;
+  dt.set();
+  for(unsigned int n = 0; n < threads; ++n)
+    pthread_create(&tids[n], 0, signingSpeedThread, &work);
+  for(unsigned int n = 0; n < threads; ++n)
+    pthread_join(tids[n], 0);
+  return work.signatures * threads / (dt.udiff()/1000000.0);
+}
+
+// signatures per second for algo, or all algorithms we know, with 1, 2, 4 .. maxthreads threads
+void testSigningSpeed(int algo, unsigned int maxthreads, unsigned int signatures)
+{
+  vector<int> algos;
+  if(algo > 0)
+    algos.push_back(algo);
+  else {
+    int all[] = {5, 8, 10, 12, 13, 14, 250};
+    algos.assign(all, all + sizeof(all)/sizeof(all[0]));
+  }
+  maxthreads = std::max(maxthreads, 1U);
+
+  BOOST_FOREACH(int a, algos) {
+    shared_ptr<DNSCryptoKeyEngine> dcke;
+    try {
+      dcke = shared_ptr<DNSCryptoKeyEngine>(DNSCryptoKeyEngine::make(a));
+      dcke->create(a <= 10 ? 1024 : (a == 14 ? 384 : 256)); // ZSK sizes
+    }
+    catch(std::exception& e) {
+      cerr<<"Skipping algorithm "<<a<<": "<<e.what()<<endl;
+      continue;
+    }
+
+    for(unsigned int threads = 1; ; threads = std::min(threads * 2, maxthreads)) {
+      double single = runSigningSpeed(dcke.get(), threads, signatures, false);
+      double batched = runSigningSpeed(dcke.get(), threads, signatures, true);
+      cout<<"Algorithm "<<a<<" ("<<dcke->getName()<<"), "<<threads<<" thread(s): "<<(unsigned int)single<<" sigs/s one by one, "<<(unsigned int)batched<<" sigs/s batched"<<endl;
+      if(threads == maxthreads)
+        break;
+    }
+  }
 }
 
 void verifyCrypto(const string& zone)
@@ -1068,6 +1146,8 @@ try
     cerr<<"unset-nsec3 ZONE                   Switch back to NSEC"<<endl;
     cerr<<"unset-presigned ZONE               No longer use presigned RRSIGs"<<endl;
     cerr<<"test-schema ZONE                   Test DB schema - will create ZONE"<<endl;
+    cerr<<"test-signing-speed [ALGORITHM] [THREADS] [SIGNATURES]"<<endl;
+    cerr<<"                                   Measure signatures/s per algorithm, one by one and batched"<<endl;
     cerr<<desc<<endl;
     return 0;
   }
@@ -1086,6 +1166,18 @@ try
     return 0;
   }
 
+  if(cmds[0] == "test-signing-speed") {
+    int algo = 0;
+    if(cmds.size() > 1 && cmds[1] != "all" && (algo = shorthand2algorithm(cmds[1])) < 0)
+      algo = atoi(cmds[1].c_str());
+    if(algo < 0 || (cmds.size() > 1 && cmds[1] != "all" && !algo)) {
+      cerr << "Syntax: pdnssec test-signing-speed [all|algorithm] [threads] [signatures]"<<endl;
+      return 0;
+    }
+    testSigningSpeed(algo, (cmds.size() > 2) ? atoi(cmds[2].c_str()) : 1, (cmds.size() > 3) ? atoi(cmds[3].c_str()) : 10000);
+    return 0;
+  }
+
   loadMainConfig(g_vm["config-dir"].as<string>());
   reportAllTypes();
 
@@ -1165,11 +1257,11 @@ try
   }
 #endif
   else if(cmds[0] == "test-speed") {
-    if(cmds.size() < 2) {
-      cerr << "Syntax: pdnssec test-speed numcores [signing-server]"<<endl;
+    if(cmds.size() < 3) {
+      cerr << "Syntax: pdnssec test-speed ZONE numcores [signing-server] [records]"<<endl;
       return 0;
     }
-    testSpeed(dk, cmds[1],  (cmds.size() > 3) ? cmds[3] : "", atoi(cmds[2].c_str()));
+    testSpeed(dk, cmds[1],  (cmds.size() > 3) ? cmds[3] : "", atoi(cmds[2].c_str()), (cmds.size() > 4) ? atoi(cmds[4].c_str()) : 100000);
   }
   else if(cmds[0] == "verify-crypto") {
     if(cmds.size() != 2) {
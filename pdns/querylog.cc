@@ -0,0 +1,216 @@
+#include "querylog.hh"
+#include <cstring>
+#include <cerrno>
+#include <unistd.h>
+#include <boost/lexical_cast.hpp>
+#include "lock.hh"
+#include "logger.hh"
+#include "pdnsexception.hh"
+#include "dnsparser.hh"
+#include "namespaces.hh"
+
+QueryLog g_querylog;
+__thread QueryLog::Ring* QueryLog::t_ring;
+
+// the ring of a thread is written by it and read by the writer, records have to be complete before the index moves
+static inline void memoryBarrier()
+{
+#if defined( __GNUC__ ) && ( defined( __i386__ ) || defined( __x86_64__ ) )
+  __asm__ __volatile__("" ::: "memory"); // x86 does not reorder stores with stores or loads with loads, keep the compiler from doing so
+#else
+  __sync_synchronize();
+#endif
+}
+
+QueryLog::QueryLog() : d_fp(0), d_filesize(0), d_maxsize(0), d_files(0), d_sample(1), d_ringsize(0), d_started(false)
+{
+  pthread_mutex_init(&d_lock, 0);
+}
+
+void QueryLog::start(const string& fname, unsigned int sample, unsigned int ringsize, uint64_t maxsize, unsigned int files)
+{
+  d_fname = fname;
+  d_sample = sample ? sample : 1;
+  d_maxsize = maxsize;
+  d_files = files;
+  for(d_ringsize = 1; d_ringsize < ringsize; d_ringsize <<= 1)
+    ;
+  openFile();
+  if(!d_fp)
+    throw PDNSException("Unable to open query log '"+d_fname+"': "+stringerror());
+
+  d_started = true;
+  pthread_t tid;
+  pthread_create(&tid, 0, writerThread, this);
+}
+
+QueryLog::Ring* QueryLog::getRing()
+{
+  t_ring = new Ring(d_ringsize);
+  Lock l(&d_lock);
+  d_rings.push_back(t_ring);
+  return t_ring;
+}
+
+QueryLog::Ring* QueryLog::getSampledRing()
+{
+  if(!d_started)
+    return 0;
+
+  Ring* ring = t_ring ? t_ring : getRing();
+  if(d_sample > 1 && ring->counter++ % d_sample)
+    return 0;
+  return ring;
+}
+
+void QueryLog::log(const ComboAddress& remote, const string& qname, uint16_t qtype, uint16_t id, uint8_t flags, uint8_t rcode, uint16_t size, const struct timeval& received, uint32_t usec)
+{
+  Ring* ring = getSampledRing();
+  if(ring)
+    add(ring, remote, qname, qtype, id, flags, rcode, size, received, usec);
+}
+
+void QueryLog::logPacket(const ComboAddress& remote, const string& question, const string& answer, uint8_t flags, const struct timeval& received)
+{
+  Ring* ring = getSampledRing();
+  if(!ring || answer.size() < sizeof(dnsheader))
+    return;
+
+  struct timeval now;
+  gettimeofday(&now, 0);
+  string qname;
+  uint16_t qtype;
+  try {
+    DNSPacketView view(question.c_str(), question.size());
+    view.getQName(qname);
+    qtype = view.d_qtype;
+  }
+  catch(MOADNSException& e) { // it was good enough to find the answer in the cache, but we can't log it
+    return;
+  }
+
+  struct dnsheader dh;
+  memcpy(&dh, answer.c_str(), sizeof(dh));
+  flags |= (dh.rd ? RD : 0) | (dh.tc ? TC : 0);
+  add(ring, remote, qname, qtype, ntohs(dh.id), flags, dh.rcode, answer.size(), received, (now.tv_sec - received.tv_sec) * 1000000 + now.tv_usec - received.tv_usec);
+}
+
+void QueryLog::add(Ring* ring, const ComboAddress& remote, const string& qname, uint16_t qtype, uint16_t id, uint8_t flags, uint8_t rcode, uint16_t size, const struct timeval& received, uint32_t usec)
+{
+  unsigned int head = ring->head;
+  if(head - ring->tail > ring->mask) { // full
+    d_dropped++;
+    return;
+  }
+
+  Record& r = ring->records[head & ring->mask];
+  r.tv_sec = received.tv_sec;
+  r.tv_usec = received.tv_usec;
+  r.usec = usec;
+  r.id = id;
+  r.qtype = qtype;
+  r.size = size;
+  r.flags = flags;
+  r.rcode = rcode;
+  memset(r.address, 0, sizeof(r.address));
+  if(remote.sin4.sin_family == AF_INET6) {
+    r.family = 6;
+    r.port = ntohs(remote.sin6.sin6_port);
+    memcpy(r.address, &remote.sin6.sin6_addr, 16);
+  }
+  else {
+    r.family = 4;
+    r.port = ntohs(remote.sin4.sin_port);
+    memcpy(r.address, &remote.sin4.sin_addr, 4);
+  }
+  r.qnamelen = min(qname.size(), sizeof(r.qname) - 1);
+  memcpy(r.qname, qname.c_str(), r.qnamelen);
+
+  memoryBarrier();
+  ring->head = head + 1;
+}
+
+void* QueryLog::writerThread(void* data)
+{
+  QueryLog* ql = static_cast<QueryLog*>(data);
+  for(;;) {
+    if(!ql->drain())
+      usleep(10000);
+  }
+  return 0;
+}
+
+bool QueryLog::drain()
+{
+  vector<Ring*> rings;
+  {
+    Lock l(&d_lock);
+    rings = d_rings;
+  }
+
+  if(!d_fp)
+    openFile();
+
+  bool wrote = false;
+  for(vector<Ring*>::const_iterator iter = rings.begin(); iter != rings.end(); ++iter) {
+    Ring* ring = *iter;
+    unsigned int head = ring->head;
+    memoryBarrier();
+    unsigned int tail = ring->tail;
+    for(; tail != head; ++tail) {
+      const Record& r = ring->records[tail & ring->mask];
+      if(!d_fp) {
+        d_dropped++;
+        continue;
+      }
+      fwrite(&r, 1, s_fixedsize, d_fp);
+      fwrite(r.qname, 1, r.qnamelen, d_fp);
+      d_filesize += s_fixedsize + r.qnamelen;
+      d_written++;
+      wrote = true;
+    }
+    memoryBarrier();
+    ring->tail = tail;
+  }
+
+  if(wrote) {
+    fflush(d_fp);
+    if(d_maxsize && d_filesize >= d_maxsize)
+      rotate();
+  }
+  return wrote;
+}
+
+void QueryLog::openFile()
+{
+  d_fp = fopen(d_fname.c_str(), "a");
+  if(!d_fp)
+    return;
+  setvbuf(d_fp, 0, _IOFBF, 65536);
+
+  fseek(d_fp, 0, SEEK_END);
+  d_filesize = ftell(d_fp);
+  if(!d_filesize) {
+    uint32_t header[2] = { s_magic, s_version };
+    fwrite(header, 1, sizeof(header), d_fp);
+    d_filesize = sizeof(header);
+  }
+}
+
+void QueryLog::rotate()
+{
+  fclose(d_fp);
+  d_fp = 0;
+
+  if(d_files) {
+    for(unsigned int n = d_files - 1; n > 0; --n)
+      rename((d_fname+"."+boost::lexical_cast<string>(n)).c_str(), (d_fname+"."+boost::lexical_cast<string>(n+1)).c_str());
+    rename(d_fname.c_str(), (d_fname+".1").c_str());
+  }
+  else
+    unlink(d_fname.c_str());
+
+  openFile();
+  if(!d_fp)
+    L<<Logger::Error<<"Unable to reopen query log '"<<d_fname<<"', dropping records until it can be: "<<stringerror()<<endl;
+}
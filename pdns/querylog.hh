@@ -0,0 +1,99 @@
+#ifndef PDNS_QUERYLOG_HH
+#define PDNS_QUERYLOG_HH
+#include <pthread.h>
+#include <cstdio>
+#include <boost/utility.hpp>
+#include "iputils.hh"
+#include "misc.hh"
+
+/** Query logging that stays out of the way of the threads answering questions. Each of those threads gets a ring
+    of fixed size records that only it writes to, without locks. A writer thread empties all rings into a binary file
+    and rotates it when it grows too big. A record that does not fit in a full ring is dropped and counted, we never wait.
+
+    The file starts with two uint32_t, s_magic and s_version. Every record after that is the first s_fixedsize bytes
+    of a Record followed by qnamelen bytes of qname, all in host byte order. */
+class QueryLog : public boost::noncopyable
+{
+public:
+  //! one answered question
+  struct Record
+  {
+    uint32_t tv_sec, tv_usec; //!< when the question came in
+    uint32_t usec;            //!< how long answering took
+    uint16_t id;
+    uint16_t qtype;
+    uint16_t port;
+    uint16_t size;            //!< of the answer, in bytes
+    uint8_t family;           //!< 4 or 6
+    uint8_t flags;            //!< Flags
+    uint8_t rcode;
+    uint8_t qnamelen;
+    uint8_t address[16];
+    char qname[256];          //!< not 0 terminated
+  };
+  enum Flags { TCP=1, RD=2, DO=4, TC=8 };
+  static const uint32_t s_magic = 0x50514c47; // "PQLG"
+  static const uint32_t s_version = 1;
+  static const unsigned int s_fixedsize = 40; //!< bytes of a Record we write before the qname
+
+  QueryLog();
+
+  /** launches the writer thread, throws PDNSException if fname can't be opened. Logs one in sample answers,
+      each thread can hold ringsize records that are not written yet. The file is rotated when it grows over maxsize
+      bytes, keeping files older copies as fname.1 and up */
+  void start(const string& fname, unsigned int sample, unsigned int ringsize, uint64_t maxsize, unsigned int files);
+  bool enabled() const
+  {
+    return d_started;
+  }
+
+  //! never blocks
+  void log(const ComboAddress& remote, const string& qname, uint16_t qtype, uint16_t id, uint8_t flags, uint8_t rcode, uint16_t size, const struct timeval& received, uint32_t usec);
+  //! like log(), for answers we only have as a packet. The question is parsed only if this answer is sampled
+  void logPacket(const ComboAddress& remote, const string& question, const string& answer, uint8_t flags, const struct timeval& received);
+
+  uint64_t getWritten()
+  {
+    return d_written;
+  }
+  uint64_t getDropped()
+  {
+    return d_dropped;
+  }
+
+private:
+  struct Ring
+  {
+    Ring(unsigned int size) : records(size), mask(size - 1), head(0), tail(0), counter(0) {}
+    vector<Record> records;
+    unsigned int mask;           //!< records.size() is a power of two
+    volatile unsigned int head;  //!< next record the owning thread fills, only that thread changes this
+    volatile unsigned int tail;  //!< next record the writer writes out, only the writer changes this
+    unsigned int counter;        //!< for sampling
+  };
+
+  Ring* getRing();
+  Ring* getSampledRing(); //!< 0 if this answer is not to be logged
+  void add(Ring* ring, const ComboAddress& remote, const string& qname, uint16_t qtype, uint16_t id, uint8_t flags, uint8_t rcode, uint16_t size, const struct timeval& received, uint32_t usec);
+  static void* writerThread(void* data);
+  bool drain(); //!< returns true if there was anything to write
+  void openFile();
+  void rotate();
+
+  static __thread Ring* t_ring;
+
+  pthread_mutex_t d_lock; //!< protects d_rings
+  vector<Ring*> d_rings;
+  string d_fname;
+  FILE* d_fp;
+  uint64_t d_filesize;
+  uint64_t d_maxsize;
+  unsigned int d_files;
+  unsigned int d_sample;
+  unsigned int d_ringsize;
+  bool d_started;
+  AtomicCounter d_written, d_dropped;
+};
+
+extern QueryLog g_querylog;
+#endif
@@ -18,6 +18,7 @@
 #include "logger.hh"
 #include "dnsparser.hh"
 #include "arguments.hh"
+#include "querylog.hh"
 #include <sys/resource.h>
 #include <sys/time.h>
 
@@ -414,6 +415,31 @@ uint64_t doGetPacketCacheMisses()
   return broadcastAccFunction<uint64_t>(pleaseGetPacketCacheMisses);
 }
 
+uint64_t doGetAnswerLatencyP50()
+{
+  return g_stats.answerLatency.get().percentile(50);
+}
+
+uint64_t doGetAnswerLatencyP99()
+{
+  return g_stats.answerLatency.get().percentile(99);
+}
+
+uint64_t doGetAnswerLatencyP999()
+{
+  return g_stats.answerLatency.get().percentile(99.9);
+}
+
+uint64_t doGetQueryLogWritten()
+{
+  return g_querylog.getWritten();
+}
+
+uint64_t doGetQueryLogDropped()
+{
+  return g_querylog.getDropped();
+}
+
 uint64_t doGetMallocated()
 {
   // this turned out to be broken
@@ -439,6 +465,9 @@ RecursorControlParser::RecursorControlParser()
   addGetStat("packetcache-bytes", doGetPacketCacheBytes); 
   
   addGetStat("malloc-bytes", doGetMallocated);
+
+  addGetStat("query-log-written", doGetQueryLogWritten);
+  addGetStat("query-log-dropped", doGetQueryLogDropped);
   
   addGetStat("servfail-answers", &g_stats.servFails);
   addGetStat("nxdomain-answers", &g_stats.nxDomains);
@@ -458,6 +487,9 @@ RecursorControlParser::RecursorControlParser()
   addGetStat("answers-slow", &g_stats.answersSlow);
 
   addGetStat("qa-latency", &g_stats.avgLatencyUsec);
+  addGetStat("answer-latency-p50", doGetAnswerLatencyP50);
+  addGetStat("answer-latency-p99", doGetAnswerLatencyP99);
+  addGetStat("answer-latency-p999", doGetAnswerLatencyP999);
   addGetStat("unexpected-packets", &g_stats.unexpectedCount);
   addGetStat("case-mismatches", &g_stats.caseMismatchCount);
   addGetStat("spoof-prevents", &g_stats.spoofCount);
@@ -567,9 +567,13 @@ int main(int argc, char **argv)
     DynListener::registerFunc("REDISCOVER",&DLRediscoverHandler, "discover any new zones");
     DynListener::registerFunc("VERSION",&DLVersionHandler, "get instance version");
     DynListener::registerFunc("PURGE",&DLPurgeHandler, "purge entries from packet cache", "[<record>]");
+    DynListener::registerFunc("WARM-SIGNATURE-CACHE",&DLWarmSignatureCacheHandler, "sign a zone in the background to fill the signature cache", "<domain>");
+    DynListener::registerFunc("PURGE-SIGNATURE-CACHE",&DLPurgeSignatureCacheHandler, "empty the signature cache");
     DynListener::registerFunc("CCOUNTS",&DLCCHandler, "get cache statistics");
     DynListener::registerFunc("QTYPES", &DLQTypesHandler, "get QType statistics");
     DynListener::registerFunc("RESPSIZES", &DLRSizesHandler, "get histogram of response sizes");
+    DynListener::registerFunc("RCODES", &DLRCodesHandler, "get RCode statistics");
+    DynListener::registerFunc("HISTOGRAM", &DLHistogramHandler, "get latency percentiles and buckets, in usec", "<name>");
     DynListener::registerFunc("REMOTES", &DLRemotesHandler, "get top remotes");
     DynListener::registerFunc("SET",&DLSettingsHandler, "set config variables", "<var> <value>");
     DynListener::registerFunc("RETRIEVE",&DLNotifyRetrieveHandler, "retrieve slave domain", "<domain>");
@@ -379,8 +379,11 @@ AXFRRetriever::AXFRRetriever(const ComboAddress& remote,
         const string& tsigkeyname,
         const string& tsigalgorithm, 
         const string& tsigsecret,
-        const ComboAddress* laddr)
-: d_tsigkeyname(tsigkeyname), d_tsigsecret(tsigsecret), d_tsigPos(0), d_nonSignedMessages(0)
+        const ComboAddress* laddr,
+        bool ixfr,
+        uint32_t ourSerial)
+: d_ixfr(ixfr), d_incremental(false), d_ixfrdone(false), d_ourSerial(ourSerial), d_newSerial(0), d_rrcount(0),
+  d_tsigkeyname(tsigkeyname), d_tsigsecret(tsigsecret), d_tsigPos(0), d_nonSignedMessages(0)
 {
   ComboAddress local;
   if (laddr != NULL) {
@@ -402,8 +405,18 @@ AXFRRetriever::AXFRRetriever(const ComboAddress& remote,
     d_soacount = 0;
   
     vector<uint8_t> packet;
-    DNSPacketWriter pw(packet, domain, QType::AXFR);
+    DNSPacketWriter pw(packet, domain, d_ixfr ? QType::IXFR : QType::AXFR);
     pw.getHeader()->id = dns_random(0xffff);
+
+    if(d_ixfr) { // RFC 1995, 3: our SOA goes in the authority section, only the serial matters
+      struct soatimes st;
+      memset(&st, 0, sizeof(st));
+      st.serial = ourSerial;
+      SOARecordContent soa(".", ".", st);
+      pw.startRecord(domain, QType::SOA, 0, QClass::IN, DNSPacketWriter::AUTHORITY);
+      soa.toPacket(pw);
+      pw.commit();
+    }
   
     if(!tsigkeyname.empty()) {
       if (tsigalgorithm == "hmac-md5")
@@ -454,7 +467,7 @@ AXFRRetriever::~AXFRRetriever()
 
 int AXFRRetriever::getChunk(Resolver::res_t &res) // Implementation is making sure RFC2845 4.4 is followed.
 {
-  if(d_soacount > 1)
+  if(d_ixfr ? d_ixfrdone : d_soacount > 1)
     return false;
 
   // d_sock is connected and is about to spit out a packet
@@ -469,9 +482,12 @@ int AXFRRetriever::getChunk(Resolver::res_t &res) // Implementation is making su
   if(err) 
     throw ResolverException("AXFR chunk with a non-zero rcode "+lexical_cast<string>(err));
 
-  BOOST_FOREACH(const MOADNSParser::answers_t::value_type& answer, mdp.d_answers)
-    if (answer.first.d_type == QType::SOA)
+  BOOST_FOREACH(const MOADNSParser::answers_t::value_type& answer, mdp.d_answers) {
+    if(d_ixfr)
+      checkIXFREnd(answer.first);
+    else if (answer.first.d_type == QType::SOA)
       d_soacount++;
+  }
  
   if(!d_tsigkeyname.empty()) { // TSIG verify message
     // If we have multiple messages, we need to concatenate them together. We also need to make sure we know the location of 
@@ -537,6 +553,42 @@ int AXFRRetriever::getChunk(Resolver::res_t &res) // Implementation is making su
   return true;
 }
 
+/* An IXFR answer starts with the newest SOA. If that is all there is, we were up to date. If the next record
+   is the SOA we asked with, diffs follow and the newest SOA shows up twice more, once as the end of the last diff
+   and once to close the transfer. Otherwise the master sent the whole zone and the next newest SOA is the end. */
+void AXFRRetriever::checkIXFREnd(const DNSRecord& dr)
+{
+  if(dr.d_place != DNSRecord::Answer)
+    return;
+
+  uint32_t serial = 0;
+  bool isSOA = dr.d_type == QType::SOA;
+  if(isSOA) {
+    shared_ptr<SOARecordContent> src = boost::dynamic_pointer_cast<SOARecordContent>(dr.d_content);
+    if(src)
+      serial = src->d_st.serial;
+  }
+
+  if(!d_rrcount++) {
+    if(!isSOA)
+      throw ResolverException("IXFR response from "+d_remote.toStringWithPort()+" does not start with a SOA");
+    d_newSerial = serial;
+    d_soacount = 1;
+    if(!rfc1982LessThan(d_ourSerial, serial))
+      d_ixfrdone = true;
+    return;
+  }
+
+  if(d_rrcount == 2)
+    d_incremental = isSOA && serial != d_newSerial;
+
+  if(isSOA && serial == d_newSerial)
+    d_soacount++;
+
+  if(d_soacount >= (d_incremental ? 3 : 2))
+    d_ixfrdone = true;
+}
+
 void AXFRRetriever::timeoutReadn(uint16_t bytes)
 {
   time_t start=time(0);
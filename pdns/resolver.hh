@@ -87,20 +87,35 @@ class AXFRRetriever : public boost::noncopyable
         const string& tsigkeyname=string(),
         const string& tsigalgorithm=string(),
         const string& tsigsecret=string(),
-        const ComboAddress* laddr = NULL);
+        const ComboAddress* laddr = NULL,
+        bool ixfr = false,
+        uint32_t ourSerial = 0);
 	~AXFRRetriever();
     int getChunk(Resolver::res_t &res);  
+    //! for an IXFR, true once the second record showed the master is sending diffs and not the whole zone
+    bool isIncremental() const
+    {
+      return d_incremental;
+    }
   
   private:
     void connect();
     int getLength();
     void timeoutReadn(uint16_t bytes);  
+    void checkIXFREnd(const DNSRecord& dr);
 
     shared_array<char> d_buf;
     string d_domain;
     int d_sock;
     int d_soacount;
     ComboAddress d_remote;
+
+    bool d_ixfr;
+    bool d_incremental;
+    bool d_ixfrdone;
+    uint32_t d_ourSerial;
+    uint32_t d_newSerial;
+    unsigned int d_rrcount;
     
     string d_tsigkeyname;
     string d_tsigsecret;
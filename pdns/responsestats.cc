@@ -5,6 +5,7 @@
 ResponseStats::ResponseStats()
 {
   d_qtypecounters.resize(std::numeric_limits<uint16_t>::max()+1);
+  d_rcodecounters.resize(16);
   d_sizecounters.push_back(make_pair(20,0));
   d_sizecounters.push_back(make_pair(40,0));
   d_sizecounters.push_back(make_pair(60,0));
@@ -21,9 +22,10 @@ static bool pcomp(const pair<uint16_t, uint64_t>&a , const pair<uint16_t, uint64
   return a.first < b.first;
 } 
 
-void ResponseStats::submitResponse(uint16_t qtype, uint16_t respsize, bool udpOrTCP) 
+void ResponseStats::submitResponse(uint16_t qtype, uint16_t respsize, uint8_t rcode, bool udpOrTCP) 
 {
   d_qtypecounters[qtype]++;
+  d_rcodecounters[rcode & 0x0f]++;
   pair<uint16_t, uint64_t> s(respsize, 0);
   sizecounters_t::iterator iter = std::upper_bound(d_sizecounters.begin(), d_sizecounters.end(), s, pcomp);
   if(iter!= d_sizecounters.begin())
@@ -53,3 +55,15 @@ map<uint16_t, uint64_t> ResponseStats::getSizeResponseCounts()
   }
   return ret;
 }
+
+map<uint8_t, uint64_t> ResponseStats::getRCodeResponseCounts()
+{
+  map<uint8_t, uint64_t> ret;
+  uint64_t count;
+  for(unsigned int i = 0 ; i < d_rcodecounters.size() ; ++i) {
+    count= d_rcodecounters[i];
+    if(count)
+      ret[i]=count;
+  }
+  return ret;
+}
@@ -7,12 +7,14 @@ class ResponseStats
 public:
   ResponseStats();
 
-  void submitResponse(uint16_t qtype, uint16_t respsize, bool udpOrTCP);
+  void submitResponse(uint16_t qtype, uint16_t respsize, uint8_t rcode, bool udpOrTCP);
   map<uint16_t, uint64_t> getQTypeResponseCounts();
   map<uint16_t, uint64_t> getSizeResponseCounts();
+  map<uint8_t, uint64_t> getRCodeResponseCounts();
 
 private:
   vector<AtomicCounter> d_qtypecounters;
+  vector<AtomicCounter> d_rcodecounters;
   typedef vector<pair<uint16_t, uint64_t> > sizecounters_t;
   sizecounters_t d_sizecounters;
 };
@@ -17,6 +17,34 @@ extern StatBag S;
 
 pthread_mutex_t PacketHandler::s_rfc2136lock=PTHREAD_MUTEX_INITIALIZER;
 
+// All records at the given names, ENTs left out. Used to see what an update did, for the IXFR journal.
+static void snapshotNames(DomainInfo *di, const set<string, CIStringCompare>& names, vector<DNSResourceRecord>& ret)
+{
+  DNSResourceRecord rec;
+  ret.clear();
+  BOOST_FOREACH(const string& name, names) {
+    di->backend->lookup(QType(QType::ANY), name, 0, di->id);
+    while(di->backend->get(rec))
+      if(rec.qtype.getCode())
+        ret.push_back(rec);
+  }
+}
+
+// Turns a record from an IXFR into the equivalent update section entry, NONE deletes it, IN adds it.
+static DNSRecord makeUpdateRecord(const DNSResourceRecord& rr, uint16_t qclass)
+{
+  DNSResourceRecord tmp(rr);
+  DNSRecord dr;
+  dr.d_label = rr.qname + ".";
+  dr.d_type = rr.qtype.getCode();
+  dr.d_class = qclass;
+  dr.d_ttl = rr.ttl;
+  dr.d_clen = 0;
+  dr.d_place = DNSRecord::Nameserver;
+  dr.d_content = shared_ptr<DNSRecordContent>(DNSRecordContent::mastermake(dr.d_type, 1, tmp.getZoneRepresentation()));
+  return dr;
+}
+
 // Implement section 3.2.1 and 3.2.2 of RFC2136
 int PacketHandler::checkUpdatePrerequisites(const DNSRecord *rr, DomainInfo *di) {
   if (rr->d_ttl != 0)
@@ -849,6 +877,17 @@ int PacketHandler::processUpdate(DNSPacket *p) {
     bool haveNSEC3 = d_dk.getNSEC3PARAM(di.zone, &ns3pr, &narrow);
     bool isPresigned = d_dk.isPresigned(di.zone);
 
+    // Remember what the names we touch looked like, so slaves can pick up this update with an IXFR.
+    set<string, CIStringCompare> touchedNames;
+    vector<DNSResourceRecord> before;
+    if (g_ixfrjournal.enabled()) {
+      touchedNames.insert(di.zone);
+      for(MOADNSParser::answers_t::const_iterator i=mdp.d_answers.begin(); i != mdp.d_answers.end(); ++i)
+        if (i->first.d_place == DNSRecord::Nameserver)
+          touchedNames.insert(stripDot(i->first.d_label));
+      snapshotNames(&di, touchedNames, before);
+    }
+
     // 3.4.2 - Perform the updates.
     // There's a special condition where deleting the last NS record at zone apex is never deleted (3.4.2.4)
     // This means we must do it outside the normal performUpdate() because that focusses only on a separate RR.
@@ -886,11 +925,24 @@ int PacketHandler::processUpdate(DNSPacket *p) {
     }
 
     if (changedRecords > 0) {
+      IXFRDiff diff;
+      bool haveDiff = false;
+      if (g_ixfrjournal.enabled()) {
+        vector<DNSResourceRecord> after;
+        snapshotNames(&di, touchedNames, after);
+        haveDiff = makeIXFRDiff(di.zone, before, after, diff);
+      }
+
       if (!di.backend->commitTransaction()) {
        L<<Logger::Error<<msgPrefix<<"Failed to commit updates!"<<endl;
         return RCode::ServFail;
       }
 
+      if (haveDiff)
+        g_ixfrjournal.addDiff(di.zone, diff);
+      else if (g_ixfrjournal.enabled()) // we can't tell what changed, slaves will have to AXFR
+        g_ixfrjournal.purge(di.zone);
+
       S.deposit("rfc2136-changes", changedRecords);
 
       // Purge the records!
@@ -928,6 +980,77 @@ int PacketHandler::processUpdate(DNSPacket *p) {
   }
 }
 
+bool PacketHandler::applyIXFRDiffs(const string& domain, const vector<IXFRDiff>& diffs) {
+  string msgPrefix="IXFR of " + domain + ": ";
+
+  DomainInfo di;
+  di.backend=0;
+  if(!B.getDomainInfo(domain, di) || !di.backend) {
+    L<<Logger::Error<<msgPrefix<<"Can't determine backend for domain"<<endl;
+    return false;
+  }
+
+  Lock l(&s_rfc2136lock);
+  if (!di.backend->startTransaction(domain, -1)) {
+    L<<Logger::Error<<msgPrefix<<"Backend does not support transactions, can't apply incremental changes"<<endl;
+    return false;
+  }
+
+  // Every step goes through performUpdate, so ENTs, auth and ordernames are kept right the same way as for RFC2136.
+  try {
+    NSEC3PARAMRecordContent ns3pr;
+    bool narrow=false;
+    bool haveNSEC3 = d_dk.getNSEC3PARAM(di.zone, &ns3pr, &narrow);
+    bool isPresigned = d_dk.isPresigned(di.zone);
+
+    BOOST_FOREACH(const IXFRDiff& diff, diffs) {
+      bool updatedSerial=false;
+      BOOST_FOREACH(const DNSResourceRecord& rr, diff.removed) {
+        DNSRecord dr = makeUpdateRecord(rr, QClass::NONE);
+        if (!performUpdate(msgPrefix, &dr, &di, isPresigned, &narrow, &haveNSEC3, &ns3pr, &updatedSerial)) {
+          L<<Logger::Warning<<msgPrefix<<"Record to delete "<<rr.qname<<"|"<<rr.qtype.getName()<<" not found, we are out of sync"<<endl;
+          di.backend->abortTransaction();
+          return false;
+        }
+      }
+      BOOST_FOREACH(const DNSResourceRecord& rr, diff.added) {
+        DNSRecord dr = makeUpdateRecord(rr, QClass::IN);
+        performUpdate(msgPrefix, &dr, &di, isPresigned, &narrow, &haveNSEC3, &ns3pr, &updatedSerial);
+      }
+
+      DNSRecord soa = makeUpdateRecord(diff.newSOA, QClass::IN);
+      performUpdate(msgPrefix, &soa, &di, isPresigned, &narrow, &haveNSEC3, &ns3pr, &updatedSerial);
+      if (!updatedSerial) {
+        L<<Logger::Warning<<msgPrefix<<"Could not move serial from "<<diff.fromSerial<<" to "<<diff.toSerial<<endl;
+        di.backend->abortTransaction();
+        return false;
+      }
+    }
+
+    if (!di.backend->commitTransaction()) {
+      L<<Logger::Error<<msgPrefix<<"Failed to commit incremental changes!"<<endl;
+      return false;
+    }
+  }
+  catch (SSqlException &e) {
+    L<<Logger::Error<<msgPrefix<<"Caught SSqlException: "<<e.txtReason()<<endl;
+    di.backend->abortTransaction();
+    return false;
+  }
+  catch (PDNSException &e) {
+    L<<Logger::Error<<msgPrefix<<"Caught PDNSException: "<<e.reason<<endl;
+    di.backend->abortTransaction();
+    return false;
+  }
+  catch (std::exception &e) {
+    L<<Logger::Error<<msgPrefix<<"Caught std::exception: "<<e.what()<<endl;
+    di.backend->abortTransaction();
+    return false;
+  }
+
+  return true;
+}
+
 void PacketHandler::increaseSerial(const string &msgPrefix, const DomainInfo *di, bool haveNSEC3, bool narrow, const NSEC3PARAMRecordContent *ns3pr) {
   DNSResourceRecord rec, newRec;
   di->backend->lookup(QType(QType::SOA), di->zone);
@@ -7,49 +7,113 @@
 #include <netinet/tcp.h>
 #include <sched.h>
 
-// deal with partial reads
-namespace {
-int readn(int fd, void* buffer, unsigned int len)
+/* Single producer, single consumer ring of RRSETs between the pipe and one worker thread.
+   Slots are swapped in and out, so once the ring has warmed up, passing an RRSET costs
+   neither an allocation nor a system call. A side only goes to sleep on the condition 
+   variable when the ring is empty, and the other side only takes the mutex to wake it up. */
+class ChunkedSigningPipe::RRSetRing
 {
-  unsigned int pos=0;
-  int res;
-  for(;;) {
-    res = read(fd, (char*)buffer + pos, len - pos);
-    if(res == 0) {
-      if(pos)
-        throw runtime_error("Signing Pipe remote shut down in the middle of a message");
-      else {
-        //cerr<<"Got decent EOF on "<<fd<<endl;
-        return 0;
+public:
+  RRSetRing(unsigned int size) : d_slots(size), d_mask(size-1), d_head(0), d_tail(0), d_sleeping(0), d_closed(false)
+  {
+    pthread_mutex_init(&d_lock, 0);
+    pthread_cond_init(&d_cond, 0);
+  }
+
+  ~RRSetRing()
+  {
+    pthread_cond_destroy(&d_cond);
+    pthread_mutex_destroy(&d_lock);
+  }
+
+  bool tryPush(rrset_t& rrset)
+  {
+    if(d_tail - d_head > d_mask)
+      return false; // full
+    __sync_synchronize();
+    d_slots[d_tail & d_mask].swap(rrset);
+    __sync_synchronize();
+    d_tail++;
+    wakeup();
+    return true;
+  }
+
+  void push(rrset_t& rrset)
+  {
+    while(!tryPush(rrset))
+      sched_yield(); // can't happen with the limits the pipe applies, but be safe
+  }
+
+  bool tryPop(rrset_t& rrset)
+  {
+    if(d_head == d_tail)
+      return false; // empty
+    __sync_synchronize();
+    rrset.swap(d_slots[d_head & d_mask]);
+    __sync_synchronize();
+    d_head++;
+    return true;
+  }
+
+  // blocks until there is an RRSET, returns false once the ring is closed and empty
+  bool pop(rrset_t& rrset)
+  {
+    if(tryPop(rrset))
+      return true;
+
+    pthread_mutex_lock(&d_lock);
+    d_sleeping=1;
+    __sync_synchronize();
+    bool ret=true;
+    while(!tryPop(rrset)) {
+      if(d_closed) {
+        ret=false;
+        break;
       }
+      pthread_cond_wait(&d_cond, &d_lock);
     }
-      
-    if(res < 0) {
-      if(errno == EAGAIN || errno == EINTR) {
-        if(pos==0)
-          return -1;
-        waitForData(fd, -1); 
-        continue;
-      }
-      unixDie("Reading from socket in Signing Pipe loop");
+    d_sleeping=0;
+    pthread_mutex_unlock(&d_lock);
+    return ret;
+  }
+
+  void close()
+  {
+    pthread_mutex_lock(&d_lock);
+    d_closed=true;
+    pthread_cond_broadcast(&d_cond);
+    pthread_mutex_unlock(&d_lock);
+  }
+
+private:
+  void wakeup()
+  {
+    __sync_synchronize(); // pairs with the barrier after setting d_sleeping in pop()
+    if(d_sleeping) {
+      pthread_mutex_lock(&d_lock);
+      pthread_cond_signal(&d_cond);
+      pthread_mutex_unlock(&d_lock);
     }
-  
-    pos+=res;
-    if(pos == len)
-      break;
   }
-  return len;
-}
-}
 
+  vector<rrset_t> d_slots;
+  const unsigned int d_mask;
+  volatile unsigned int d_head, d_tail;
+  volatile int d_sleeping;
+  bool d_closed;
+  pthread_mutex_t d_lock;
+  pthread_cond_t d_cond;
+};
+
+// per worker ring size, must be a power of two
+static const unsigned int s_ringsize = 256;
 
 // used to pass information to the new thread
 struct StartHelperStruct
 {
-  StartHelperStruct(ChunkedSigningPipe* csp, int id, int fd) : d_csp(csp), d_id(id), d_fd(fd){}
+  StartHelperStruct(ChunkedSigningPipe* csp, int id) : d_csp(csp), d_id(id){}
   ChunkedSigningPipe* d_csp;
   int d_id;
-  int d_fd;
 };
 
 // used to launch the new thread
@@ -59,7 +123,7 @@ try
   StartHelperStruct shs=*(StartHelperStruct*)p;
   delete (StartHelperStruct*)p;
   
-  shs.d_csp->worker(shs.d_id, shs.d_fd);
+  shs.d_csp->worker(shs.d_id);
   return 0;
 }
 catch(std::exception& e) {
@@ -68,8 +132,8 @@ catch(std::exception& e) {
 }
 
 ChunkedSigningPipe::ChunkedSigningPipe(const std::string& signerName, bool mustSign, const pdns::string& servers, unsigned int workers) 
-  : d_queued(0), d_outstanding(0), d_signer(signerName), d_maxchunkrecords(100), d_numworkers(workers), d_tids(d_numworkers),
-    d_mustSign(mustSign), d_final(false), d_submitted(0)
+  : d_queued(0), d_outstanding(0), d_signer(signerName), d_maxchunkrecords(100), d_nextWorker(0), d_nextResult(0),
+    d_numworkers(workers ? workers : 1), d_tids(d_numworkers), d_mustSign(mustSign), d_final(false), d_submitted(0)
 {
   d_rrsetToSign = new rrset_t;
   d_chunks.push_back(vector<DNSResourceRecord>()); // load an empty chunk
@@ -77,17 +141,12 @@ ChunkedSigningPipe::ChunkedSigningPipe(const std::string& signerName, bool mustS
   if(!d_mustSign)
     return;
   
-  int fds[2];
-  
   for(unsigned int n=0; n < d_numworkers; ++n) {
-    if(socketpair(AF_UNIX, SOCK_STREAM, 0, fds) < 0) 
-      throw runtime_error("Unable to create communication socket in for ChunkedSigningPipe");
-    Utility::setCloseOnExec(fds[0]);
-    Utility::setCloseOnExec(fds[1]);
-    pthread_create(&d_tids[n], 0, helperWorker, (void*) new StartHelperStruct(this, n, fds[1]));
-    Utility::setNonBlocking(fds[0]);
-    d_sockets.push_back(fds[0]);
+    d_toWorker.push_back(new RRSetRing(s_ringsize));
+    d_fromWorker.push_back(new RRSetRing(s_ringsize));
   }
+  for(unsigned int n=0; n < d_numworkers; ++n)
+    pthread_create(&d_tids[n], 0, helperWorker, (void*) new StartHelperStruct(this, n));
 }
 
 ChunkedSigningPipe::~ChunkedSigningPipe()
@@ -95,14 +154,18 @@ ChunkedSigningPipe::~ChunkedSigningPipe()
   delete d_rrsetToSign;
   if(!d_mustSign)
     return;
-  BOOST_FOREACH(int fd, d_sockets) {
-    close(fd); // this will trigger all threads to exit
+  BOOST_FOREACH(RRSetRing* ring, d_toWorker) {
+    ring->close(); // this will trigger all threads to exit
   }
     
   void* res;
   BOOST_FOREACH(pthread_t& tid, d_tids) {
     pthread_join(tid, &res);
   }
+  for(unsigned int n=0; n < d_numworkers; ++n) {
+    delete d_toWorker[n];
+    delete d_fromWorker[n];
+  }
   //cout<<"Did: "<<d_signed<<", records (!= chunks) submitted: "<<d_submitted<<endl;
 }
 
@@ -146,36 +209,6 @@ bool ChunkedSigningPipe::submit(const DNSResourceRecord& rr)
   return !d_chunks.empty() && d_chunks.front().size() >= d_maxchunkrecords; // "you can send more"
 }
 
-pair<vector<int>, vector<int> > ChunkedSigningPipe::waitForRW(bool rd, bool wr, int seconds)
-{
-  vector<pollfd> pfds;
-  
-  for(unsigned int n = 0; n < d_sockets.size(); ++n) {    
-    if(d_eof.count(d_sockets[n]))  
-      continue;
-    struct pollfd pfd;
-    memset(&pfd, 0, sizeof(pfd));
-    pfd.fd = d_sockets[n];
-    if(rd)
-      pfd.events |= POLLIN;
-    if(wr)
-      pfd.events |= POLLOUT;
-    pfds.push_back(pfd);
-  }
-  
-  int res = poll(&pfds[0], pfds.size(), (seconds < 0) ? -1 : (seconds * 1000)); // -1 = infinite
-  if(res < 0)
-    unixDie("polling for activity from signers, "+lexical_cast<string>(d_sockets.size()));
-  pair<vector<int>, vector<int> > vects;
-  for(unsigned int n = 0; n < pfds.size(); ++n) 
-    if(pfds[n].revents & POLLIN)
-      vects.first.push_back(pfds[n].fd);
-    else if(pfds[n].revents & POLLOUT)
-      vects.second.push_back(pfds[n].fd);
-  
-  return vects;
-}
-
 void ChunkedSigningPipe::addSignedToChunks(chunk_t* signedChunk)
 {
   chunk_t::const_iterator from = signedChunk->begin();
@@ -195,6 +228,26 @@ void ChunkedSigningPipe::addSignedToChunks(chunk_t* signedChunk)
   }
 }
 
+bool ChunkedSigningPipe::collectSigned(bool wait)
+{
+  if(!d_outstanding)
+    return false;
+
+  RRSetRing* ring = d_fromWorker[d_nextResult % d_numworkers];
+  if(wait) {
+    if(!ring->pop(d_signedRRSet))
+      throw runtime_error("Signing thread went away with work outstanding");
+  }
+  else if(!ring->tryPop(d_signedRRSet))
+    return false;
+
+  d_nextResult++;
+  --d_outstanding;
+  addSignedToChunks(&d_signedRRSet);
+  d_signedRRSet.clear(); // keeps the capacity for the next round trip
+  return true;
+}
+
 void ChunkedSigningPipe::sendRRSetToWorker() // it sounds so socialist!
 {
   if(!d_mustSign) {
@@ -203,70 +256,27 @@ void ChunkedSigningPipe::sendRRSetToWorker() // it sounds so socialist!
     return;
   }
   
-  if(d_final && !d_outstanding) // nothing to do!
-    return;
-  
-  bool wantRead, wantWrite;
-  
-  wantWrite = !d_rrsetToSign->empty();
-  wantRead = d_outstanding || wantWrite;  // if we wrote, we want to read
-  
-  pair<vector<int>, vector<int> > rwVect;
-  
-  rwVect = waitForRW(wantRead, wantWrite, -1); // wait for something to happen  
-  
-  if(wantWrite && !rwVect.second.empty()) {
-    random_shuffle(rwVect.second.begin(), rwVect.second.end()); // pick random available worker
-    writen2(*rwVect.second.begin(), &d_rrsetToSign, sizeof(d_rrsetToSign));
-    d_rrsetToSign = new rrset_t;
+  if(!d_rrsetToSign->empty()) {
+    /* RRSETs are dealt round robin, so with at most s_ringsize outstanding per worker, 
+       neither the ring to the worker nor the one back can fill up */
+    while((unsigned int)d_outstanding >= s_ringsize * d_numworkers)
+      collectSigned(true);
+
+    d_toWorker[d_nextWorker % d_numworkers]->push(*d_rrsetToSign); // swaps in an empty (but allocated) RRSET
+    d_rrsetToSign->clear();
+    d_nextWorker++;
     d_outstanding++;
     d_queued++;
-    wantWrite=false;
-  } 
-  
-  if(wantRead) {
-    while(d_outstanding) {
-      chunk_t* chunk;
-      
-      BOOST_FOREACH(int fd, rwVect.first) {
-        if(d_eof.count(fd))
-          continue;
-        
-        while(d_outstanding) {
-          int res = readn(fd, &chunk, sizeof(chunk));
-          if(!res) {
-            d_eof.insert(fd);
-            break;
-          }
-          if(res < 0) {
-            if(errno != EAGAIN && errno != EINTR)
-              unixDie("Error reading signed chunk from thread");
-            else
-              break;
-          }
-          
-          --d_outstanding;
-          
-          addSignedToChunks(chunk);
-          
-          delete chunk;
-        }
-      }
-      if(!d_outstanding || !d_final)
-        break;
-      rwVect = waitForRW(1, 0, -1); // wait for something to happen  
-    }
   }
   
-  if(wantWrite) {  // our optimization above failed, we now wait synchronously
-    rwVect = waitForRW(0, wantWrite, -1); // wait for something to happen  
-    random_shuffle(rwVect.second.begin(), rwVect.second.end()); // pick random available worker
-    writen2(*rwVect.second.begin(), &d_rrsetToSign, sizeof(d_rrsetToSign));
-    d_rrsetToSign = new rrset_t;
-    d_outstanding++;
-    d_queued++;
+  if(d_final) {
+    while(collectSigned(true))
+      ;
+  }
+  else {
+    while(collectSigned(false))
+      ;
   }
-  
 }
 
 unsigned int ChunkedSigningPipe::getReady()
@@ -277,33 +287,31 @@ unsigned int ChunkedSigningPipe::getReady()
    }
    return sum;
 }
-void ChunkedSigningPipe::worker(int id, int fd)
+
+void ChunkedSigningPipe::worker(int id)
 try
 {
   DNSSECKeeper dk;
   UeberBackend db("key-only");
   
-  chunk_t* chunk;
-  int res;
-  for(;;) {
-    res = readn(fd, &chunk, sizeof(chunk));
-    if(!res)
-      break;
-    if(res < 0)
-      unixDie("reading object pointer to sign from pdns");
-    set<string, CIStringCompare> authSet;
-    authSet.insert(d_signer);
-    addRRSigs(dk, db, authSet, *chunk);
+  RRSetRing* in = d_toWorker[id];
+  RRSetRing* out = d_fromWorker[id];
+  rrset_t chunk;
+  set<string, CIStringCompare> authSet;
+  authSet.insert(d_signer);
+
+  while(in->pop(chunk)) {
+    addRRSigs(dk, db, authSet, chunk);
     ++d_signed;
     
-    writen2(fd, &chunk, sizeof(chunk));
+    out->push(chunk);
+    chunk.clear();
   }
-  close(fd);
 }
 catch(std::exception& e)
 {
   L<<Logger::Error<<"Signing thread died because of std::exception: "<<e.what()<<endl;
-  close(fd);
+  d_fromWorker[id]->close(); // don't leave the pipe waiting for us
 }
 
 void ChunkedSigningPipe::flushToSign()
@@ -318,15 +326,11 @@ vector<DNSResourceRecord> ChunkedSigningPipe::getChunk(bool final)
     // this means we should keep on reading until d_outstanding == 0
     d_final = true;
     flushToSign();
-    
-    BOOST_FOREACH(int fd, d_sockets) {
-      shutdown(fd, SHUT_WR); // perhaps this transmits EOF the other side
-      //cerr<<"shutdown of "<<fd<<endl;
-    }
   }
   if(d_final)
     flushToSign(); // should help us wait
-  vector<DNSResourceRecord> front=d_chunks.front();
+  vector<DNSResourceRecord> front;
+  front.swap(d_chunks.front());
   d_chunks.pop_front();
   if(d_chunks.empty())
     d_chunks.push_back(vector<DNSResourceRecord>());
@@ -30,23 +30,28 @@ public:
   int d_outstanding;
   unsigned int getReady();
 private:
+  class RRSetRing;
+
   void flushToSign();	
   void dedupRRSet();
   void sendRRSetToWorker(); // dispatch RRSET to worker
+  bool collectSigned(bool wait); // fetch the oldest outstanding RRSET, if it is done (or if we wait for it)
   void addSignedToChunks(chunk_t* signedChunk);
-  pair<vector<int>, vector<int> > waitForRW(bool rd, bool wr, int seconds);
 
-  void worker(int n, int fd);
+  void worker(int n);
   
   static void* helperWorker(void* p);
   rrset_t* d_rrsetToSign;
+  rrset_t d_signedRRSet;
   std::deque< std::vector<DNSResourceRecord> > d_chunks;
   string d_signer;
   
   chunk_t::size_type d_maxchunkrecords;
   
-  std::vector<int> d_sockets;
-  std::set<int> d_eof;
+  std::vector<RRSetRing*> d_toWorker;    // RRSETs go out to worker n over d_toWorker[n]..
+  std::vector<RRSetRing*> d_fromWorker;  // .. and come back signed over d_fromWorker[n]
+  unsigned int d_nextWorker;             // round robin, so reading back in the same order keeps the zone in order
+  unsigned int d_nextResult;
   unsigned int d_numworkers;
   vector<pthread_t> d_tids;
   bool d_mustSign;
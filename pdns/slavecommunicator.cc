@@ -45,24 +45,141 @@
 #include "namespaces.hh"
 #include "common_startup.hh"
 #include <boost/scoped_ptr.hpp>
+#include "statbag.hh"
 using boost::scoped_ptr;
 
+extern StatBag S;
 
-void CommunicatorClass::addSuckRequest(const string &domain, const string &master)
+
+void CommunicatorClass::addSuckRequest(const string &domain, const string &master, bool priority)
 {
   Lock l(&d_lock);
   SuckRequest sr;
   sr.domain = domain;
   sr.master = master;
+  sr.queued = time(0);
   pair<UniQueue::iterator, bool>  res;
 
-  res=d_suckdomains.push_back(sr);
+  if(priority) {
+    res=d_suckdomains.push_front(sr);
+    if(!res.second) // already queued, move it up
+      d_suckdomains.relocate(d_suckdomains.begin(), res.first);
+  }
+  else
+    res=d_suckdomains.push_back(sr);
   
   if(res.second) {
     d_suck_sem.post();
   }
 }
 
+/** Bring a slave zone up to date with an IXFR (RFC 1995). Returns false if the caller should do a full AXFR instead,
+    which is the case whenever the master sends the whole zone anyway, the answer carries DNSSEC records (we leave
+    those to the presigned AXFR logic) or the diffs don't apply cleanly to what we have. */
+bool CommunicatorClass::ixfrSuck(PacketHandler& P, const DomainInfo& di, const ComboAddress& raddr, const string& tsigkeyname, const string& tsigalgorithm, const string& tsigsecret, const ComboAddress* laddr)
+{
+  const string& domain = di.zone;
+  vector<DNSResourceRecord> rrs;
+  try {
+    AXFRRetriever retriever(raddr, domain, tsigkeyname, tsigalgorithm, tsigsecret, laddr, true, di.serial);
+    Resolver::res_t recs;
+    while(retriever.getChunk(recs)) {
+      for(Resolver::res_t::iterator i=recs.begin();i!=recs.end();++i) {
+        if(i->qtype.getCode() == QType::OPT || i->qtype.getCode() == QType::TSIG) // ignore EDNS0 & TSIG
+          continue;
+
+        if(!endsOn(i->qname, domain)) {
+          L<<Logger::Error<<"Remote "<<raddr.toString()<<" tried to sneak in out-of-zone data '"<<i->qname<<"'|"<<i->qtype.getName()<<" during IXFR of zone '"<<domain<<"'"<<endl;
+          return false;
+        }
+
+        switch(i->qtype.getCode()) {
+          case QType::RRSIG:
+          case QType::NSEC:
+          case QType::NSEC3:
+          case QType::NSEC3PARAM:
+          case QType::DNSKEY:
+            L<<Logger::Info<<"IXFR of '"<<domain<<"' carries DNSSEC records"<<endl;
+            return false;
+        }
+        rrs.push_back(*i);
+      }
+      if(rrs.size() > 1 && !retriever.isIncremental()) {
+        L<<Logger::Info<<"Remote "<<raddr.toString()<<" answered IXFR of '"<<domain<<"' with the full zone"<<endl;
+        return false;
+      }
+    }
+  }
+  catch(ResolverException &re) {
+    L<<Logger::Warning<<"Unable to IXFR zone '"<<domain<<"' from remote '"<<raddr.toString()<<"': "<<re.reason<<endl;
+    return false;
+  }
+  catch(std::exception &e) {
+    L<<Logger::Warning<<"Unable to parse IXFR of zone '"<<domain<<"' from remote '"<<raddr.toString()<<"': "<<e.what()<<endl;
+    return false;
+  }
+
+  if(rrs.empty())
+    return false;
+
+  SOAData sd;
+  fillSOAData(rrs.front().content, sd);
+  if(rrs.size() == 1) { // a lone SOA is either 'nothing newer' or a master that wants us to AXFR
+    if(rfc1982LessThan(di.serial, sd.serial)) {
+      L<<Logger::Info<<"Remote "<<raddr.toString()<<" answered IXFR of '"<<domain<<"' with only its SOA, serial "<<sd.serial<<endl;
+      return false;
+    }
+    L<<Logger::Info<<"IXFR of '"<<domain<<"' from remote '"<<raddr.toString()<<"' shows no newer serial than "<<di.serial<<endl;
+    di.backend->setFresh(di.id);
+    return true;
+  }
+
+  // newest SOA, then per diff: old SOA, deletions, new SOA, additions, and finally the newest SOA again
+  uint32_t newSerial = sd.serial;
+  vector<IXFRDiff> diffs;
+  bool adding = true;
+  for(vector<DNSResourceRecord>::size_type n = 1; n + 1 < rrs.size(); ++n) {
+    DNSResourceRecord& rr = rrs[n];
+    if(rr.qtype.getCode() == QType::SOA) {
+      fillSOAData(rr.content, sd);
+      if(adding) {
+        diffs.push_back(IXFRDiff());
+        diffs.back().oldSOA = rr;
+        diffs.back().fromSerial = sd.serial;
+      }
+      else {
+        diffs.back().newSOA = rr;
+        diffs.back().toSerial = sd.serial;
+      }
+      adding = !adding;
+    }
+    else if(diffs.empty())
+      return false;
+    else if(adding)
+      diffs.back().added.push_back(rr);
+    else
+      diffs.back().removed.push_back(rr);
+  }
+
+  if(diffs.empty() || !adding || diffs.front().fromSerial != di.serial || diffs.back().toSerial != newSerial) {
+    L<<Logger::Error<<"IXFR of '"<<domain<<"' from remote '"<<raddr.toString()<<"' does not lead from serial "<<di.serial<<" to "<<newSerial<<endl;
+    return false;
+  }
+
+  if(!P.applyIXFRDiffs(domain, diffs))
+    return false;
+
+  di.backend->setFresh(di.id);
+  PC.purge(domain+"$");
+  BOOST_FOREACH(const IXFRDiff& diff, diffs)
+    g_ixfrjournal.addDiff(domain, diff); // so slaves of ours can IXFR too
+
+  L<<Logger::Error<<"IXFR done for '"<<domain<<"', applied "<<diffs.size()<<" diff(s), zone committed with serial number "<<newSerial<<endl;
+  if(::arg().mustDo("slave-renotify"))
+    notifyDomain(domain);
+  return true;
+}
+
 void CommunicatorClass::suck(const string &domain,const string &remote)
 {
   L<<Logger::Error<<"Initiating transfer of '"<<domain<<"' from remote '"<<remote<<"'"<<endl;
@@ -147,6 +264,12 @@ void CommunicatorClass::suck(const string &domain,const string &remote)
                   laddr.sin4.sin_family = 0;
     }
 
+    if(::arg().mustDo("slave-ixfr") && !pdl && !hadPresigned && di.serial) {
+      if(ixfrSuck(P, di, raddr, tsigkeyname, tsigalgorithm, tsigsecret, (laddr.sin4.sin_family == 0) ? NULL : &laddr))
+        return;
+      L<<Logger::Warning<<"Falling back to AXFR of '"<<domain<<"' from remote '"<<remote<<"'"<<endl;
+    }
+
     AXFRRetriever retriever(raddr, domain.c_str(), tsigkeyname, tsigalgorithm, tsigsecret,
                 (laddr.sin4.sin_family == 0) ? NULL : &laddr);
 
@@ -243,6 +366,8 @@ void CommunicatorClass::suck(const string &domain,const string &remote)
     uint32_t maxent = ::arg().asNum("max-ent-entries");
     string ordername, shorter;
     set<string> nonterm, rrterm;
+    vector<FeedRecord> batch;
+    batch.reserve(1000);
 
     BOOST_FOREACH(DNSResourceRecord& rr, rrs) {
 
@@ -277,26 +402,34 @@ void CommunicatorClass::suck(const string &domain,const string &remote)
       if (rr.qtype.getCode() == QType::RRSIG)
         rr.auth=true;
 
-      // Add ordername and insert record
+      // Add ordername and queue record
       if (dnssecZone && rr.qtype.getCode() != QType::RRSIG) {
         if (haveNSEC3) {
           // NSEC3
           ordername=toBase32Hex(hashQNameWithSalt(ns3pr.d_iterations, ns3pr.d_salt, rr.qname));
           if(!narrow && (rr.auth || (rr.qtype.getCode() == QType::NS && (!gotOptOutFlag || secured.count(ordername))))) {
-            di.backend->feedRecord(rr, &ordername);
+            batch.push_back(FeedRecord(rr, ordername));
           } else
-            di.backend->feedRecord(rr);
+            batch.push_back(FeedRecord(rr));
         } else {
           // NSEC
           if (rr.auth || rr.qtype.getCode() == QType::NS) {
             ordername=toLower(labelReverse(makeRelative(rr.qname, domain)));
-            di.backend->feedRecord(rr, &ordername);
+            batch.push_back(FeedRecord(rr, ordername));
           } else
-            di.backend->feedRecord(rr);
+            batch.push_back(FeedRecord(rr));
         }
       } else
-        di.backend->feedRecord(rr);
+        batch.push_back(FeedRecord(rr));
+
+      // backends that can will insert a whole batch in one go
+      if(batch.size() >= 1000) {
+        di.backend->feedRecords(batch);
+        batch.clear();
+      }
     }
+    if(!batch.empty())
+      di.backend->feedRecords(batch);
 
     // Insert empty non-terminals
     if(doent && !nonterm.empty()) {
@@ -340,6 +473,7 @@ void CommunicatorClass::suck(const string &domain,const string &remote)
     di.backend->commitTransaction();
     di.backend->setFresh(domain_id);
     PC.purge(domain+"$");
+    g_ixfrjournal.purge(domain); // whatever chain we had doesn't lead here
 
 
     L<<Logger::Error<<"AXFR done for '"<<domain<<"', zone committed with serial number "<<soa_serial<<endl;
@@ -393,6 +527,7 @@ struct DomainNotificationInfo
 {
   DomainInfo di;
   bool dnssecOk;
+  bool priority;
   ComboAddress localaddr;
   string tsigkeyname, tsigalgname, tsigsecret;
 };
@@ -478,7 +613,41 @@ void CommunicatorClass::addTrySuperMasterRequest(DNSPacket *p)
   d_any_sem.post(); // kick the loop!
 }
 
-void CommunicatorClass::slaveRefresh(PacketHandler *P)
+void CommunicatorClass::scheduleSlaveCheck(const DomainInfo& di, time_t deadline, bool priority)
+{
+  SlaveCheck sc;
+  sc.zone = di.zone;
+  sc.deadline = deadline;
+  sc.priority = priority;
+  sc.di = di;
+  sc.di.backend = 0; // our serial may have moved by the time the check is due, so look it up again then
+
+  pair<SlaveCheckQueue::iterator, bool> res = d_slavechecks.insert(sc);
+  if(!res.second && deadline < res.first->deadline)
+    d_slavechecks.replace(res.first, sc);
+}
+
+void CommunicatorClass::updateSlaveStats()
+{
+  time_t now = time(0), oldest = now;
+  unsigned int queued;
+  {
+    Lock l(&d_lock);
+    queued = d_suckdomains.size();
+    for(UniQueue::const_iterator i = d_suckdomains.begin(); i != d_suckdomains.end(); ++i)
+      oldest = min(oldest, i->queued);
+    for(std::list<SuckRequest>::const_iterator i = d_transferring.begin(); i != d_transferring.end(); ++i)
+      oldest = min(oldest, i->queued);
+  }
+  S.set("slave-freshness-lag", now - oldest);
+  S.set("slave-transfer-queue", queued);
+  S.set("slave-check-queue", d_slavechecks.size());
+}
+
+/** Zones NOTIFY told us about are checked at once. All others come from the backends once per slave-cycle-interval
+    and get a random deadline within slave-check-spread seconds, so large numbers of zones whose refresh timers
+    expire together don't all get their SOA queries at the same moment. Returns the seconds until the next check is due. */
+time_t CommunicatorClass::slaveRefresh(PacketHandler *P)
 {
   UeberBackend *B=dynamic_cast<UeberBackend *>(P->getBackend());
   vector<DomainInfo> rdomains;
@@ -505,15 +674,36 @@ void CommunicatorClass::slaveRefresh(PacketHandler *P)
     }
   }
 
-  if(rdomains.empty()) // if we have priority domains, check them first
-    B->getUnfreshSlaveInfos(&rdomains);
+  time_t now=time(0);
+  BOOST_FOREACH(const DomainInfo& di, rdomains)
+    scheduleSlaveCheck(di, 0, true);
+
+  if(d_lastslavediscovery + d_tickinterval <= now) {
+    vector<DomainInfo> unfresh;
+    B->getUnfreshSlaveInfos(&unfresh);
+    d_lastslavediscovery = now;
+    BOOST_FOREACH(const DomainInfo& di, unfresh)
+      scheduleSlaveCheck(di, now + (d_slavecheckspread ? Utility::random() % d_slavecheckspread : 0), false);
+  }
+
+  vector<SlaveCheck> due;
+  checks_by_deadline_t& deadlines = boost::multi_index::get<DeadlineTag>(d_slavechecks);
+  while(!deadlines.empty() && deadlines.begin()->deadline <= now) {
+    due.push_back(*deadlines.begin());
+    deadlines.erase(deadlines.begin());
+  }
+
+  time_t nextcheck = d_tickinterval;
+  if(!deadlines.empty())
+    nextcheck = min(nextcheck, max((time_t)1, deadlines.begin()->deadline - now));
     
   DNSSECKeeper dk(B); // NOW HEAR THIS! This DK uses our B backend, so no interleaved access!
   {
     Lock l(&d_lock);
     domains_by_name_t& nameindex=boost::multi_index::get<IDTag>(d_suckdomains);
 
-    BOOST_FOREACH(DomainInfo& di, rdomains) {
+    BOOST_FOREACH(SlaveCheck& sc, due) {
+      DomainInfo& di(sc.di);
       std::vector<std::string> localaddr;
       SuckRequest sr;
       sr.domain=di.zone;
@@ -526,6 +716,7 @@ void CommunicatorClass::slaveRefresh(PacketHandler *P)
       }
       DomainNotificationInfo dni;
       dni.di=di;
+      dni.priority=sc.priority;
       dni.dnssecOk = dk.isPresigned(di.zone);
       
       if(dk.getTSIGForAccess(di.zone, sr.master, &dni.tsigkeyname)) {
@@ -543,7 +734,7 @@ void CommunicatorClass::slaveRefresh(PacketHandler *P)
         }
         catch(std::exception& e) {
           L<<Logger::Error<<"Failed to load freshness check source '"<<localaddr[0]<<"' for '"<<di.zone<<"': "<<e.what()<<endl;
-          return;
+          return nextcheck;
         }
       } else {
         dni.localaddr.sin4.sin_family = 0;
@@ -559,8 +750,9 @@ void CommunicatorClass::slaveRefresh(PacketHandler *P)
       Lock l(&d_lock);
       L<<Logger::Warning<<"No new unfresh slave domains, "<<d_suckdomains.size()<<" queued for AXFR already"<<endl;
     }
-    d_slaveschanged = !rdomains.empty();
-    return;
+    d_slaveschanged = !due.empty();
+    updateSlaveStats();
+    return nextcheck;
   }
   else {
     Lock l(&d_lock);
@@ -628,15 +820,17 @@ void CommunicatorClass::slaveRefresh(PacketHandler *P)
         }
         else {
           L<<Logger::Warning<<"Domain '"<< di.zone<<"' is fresh, but RRSIGS differ, so DNSSEC stale"<<endl;
-          addSuckRequest(di.zone, *di.masters.begin());
+          addSuckRequest(di.zone, *di.masters.begin(), val.priority);
         }
       }
     }
     else {
       L<<Logger::Warning<<"Domain '"<< di.zone<<"' is stale, master serial "<<theirserial<<", our serial "<< ourserial <<endl;
-      addSuckRequest(di.zone, *di.masters.begin());
+      addSuckRequest(di.zone, *di.masters.begin(), val.priority);
     }
   }
+  updateSlaveStats();
+  return nextcheck;
 }  
 
 // stub for PowerDNSLua linking
@@ -303,6 +303,16 @@ vector<uint8_t> makeEmptyQuery()
 }
 
 
+vector<uint8_t> makeEDNSQuery()
+{
+  vector<uint8_t> packet;
+  DNSPacketWriter pw(packet, "www.outpost.ds9a.nl", QType::A);
+  pw.getHeader()->rd=1;
+  pw.addOpt(4096, 0, EDNSOpts::DNSSECOK);
+  pw.commit();
+  return  packet;
+}
+
 vector<uint8_t> makeRootReferral()
 {
   vector<uint8_t> packet;
@@ -658,6 +668,71 @@ struct ParsePacketBareTest
 };
 
 
+// what the auth and recursor do with every question they get: header, qname, qtype and the EDNS options
+struct ParseQuestionTest
+{
+  explicit ParseQuestionTest(const vector<uint8_t>& packet, const std::string& name) 
+    : d_packet(packet), d_name(name)
+  {}
+
+  string getName() const
+  {
+    return "parse question '"+d_name+"' with MOADNSParser";
+  }
+
+  void operator()() const
+  {
+    MOADNSParser mdp((const char*)&*d_packet.begin(), d_packet.size());
+    EDNSOpts edo;
+    getEDNSOpts(mdp, &edo);
+    string qname=mdp.d_qname;
+  }
+  const vector<uint8_t>& d_packet;
+  std::string d_name;
+};
+
+struct ParseQuestionViewTest
+{
+  explicit ParseQuestionViewTest(const vector<uint8_t>& packet, const std::string& name) 
+    : d_packet(packet), d_name(name)
+  {}
+
+  string getName() const
+  {
+    return "parse question '"+d_name+"' with DNSPacketView";
+  }
+
+  void operator()() const
+  {
+    DNSPacketView mdp((const char*)&*d_packet.begin(), d_packet.size());
+    EDNSOpts edo;
+    getEDNSOpts(mdp, &edo);
+    string qname;
+    mdp.getQName(qname);
+  }
+  const vector<uint8_t>& d_packet;
+  std::string d_name;
+};
+
+struct ParsePacketViewTest
+{
+  explicit ParsePacketViewTest(const vector<uint8_t>& packet, const std::string& name) 
+    : d_packet(packet), d_name(name)
+  {}
+
+  string getName() const
+  {
+    return "parse '"+d_name+"' bare with DNSPacketView";
+  }
+
+  void operator()() const
+  {
+    DNSPacketView mdp((const char*)&*d_packet.begin(), d_packet.size());
+  }
+  const vector<uint8_t>& d_packet;
+  std::string d_name;
+};
+
 struct SimpleCompressTest
 {
   explicit SimpleCompressTest(const std::string& name) 
@@ -759,10 +834,77 @@ struct NOPTest
 
 
 
+#ifdef HAVE_LUA
+#include "lua-recursor.hh"
+
+// nothing is resolved here, so the getFake* helpers of a script only get an error back
+int directResolve(const std::string& qname, const QType& qtype, int qclass, vector<DNSResourceRecord>& ret)
+{
+  return -1;
+}
+
+struct LuaHookTest
+{
+  typedef bool (RecursorLua::*hook_t)(const ComboAddress&, const ComboAddress&, const string&, const QType&, vector<DNSResourceRecord>&, int&, bool*);
+
+  LuaHookTest(RecursorLua* pdl, const string& name, hook_t hook, int records)
+    : d_pdl(pdl), d_name(name), d_hook(hook), d_remote("192.0.2.1"), d_local("192.0.2.53")
+  {
+    DNSResourceRecord rr;
+    rr.qname="www.example.com";
+    rr.qtype=QType::A;
+    rr.content="192.0.2.80";
+    rr.ttl=3600;
+    d_records.resize(records, rr);
+  }
+
+  string getName() const
+  {
+    return (boost::format("lua %s with %d records") % d_name % d_records.size()).str();
+  }
+
+  void operator()() const
+  {
+    vector<DNSResourceRecord> ret(d_records);
+    int res=0;
+    bool variable=false;
+    g_ret=(d_pdl->*d_hook)(d_remote, d_local, "www.example.com", QType(QType::A), ret, res, &variable);
+  }
+
+  RecursorLua* d_pdl;
+  string d_name;
+  hook_t d_hook;
+  ComboAddress d_remote, d_local;
+  vector<DNSResourceRecord> d_records;
+};
+
+// times only the hooks of a recursor script, like 'speedtest lua powerdns-example-script.lua'
+void doLuaRuns(const string& fname)
+{
+  RecursorLua pdl(fname);
+
+  doRun(LuaHookTest(&pdl, "preresolve", &RecursorLua::preresolve, 0));
+  doRun(LuaHookTest(&pdl, "nxdomain", &RecursorLua::nxdomain, 0));
+  doRun(LuaHookTest(&pdl, "nodata", &RecursorLua::nodata, 0));
+  doRun(LuaHookTest(&pdl, "postresolve", &RecursorLua::postresolve, 1));
+  doRun(LuaHookTest(&pdl, "postresolve", &RecursorLua::postresolve, 4));
+  doRun(LuaHookTest(&pdl, "postresolve", &RecursorLua::postresolve, 64));
+}
+#endif
+
 int main(int argc, char** argv)
 try
 {
   reportAllTypes();
+
+#ifdef HAVE_LUA
+  if(argc > 2 && !strcmp(argv[1], "lua")) {
+    doLuaRuns(argv[2]);
+    cerr<<"Total runs: " << g_totalRuns<<endl;
+    return 0;
+  }
+#endif
+
   doRun(NOPTest());
 
   doRun(IEqualsTest());
@@ -773,6 +915,7 @@ try
 
   vector<uint8_t> packet = makeRootReferral();
   doRun(ParsePacketBareTest(packet, "root-referral"));
+  doRun(ParsePacketViewTest(packet, "root-referral"));
   doRun(ParsePacketTest(packet, "root-referral"));
 
   doRun(RootRefTest());
@@ -789,6 +932,11 @@ try
   doRun(ParsePacketBareTest(packet, "typical-referral"));
 
   doRun(ParsePacketTest(packet, "typical-referral"));
+  doRun(ParsePacketViewTest(packet, "typical-referral"));
+
+  packet = makeEDNSQuery();
+  doRun(ParseQuestionTest(packet, "edns-query"));
+  doRun(ParseQuestionViewTest(packet, "edns-query"));
 
   doRun(SimpleCompressTest("www.france.ds9a.nl"));
 
@@ -95,6 +95,46 @@ int SSQLite3::doQuery( const std::string & query )
   return 0;
 }
 
+// Inserts rows, the statement is compiled once and every row is bound to it, so nothing needs escaping either.
+void SSQLite3::insertRows( const std::string & query, const result_t & rows )
+{
+  if ( rows.empty() )
+    return;
+
+  std::string statement = query + " (";
+  for ( row_t::size_type n = 0; n < rows[0].size(); n++ )
+    statement += n ? ",?" : "?";
+  statement += ")";
+
+  if(m_dolog)
+    L<<Logger::Warning<<"Query: "<<statement<<" ("<<rows.size()<<" rows)"<<endl;
+
+  sqlite3_stmt *pStmt;
+  const char *pTail;
+#if SQLITE_VERSION_NUMBER >=  3003009
+  if ( sqlite3_prepare_v2( m_pDB, statement.c_str(), -1, &pStmt, &pTail ) != SQLITE_OK )
+#else
+  if ( sqlite3_prepare( m_pDB, statement.c_str(), -1, &pStmt, &pTail ) != SQLITE_OK )
+#endif
+    throw sPerrorException( string("Unable to compile SQLite statement : ")+ sqlite3_errmsg( m_pDB ) );
+
+  for ( result_t::const_iterator row = rows.begin(); row != rows.end(); ++row )
+  {
+    for ( row_t::size_type n = 0; n < row->size(); n++ )
+      sqlite3_bind_text( pStmt, n + 1, (*row)[n].c_str(), (*row)[n].size(), SQLITE_STATIC );
+
+    if ( sqlite3_step( pStmt ) != SQLITE_DONE )
+    {
+      sqlite3_reset( pStmt ); // with the old sqlite3_prepare, this is where the real error comes from
+      string error = sqlite3_errmsg( m_pDB );
+      sqlite3_finalize( pStmt );
+      throw sPerrorException( "Unable to insert rows: " + error );
+    }
+    sqlite3_reset( pStmt );
+  }
+  sqlite3_finalize( pStmt );
+}
+
 int SSQLite3::busyHandler(void*, int)
 {
   usleep(1000);
@@ -43,6 +43,9 @@ public:
     return doQuery(query, result); // 'result' is necessary to force doQuery to do the work, closing Debian bug 280359
   }
   
+  //! Inserts rows through one prepared statement, query ends in 'values'
+  void insertRows( const std::string & query, const result_t & rows );
+
   //! Returns a row from a result set.
   bool getRow( row_t & row );
 
@@ -26,11 +26,24 @@
 #include <iostream>
 #include <sstream>
 #include <algorithm>
+#include <limits>
 #include "arguments.hh"
 #include "lock.hh"
 
 #include "namespaces.hh"
 
+static const struct
+{
+  const char* suffix;
+  double percent;
+  const char* descrip;
+} s_percentiles[] = {
+  { "-p50", 50, "median" },
+  { "-p99", 99, "99th percentile" },
+  { "-p999", 99.9, "99.9th percentile" }
+};
+static const unsigned int s_numpercentiles = sizeof(s_percentiles) / sizeof(s_percentiles[0]);
+
 StatBag::StatBag()
 {
   d_doRings=false;
@@ -60,6 +73,11 @@ string StatBag::directory()
     {
       o<<i->first<<"="<<*(i->second)<<",";
     }
+  for(map<string, LatencyHistogram *>::const_iterator i=d_histograms.begin(); i!=d_histograms.end(); ++i) {
+    LatencyHistogram::Snapshot snap=i->second->get();
+    for(unsigned int n=0; n < s_numpercentiles; ++n)
+      o<<i->first<<s_percentiles[n].suffix<<"="<<snap.percentile(s_percentiles[n].percent)<<",";
+  }
   unlock();
   dir=o.str();
   return dir;
@@ -74,6 +92,9 @@ vector<string>StatBag::getEntries()
       i!=d_stats.end();
       i++)
       ret.push_back(i->first);
+  for(map<string, LatencyHistogram *>::const_iterator i=d_histograms.begin(); i!=d_histograms.end(); ++i)
+    for(unsigned int n=0; n < s_numpercentiles; ++n)
+      ret.push_back(i->first+s_percentiles[n].suffix);
 
   unlock();
   return ret;
@@ -97,6 +118,47 @@ void StatBag::declare(const string &key, const string &descrip)
   unlock();
 }
 
+void StatBag::declareHistogram(const string &key, const string &descrip)
+{
+  lock();
+  if(!d_histograms.count(key))
+    d_histograms[key]=new LatencyHistogram;
+  for(unsigned int n=0; n < s_numpercentiles; ++n)
+    d_keyDescrips[key+s_percentiles[n].suffix]=descrip+", "+s_percentiles[n].descrip+" in usec";
+  unlock();
+}
+
+LatencyHistogram *StatBag::getHistogram(const string &key)
+{
+  Lock l(&d_lock);
+  map<string, LatencyHistogram *>::const_iterator i=d_histograms.find(key);
+  return i==d_histograms.end() ? 0 : i->second;
+}
+
+vector<string>StatBag::listHistograms()
+{
+  vector<string> ret;
+  Lock l(&d_lock);
+  for(map<string, LatencyHistogram *>::const_iterator i=d_histograms.begin(); i!=d_histograms.end(); ++i)
+    ret.push_back(i->first);
+  return ret;
+}
+
+bool StatBag::readPercentile(const string &key, unsigned int &value)
+{
+  for(unsigned int n=0; n < s_numpercentiles; ++n) {
+    string suffix(s_percentiles[n].suffix);
+    if(key.size() <= suffix.size() || key.compare(key.size()-suffix.size(), suffix.size(), suffix))
+      continue;
+    map<string, LatencyHistogram *>::const_iterator i=d_histograms.find(key.substr(0, key.size()-suffix.size()));
+    if(i==d_histograms.end())
+      return false;
+    value=(unsigned int)min(i->second->get().percentile(s_percentiles[n].percent), (uint64_t)std::numeric_limits<unsigned int>::max());
+    return true;
+  }
+  return false;
+}
+
 
           
 void StatBag::set(const string &key, unsigned int value)
@@ -114,8 +176,10 @@ unsigned int StatBag::read(const string &key)
 
   if(!d_stats.count(key))
     {
+      unsigned int value=0;
+      readPercentile(key, value);
       unlock();
-      return 0;
+      return value;
     }
 
   unsigned int tmp=*d_stats[key];
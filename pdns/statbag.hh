@@ -26,6 +26,7 @@
 #include <string>
 #include <vector>
 #include "lock.hh"
+#include "histogram.hh"
 #include "namespaces.hh"
 
 class StatRing
@@ -64,6 +65,7 @@ class StatBag
   map<string, unsigned int *> d_stats;
   map<string, string> d_keyDescrips;
   map<string,StatRing>d_rings;
+  map<string, LatencyHistogram*> d_histograms;
   bool d_doRings;
   pthread_mutex_t d_lock;
 
@@ -91,6 +93,12 @@ public:
   void resizeRing(const string &name, unsigned int newsize);
   unsigned int getRingSize(const string &name);
 
+  /** A histogram shows up as the entries key-p50, key-p99 and key-p999, the latency in usec that 50, 99 and 99.9
+      percent of the submitted values stayed under */
+  void declareHistogram(const string &key, const string &descrip="");
+  LatencyHistogram *getHistogram(const string &key); //!< returns 0 if no such histogram was declared, so tools that don't declare it can skip timing
+  vector<string>listHistograms();
+
   string directory(); //!< Returns a list of all data stored
   vector<string> getEntries(); //!< returns a vector with datums (items)
   string getDescrip(const string &item); //!< Returns the description of this datum/item
@@ -105,6 +113,7 @@ public:
   string getValueStrZero(const string &key); //!< read a value behind a key, and return it as a string, and zero afterwards
 
 private:
+  bool readPercentile(const string &key, unsigned int &value); //!< needs the lock held
   void lock(){pthread_mutex_lock(&d_lock);}
   void unlock(){pthread_mutex_unlock(&d_lock);}
 };
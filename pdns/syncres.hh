@@ -20,6 +20,7 @@
 #include <boost/tuple/tuple_comparison.hpp>
 #include "mtasker.hh"
 #include "iputils.hh"
+#include "histogram.hh"
 
 void primeHints(void);
 
@@ -485,6 +486,7 @@ struct RecursorStats
   uint64_t noErrors;
   uint64_t answers0_1, answers1_10, answers10_100, answers100_1000, answersSlow;
   uint64_t avgLatencyUsec;
+  LatencyHistogram answerLatency; //!< usec between receiving a question and sending the answer
   uint64_t qcounter;
   uint64_t ipv6qcounter;
   uint64_t tcpqcounter;
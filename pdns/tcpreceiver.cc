@@ -35,6 +35,7 @@
 #include <boost/foreach.hpp>
 #include <errno.h>
 #include <signal.h>
+#include <netinet/tcp.h>
 #include "base64.hh"
 #include "ueberbackend.hh"
 #include "dnspacket.hh"
@@ -50,6 +51,8 @@
 #include "communicator.hh"
 #include "namespaces.hh"
 #include "signingpipe.hh"
+#include "mplexer.hh"
+#include "common_startup.hh"
 extern PacketCache PC;
 extern StatBag S;
 
@@ -59,10 +62,14 @@ extern StatBag S;
 */
 
 pthread_mutex_t TCPNameserver::s_plock = PTHREAD_MUTEX_INITIALIZER;
-Semaphore *TCPNameserver::d_connectionroom_sem;
 PacketHandler *TCPNameserver::s_P; 
 int TCPNameserver::s_timeout;
 NetmaskGroup TCPNameserver::d_ng;
+pthread_mutex_t TCPNameserver::s_clientslock = PTHREAD_MUTEX_INITIALIZER;
+map<ComboAddress, unsigned int> TCPNameserver::s_clients;
+unsigned int TCPNameserver::s_connections;
+unsigned int TCPNameserver::s_maxconnections;
+unsigned int TCPNameserver::s_maxperclient;
 
 void TCPNameserver::go()
 {
@@ -75,6 +82,9 @@ void TCPNameserver::go()
     L<<Logger::Error<<Logger::NTLog<<"TCP server is unable to launch backends - will try again when questions come in"<<endl;
     L<<Logger::Error<<"TCP server is unable to launch backends - will try again when questions come in: "<<ae.reason<<endl;
   }
+
+  for(vector<Worker>::iterator w=d_workers.begin(); w!=d_workers.end(); ++w)
+    pthread_create(&w->tid, 0, workerThread, static_cast<void *>(&*w));
   pthread_create(&d_tid, 0, launcher, static_cast<void *>(this));
 }
 
@@ -187,22 +197,29 @@ void TCPNameserver::sendPacket(shared_ptr<DNSPacket> p, int outsock)
     }
   }
 
-  uint16_t len=htons(p->getString().length());
-  string buffer((const char*)&len, 2);
-  buffer.append(p->getString());
-  writenWithTimeout(outsock, buffer.c_str(), buffer.length());
+  const string& buffer=p->getString();
+  uint16_t len=htons(buffer.length());
+  struct iovec iov[2];
+  iov[0].iov_base=(void*)&len;
+  iov[0].iov_len=2;
+  iov[1].iov_base=(void*)buffer.c_str();
+  iov[1].iov_len=buffer.length();
+
+  int ret=writev(outsock, iov, 2);
+  if(ret < 0) {
+    if(errno!=EAGAIN)
+      throw NetworkError("Writing data: "+stringerror());
+    ret=0;
+  }
+  // partial writes get finished the old fashioned way
+  if(ret < 2) {
+    writenWithTimeout(outsock, (const char*)&len + ret, 2 - ret);
+    ret=2;
+  }
+  writenWithTimeout(outsock, buffer.c_str() + (ret - 2), buffer.length() - (ret - 2));
 }
 
 
-void TCPNameserver::getQuestion(int fd, char *mesg, int pktlen, const ComboAddress &remote)
-try
-{
-  readnWithTimeout(fd, mesg, pktlen);
-}
-catch(NetworkError& ae) {
-  throw NetworkError("Error reading DNS data from TCP client "+remote.toString()+": "+ae.what());
-}
-
 static void proxyQuestion(shared_ptr<DNSPacket> packet)
 {
   int sock=socket(AF_INET, SOCK_STREAM, 0);
@@ -245,102 +262,229 @@ static void proxyQuestion(shared_ptr<DNSPacket> packet)
   return;
 }
 
-void *TCPNameserver::doConnection(void *data)
+static FDMultiplexer* getMultiplexer()
 {
-  shared_ptr<DNSPacket> packet;
-  // Fix gcc-4.0 error (on AMD64)
-  int fd=(int)(long)data; // gotta love C (generates a harmless warning on opteron)
-  pthread_detach(pthread_self());
-  Utility::setNonBlocking(fd);
+  for(FDMultiplexer::FDMultiplexermap_t::const_iterator i = FDMultiplexer::getMultiplexerMap().begin();
+      i != FDMultiplexer::getMultiplexerMap().end(); ++i) {
+    try {
+      return i->second();
+    }
+    catch(FDMultiplexerException &fe) {
+      L<<Logger::Error<<"Non-fatal error initializing possible multiplexer ("<<fe.what()<<"), falling back"<<endl;
+    }
+  }
+  throw PDNSException("No working multiplexer found for the TCP server");
+}
+
+void *TCPNameserver::workerThread(void *data)
+{
+  Worker* w=static_cast<Worker*>(data);
   try {
-    char mesg[65535];
-    
-    DLOG(L<<"TCP Connection accepted on fd "<<fd<<endl);
-    bool logDNSQueries= ::arg().mustDo("log-dns-queries");
+    w->P=new PacketHandler;
+  }
+  catch(PDNSException &ae) {
+    L<<Logger::Error<<"TCP worker is unable to launch backends - will try again when questions come in: "<<ae.reason<<endl;
+  }
+
+  try {
+    w->fdm->addReadFD(w->pipes[0], handleNewConnection, w);
+    struct timeval now;
     for(;;) {
-      ComboAddress remote;
-      socklen_t remotelen=sizeof(remote);
-      if(getpeername(fd, (struct sockaddr *)&remote, &remotelen) < 0) {
-        L<<Logger::Error<<"Received question from socket which had no remote address, dropping ("<<stringerror()<<")"<<endl;
-        break;
+      w->fdm->run(&now);
+
+      typedef vector<pair<int, FDMultiplexer::funcparam_t> > expired_t;
+      expired_t expired=w->fdm->getTimeouts(now);
+      for(expired_t::iterator i=expired.begin(); i!=expired.end(); ++i) {
+        Connection* conn=boost::any_cast<Connection*>(i->second);
+        DLOG(L<<"Closing idle TCP connection from "<<conn->remote.toStringWithPort()<<endl);
+        closeWatchedConnection(conn);
       }
+    }
+  }
+  catch(FDMultiplexerException &fe) {
+    L<<Logger::Error<<"TCP worker thread dying because of multiplexer error: "<<fe.what()<<endl;
+  }
+  exit(1); // take rest of server with us
+}
 
-      uint16_t pktlen;
-      if(!readnWithTimeout(fd, &pktlen, 2, false))
-        break;
-      else
-        pktlen=ntohs(pktlen);
+void TCPNameserver::handleNewConnection(int fd, boost::any& param)
+{
+  Worker* w=boost::any_cast<Worker*>(param);
+  Connection* conn;
+  if(read(fd, &conn, sizeof(conn)) != sizeof(conn)) { // pipe writes of this size are atomic
+    L<<Logger::Error<<"Reading new TCP connection from pipe: "<<stringerror()<<endl;
+    return;
+  }
 
-      if(pktlen>sizeof(mesg)) {
-        L<<Logger::Error<<"Received an overly large question from "<<remote.toString()<<", dropping"<<endl;
-        break;
-      }
-      
-      getQuestion(fd, mesg, pktlen, remote);
-      S.inc("tcp-queries");      
-
-      packet=shared_ptr<DNSPacket>(new DNSPacket);
-      packet->setRemote(&remote);
-      packet->d_tcp=true;
-      packet->setSocket(fd);
-      if(packet->parse(mesg, pktlen)<0)
-        break;
-      
-      if(packet->qtype.getCode()==QType::AXFR || packet->qtype.getCode()==QType::IXFR ) {
-        if(doAXFR(packet->qdomain, packet, fd)) 
-          S.inc("tcp-answers");  
-        continue;
-      }
+  w->fdm->addReadFD(conn->fd, handleReadable, conn);
+  struct timeval now;
+  gettimeofday(&now, 0);
+  w->fdm->setReadTTD(conn->fd, now, s_timeout);
+  processBuffer(conn); // coming back from a transfer, the client may already have sent more
+}
 
-      shared_ptr<DNSPacket> reply; 
-      shared_ptr<DNSPacket> cached= shared_ptr<DNSPacket>(new DNSPacket);
-      if(logDNSQueries)  {
-        string remote;
-        if(packet->hasEDNSSubnet()) 
-          remote = packet->getRemote() + "<-" + packet->getRealRemote().toString();
-        else
-          remote = packet->getRemote();
-        L << Logger::Notice<<"TCP Remote "<< remote <<" wants '" << packet->qdomain<<"|"<<packet->qtype.getName() << 
-        "', do = " <<packet->d_dnssecOk <<", bufsize = "<< packet->getMaxReplyLen()<<": ";
-      }
+void TCPNameserver::handleReadable(int fd, boost::any& param)
+{
+  Connection* conn=boost::any_cast<Connection*>(param);
+  char buffer[16384];
+  int ret=read(fd, buffer, sizeof(buffer));
+  if(ret < 0 && (errno==EAGAIN || errno==EINTR))
+    return;
+  if(ret <= 0) {
+    if(ret < 0)
+      L<<Logger::Info<<"Error reading from TCP client "<<conn->remote.toString()<<": "<<stringerror()<<endl;
+    closeWatchedConnection(conn);
+    return;
+  }
+
+  conn->buffer.append(buffer, ret);
+  struct timeval now;
+  gettimeofday(&now, 0);
+  conn->worker->fdm->setReadTTD(fd, now, s_timeout);
+  processBuffer(conn);
+}
 
+//! answers every whole question in the buffer of conn, in order
+void TCPNameserver::processBuffer(Connection* conn)
+{
+  while(conn->buffer.size() >= 2) {
+    unsigned int pktlen=(unsigned char)conn->buffer[0]*256 + (unsigned char)conn->buffer[1];
+    if(conn->buffer.size() < pktlen + 2)
+      return;
+
+    S.inc("tcp-queries");
+    shared_ptr<DNSPacket> packet(new DNSPacket);
+    packet->d_dt.set(); // timing
+    packet->setRemote(&conn->remote);
+    packet->d_tcp=true;
+    packet->setSocket(conn->fd);
+    int ret=packet->parse(conn->buffer.c_str() + 2, pktlen);
+    conn->buffer.erase(0, pktlen + 2);
+    if(ret < 0) {
+      closeWatchedConnection(conn);
+      return;
+    }
+    if(!answerQuestion(conn, packet))
+      return;
+  }
+}
 
-      if(!packet->d.rd && packet->couldBeCached() && PC.get(packet.get(), cached.get())) { // short circuit - does the PacketCache recognize this question?
-        if(logDNSQueries)
-          L<<"packetcache HIT"<<endl;
-        cached->setRemote(&packet->d_remote);
-        cached->d.id=packet->d.id;
-        cached->d.rd=packet->d.rd; // copy in recursion desired bit 
-        cached->commitD(); // commit d to the packet                        inlined
+bool TCPNameserver::answerQuestion(Connection* conn, shared_ptr<DNSPacket> packet)
+{
+  Worker* w=conn->worker;
+  try {
+    if(packet->qtype.getCode()==QType::AXFR || packet->qtype.getCode()==QType::IXFR) {
+      conn->pending=packet;
+      handOff(conn);
+      return false;
+    }
 
-        sendPacket(cached, fd); // presigned, don't do it again
-        S.inc("tcp-answers");
-        continue;
-      }
+    shared_ptr<DNSPacket> reply; 
+    shared_ptr<DNSPacket> cached= shared_ptr<DNSPacket>(new DNSPacket);
+    static bool logDNSQueries= ::arg().mustDo("log-dns-queries");
+    if(logDNSQueries)  {
+      string remote;
+      if(packet->hasEDNSSubnet()) 
+        remote = packet->getRemote() + "<-" + packet->getRealRemote().toString();
+      else
+        remote = packet->getRemote();
+      L << Logger::Notice<<"TCP Remote "<< remote <<" wants '" << packet->qdomain<<"|"<<packet->qtype.getName() << 
+      "', do = " <<packet->d_dnssecOk <<", bufsize = "<< packet->getMaxReplyLen()<<": ";
+    }
+
+    if(!packet->d.rd && packet->couldBeCached() && PC.get(packet.get(), cached.get())) { // short circuit - does the PacketCache recognize this question?
       if(logDNSQueries)
-          L<<"packetcache MISS"<<endl;  
-      {
-        Lock l(&s_plock);
-        if(!s_P) {
-          L<<Logger::Error<<"TCP server is without backend connections, launching"<<endl;
-          s_P=new PacketHandler;
-        }
-        bool shouldRecurse;
+        L<<"packetcache HIT"<<endl;
+      cached->setRemote(&packet->d_remote);
+      cached->d.id=packet->d.id;
+      cached->d.rd=packet->d.rd; // copy in recursion desired bit 
+      cached->commitD(); // commit d to the packet                        inlined
+
+      sendPacket(cached, conn->fd); // presigned, don't do it again
+      accountAnswer(packet.get(), cached.get());
+      S.inc("tcp-answers");
+      return true;
+    }
+    if(logDNSQueries)
+        L<<"packetcache MISS"<<endl;  
 
-        reply=shared_ptr<DNSPacket>(s_P->questionOrRecurse(packet.get(), &shouldRecurse)); // we really need to ask the backend :-)
+    if(!w->P) {
+      L<<Logger::Error<<"TCP worker is without backend connections, launching"<<endl;
+      w->P=new PacketHandler;
+    }
+    bool shouldRecurse;
 
-        if(shouldRecurse) {
-          proxyQuestion(packet);
-          continue;
-        }
-      }
+    reply=shared_ptr<DNSPacket>(w->P->questionOrRecurse(packet.get(), &shouldRecurse)); // we really need to ask the backend :-)
 
-      if(!reply)  // unable to write an answer?
-        break;
+    if(shouldRecurse) {
+      conn->pending=packet;
+      handOff(conn);
+      return false;
+    }
+
+    if(!reply) { // unable to write an answer?
+      closeWatchedConnection(conn);
+      return false;
+    }
         
-      S.inc("tcp-answers");
-      sendPacket(reply, fd);
+    S.inc("tcp-answers");
+    sendPacket(reply, conn->fd);
+    accountAnswer(packet.get(), reply.get());
+    return true;
+  }
+  catch(DBException &e) {
+    delete w->P;
+    w->P = 0;
+
+    L<<Logger::Error<<"TCP worker unable to answer a question because of a backend error, cycling"<<endl;
+  }
+  catch(PDNSException &ae) {
+    delete w->P;
+    w->P = 0; // on next call, backend will be recycled
+    L<<Logger::Error<<"TCP nameserver had error, cycling backend: "<<ae.reason<<endl;
+  }
+  catch(NetworkError &e) {
+    L<<Logger::Info<<"TCP connection from "<<conn->remote.toString()<<" closed because of network error: "<<e.what()<<endl;
+  }
+  catch(std::exception &e) {
+    L<<Logger::Error<<"TCP connection from "<<conn->remote.toString()<<" closed because of STL error: "<<e.what()<<endl;
+  }
+  closeWatchedConnection(conn);
+  return false;
+}
+
+//! takes conn away from its worker and lets a thread of its own deal with conn->pending
+void TCPNameserver::handOff(Connection* conn)
+{
+  conn->worker->fdm->removeReadFD(conn->fd);
+
+  pthread_t tid;
+  if(pthread_create(&tid, 0, &doLongQuestion, conn)) {
+    L<<Logger::Error<<"Error creating thread: "<<stringerror()<<endl;
+    closeConnection(conn);
+  }
+}
+
+void *TCPNameserver::doLongQuestion(void *data)
+{
+  pthread_detach(pthread_self());
+  Connection* conn=static_cast<Connection*>(data);
+  shared_ptr<DNSPacket> packet;
+  packet.swap(conn->pending);
+  try {
+    if(packet->qtype.getCode()==QType::AXFR) {
+      if(doAXFR(packet->qdomain, packet, conn->fd)) 
+        S.inc("tcp-answers");  
+    }
+    else if(packet->qtype.getCode()==QType::IXFR) {
+      if(doIXFR(packet->qdomain, packet, conn->fd))
+        S.inc("tcp-answers");
     }
+    else
+      proxyQuestion(packet);
+
+    adopt(conn);
+    return 0;
   }
   catch(DBException &e) {
     Lock l(&s_plock);
@@ -366,12 +510,39 @@ void *TCPNameserver::doConnection(void *data)
   {
     L << Logger::Error << "TCP Connection Thread caught unknown exception." << endl;
   }
-  d_connectionroom_sem->post();
-  Utility::closesocket(fd);
-
+  closeConnection(conn);
   return 0;
 }
 
+void TCPNameserver::adopt(Connection* conn)
+{
+  if(write(conn->worker->pipes[1], &conn, sizeof(conn)) != sizeof(conn)) {
+    L<<Logger::Error<<"Unable to hand TCP connection to worker: "<<stringerror()<<endl;
+    closeConnection(conn);
+  }
+}
+
+void TCPNameserver::closeWatchedConnection(Connection* conn)
+{
+  conn->worker->fdm->removeReadFD(conn->fd);
+  closeConnection(conn);
+}
+
+void TCPNameserver::closeConnection(Connection* conn)
+{
+  Utility::closesocket(conn->fd);
+  {
+    Lock l(&s_clientslock);
+    s_connections--;
+    ComboAddress client(conn->remote);
+    client.sin4.sin_port=0;
+    map<ComboAddress, unsigned int>::iterator iter=s_clients.find(client);
+    if(iter != s_clients.end() && !--iter->second)
+      s_clients.erase(iter);
+  }
+  delete conn;
+}
+
 
 // call this method with s_plock held!
 bool TCPNameserver::canDoAXFR(shared_ptr<DNSPacket> q)
@@ -462,6 +633,29 @@ bool TCPNameserver::canDoAXFR(shared_ptr<DNSPacket> q)
 }
 
 namespace {
+  /* while a zone streams out, hold back partially filled segments so many small
+     AXFR packets share full segments, the last packet is flushed on destruction */
+  class TCPCorker
+  {
+  public:
+    TCPCorker(int fd) : d_fd(fd)
+    {
+      setCork(1);
+    }
+    ~TCPCorker()
+    {
+      setCork(0);
+    }
+  private:
+    void setCork(int on)
+    {
+#ifdef TCP_CORK
+      setsockopt(d_fd, IPPROTO_TCP, TCP_CORK, (char*)&on, sizeof(on));
+#endif
+    }
+    int d_fd;
+  };
+
   struct NSECXEntry
   {
     set<uint16_t> d_set;
@@ -577,7 +771,9 @@ int TCPNameserver::doAXFR(const string &target, shared_ptr<DNSPacket> q, int out
   
   UeberBackend signatureDB; 
   
-  // SOA *must* go out first, our signing pipe might reorder
+  TCPCorker corker(outsock);
+
+  // SOA *must* go out first
   DLOG(L<<"Sending out SOA"<<endl);
   DNSResourceRecord soa = makeDNSRRFromSOAData(sd);
   outpacket->addRecord(soa);
@@ -834,17 +1030,129 @@ int TCPNameserver::doAXFR(const string &target, shared_ptr<DNSPacket> q, int out
   return 1;
 }
 
+/** answer an IXFR from the journal, or hand it to doAXFR if we can't. Return 0 in case of error, 1 in case of success */
+int TCPNameserver::doIXFR(const string &target, shared_ptr<DNSPacket> q, int outsock)
+{
+  uint32_t clientSerial = 0;
+  bool haveClientSerial = false;
+  try {
+    MOADNSParser mdp(q->getString());
+    BOOST_FOREACH(const MOADNSParser::answers_t::value_type& answer, mdp.d_answers) {
+      if(answer.first.d_place == DNSRecord::Nameserver && answer.first.d_type == QType::SOA) {
+        shared_ptr<SOARecordContent> src = boost::dynamic_pointer_cast<SOARecordContent>(answer.first.d_content);
+        if(src) {
+          clientSerial = src->d_st.serial;
+          haveClientSerial = true;
+        }
+        break;
+      }
+    }
+  }
+  catch(MOADNSException &e) {
+    L<<Logger::Warning<<"IXFR of domain '"<<target<<"' from "<<q->getRemote()<<" has an unparseable question: "<<e.what()<<endl;
+  }
+
+  if(!haveClientSerial)
+    return doAXFR(target, q, outsock);
+
+  // the journal has what went into the database, not what we sign or SOA-EDIT on the way out
+  DNSSECKeeper dk;
+  string soaEdit;
+  dk.getFromMeta(target, "SOA-EDIT", soaEdit);
+  if(dk.isSecuredZone(target) || !soaEdit.empty())
+    return doAXFR(target, q, outsock);
+
+  shared_ptr<DNSPacket> outpacket = getFreshAXFRPacket(q);
+
+  SOAData sd;
+  sd.db=(DNSBackend *)-1; // force uncached answer
+  {
+    Lock l(&s_plock);
+    if(!s_P) {
+      L<<Logger::Error<<"TCP server is without backend connections in doIXFR, launching"<<endl;
+      s_P=new PacketHandler;
+    }
+
+    if(!s_P->getBackend()->getSOA(target, sd) || !canDoAXFR(q)) {
+      L<<Logger::Error<<"IXFR of domain '"<<target<<"' failed: not authoritative"<<endl;
+      outpacket->setRcode(9); // 'NOTAUTH'
+      sendPacket(outpacket,outsock);
+      return 0;
+    }
+  }
+
+  vector<IXFRDiff> diffs;
+  if(rfc1982LessThan(clientSerial, sd.serial) && !g_ixfrjournal.getDiffs(target, clientSerial, sd.serial, diffs)) {
+    L<<Logger::Warning<<"IXFR of domain '"<<target<<"' from serial "<<clientSerial<<" not in journal, sending AXFR to "<<q->getRemote()<<endl;
+    return doAXFR(target, q, outsock);
+  }
+
+  TSIGRecordContent trc;
+  string tsigkeyname, tsigsecret;
+
+  q->getTSIGDetails(&trc, &tsigkeyname, 0);
+
+  if(!tsigkeyname.empty()) {
+    string tsig64, algorithm;
+    Lock l(&s_plock);
+    s_P->getBackend()->getTSIGKey(tsigkeyname, &algorithm, &tsig64);
+    B64Decode(tsig64, tsigsecret);
+  }
+
+  // RFC 1995, 4: the current SOA, per diff the old SOA, what went, the new SOA, what came, and the current SOA again
+  DNSResourceRecord soa = makeDNSRRFromSOAData(sd);
+  vector<DNSResourceRecord> rrs;
+  rrs.push_back(soa);
+  BOOST_FOREACH(const IXFRDiff& diff, diffs) {
+    rrs.push_back(diff.oldSOA);
+    rrs.insert(rrs.end(), diff.removed.begin(), diff.removed.end());
+    rrs.push_back(diff.newSOA);
+    rrs.insert(rrs.end(), diff.added.begin(), diff.added.end());
+  }
+  if(!diffs.empty()) // a client that is up to date just gets the one SOA
+    rrs.push_back(soa);
+
+  L<<Logger::Error<<"IXFR of domain '"<<target<<"' from serial "<<clientSerial<<" to "<<sd.serial<<" initiated by "<<q->getRemote()<<", "<<diffs.size()<<" diff(s)"<<endl;
+
+  TCPCorker corker(outsock);
+  const unsigned int maxrecords = 100;
+  bool first = true;
+  for(vector<DNSResourceRecord>::size_type n = 0; n < rrs.size(); ) {
+    for(unsigned int count = 0; count < maxrecords && n < rrs.size(); ++count, ++n) {
+      rrs[n].d_place = DNSResourceRecord::ANSWER;
+      outpacket->addRecord(rrs[n]);
+    }
+    if(!tsigkeyname.empty())
+      outpacket->setTSIGDetails(trc, tsigkeyname, tsigsecret, trc.d_mac, !first); // first answer is 'normal'
+    sendPacket(outpacket, outsock);
+    trc.d_mac = outpacket->d_trc.d_mac;
+    outpacket = getFreshAXFRPacket(q);
+    first = false;
+  }
+
+  L<<Logger::Error<<"IXFR of domain '"<<target<<"' to "<<q->getRemote()<<" finished"<<endl;
+  return 1;
+}
+
 TCPNameserver::~TCPNameserver()
 {
-  delete d_connectionroom_sem;
 }
 
 TCPNameserver::TCPNameserver()
 {
-//  sem_init(&d_connectionroom_sem,0,::arg().asNum("max-tcp-connections"));
-  d_connectionroom_sem = new Semaphore( ::arg().asNum( "max-tcp-connections" ));
+  s_maxconnections=::arg().asNum("max-tcp-connections");
+  s_maxperclient=::arg().asNum("max-tcp-per-client");
+  s_timeout=::arg().asNum("tcp-idle-timeout");
+
+  d_workers.resize(max(1, ::arg().asNum("tcp-threads"))); // never resized after this, workers hold on to their Worker
+  for(vector<Worker>::iterator w=d_workers.begin(); w!=d_workers.end(); ++w) {
+    if(pipe(w->pipes) < 0)
+      throw PDNSException("Unable to create pipe for TCP worker: "+stringerror());
+    Utility::setCloseOnExec(w->pipes[0]);
+    Utility::setCloseOnExec(w->pipes[1]);
+    w->fdm=getMultiplexer();
+  }
 
-  s_timeout=10;
   vector<string>locals;
   stringtok(locals,::arg()["local-address"]," ,");
 
@@ -933,13 +1241,14 @@ TCPNameserver::TCPNameserver()
 }
 
 
-//! Start of TCP operations thread, we launch a new thread for each incoming TCP question
+//! Start of TCP operations thread, we accept connections here and hand them to the workers in turn
 void TCPNameserver::thread()
 {
   try {
+    unsigned int next=0;
     for(;;) {
       int fd;
-      struct sockaddr_in remote;
+      ComboAddress remote;
       Utility::socklen_t addrlen=sizeof(remote);
 
       int ret=poll(&d_prfds[0], d_prfds.size(), -1); // blocks, forever if need be
@@ -959,21 +1268,37 @@ void TCPNameserver::thread()
               L<<Logger::Error<<Logger::NTLog<<"TCP handler out of filedescriptors, exiting, won't recover from this"<<endl;
               exit(1);
             }
+            continue;
           }
-          else {
-            pthread_t tid;
-            d_connectionroom_sem->wait(); // blocks if no connections are available
 
-            int room;
-            d_connectionroom_sem->getValue( &room);
-            if(room<1)
-              L<<Logger::Warning<<Logger::NTLog<<"Limit of simultaneous TCP connections reached - raise max-tcp-connections"<<endl;
-
-            if(pthread_create(&tid, 0, &doConnection, reinterpret_cast<void*>(fd))) {
-              L<<Logger::Error<<"Error creating thread: "<<stringerror()<<endl;
-              d_connectionroom_sem->post();
+          ComboAddress client(remote);
+          client.sin4.sin_port=0;
+          bool full=false, greedy=false;
+          {
+            Lock l(&s_clientslock);
+            if(s_connections >= s_maxconnections)
+              full=true;
+            else if(s_maxperclient && s_clients[client] >= s_maxperclient)
+              greedy=true;
+            else {
+              s_connections++;
+              s_clients[client]++;
             }
           }
+          if(full || greedy) {
+            if(full)
+              L<<Logger::Warning<<Logger::NTLog<<"Limit of simultaneous TCP connections reached - raise max-tcp-connections"<<endl;
+            else
+              DLOG(L<<"Too many TCP connections from "<<client.toString()<<", dropping new one"<<endl);
+            Utility::closesocket(fd);
+            continue;
+          }
+
+          Utility::setNonBlocking(fd);
+          Utility::setCloseOnExec(fd);
+          DLOG(L<<"TCP Connection accepted on fd "<<fd<<endl);
+          Worker& w=d_workers[next++ % d_workers.size()];
+          adopt(new Connection(fd, remote, &w));
         }
       }
     }
@@ -28,6 +28,7 @@
 #include "packethandler.hh"
 #include <vector>
 #include <boost/shared_ptr.hpp>
+#include <boost/any.hpp>
 #include <poll.h>
 #include <sys/select.h>
 #include <sys/socket.h>
@@ -41,6 +42,13 @@
 
 #include "namespaces.hh"
 
+class FDMultiplexer;
+
+/** Answers questions over TCP. One thread accepts connections and hands them to a fixed pool of workers, each
+    watching its connections with its own FDMultiplexer and answering from its own PacketHandler, so connections
+    don't cost a thread and workers don't wait on each other. Clients may send several questions without waiting
+    for the answers. AXFR, IXFR and questions we proxy to the recursor can take long, those get a thread of their own
+    which hands the connection back to its worker when done. */
 class TCPNameserver
 {
 public:
@@ -48,21 +56,57 @@ public:
   ~TCPNameserver();
   void go();
 private:
+  struct Worker;
+
+  struct Connection
+  {
+    Connection(int fd_, const ComboAddress& remote_, Worker* worker_) : fd(fd_), remote(remote_), worker(worker_) {}
+    int fd;
+    ComboAddress remote;
+    Worker* worker;
+    string buffer; //!< what we read that is not a whole question yet
+    boost::shared_ptr<DNSPacket> pending; //!< the question a transfer or proxy thread is working on
+  };
+
+  struct Worker
+  {
+    Worker() : fdm(0), P(0) {}
+    int pipes[2]; //!< new connections come in here, as Connection*
+    FDMultiplexer* fdm;
+    PacketHandler* P;
+    pthread_t tid;
+  };
 
   static void sendPacket(boost::shared_ptr<DNSPacket> p, int outsock);
-  static int readLength(int fd, ComboAddress *remote);
-  static void getQuestion(int fd, char *mesg, int pktlen, const ComboAddress& remote);
   static int doAXFR(const string &target, boost::shared_ptr<DNSPacket> q, int outsock);
+  static int doIXFR(const string &target, boost::shared_ptr<DNSPacket> q, int outsock);
   static bool canDoAXFR(boost::shared_ptr<DNSPacket> q);
-  static void *doConnection(void *data);
   static void *launcher(void *data);
   void thread(void);
+
+  static void *workerThread(void *data);
+  static void *doLongQuestion(void *data);
+  static void handleNewConnection(int fd, boost::any& param);
+  static void handleReadable(int fd, boost::any& param);
+  static void processBuffer(Connection* conn);
+  static bool answerQuestion(Connection* conn, boost::shared_ptr<DNSPacket> packet); //!< false if the connection is no longer ours
+  static void handOff(Connection* conn);
+  static void adopt(Connection* conn); //!< give conn to its worker
+  static void closeConnection(Connection* conn); //!< only for connections not in a multiplexer
+  static void closeWatchedConnection(Connection* conn);
+
   static pthread_mutex_t s_plock;
-  static PacketHandler *s_P;
+  static PacketHandler *s_P; //!< for transfers
   pthread_t d_tid;
-  static Semaphore *d_connectionroom_sem;
   static NetmaskGroup d_ng;
 
+  static pthread_mutex_t s_clientslock;
+  static map<ComboAddress, unsigned int> s_clients; //!< open connections per client address
+  static unsigned int s_connections;
+  static unsigned int s_maxconnections;
+  static unsigned int s_maxperclient;
+  vector<Worker> d_workers;
+
   vector<int>d_sockets;
   vector<struct pollfd> d_prfds;
   static int s_timeout;
@@ -0,0 +1,53 @@
+#define BOOST_TEST_DYN_LINK
+#define BOOST_TEST_NO_MAIN
+#include <boost/test/unit_test.hpp>
+#include "dnsparser.hh"
+#include "dnsrecords.hh"
+
+// header with one question and one answer, the flags go in the third byte
+static std::string makePacket(const std::string& answer, uint8_t flags=0)
+{
+  std::string packet("\x00\x01\x00\x00\x00\x01\x00\x01\x00\x00\x00\x00", 12);
+  packet[2]=flags;
+  packet.append("\x03www\x07""example\x03""com\x00\x00\x01\x00\x01", 21);
+  packet.append("\xc0\x0c", 2); // owner points at the qname
+  packet.append(answer);
+  return packet;
+}
+
+BOOST_AUTO_TEST_SUITE(test_dnsparser_cc)
+
+BOOST_AUTO_TEST_CASE(test_view_matches_parser) {
+  reportAllTypes();
+
+  std::string good=makePacket(std::string("\x00\x01\x00\x01\x00\x00\x0e\x10\x00\x04\x7f\x00\x00\x01", 14));
+  MOADNSParser mdp(good);
+  DNSPacketView view(good.c_str(), good.size());
+  BOOST_CHECK_EQUAL(view.d_header.ancount, mdp.d_header.ancount);
+  BOOST_REQUIRE_EQUAL(view.size(), 1);
+  string qname;
+  view.getQName(qname);
+  BOOST_CHECK_EQUAL(qname, mdp.d_qname);
+  BOOST_CHECK_EQUAL(view.getContent(view[0])->getZoneRepresentation(), "127.0.0.1");
+  BOOST_CHECK_EQUAL(view.getContent(view[0])->getZoneRepresentation(), "127.0.0.1"); // again, from the copy made once
+
+  // an A record with only two bytes of address
+  std::string shortA=makePacket(std::string("\x00\x01\x00\x01\x00\x00\x0e\x10\x00\x02\x7f\x00", 12));
+  BOOST_CHECK_THROW(MOADNSParser bad(shortA), MOADNSException);
+  BOOST_CHECK_THROW(DNSPacketView bad(shortA.c_str(), shortA.size()), MOADNSException);
+
+  // an NS record whose target points forward
+  std::string forward=makePacket(std::string("\x00\x02\x00\x01\x00\x00\x0e\x10\x00\x02\xc0\x30", 12));
+  BOOST_CHECK_THROW(MOADNSParser bad(forward), MOADNSException);
+  BOOST_CHECK_THROW(DNSPacketView bad(forward.c_str(), forward.size()), MOADNSException);
+
+  // with TC set both let a record go that the packet end cuts off
+  std::string truncated=makePacket(std::string("\x00\x01\x00\x01\x00\x00\x0e\x10\x00\x04\x7f\x00", 12), 0x02);
+  MOADNSParser tmdp(truncated);
+  DNSPacketView tview(truncated.c_str(), truncated.size());
+  BOOST_CHECK_EQUAL(tmdp.d_header.ancount, 0);
+  BOOST_CHECK_EQUAL(tview.d_header.ancount, 0);
+  BOOST_CHECK_EQUAL(tview.size(), 0);
+}
+
+BOOST_AUTO_TEST_SUITE_END();
@@ -0,0 +1,80 @@
+#define BOOST_TEST_DYN_LINK
+#define BOOST_TEST_NO_MAIN
+#include <boost/test/unit_test.hpp>
+#include "histogram.hh"
+
+static void* submitTen(void* data)
+{
+  LatencyHistogram* hist = static_cast<LatencyHistogram*>(data);
+  for(unsigned int n = 0; n < 10; ++n)
+    hist->submit(1000);
+  return 0;
+}
+
+BOOST_AUTO_TEST_SUITE(test_histogram_hh)
+
+BOOST_AUTO_TEST_CASE(test_buckets) {
+  // small values are exact
+  for(unsigned int n = 0; n < LatencyHistogram::s_subbuckets; ++n) {
+    BOOST_CHECK_EQUAL(LatencyHistogram::bucketFor(n), n);
+    BOOST_CHECK_EQUAL(LatencyHistogram::upperBound(n), n + 1);
+  }
+  BOOST_CHECK_EQUAL(LatencyHistogram::bucketFor(16), 16);
+  BOOST_CHECK_EQUAL(LatencyHistogram::bucketFor(31), 31);
+  BOOST_CHECK_EQUAL(LatencyHistogram::bucketFor(32), 32);
+  BOOST_CHECK_EQUAL(LatencyHistogram::bucketFor(33), 32);
+  BOOST_CHECK_EQUAL(LatencyHistogram::upperBound(32), 34);
+
+  // every bucket ends where the next one starts
+  for(unsigned int n = 0; n < LatencyHistogram::s_buckets - 1; ++n) {
+    uint64_t bound = LatencyHistogram::upperBound(n);
+    BOOST_CHECK_EQUAL(LatencyHistogram::bucketFor(bound - 1), n);
+    BOOST_CHECK_EQUAL(LatencyHistogram::bucketFor(bound), n + 1);
+  }
+
+  // the last bucket takes everything that is too large
+  unsigned int last = LatencyHistogram::s_buckets - 1;
+  BOOST_CHECK_EQUAL(LatencyHistogram::upperBound(last), 1ULL << LatencyHistogram::s_maxbits);
+  BOOST_CHECK_EQUAL(LatencyHistogram::bucketFor(1ULL << LatencyHistogram::s_maxbits), last);
+  BOOST_CHECK_EQUAL(LatencyHistogram::bucketFor(~0ULL), last);
+}
+
+BOOST_AUTO_TEST_CASE(test_percentiles) {
+  LatencyHistogram hist;
+  LatencyHistogram::Snapshot snap = hist.get();
+  BOOST_CHECK_EQUAL(snap.count, 0);
+  BOOST_CHECK_EQUAL(snap.percentile(50), 0);
+  BOOST_CHECK_EQUAL(snap.mean(), 0);
+
+  for(unsigned int n = 0; n < 100; ++n)
+    hist.submit(n);
+  snap = hist.get();
+  BOOST_CHECK_EQUAL(snap.count, 100);
+  BOOST_CHECK_EQUAL(snap.sum, 4950);
+  BOOST_CHECK_EQUAL(snap.mean(), 49);
+
+  // percentiles report the end of their bucket, 48 and 49 share one
+  BOOST_CHECK_EQUAL(snap.percentile(0), 1);
+  BOOST_CHECK_EQUAL(snap.percentile(10), 10);
+  BOOST_CHECK_EQUAL(snap.percentile(50), 50);
+  BOOST_CHECK_EQUAL(snap.percentile(99), 100);
+  BOOST_CHECK_EQUAL(snap.percentile(100), 100);
+}
+
+BOOST_AUTO_TEST_CASE(test_threads) {
+  LatencyHistogram hist;
+  hist.submit(10);
+
+  // a thread that is gone still counts
+  pthread_t tid;
+  BOOST_REQUIRE(!pthread_create(&tid, 0, submitTen, &hist));
+  pthread_join(tid, 0);
+
+  LatencyHistogram::Snapshot snap = hist.get();
+  BOOST_CHECK_EQUAL(snap.count, 11);
+  BOOST_CHECK_EQUAL(snap.sum, 10010);
+  BOOST_CHECK_EQUAL(snap.counts[LatencyHistogram::bucketFor(1000)], 10);
+  BOOST_CHECK_EQUAL(snap.percentile(50), LatencyHistogram::upperBound(LatencyHistogram::bucketFor(1000)));
+}
+
+BOOST_AUTO_TEST_SUITE_END();
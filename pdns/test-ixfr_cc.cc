@@ -0,0 +1,135 @@
+#define BOOST_TEST_DYN_LINK
+#define BOOST_TEST_NO_MAIN
+#include <boost/test/unit_test.hpp>
+#include "ixfr.hh"
+
+static DNSResourceRecord makeRecord(const string& qname, uint16_t qtype, const string& content)
+{
+  DNSResourceRecord rr;
+  rr.qname = qname;
+  rr.qtype = qtype;
+  rr.content = content;
+  rr.ttl = 3600;
+  return rr;
+}
+
+static IXFRDiff makeDiff(uint32_t fromSerial, uint32_t toSerial)
+{
+  IXFRDiff diff;
+  diff.fromSerial = fromSerial;
+  diff.toSerial = toSerial;
+  return diff;
+}
+
+BOOST_AUTO_TEST_SUITE(test_ixfr_cc)
+
+BOOST_AUTO_TEST_CASE(test_journal_chain) {
+  IXFRJournal journal;
+  vector<IXFRDiff> diffs;
+  journal.addDiff("example.com", makeDiff(1, 2)); // disabled
+  BOOST_CHECK_EQUAL(journal.size(), 0);
+
+  journal.setMaxDiffs(3);
+  journal.addDiff("example.com", makeDiff(1, 2));
+  journal.addDiff("example.com", makeDiff(2, 3));
+  journal.addDiff("example.com", makeDiff(3, 5));
+  BOOST_CHECK_EQUAL(journal.size(), 3);
+
+  BOOST_REQUIRE(journal.getDiffs("EXAMPLE.com", 1, 5, diffs));
+  BOOST_REQUIRE_EQUAL(diffs.size(), 3);
+  BOOST_CHECK_EQUAL(diffs.front().fromSerial, 1);
+  BOOST_CHECK_EQUAL(diffs.back().toSerial, 5);
+
+  BOOST_REQUIRE(journal.getDiffs("example.com", 2, 5, diffs));
+  BOOST_CHECK_EQUAL(diffs.size(), 2);
+
+  BOOST_CHECK(!journal.getDiffs("example.com", 4, 5, diffs)); // not a step we have
+  BOOST_CHECK(diffs.empty());
+  BOOST_CHECK(!journal.getDiffs("example.com", 1, 3, diffs)); // only up to the current serial
+  BOOST_CHECK(!journal.getDiffs("example.net", 1, 5, diffs));
+
+  // the oldest diff makes way
+  journal.addDiff("example.com", makeDiff(5, 6));
+  BOOST_CHECK_EQUAL(journal.size(), 3);
+  BOOST_CHECK(!journal.getDiffs("example.com", 1, 6, diffs));
+  BOOST_CHECK(journal.getDiffs("example.com", 2, 6, diffs));
+
+  journal.setMaxDiffs(1);
+  BOOST_CHECK_EQUAL(journal.size(), 1);
+  BOOST_CHECK(journal.getDiffs("example.com", 5, 6, diffs));
+}
+
+BOOST_AUTO_TEST_CASE(test_journal_restart) {
+  IXFRJournal journal;
+  vector<IXFRDiff> diffs;
+  journal.setMaxDiffs(10);
+  journal.addDiff("example.com", makeDiff(1, 2));
+  journal.addDiff("example.com", makeDiff(2, 3));
+
+  // a diff that doesn't follow on the newest one starts the chain over
+  journal.addDiff("example.com", makeDiff(7, 8));
+  BOOST_CHECK_EQUAL(journal.size(), 1);
+  BOOST_CHECK(!journal.getDiffs("example.com", 1, 8, diffs));
+  BOOST_CHECK(journal.getDiffs("example.com", 7, 8, diffs));
+
+  // serials wrap around
+  journal.addDiff("example.com", makeDiff(8, 4294967295U));
+  journal.addDiff("example.com", makeDiff(4294967295U, 1));
+  BOOST_CHECK(journal.getDiffs("example.com", 8, 1, diffs));
+  BOOST_CHECK_EQUAL(diffs.size(), 2);
+
+  journal.purge("example.com");
+  BOOST_CHECK_EQUAL(journal.size(), 0);
+
+  journal.addDiff("example.com", makeDiff(1, 2));
+  journal.setMaxDiffs(0);
+  BOOST_CHECK_EQUAL(journal.size(), 0);
+}
+
+BOOST_AUTO_TEST_CASE(test_make_diff) {
+  vector<DNSResourceRecord> before, after;
+  before.push_back(makeRecord("example.com", QType::SOA, "ns1.example.com hostmaster.example.com 1 10800 3600 604800 3600"));
+  before.push_back(makeRecord("www.example.com", QType::A, "192.0.2.1"));
+  before.push_back(makeRecord("mail.example.com", QType::A, "192.0.2.2"));
+
+  after.push_back(makeRecord("example.com", QType::SOA, "ns1.example.com hostmaster.example.com 2 10800 3600 604800 3600"));
+  after.push_back(makeRecord("WWW.example.com", QType::A, "192.0.2.1")); // same record
+  after.push_back(makeRecord("mail.example.com", QType::A, "192.0.2.3"));
+
+  IXFRDiff diff;
+  BOOST_REQUIRE(makeIXFRDiff("example.com", before, after, diff));
+  BOOST_CHECK_EQUAL(diff.fromSerial, 1);
+  BOOST_CHECK_EQUAL(diff.toSerial, 2);
+  BOOST_CHECK_EQUAL(diff.oldSOA.d_place, DNSResourceRecord::ANSWER);
+  BOOST_REQUIRE_EQUAL(diff.removed.size(), 1);
+  BOOST_CHECK_EQUAL(diff.removed[0].content, "192.0.2.2");
+  BOOST_REQUIRE_EQUAL(diff.added.size(), 1);
+  BOOST_CHECK_EQUAL(diff.added[0].content, "192.0.2.3");
+
+  // a changed TTL is a removal and an addition
+  after[1].ttl = 60;
+  IXFRDiff ttldiff;
+  BOOST_REQUIRE(makeIXFRDiff("example.com", before, after, ttldiff));
+  BOOST_CHECK_EQUAL(ttldiff.removed.size(), 2);
+  BOOST_CHECK_EQUAL(ttldiff.added.size(), 2);
+}
+
+BOOST_AUTO_TEST_CASE(test_make_diff_incomplete) {
+  vector<DNSResourceRecord> before, after;
+  before.push_back(makeRecord("example.com", QType::SOA, "ns1.example.com hostmaster.example.com 1 10800 3600 604800 3600"));
+  after.push_back(makeRecord("www.example.com", QType::A, "192.0.2.1"));
+
+  IXFRDiff diff;
+  BOOST_CHECK(!makeIXFRDiff("example.com", before, after, diff)); // no SOA afterwards
+
+  IXFRDiff samediff;
+  after.push_back(before.front());
+  BOOST_CHECK(!makeIXFRDiff("example.com", before, after, samediff)); // serial did not move
+
+  // the SOA of a child zone is just a record
+  after.back().qname = "sub.example.com";
+  IXFRDiff childdiff;
+  BOOST_CHECK(!makeIXFRDiff("example.com", before, after, childdiff));
+}
+
+BOOST_AUTO_TEST_SUITE_END();
@@ -0,0 +1,133 @@
+#define BOOST_TEST_DYN_LINK
+#define BOOST_TEST_NO_MAIN
+#include <boost/test/unit_test.hpp>
+#include "nsec3cache.hh"
+#include "dnssecinfra.hh"
+#include "dnsrecords.hh"
+#include "base32.hh"
+
+BOOST_AUTO_TEST_SUITE(test_nsec3cache_cc)
+
+BOOST_AUTO_TEST_CASE(test_ranges) {
+  NSEC3Cache cache;
+  string unhashed, before, after;
+  cache.addRange(1, 1, "c.example.com", "c", "e"); // disabled
+  BOOST_CHECK(!cache.getRange(1, 1, "d", false, unhashed, before, after));
+
+  cache.setLimits(100, 60);
+  BOOST_CHECK(!cache.getRange(1, 1, "d", false, unhashed, before, after)); // nothing known yet
+  cache.addRange(1, 1, "c.example.com", "c", "e");
+  cache.addRange(1, 1, "", "g", "h"); // a range without its name is no use
+  BOOST_CHECK_EQUAL(cache.size(), 1);
+
+  BOOST_CHECK(cache.getRange(1, 1, "d", true, unhashed, before, after));
+  BOOST_CHECK_EQUAL(unhashed, "c.example.com");
+  BOOST_CHECK_EQUAL(before, "c");
+  BOOST_CHECK_EQUAL(after, "e");
+
+  // the start is part of the range, the end is not
+  BOOST_CHECK(cache.getRange(1, 1, "c", true, unhashed, before, after));
+  BOOST_CHECK(!cache.getRange(1, 1, "e", true, unhashed, before, after));
+  BOOST_CHECK(!cache.getRange(1, 1, "b", true, unhashed, before, after));
+  BOOST_CHECK(!cache.getRange(1, 1, "f", true, unhashed, before, after));
+
+  // other zones are separate, and a new serial forgets the ranges
+  BOOST_CHECK(!cache.getRange(2, 1, "d", false, unhashed, before, after));
+  BOOST_CHECK(!cache.getRange(1, 2, "d", false, unhashed, before, after));
+  BOOST_CHECK(!cache.getRange(1, 1, "d", false, unhashed, before, after));
+}
+
+BOOST_AUTO_TEST_CASE(test_wrap_around) {
+  NSEC3Cache cache;
+  cache.setLimits(100, 60);
+  string unhashed, before, after;
+  cache.addRange(1, 1, "c.example.com", "c", "e");
+  cache.addRange(1, 1, "x.example.com", "x", "b"); // the last hash, its successor is the first one
+
+  BOOST_CHECK(cache.getRange(1, 1, "z", true, unhashed, before, after));
+  BOOST_CHECK_EQUAL(before, "x");
+  BOOST_CHECK_EQUAL(after, "b");
+
+  // before the first range starts
+  BOOST_CHECK(cache.getRange(1, 1, "a", true, unhashed, before, after));
+  BOOST_CHECK_EQUAL(before, "x");
+  BOOST_CHECK(cache.getRange(1, 1, "x", true, unhashed, before, after));
+  BOOST_CHECK(!cache.getRange(1, 1, "b", true, unhashed, before, after));
+  BOOST_CHECK(!cache.getRange(1, 1, "w", true, unhashed, before, after));
+
+  // a zone with a single hash has one range that covers everything
+  cache.addRange(2, 1, "example.com", "m", "m");
+  BOOST_CHECK(cache.getRange(2, 1, "a", true, unhashed, before, after));
+  BOOST_CHECK(cache.getRange(2, 1, "m", true, unhashed, before, after));
+  BOOST_CHECK(cache.getRange(2, 1, "z", true, unhashed, before, after));
+}
+
+BOOST_AUTO_TEST_CASE(test_successors) {
+  NSEC3Cache cache;
+  cache.setLimits(100, 60);
+  string unhashed, before, after;
+  cache.addSuccessor(1, 1, "e", "g");
+  BOOST_CHECK(!cache.getRange(1, 1, "f", true, unhashed, before, after));
+  BOOST_CHECK(cache.getRange(1, 1, "f", false, unhashed, before, after));
+  BOOST_CHECK(unhashed.empty());
+  BOOST_CHECK_EQUAL(before, "e");
+  BOOST_CHECK_EQUAL(after, "g");
+
+  // a successor does not replace a range whose name we know
+  cache.addRange(1, 1, "c.example.com", "c", "e");
+  cache.addSuccessor(1, 1, "c", "d");
+  BOOST_CHECK(cache.getRange(1, 1, "d", true, unhashed, before, after));
+  BOOST_CHECK_EQUAL(unhashed, "c.example.com");
+  BOOST_CHECK_EQUAL(after, "e");
+
+  // but a range replaces a successor
+  cache.addRange(1, 1, "e.example.com", "e", "g");
+  BOOST_CHECK(cache.getRange(1, 1, "f", true, unhashed, before, after));
+  BOOST_CHECK_EQUAL(unhashed, "e.example.com");
+}
+
+BOOST_AUTO_TEST_CASE(test_records_and_limits) {
+  NSEC3Cache cache;
+  cache.setLimits(2, 60);
+  DNSResourceRecord rr, out;
+  rr.qname = "c.example.com";
+  rr.content = "1 0 12 aabbccdd e A RRSIG";
+  cache.addRecord(1, 1, "c", "e", rr);
+  BOOST_CHECK(cache.getRecord(1, 1, "c", "e", out));
+  BOOST_CHECK_EQUAL(out.content, rr.content);
+  BOOST_CHECK(!cache.getRecord(1, 1, "c", "f", out)); // the range moved on
+  BOOST_CHECK(!cache.getRecord(1, 2, "c", "e", out));
+
+  // a zone that is full starts over
+  string unhashed, before, after;
+  cache.addRange(1, 1, "a.example.com", "a", "b");
+  cache.addRange(1, 1, "b.example.com", "b", "c");
+  BOOST_CHECK_EQUAL(cache.size(), 2);
+  cache.addRange(1, 1, "c.example.com", "c", "d");
+  BOOST_CHECK_EQUAL(cache.size(), 1);
+  BOOST_CHECK(!cache.getRange(1, 1, "a", true, unhashed, before, after));
+  BOOST_CHECK(cache.getRange(1, 1, "c", true, unhashed, before, after));
+
+  cache.purge();
+  BOOST_CHECK_EQUAL(cache.size(), 0);
+}
+
+BOOST_AUTO_TEST_CASE(test_hashes) {
+  NSEC3Cache cache;
+  cache.setLimits(100, 60);
+  NSEC3PARAMRecordContent ns3prc("1 0 12 aabbccdd");
+
+  // RFC 5155 appendix A
+  string hashed = cache.getHash(1, ns3prc, "example");
+  BOOST_CHECK_EQUAL(toBase32Hex(hashed), "0p9mhaveqvm6t7vbl5lop2u3t2rp3tom");
+  BOOST_CHECK_EQUAL(cache.getHash(1, ns3prc, "EXAMPLE"), hashed);
+  BOOST_CHECK_EQUAL(cache.size(), 1);
+
+  // new parameters mean new hashes
+  NSEC3PARAMRecordContent other("1 0 1 aabbccdd");
+  BOOST_CHECK_EQUAL(cache.getHash(1, other, "example"), hashQNameWithSalt(1, other.d_salt, "example"));
+  BOOST_CHECK(cache.getHash(1, other, "example") != hashed);
+  BOOST_CHECK_EQUAL(cache.size(), 1);
+}
+
+BOOST_AUTO_TEST_SUITE_END();
@@ -0,0 +1,126 @@
+#define BOOST_TEST_DYN_LINK
+#define BOOST_TEST_NO_MAIN
+#include <boost/test/unit_test.hpp>
+#include "ordernameindex.hh"
+
+typedef OrderNameIndex::Change Change;
+
+static void loadZone(OrderNameIndex& oni, uint32_t domain_id)
+{
+  uint64_t generation;
+  BOOST_REQUIRE(oni.needsLoad("gmysql", domain_id, generation));
+
+  vector<pair<string, string> > ordernames;
+  ordernames.push_back(make_pair("", "example.com"));
+  ordernames.push_back(make_pair("a", "a.example.com"));
+  ordernames.push_back(make_pair("c", "c.example.com"));
+  ordernames.push_back(make_pair("e", "E.example.com"));
+  oni.load("gmysql", domain_id, generation, ordernames);
+}
+
+BOOST_AUTO_TEST_SUITE(test_ordernameindex_cc)
+
+BOOST_AUTO_TEST_CASE(test_before_and_after) {
+  OrderNameIndex oni;
+  oni.setTTL(60);
+  string unhashed, before, after;
+  BOOST_CHECK(!oni.getBeforeAndAfterNamesAbsolute("gmysql", 1, "b", unhashed, before, after)); // not loaded
+
+  loadZone(oni, 1);
+  BOOST_CHECK_EQUAL(oni.size(), 4);
+
+  BOOST_CHECK(oni.getBeforeAndAfterNamesAbsolute("gmysql", 1, "b", unhashed, before, after));
+  BOOST_CHECK_EQUAL(before, "a");
+  BOOST_CHECK_EQUAL(unhashed, "a.example.com");
+  BOOST_CHECK_EQUAL(after, "c");
+
+  before.clear();
+  BOOST_CHECK(oni.getBeforeAndAfterNamesAbsolute("gmysql", 1, "c", unhashed, before, after));
+  BOOST_CHECK_EQUAL(before, "c");
+  BOOST_CHECK_EQUAL(after, "e");
+
+  // past the last name we wrap around to the apex
+  before.clear();
+  BOOST_CHECK(oni.getBeforeAndAfterNamesAbsolute("gmysql", 1, "z", unhashed, before, after));
+  BOOST_CHECK_EQUAL(before, "e");
+  BOOST_CHECK_EQUAL(unhashed, "e.example.com");
+  BOOST_CHECK_EQUAL(after, "");
+
+  // a non-empty before only asks for the next name
+  before = "x";
+  BOOST_CHECK(oni.getBeforeAndAfterNamesAbsolute("gmysql", 1, "A", unhashed, before, after));
+  BOOST_CHECK_EQUAL(before, "a");
+  BOOST_CHECK_EQUAL(after, "c");
+
+  // other zones and backends are separate
+  BOOST_CHECK(!oni.getBeforeAndAfterNamesAbsolute("gmysql", 2, "b", unhashed, before, after));
+  BOOST_CHECK(!oni.getBeforeAndAfterNamesAbsolute("gpgsql", 1, "b", unhashed, before, after));
+}
+
+BOOST_AUTO_TEST_CASE(test_changes) {
+  OrderNameIndex oni;
+  oni.setTTL(60);
+  loadZone(oni, 1);
+  string unhashed, before, after;
+
+  oni.apply("gmysql", Change(Change::Set, 1, "B.example.com", "b"));
+  BOOST_CHECK(oni.getBeforeAndAfterNamesAbsolute("gmysql", 1, "b", unhashed, before, after));
+  BOOST_CHECK_EQUAL(before, "b");
+  BOOST_CHECK_EQUAL(unhashed, "b.example.com");
+
+  // a new ordername for a known name replaces the old one
+  oni.apply("gmysql", Change(Change::Set, 1, "b.example.com", "d"));
+  BOOST_CHECK_EQUAL(oni.size(), 5);
+  before.clear();
+  BOOST_CHECK(oni.getBeforeAndAfterNamesAbsolute("gmysql", 1, "b", unhashed, before, after));
+  BOOST_CHECK_EQUAL(before, "a");
+  BOOST_CHECK_EQUAL(after, "c");
+
+  oni.apply("gmysql", Change(Change::Remove, 1, "c.example.com"));
+  oni.apply("gmysql", Change(Change::Remove, 1, "nothere.example.com"));
+  BOOST_CHECK_EQUAL(oni.size(), 4);
+  before.clear();
+  BOOST_CHECK(oni.getBeforeAndAfterNamesAbsolute("gmysql", 1, "b", unhashed, before, after));
+  BOOST_CHECK_EQUAL(after, "d");
+
+  // cleared zones stay loaded, so the records fed after a zone delete fill them again
+  oni.apply("gmysql", Change(Change::Clear, 1));
+  BOOST_CHECK_EQUAL(oni.size(), 0);
+  oni.apply("gmysql", Change(Change::Set, 1, "example.com", ""));
+  oni.apply("gmysql", Change(Change::Set, 1, "m.example.com", "m"));
+  before.clear();
+  BOOST_CHECK(oni.getBeforeAndAfterNamesAbsolute("gmysql", 1, "b", unhashed, before, after));
+  BOOST_CHECK_EQUAL(before, "");
+  BOOST_CHECK_EQUAL(after, "m");
+
+  oni.apply("gmysql", Change(Change::Invalidate, 1));
+  BOOST_CHECK(!oni.getBeforeAndAfterNamesAbsolute("gmysql", 1, "b", unhashed, before, after));
+  BOOST_CHECK_EQUAL(oni.size(), 0);
+}
+
+BOOST_AUTO_TEST_CASE(test_load_races) {
+  OrderNameIndex oni;
+  uint64_t generation, other;
+  BOOST_CHECK(!oni.needsLoad("gmysql", 1, generation)); // disabled
+
+  oni.setTTL(60);
+  BOOST_REQUIRE(oni.needsLoad("gmysql", 1, generation));
+  BOOST_CHECK(!oni.needsLoad("gmysql", 1, other)); // somebody is loading it already
+
+  // a change that comes in while we read the zone makes what we read worthless
+  oni.apply("gmysql", Change(Change::Set, 1, "a.example.com", "a"));
+  vector<pair<string, string> > ordernames;
+  ordernames.push_back(make_pair("", "example.com"));
+  oni.load("gmysql", 1, generation, ordernames);
+  string unhashed, before, after;
+  BOOST_CHECK(!oni.getBeforeAndAfterNamesAbsolute("gmysql", 1, "b", unhashed, before, after));
+
+  BOOST_REQUIRE(oni.needsLoad("gmysql", 1, generation));
+  oni.loadFailed("gmysql", 1);
+  BOOST_REQUIRE(oni.needsLoad("gmysql", 1, generation));
+  oni.load("gmysql", 1, generation, ordernames);
+  BOOST_CHECK(oni.getBeforeAndAfterNamesAbsolute("gmysql", 1, "b", unhashed, before, after));
+  BOOST_CHECK(!oni.needsLoad("gmysql", 1, generation)); // fresh for another minute
+}
+
+BOOST_AUTO_TEST_SUITE_END();
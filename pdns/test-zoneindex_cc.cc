@@ -0,0 +1,93 @@
+#define BOOST_TEST_DYN_LINK
+#define BOOST_TEST_NO_MAIN
+#include <boost/test/unit_test.hpp>
+#include "dnsbackend.hh"
+#include "zoneindex.hh"
+
+static void addZone(vector<DomainInfo>& domains, const string& zone, int id)
+{
+  DomainInfo di;
+  di.zone = zone;
+  di.id = id;
+  domains.push_back(di);
+}
+
+BOOST_AUTO_TEST_SUITE(test_zoneindex_cc)
+
+BOOST_AUTO_TEST_CASE(test_closest_zone) {
+  ZoneIndex zi;
+  string zone;
+  int id;
+  BOOST_CHECK(!zi.getClosestZone("www.example.com", zone)); // not built yet
+
+  vector<DomainInfo> domains;
+  addZone(domains, "example.com", 1);
+  addZone(domains, "sub.example.com", 2);
+  addZone(domains, "deep.down.sub.example.com", 3);
+  addZone(domains, "example.net", 4);
+  zi.load(domains);
+  BOOST_CHECK_EQUAL(zi.size(), 4);
+
+  BOOST_CHECK(zi.getClosestZone("example.com", zone, &id));
+  BOOST_CHECK_EQUAL(zone, "example.com");
+  BOOST_CHECK_EQUAL(id, 1);
+
+  BOOST_CHECK(zi.getClosestZone("www.example.com", zone, &id));
+  BOOST_CHECK_EQUAL(zone, "example.com");
+
+  BOOST_CHECK(zi.getClosestZone("a.b.sub.example.com", zone, &id));
+  BOOST_CHECK_EQUAL(zone, "sub.example.com");
+  BOOST_CHECK_EQUAL(id, 2);
+
+  // down.sub.example.com only exists as a path to the deeper zone
+  BOOST_CHECK(zi.getClosestZone("down.sub.example.com", zone, &id));
+  BOOST_CHECK_EQUAL(zone, "sub.example.com");
+
+  BOOST_CHECK(zi.getClosestZone("www.DEEP.Down.sub.example.COM", zone, &id));
+  BOOST_CHECK_EQUAL(zone, "deep.down.sub.example.com");
+  BOOST_CHECK_EQUAL(id, 3);
+
+  BOOST_CHECK(!zi.getClosestZone("com", zone));
+  BOOST_CHECK(!zi.getClosestZone("example.org", zone));
+  BOOST_CHECK(!zi.getClosestZone("notexample.com", zone));
+  BOOST_CHECK(!zi.getClosestZone("", zone));
+}
+
+BOOST_AUTO_TEST_CASE(test_root_and_duplicates) {
+  ZoneIndex zi;
+  vector<DomainInfo> domains;
+  addZone(domains, "", 1);
+  addZone(domains, "example.com", 2);
+  addZone(domains, "Example.COM", 3); // same zone from a second backend, last one wins
+  zi.load(domains);
+  BOOST_CHECK_EQUAL(zi.size(), 2);
+
+  string zone;
+  int id;
+  BOOST_CHECK(zi.getClosestZone("www.example.org", zone, &id));
+  BOOST_CHECK_EQUAL(zone, "");
+  BOOST_CHECK_EQUAL(id, 1);
+
+  BOOST_CHECK(zi.getClosestZone("www.example.com", zone, &id));
+  BOOST_CHECK_EQUAL(id, 3);
+}
+
+BOOST_AUTO_TEST_CASE(test_disable) {
+  ZoneIndex zi;
+  zi.setRefreshInterval(10);
+  BOOST_CHECK(zi.enabled());
+
+  vector<DomainInfo> domains;
+  addZone(domains, "example.com", 1);
+  zi.load(domains);
+
+  string zone;
+  BOOST_CHECK(zi.getClosestZone("www.example.com", zone));
+
+  zi.setRefreshInterval(0);
+  BOOST_CHECK(!zi.enabled());
+  BOOST_CHECK(!zi.getClosestZone("www.example.com", zone));
+  BOOST_CHECK_EQUAL(zi.size(), 0);
+}
+
+BOOST_AUTO_TEST_SUITE_END();
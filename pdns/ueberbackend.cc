@@ -322,6 +322,7 @@ UeberBackend::UeberBackend(const string &pname)
 
   tid=pthread_self(); 
   stale=false;
+  d_latency=S.getHistogram("backend-latency");
 
   backends=BackendMakers().all(pname=="key-only");
 }
@@ -468,6 +469,7 @@ void UeberBackend::lookup(const QType &qtype,const string &qname, DNSPacket *pkt
     if(cstat<0) { // nothing
       d_negcached=d_cached=false;
       d_answers.clear(); 
+      d_lookupdt.set();
       (d_handle.d_hinterBackend=backends[d_handle.i++])->lookup(qtype, qname,pkt_p,zoneId);
     } 
     else if(cstat==0) {
@@ -492,6 +494,14 @@ void UeberBackend::getAllDomains(vector<DomainInfo> *domains) {
   }
 }
 
+bool UeberBackend::listsAllDomains()
+{
+  for (vector<DNSBackend*>::iterator i = backends.begin(); i != backends.end(); ++i )
+    if(!(*i)->listsAllDomains())
+      return false;
+  return true;
+}
+
 bool UeberBackend::get(DNSResourceRecord &rr)
 {
   if(d_negcached) {
@@ -511,6 +521,8 @@ bool UeberBackend::get(DNSResourceRecord &rr)
 
     addCache(d_question, d_answers);
     d_answers.clear();
+    if(d_latency)
+      d_latency->submit(d_lookupdt.udiffNoReset());
     return false;
   }
   d_ancount++;
@@ -40,6 +40,7 @@
 #include <boost/utility.hpp>
 #include "dnspacket.hh"
 #include "dnsbackend.hh"
+#include "histogram.hh"
 
 #include "namespaces.hh"
 
@@ -117,6 +118,7 @@ public:
   bool list(const string &target, int domain_id);
   bool get(DNSResourceRecord &r);
   void getAllDomains(vector<DomainInfo> *domains);
+  bool listsAllDomains();
 
   static DNSBackend *maker(const map<string,string> &);
   static void closeDynListener();
@@ -159,6 +161,8 @@ private:
   }d_question;
   vector<DNSResourceRecord> d_answers;
   vector<DNSResourceRecord>::const_iterator d_cachehandleiter;
+  DTime d_lookupdt; //!< started when a lookup goes to the backends
+  LatencyHistogram* d_latency; //!< 0 if nobody declared backend-latency
 
   int cacheHas(const Question &q, vector<DNSResourceRecord> &rrs);
   void addNegCache(const Question &q);
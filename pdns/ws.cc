@@ -30,6 +30,7 @@
 #include "arguments.hh"
 #include "dns.hh"
 #include "ueberbackend.hh"
+#include "zoneindex.hh"
 #include <boost/format.hpp>
 #include <boost/foreach.hpp>
 #include "namespaces.hh"
@@ -345,6 +346,7 @@ static string createOrUpdateZone(const string& zonename, bool onlyCreate, varmap
   if(!exists) {
     if(!B.createDomain(zonename))
       return returnJSONError("Creating domain '"+zonename+"' failed");
+    g_zoneindex.invalidate();
 
     if(!B.getDomainInfo(zonename, di))
       return returnJSONError("Creating domain '"+zonename+"' failed: lookup of domain ID failed");
@@ -480,6 +482,46 @@ void StatWebServer::jsonstat(HttpRequest* req, HttpResponse* resp)
     apiServerConfig(req, resp);
     return;
   }
+  else if(command=="histogram") { // http://jsonstat?command=histogram&name=answer-latency
+    LatencyHistogram* histogram = S.getHistogram(req->parameters["name"]);
+    if(!histogram) {
+      resp->status = 404;
+      resp->body = returnJSONError("Could not find histogram '"+req->parameters["name"]+"'");
+      return;
+    }
+    LatencyHistogram::Snapshot snap = histogram->get();
+
+    Document doc;
+    doc.SetObject();
+    Value count, mean, p50, p99, p999;
+    count.SetUint64(snap.count);
+    doc.AddMember("count", count, doc.GetAllocator());
+    mean.SetUint64(snap.mean());
+    doc.AddMember("mean", mean, doc.GetAllocator());
+    p50.SetUint64(snap.percentile(50));
+    doc.AddMember("p50", p50, doc.GetAllocator());
+    p99.SetUint64(snap.percentile(99));
+    doc.AddMember("p99", p99, doc.GetAllocator());
+    p999.SetUint64(snap.percentile(99.9));
+    doc.AddMember("p999", p999, doc.GetAllocator());
+
+    Value buckets; // [ upper bound, count ] of the buckets that are in use
+    buckets.SetArray();
+    for(unsigned int n = 0; n < LatencyHistogram::s_buckets; ++n) {
+      if(!snap.counts[n])
+        continue;
+      Value bucket, upper, number;
+      bucket.SetArray();
+      upper.SetUint64(LatencyHistogram::upperBound(n));
+      bucket.PushBack(upper, doc.GetAllocator());
+      number.SetUint64(snap.counts[n]);
+      bucket.PushBack(number, doc.GetAllocator());
+      buckets.PushBack(bucket, doc.GetAllocator());
+    }
+    doc.AddMember("buckets", buckets, doc.GetAllocator());
+    resp->body = makeStringFromDocument(doc);
+    return;
+  }
   else if(command == "flush-cache") {
     extern PacketCache PC;
     int number; 
@@ -648,6 +690,7 @@ void StatWebServer::jsonstat(HttpRequest* req, HttpResponse* resp)
         resp->body = returnJSONError("Deleting domain '"+zonename+"' failed: backend delete failed/unsupported");
         return;
       }
+      g_zoneindex.invalidate();
       map<string, string> success; // empty success object
       resp->body = returnJSONObject(success);
       return;
@@ -0,0 +1,159 @@
+#include "zoneindex.hh"
+#include "dnsbackend.hh"
+#include "logger.hh"
+#include "lock.hh"
+#include <boost/foreach.hpp>
+#include "namespaces.hh"
+
+ZoneIndex g_zoneindex;
+
+ZoneIndex::ZoneIndex() : d_nextrefresh(0), d_interval(0), d_generation(0)
+{
+  pthread_mutex_init(&d_lock, 0);
+  pthread_mutex_init(&d_refreshlock, 0);
+}
+
+ZoneIndex::~ZoneIndex()
+{
+  pthread_mutex_destroy(&d_refreshlock);
+  pthread_mutex_destroy(&d_lock);
+}
+
+void ZoneIndex::Trie::add(const string& zone, int domain_id)
+{
+  vector<string> labels;
+  stringtok(labels, zone, ".");
+
+  unsigned int pos = 0;
+  for(vector<string>::const_reverse_iterator label = labels.rbegin(); label != labels.rend(); ++label) {
+    map<string, unsigned int, CIStringCompare>::const_iterator child = nodes[pos].children.find(*label);
+    if(child != nodes[pos].children.end()) {
+      pos = child->second;
+      continue;
+    }
+    nodes.push_back(Node()); // may move nodes around, so only hang on to offsets
+    nodes[pos].children[*label] = nodes.size() - 1;
+    pos = nodes.size() - 1;
+  }
+
+  if(nodes[pos].domain_id < 0)
+    zones++;
+  nodes[pos].zone = zone;
+  nodes[pos].domain_id = domain_id;
+}
+
+void ZoneIndex::setRefreshInterval(unsigned int seconds)
+{
+  Lock l(&d_lock);
+  d_interval = seconds;
+  d_nextrefresh = 0;
+  if(!d_interval)
+    d_trie.reset();
+}
+
+boost::shared_ptr<ZoneIndex::Trie> ZoneIndex::get()
+{
+  Lock l(&d_lock);
+  return d_trie;
+}
+
+void ZoneIndex::invalidate()
+{
+  Lock l(&d_lock);
+  d_nextrefresh = 0;
+  d_generation++;
+}
+
+boost::shared_ptr<ZoneIndex::Trie> ZoneIndex::build(const vector<DomainInfo>& domains)
+{
+  boost::shared_ptr<Trie> trie(new Trie);
+  BOOST_FOREACH(const DomainInfo& di, domains) {
+    trie->add(di.zone, di.id);
+  }
+  return trie;
+}
+
+void ZoneIndex::load(const vector<DomainInfo>& domains)
+{
+  boost::shared_ptr<Trie> trie = build(domains);
+  Lock l(&d_lock);
+  d_trie = trie;
+}
+
+void ZoneIndex::refreshIfNeeded(DNSBackend& B)
+{
+  time_t now = time(0);
+  unsigned int generation;
+  {
+    Lock l(&d_lock);
+    if(!d_interval || now < d_nextrefresh)
+      return;
+    generation = d_generation;
+  }
+
+  if(pthread_mutex_trylock(&d_refreshlock)) // somebody else is already at it
+    return;
+
+  if(!B.listsAllDomains()) {
+    L<<Logger::Warning<<"Not all launched backends can list their zones, disabling the zone index"<<endl;
+    setRefreshInterval(0);
+    pthread_mutex_unlock(&d_refreshlock);
+    return;
+  }
+
+  boost::shared_ptr<Trie> trie;
+  try {
+    vector<DomainInfo> domains;
+    B.getAllDomains(&domains);
+    trie = build(domains);
+  }
+  catch(PDNSException& ae) {
+    L<<Logger::Error<<"Unable to rebuild the zone index, keeping the old one: "<<ae.reason<<endl;
+  }
+
+  {
+    Lock l(&d_lock);
+    if(trie && d_interval) // could have been switched off while we were busy
+      d_trie = trie;
+    if(generation == d_generation) // else it got invalidated halfway and we might have missed something
+      d_nextrefresh = now + d_interval;
+  }
+  pthread_mutex_unlock(&d_refreshlock);
+}
+
+bool ZoneIndex::getClosestZone(const string& qname, string& zone, int* domain_id)
+{
+  boost::shared_ptr<Trie> trie = get();
+  if(!trie)
+    return false;
+
+  vector<string> labels;
+  stringtok(labels, qname, ".");
+
+  unsigned int pos = 0, best = 0;
+  bool found = trie->nodes[0].domain_id >= 0;
+  for(vector<string>::const_reverse_iterator label = labels.rbegin(); label != labels.rend(); ++label) {
+    map<string, unsigned int, CIStringCompare>::const_iterator child = trie->nodes[pos].children.find(*label);
+    if(child == trie->nodes[pos].children.end())
+      break;
+    pos = child->second;
+    if(trie->nodes[pos].domain_id >= 0) {
+      best = pos;
+      found = true;
+    }
+  }
+
+  if(!found)
+    return false;
+
+  zone = trie->nodes[best].zone;
+  if(domain_id)
+    *domain_id = trie->nodes[best].domain_id;
+  return true;
+}
+
+unsigned int ZoneIndex::size()
+{
+  boost::shared_ptr<Trie> trie = get();
+  return trie ? trie->zones : 0;
+}
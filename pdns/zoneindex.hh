@@ -0,0 +1,64 @@
+#ifndef PDNS_ZONEINDEX_HH
+#define PDNS_ZONEINDEX_HH
+#include <pthread.h>
+#include <boost/utility.hpp>
+#include <boost/shared_ptr.hpp>
+#include "misc.hh"
+
+class DNSBackend;
+struct DomainInfo;
+
+/** Process wide index of the apexes of all zones we serve, held as a trie on reversed labels so finding the zone
+    a name belongs to is one walk in memory instead of a getSOA per label. Rebuilt from getAllDomains every few
+    seconds by whichever thread notices it is due, the others keep using the previous copy in the meantime.
+    Only usable if every backend can list all of its zones: a zone missing from the index would be answered from
+    its parent, so the index switches itself off on the first refresh if one of them can't. */
+class ZoneIndex : public boost::noncopyable
+{
+public:
+  ZoneIndex();
+  ~ZoneIndex();
+
+  void setRefreshInterval(unsigned int seconds); //!< 0 disables the index
+  bool enabled() const
+  {
+    return d_interval > 0;
+  }
+
+  void refreshIfNeeded(DNSBackend& B);
+  void load(const vector<DomainInfo>& domains); //!< replaces the index with these zones right away
+  void invalidate(); //!< zones got added or removed, rebuild on the next query
+  //! finds the deepest zone at or above qname, returns false if there is none or the index has not been built yet
+  bool getClosestZone(const string& qname, string& zone, int* domain_id=0);
+  unsigned int size();
+
+private:
+  struct Node
+  {
+    Node() : domain_id(-1) {}
+    map<string, unsigned int, CIStringCompare> children; //!< label -> offset in Trie::nodes
+    string zone;
+    int domain_id; //!< -1 if no zone starts here
+  };
+
+  struct Trie
+  {
+    Trie() : nodes(1), zones(0) {}
+    void add(const string& zone, int domain_id);
+    vector<Node> nodes; //!< nodes[0] is the root
+    unsigned int zones;
+  };
+
+  static boost::shared_ptr<Trie> build(const vector<DomainInfo>& domains);
+  boost::shared_ptr<Trie> get();
+
+  boost::shared_ptr<Trie> d_trie;
+  pthread_mutex_t d_lock;
+  pthread_mutex_t d_refreshlock;
+  time_t d_nextrefresh;
+  unsigned int d_interval;
+  unsigned int d_generation; //!< bumped by invalidate()
+};
+
+extern ZoneIndex g_zoneindex;
+#endif